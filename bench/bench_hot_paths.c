@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "mimetypes.h"
+#include "request.h"
+#include "response.h"
+
+#define DEFAULT_NO_OPS 200000
+#define SEND_DRAIN_EVERY 64
+
+// A function timed by run_bench(), doing `no_ops` operations on `arg`.
+typedef void (*bench_fn)(void *arg, const int no_ops);
+
+const char small_request[] = "GET /index.html HTTP/1.1\r\nHost: localhost:8080\r\n\r\n";
+const char browser_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 11_2_0) AppleWebKit/537.36 (KHTML, like "
+    "Gecko) Chrome/87.0.4280.88 Safari/537.36\r\n"
+    "Accept: "
+    "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/"
+    "*;q=0.8,application/signed-exchange;v=b3;q=0.9\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n";
+char cookie_request[2048];
+
+// Allocations made through malloc(), calloc() and realloc() so far, by any library.
+size_t no_allocs = 0;
+
+// The instruction counter of the process, or -1 if perf events aren't available.
+int perf_fd = -1;
+
+// Whether results are printed as JSON lines instead of a table.
+int json_output = 0;
+
+// Where lookups store their results, so the compiler can't drop them.
+volatile size_t sink = 0;
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+// Counts every allocation of the process, the shared libraries included, before passing it on.
+void *malloc(size_t size) {
+    no_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t no_elems, size_t size) {
+    no_allocs++;
+    return __libc_calloc(no_elems, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    no_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+double _now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void _fail(const char *name) {
+    fprintf(stderr, "Unable to run %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// Builds a ~1.4KB request, the browser request with a long Cookie header.
+void _build_cookie_request() {
+    size_t len = strlen(browser_request) - 2;
+
+    memcpy(cookie_request, browser_request, len);
+    len += sprintf(cookie_request + len, "Cookie: ");
+    for (int c_no = 0; c_no < 24; c_no++)
+        len += sprintf(cookie_request + len, "session_%02d=%s; ", c_no, "0123456789abcdef0123");
+    sprintf(cookie_request + len, "\r\n\r\n");
+}
+
+// Opens a counter of the instructions retired in user space by this thread. Virtual machines and
+// containers often have no PMU, or forbid perf events, then instructions aren't reported.
+void _open_perf_counter() {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void _report(const char *name, const char *bench_case, const int no_ops, const double elapsed,
+             const size_t allocs, const long long instrs) {
+    double ns_per_op = elapsed * 1e9 / no_ops, allocs_per_op = (double)allocs / no_ops;
+
+    if (json_output) {
+        printf("{\"bench\":\"%s\",\"case\":\"%s\",\"ops\":%d,\"ns_per_op\":%.2f,"
+               "\"allocs_per_op\":%.2f,\"instructions_per_op\":",
+               name, bench_case, no_ops, ns_per_op, allocs_per_op);
+        if (instrs < 0)
+            printf("null}\n");
+        else
+            printf("%.1f}\n", (double)instrs / no_ops);
+    } else if (instrs < 0)
+        printf("%-20s %-16s %8d ops %10.1f ns/op %8.2f allocs/op %12s\n", name, bench_case, no_ops,
+               ns_per_op, allocs_per_op, "n/a instrs/op");
+    else
+        printf("%-20s %-16s %8d ops %10.1f ns/op %8.2f allocs/op %8.0f instrs/op\n", name,
+               bench_case, no_ops, ns_per_op, allocs_per_op, (double)instrs / no_ops);
+    fflush(stdout);
+}
+
+// Runs `fn` once to warm caches up, then times `no_ops` operations, counting the allocations and
+// the instructions they take.
+void run_bench(const char *name, const char *bench_case, bench_fn fn, void *arg,
+               const int no_ops) {
+    long long instrs = -1;
+    size_t allocs = 0;
+    double start = 0;
+
+    fn(arg, no_ops / 10 + 1);
+
+    if (perf_fd != -1) {
+        ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    allocs = no_allocs;
+    start = _now();
+
+    fn(arg, no_ops);
+
+    start = _now() - start;
+    allocs = no_allocs - allocs;
+    if (perf_fd != -1) {
+        ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf_fd, &instrs, sizeof(instrs)) != sizeof(instrs))
+            instrs = -1;
+    }
+
+    _report(name, bench_case, no_ops, start, allocs, instrs);
+}
+
+// Parses the request with parse_request(), which creates the request and copies the string in.
+void bench_parse_request(void *req_str, const int no_ops) {
+    for (int op_no = 0; op_no < no_ops; op_no++) {
+        request *req = parse_request(req_str, -1);
+        if (req == NULL)
+            _fail("parse_request");
+        _free_request(req);
+    }
+}
+
+// The request parsed by bench__parse_request(), and the arena the request is created in.
+typedef struct request_parse {
+    const char *req_str;
+    arena *mem;
+} request_parse;
+
+// Parses the request with _parse_request() into a request created in an arena, so only the copy of
+// the string is allocated. Arena requests don't free their copy, so it is freed here.
+void bench__parse_request(void *arg, const int no_ops) {
+    request_parse *parse = arg;
+
+    for (int op_no = 0; op_no < no_ops; op_no++) {
+        request *req = create_request_in_arena(parse->mem, -1);
+        if (req == NULL || _parse_request(parse->req_str, req) == 0)
+            _fail("_parse_request");
+        free(req->owned_buf);
+        reset_arena(parse->mem);
+    }
+}
+
+// The request and header looked up by bench_get_request_header().
+typedef struct header_lookup {
+    request *req;
+    const char *header_key;
+    char *header_val;
+} header_lookup;
+
+void bench_get_request_header(void *arg, const int no_ops) {
+    header_lookup *lookup = arg;
+
+    for (int op_no = 0; op_no < no_ops; op_no++)
+        sink += (size_t)get_request_header(lookup->req, lookup->header_key, lookup->header_val);
+}
+
+void bench_get_mimetype_for_url(void *url, const int no_ops) {
+    for (int op_no = 0; op_no < no_ops; op_no++)
+        sink += (size_t)get_mimetype_for_url(url, NULL);
+}
+
+// Sets the status and the headers of a typical file response, on a response in `mem` (an arena)
+// or, if `mem` is `NULL`, on the heap.
+response *_build_response(arena *mem, const int conn_fd) {
+    response *res = create_response_in_arena(mem, conn_fd);
+
+    if (res == NULL || set_response_status(res, "HTTP/1.1", "200 OK") == 0 ||
+        set_response_header(res, "Server", "nanows/1.0") == NULL ||
+        set_response_header(res, "Content-Type", "text/html; charset=utf-8") == NULL ||
+        set_response_header(res, "Content-Length", "10240") == NULL ||
+        set_response_header(res, "Last-Modified", "Sat, 16 Jan 2021 10:00:00 GMT") == NULL ||
+        set_response_header(res, "Connection", "keep-alive") == NULL ||
+        set_response_header(res, "X-Content-Type-Options", "nosniff") == NULL)
+        _fail("set_response_header");
+    return res;
+}
+
+// Builds a response with set_response_header() in an arena reset after every response.
+void bench_set_response_header_arena(void *mem, const int no_ops) {
+    for (int op_no = 0; op_no < no_ops; op_no++) {
+        _build_response(mem, -1);
+        reset_arena(mem);
+    }
+}
+
+// Builds a response with set_response_header() on the heap, every header copied with strdup().
+void bench_set_response_header_heap(void *arg, const int no_ops) {
+    (void)arg;
+    for (int op_no = 0; op_no < no_ops; op_no++)
+        _free_response(_build_response(NULL, -1));
+}
+
+// The response sent by bench_send_response_head(), and the other end of its socket.
+typedef struct head_send {
+    response *res;
+    int peer_fd;
+} head_send;
+
+// Sends the response head into a socket pair. The other end is drained every few heads, so the
+// socket buffer never fills up.
+void bench_send_response_head(void *arg, const int no_ops) {
+    head_send *head = arg;
+    char buf[16384];
+
+    for (int op_no = 0; op_no < no_ops; op_no++) {
+        if (send_response_head(head->res) <= 0)
+            _fail("send_response_head");
+        if (op_no % SEND_DRAIN_EVERY == SEND_DRAIN_EVERY - 1 || op_no == no_ops - 1) {
+            while (recv(head->peer_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                ;
+        }
+    }
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-j] [-n no_ops]\n", prog);
+    fprintf(stderr, "  -j  prints one JSON object per line, to track results across commits\n");
+    fprintf(stderr, "  -n  sets the number of operations per case (default: %d)\n", DEFAULT_NO_OPS);
+}
+
+int main(int argc, char *argv[]) {
+    char header_val[REQ_BUF_SIZE];
+    int no_ops = DEFAULT_NO_OPS, opt = 0, fds[2];
+    arena *mem = NULL;
+
+    while ((opt = getopt(argc, argv, "jn:")) != -1) {
+        switch (opt) {
+        case 'j':
+            json_output = 1;
+            break;
+        case 'n':
+            no_ops = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (no_ops <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    _build_cookie_request();
+    _open_perf_counter();
+    if (!json_output)
+        printf("Hot Paths (instructions %s)\n",
+               (perf_fd != -1) ? "in user space" : "unavailable: perf_event_open failed");
+
+    run_bench("parse_request", "small", bench_parse_request, (void *)small_request, no_ops);
+    run_bench("parse_request", "browser", bench_parse_request, (void *)browser_request, no_ops);
+    run_bench("parse_request", "cookie", bench_parse_request, cookie_request, no_ops);
+
+    if ((mem = create_arena(ARENA_BLOCK_SIZE)) == NULL)
+        _fail("_parse_request");
+    request_parse parses[] = {{small_request, mem}, {browser_request, mem}, {cookie_request, mem}};
+    const char *parse_cases[] = {"small-arena", "browser-arena", "cookie-arena"};
+    for (size_t p_no = 0; p_no < sizeof(parses) / sizeof(parses[0]); p_no++)
+        run_bench("_parse_request", parse_cases[p_no], bench__parse_request, &parses[p_no], no_ops);
+
+    request *req = parse_request(cookie_request, -1);
+    if (req == NULL)
+        _fail("get_request_header");
+    header_lookup lookups[] = {{req, "Host", NULL},
+                               {req, "accept-encoding", NULL},
+                               {req, "Sec-Fetch-Mode", NULL},
+                               {req, "X-Forwarded-For", NULL},
+                               {req, "Cookie", header_val}};
+    const char *lookup_cases[] = {"known", "known-lowercase", "unknown", "missing", "cookie-copy"};
+    for (size_t l_no = 0; l_no < sizeof(lookups) / sizeof(lookups[0]); l_no++)
+        run_bench("get_request_header", lookup_cases[l_no], bench_get_request_header,
+                  &lookups[l_no], no_ops);
+    _free_request(req);
+
+    const char *urls[] = {"/index.html", "/images/Starship.JPG", "/docs/README", "/a.unknownext"};
+    const char *url_cases[] = {"html", "uppercase", "no-extension", "unknown"};
+    for (size_t u_no = 0; u_no < sizeof(urls) / sizeof(urls[0]); u_no++)
+        run_bench("get_mimetype_for_url", url_cases[u_no], bench_get_mimetype_for_url,
+                  (void *)urls[u_no], no_ops);
+
+    run_bench("set_response_header", "arena-6-headers", bench_set_response_header_arena, mem,
+              no_ops);
+    run_bench("set_response_header", "heap-6-headers", bench_set_response_header_heap, NULL,
+              no_ops);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        _fail("send_response_head");
+    head_send head = {_build_response(mem, fds[0]), fds[1]};
+    run_bench("send_response_head", "socketpair", bench_send_response_head, &head, no_ops);
+    close(head.res->conn_fd);
+    close(fds[0]);
+    close(fds[1]);
+    destroy_arena(mem);
+
+    if (perf_fd != -1)
+        close(perf_fd);
+    return EXIT_SUCCESS;
+}
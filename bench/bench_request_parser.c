@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "request.h"
+
+#define DEFAULT_NO_REQS 1000000
+
+const char small_request[] = "GET /index.html HTTP/1.1\r\nHost: localhost:8080\r\n\r\n";
+const char browser_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 11_2_0) AppleWebKit/537.36 (KHTML, like "
+    "Gecko) Chrome/87.0.4280.88 Safari/537.36\r\n"
+    "Accept: "
+    "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/"
+    "*;q=0.8,application/signed-exchange;v=b3;q=0.9\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n";
+char cookie_request[2048];
+
+double _now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void _report(const char *name, const int no_reqs, const size_t req_len, const double elapsed) {
+    printf("%-22s %8d reqs %10.3f s %12.0f reqs/s %10.1f MB/s %8.0f ns/req\n", name, no_reqs,
+           elapsed, no_reqs / elapsed, no_reqs * req_len / elapsed / 1e6, elapsed * 1e9 / no_reqs);
+}
+
+// Builds a ~1.4KB request, the browser request with a long Cookie header.
+void _build_cookie_request() {
+    size_t len = strlen(browser_request) - 2;
+
+    memcpy(cookie_request, browser_request, len);
+    len += sprintf(cookie_request + len, "Cookie: ");
+    for (int c_no = 0; c_no < 24; c_no++)
+        len += sprintf(cookie_request + len, "session_%02d=%s; ", c_no, "0123456789abcdef0123");
+    sprintf(cookie_request + len, "\r\n\r\n");
+}
+
+// Scans the request line by line `no_reqs` times, like the parser does for header values.
+void bench_scanner(const char *name, request_scanner scanner, const char *req_str,
+                   const int no_reqs) {
+    size_t req_len = strlen(req_str);
+    size_t no_lines = 0;
+
+    double start = _now();
+    for (int r_no = 0; r_no < no_reqs; r_no++) {
+        for (size_t pos = 0; pos < req_len; pos++, no_lines++)
+            pos = scanner(req_str, pos, req_len, ' ' - 1, 0x7f);
+    }
+
+    if (no_lines == 0)
+        exit(EXIT_FAILURE);
+    _report(name, no_reqs, req_len, _now() - start);
+}
+
+// Parses the request `no_reqs` times, delivered in `no_chunks` parts like a head split over several
+// reads. The request is copied in every time, as parsing terminates the parts in place.
+void bench_parse_request_buf(const char *name, const char *req_str, const int no_chunks,
+                             const int no_reqs) {
+    char buf[REQ_BUF_SIZE];
+    size_t req_len = strlen(req_str);
+    size_t chunk_len = req_len / no_chunks + 1;
+
+    double start = _now();
+    for (int r_no = 0; r_no < no_reqs; r_no++) {
+        request *req = create_request(-1);
+        parse_status status = PARSE_INCOMPLETE;
+
+        memcpy(buf, req_str, req_len);
+        for (size_t len = chunk_len; status == PARSE_INCOMPLETE; len += chunk_len)
+            status = parse_request_buf(req, buf, (len < req_len) ? len : req_len);
+
+        if (status != PARSE_COMPLETE || get_request_header(req, "Host", NULL) == NULL) {
+            fprintf(stderr, "Unable to parse request\n");
+            exit(EXIT_FAILURE);
+        }
+        _free_request(req);
+    }
+
+    _report(name, no_reqs, req_len, _now() - start);
+}
+
+int main(int argc, char *argv[]) {
+    int no_reqs = (argc > 1) ? atoi(argv[1]) : DEFAULT_NO_REQS;
+
+    _build_cookie_request();
+
+    printf("Request Scanner (cookie request, %zu bytes)\n", strlen(cookie_request));
+    bench_scanner("scalar", _scan_request_scalar, cookie_request, no_reqs);
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        bench_scanner("sse4.2", _scan_request_sse42, cookie_request, no_reqs);
+    if (__builtin_cpu_supports("avx2"))
+        bench_scanner("avx2", _scan_request_avx2, cookie_request, no_reqs);
+#endif
+
+    printf("Request Parser (create, parse, lookup Host, free)\n");
+    bench_parse_request_buf("small", small_request, 1, no_reqs);
+    bench_parse_request_buf("browser", browser_request, 1, no_reqs);
+    bench_parse_request_buf("browser-4-reads", browser_request, 4, no_reqs);
+    bench_parse_request_buf("cookie", cookie_request, 1, no_reqs);
+
+    return EXIT_SUCCESS;
+}
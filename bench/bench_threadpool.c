@@ -0,0 +1,115 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+#define DEFAULT_NO_CONNS 20000
+#define NO_WORKERS 8
+#define QUEUE_DEPTH 1024
+
+const char request[] = "GET /index.html HTTP/1.1\r\nHost: localhost:8080\r\n\r\n";
+const char response[] = "HTTP/1.1 200 OK\r\nserver: ElServe/2.0\r\n\r\n";
+
+atomic_int no_served;
+
+// Stands in for serve_connection(): reads the request, sends a response and closes the connection.
+int _serve(const int conn_fd) {
+    char buf[512];
+
+    recv(conn_fd, buf, sizeof(buf), 0);
+    send(conn_fd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+    close(conn_fd);
+
+    atomic_fetch_add(&no_served, 1);
+    return 0;
+}
+
+void *_spawned_serve(void *conn_fd) {
+    int fd = *((int *)conn_fd);
+    free(conn_fd);
+    return (void *)(intptr_t)_serve(fd);
+}
+
+// Creates a connected socket pair with the request already sent, returns the server side.
+int _new_conn() {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("Unable to create socket pair");
+        exit(EXIT_FAILURE);
+    }
+
+    send(fds[0], request, sizeof(request) - 1, 0);
+    close(fds[0]);
+    return fds[1];
+}
+
+double _now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void _wait_for(const int no_conns) {
+    while (atomic_load(&no_served) < no_conns)
+        sched_yield();
+}
+
+void _report(const char *name, const int no_conns, const double elapsed) {
+    printf("%-22s %8d conns %10.3f s %12.0f conns/s %10.0f ns/conn\n", name, no_conns, elapsed,
+           no_conns / elapsed, elapsed * 1e9 / no_conns);
+}
+
+void bench_spawn_per_connection(const int no_conns) {
+    pthread_t tid;
+
+    atomic_store(&no_served, 0);
+    double start = _now();
+
+    for (int c_no = 0; c_no < no_conns; c_no++) {
+        int *conn_fd = malloc(sizeof(int));
+        *conn_fd = _new_conn();
+        while (pthread_create(&tid, NULL, _spawned_serve, conn_fd) != 0)
+            sched_yield();
+        pthread_detach(tid);
+    }
+    _wait_for(no_conns);
+
+    _report("spawn-per-connection", no_conns, _now() - start);
+}
+
+void bench_thread_pool(const int no_conns) {
+    thread_pool *pool = create_thread_pool(NO_WORKERS, QUEUE_DEPTH, _serve);
+    if (pool == NULL) {
+        perror("Unable to create thread pool");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_store(&no_served, 0);
+    double start = _now();
+
+    for (int c_no = 0; c_no < no_conns; c_no++)
+        submit_to_thread_pool(pool, _new_conn());
+    _wait_for(no_conns);
+
+    _report("thread-pool", no_conns, _now() - start);
+    destroy_thread_pool(pool);
+}
+
+int main(int argc, char *argv[]) {
+    int no_conns = (argc > 1) ? atoi(argv[1]) : DEFAULT_NO_CONNS;
+
+    printf("Thread Pool (%d workers, queue depth %d) vs Spawn per Connection\n", NO_WORKERS,
+           QUEUE_DEPTH);
+    bench_spawn_per_connection(no_conns);
+    bench_thread_pool(no_conns);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,474 @@
+/**
+ * @file include/accesslog.h
+ * @brief Function Prototypes for logging requests without blocking them.
+ *
+ * This file contains the function prototypes to log every request to an access log file. A thread
+ * handling requests copies a fixed-size record of each request into a ring buffer of its own, and
+ * a background thread formats the records of all rings (in the combined log format or as JSON) and
+ * writes them to the file in large batches. Requests never wait for the file, nor for each other:
+ * if a ring is full, the record is dropped and counted instead.
+ *
+ * Implemented in slib/accesslog.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _ACCESSLOG_H
+#define _ACCESSLOG_H 1
+
+/**
+ * @brief Defines the number of records in the ring buffer of a thread, a power of 2.
+ */
+#ifndef ACCESS_LOG_RING_SIZE
+#define ACCESS_LOG_RING_SIZE 512
+#endif
+
+/**
+ * @brief Defines the size of the buffer records are formatted into, and so the max size of a write.
+ */
+#ifndef ACCESS_LOG_BUF_SIZE
+#define ACCESS_LOG_BUF_SIZE 65536
+#endif
+
+/**
+ * @brief Defines the max number of milliseconds a record waits in a ring before it is written.
+ */
+#ifndef ACCESS_LOG_FLUSH_MSEC
+#define ACCESS_LOG_FLUSH_MSEC 100
+#endif
+
+/**
+ * @brief Defines the size of the URL of a record, longer URLs are truncated.
+ */
+#ifndef ACCESS_LOG_URL_SIZE
+#define ACCESS_LOG_URL_SIZE 256
+#endif
+
+/**
+ * @brief Defines the size of the Referer and User-Agent headers of a record, longer values are
+ * truncated.
+ */
+#ifndef ACCESS_LOG_HEADER_SIZE
+#define ACCESS_LOG_HEADER_SIZE 128
+#endif
+
+/**
+ * @brief Defines the size of the method and HTTP version of a record.
+ */
+#define ACCESS_LOG_TOKEN_SIZE 16
+
+/**
+ * @brief Defines the max size of a formatted record, a record is formatted only if this much of the
+ * buffer is free. Every byte of the strings may be escaped into 6 bytes.
+ */
+#define ACCESS_LOG_LINE_MAX_SIZE                                                                   \
+    (6 * (ACCESS_LOG_URL_SIZE + 2 * ACCESS_LOG_HEADER_SIZE + 2 * ACCESS_LOG_TOKEN_SIZE) + 256)
+
+/**
+ * @brief Defines the name of the combined log format.
+ */
+#define ACCESS_LOG_FORMAT_COMBINED "combined"
+
+/**
+ * @brief Defines the name of the JSON log format.
+ */
+#define ACCESS_LOG_FORMAT_JSON "json"
+
+/**
+ * @brief Defines the path that logs to the standard output instead of a file.
+ */
+#define ACCESS_LOG_STDOUT "-"
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "rcu.h"
+#include "request.h"
+
+/**
+ * @brief Defines the format of the lines of an access log.
+ */
+typedef enum access_log_format {
+    LOG_FORMAT_COMBINED, /**< Apache/nginx combined log format. */
+    LOG_FORMAT_JSON,     /**< A JSON object per line. */
+} access_log_format;
+
+/**
+ * @struct access_log_record
+ * @brief Defines the record of a request, copied into a ring without allocating.
+ *
+ * @property struct timespec access_log_record::time
+ * @brief The wall clock time the request was logged, once its response was sent.
+ *
+ * @property off_t access_log_record::bytes
+ * @brief The bytes of the response body that were sent.
+ *
+ * @property long access_log_record::latency_usec
+ * @brief The microseconds from when the response was prepared until it was sent.
+ *
+ * @property int access_log_record::status
+ * @brief The status code of the response.
+ *
+ * @property bool access_log_record::has_client
+ * @brief Whether `client_addr` is known.
+ *
+ * @property struct in_addr access_log_record::client_addr
+ * @brief The address of the client.
+ *
+ * @property char access_log_record::method
+ * @brief The method of the request.
+ *
+ * @property char access_log_record::http_ver
+ * @brief The HTTP version of the request.
+ *
+ * @property char access_log_record::url
+ * @brief The URL of the request.
+ *
+ * @property char access_log_record::referer
+ * @brief The Referer header of the request, empty if it wasn't sent.
+ *
+ * @property char access_log_record::user_agent
+ * @brief The User-Agent header of the request, empty if it wasn't sent.
+ */
+typedef struct access_log_record {
+    struct timespec time;
+    off_t bytes;
+    long latency_usec;
+    int status;
+    bool has_client;
+    struct in_addr client_addr;
+    char method[ACCESS_LOG_TOKEN_SIZE];
+    char http_ver[ACCESS_LOG_TOKEN_SIZE];
+    char url[ACCESS_LOG_URL_SIZE];
+    char referer[ACCESS_LOG_HEADER_SIZE];
+    char user_agent[ACCESS_LOG_HEADER_SIZE];
+} access_log_record;
+
+/**
+ * @struct access_log_ring
+ * @brief Defines a single-producer single-consumer ring buffer of records.
+ *
+ * Only the thread owning the ring advances `head`, and only the log thread advances `tail`, so
+ * neither takes a lock. The counters only grow, and a record is in slot `counter % size`. When its
+ * thread exits, the ring is handed over to the next thread that logs.
+ *
+ * @property size_t access_log_ring::head
+ * @brief The number of records written to the ring.
+ *
+ * @property size_t access_log_ring::tail
+ * @brief The number of records read from the ring.
+ *
+ * @property access_log* access_log_ring::log
+ * @brief The log the ring belongs to.
+ *
+ * @property access_log_ring* access_log_ring::next
+ * @brief The next ring of the log, or `NULL`.
+ *
+ * @property access_log_ring* access_log_ring::next_free
+ * @brief The next ring without a thread, or `NULL`.
+ *
+ * @property access_log_record access_log_ring::records
+ * @brief The records.
+ */
+typedef struct access_log_ring {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+    struct access_log *log;
+    struct access_log_ring *next;
+    struct access_log_ring *next_free;
+    access_log_record records[ACCESS_LOG_RING_SIZE];
+} access_log_ring;
+
+/**
+ * @struct access_log
+ * @brief Defines an access log, written by a background thread.
+ *
+ * @see create_access_log
+ * @see log_access
+ * @see reopen_access_log
+ * @see destroy_access_log
+ *
+ * @property char* access_log::path
+ * @brief The path of the log file, or `ACCESS_LOG_STDOUT`.
+ *
+ * @property access_log_format access_log::format
+ * @brief The format of the lines.
+ *
+ * @property int access_log::fd
+ * @brief The log file, only used by the log thread after the log is created.
+ *
+ * @property access_log_ring* access_log::rings
+ * @brief The rings of all threads that logged so far. Rings are only prepended, and only freed
+ * with the log.
+ *
+ * @property access_log_ring* access_log::free_rings
+ * @brief The rings whose threads exited.
+ *
+ * @property pthread_mutex_t access_log::rings_lock
+ * @brief Serializes threads taking and giving back rings, once per thread.
+ *
+ * @property pthread_key_t access_log::ring_key
+ * @brief The ring of the calling thread.
+ *
+ * @property int access_log::wake_fd
+ * @brief An eventfd written to wake the log thread, to reopen the file or to stop.
+ *
+ * @property pthread_t access_log::thread
+ * @brief The thread writing the log.
+ *
+ * @property bool access_log::reopen
+ * @brief Set when the file should be reopened.
+ *
+ * @property bool access_log::stop
+ * @brief Set when the log thread should write the remaining records and exit.
+ *
+ * @property unsigned long access_log::dropped
+ * @brief The number of records dropped because a ring was full.
+ *
+ * @property char* access_log::buf
+ * @brief The buffer records are formatted into.
+ *
+ * @property time_t access_log::buf_time
+ * @brief The second `buf_date` was formatted for.
+ *
+ * @property char access_log::buf_date
+ * @brief The date of records of the second `buf_time`, as formatted by the format.
+ */
+typedef struct access_log {
+    char *path;
+    access_log_format format;
+    int fd;
+    _Atomic(access_log_ring *) rings;
+    access_log_ring *free_rings;
+    pthread_mutex_t rings_lock;
+    pthread_key_t ring_key;
+    int wake_fd;
+    pthread_t thread;
+    atomic_bool reopen;
+    atomic_bool stop;
+    atomic_ulong dropped;
+    char *buf;
+    time_t buf_time;
+    char buf_date[64];
+} access_log;
+
+/**
+ * @brief Opens the log file `path` (appending to it) and starts the thread writing it.
+ *
+ * @param path The path of the log file, or `ACCESS_LOG_STDOUT` to log to the standard output.
+ * @param format The format of the lines.
+ * @return On success, pointer to the log is returned. On failure, `NULL` is returned.
+ */
+access_log *create_access_log(const char *, const access_log_format);
+
+/**
+ * @brief Logs a request handled by the calling thread. Never blocks: the record is copied into the
+ * ring of the thread, or dropped if it is full.
+ *
+ * Requests are logged once their response is sent (or failed), so the record tells what the client
+ * actually got.
+ *
+ * @param log The access log, `NULL` is ignored.
+ * @param req The request.
+ * @param status The status code of the response.
+ * @param bytes The bytes of the response body that were sent.
+ * @param latency_usec The microseconds from when the response was prepared until it was sent.
+ * @return If the record is logged, returns `1`. Otherwise, returns `0`.
+ */
+int log_access(access_log *, const request *, const int, const off_t, const long);
+
+/**
+ * @brief Logs a request captured with `capture_access_log_record()`, like `log_access()` does. Used
+ * when the request is freed before its response is sent.
+ *
+ * @param log The access log, `NULL` is ignored.
+ * @param captured The captured record, `NULL` is ignored.
+ * @param status The status code of the response.
+ * @param bytes The bytes of the response body that were sent.
+ * @param latency_usec The microseconds from when the response was prepared until it was sent.
+ * @return If the record is logged, returns `1`. Otherwise, returns `0`.
+ */
+int log_access_record(access_log *, const access_log_record *, const int, const off_t, const long);
+
+/**
+ * @brief Copies the fields of a request that are logged (client, request line, Referer and
+ * User-Agent) into a record, to be logged with `log_access_record()` after the request is freed.
+ *
+ * @param record The record.
+ * @param req The request, whose `conn_fd` must still be open for the client to be known.
+ * @return void
+ */
+void capture_access_log_record(access_log_record *, const request *);
+
+/**
+ * @brief Makes the log thread reopen the log file, e.g. after it was rotated. Safe to call from
+ * any thread.
+ *
+ * @param log The access log, `NULL` is ignored.
+ * @return void
+ */
+void reopen_access_log(access_log *);
+
+/**
+ * @brief Stops the log thread after it wrote the records logged so far, and frees the log. No
+ * thread must be logging.
+ *
+ * @param log The access log, `NULL` is ignored.
+ * @return void
+ */
+void destroy_access_log(access_log *);
+
+/**
+ * @brief Parses the name of a format.
+ *
+ * @param format_str The name, `ACCESS_LOG_FORMAT_COMBINED` or `ACCESS_LOG_FORMAT_JSON`.
+ * @return The format, `LOG_FORMAT_COMBINED` if the name is `NULL` or unknown.
+ */
+access_log_format parse_access_log_format(const char *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Returns the ring of the calling thread, taking a free ring or creating one on the first
+ * call of the thread.
+ *
+ * @param log The access log.
+ * @return The ring, or `NULL` if it can't be created.
+ */
+access_log_ring *_get_access_log_ring(access_log *);
+
+/**
+ * @private
+ * @brief Claims the next slot of the ring of the calling thread, counting the record as dropped if
+ * the ring is full.
+ *
+ * @param log The access log.
+ * @param ring Pointer to store the ring of the thread.
+ * @param head Pointer to store the head of the ring, to be passed to
+ * `_commit_access_log_record()`.
+ * @return The record of the slot, or `NULL` if the record is dropped.
+ */
+access_log_record *_claim_access_log_record(access_log *, access_log_ring **, size_t *);
+
+/**
+ * @private
+ * @brief Publishes a record claimed by `_claim_access_log_record()` to the log thread, waking it
+ * once per ring it half fills.
+ *
+ * @param log The access log.
+ * @param ring The ring of the thread.
+ * @param head The head the record was claimed at.
+ * @return void
+ */
+void _commit_access_log_record(access_log *, access_log_ring *, const size_t);
+
+/**
+ * @private
+ * @brief Gives the ring of an exiting thread back to its log. Set as the destructor of `ring_key`.
+ *
+ * @param ring_ptr The ring.
+ * @return void
+ */
+void _put_access_log_ring(void *);
+
+/**
+ * @private
+ * @brief Copies a string into a field of a record, truncating it.
+ *
+ * @param field The field.
+ * @param size The size of the field.
+ * @param value The string, `NULL` for an empty field.
+ * @return void
+ */
+void _copy_access_log_field(char *, const size_t, const char *);
+
+/**
+ * @private
+ * @brief Wakes the log thread up, if it is waiting. Never blocks.
+ *
+ * @param log The access log.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _wake_access_log(access_log *);
+
+/**
+ * @private
+ * @brief Entry point of the log thread, writes the records of all rings until the log is stopped.
+ *
+ * @param log_ptr The access log.
+ * @return `NULL`
+ */
+void *_run_access_log(void *);
+
+/**
+ * @private
+ * @brief Formats the records of all rings into the buffer and writes it whenever it is full.
+ *
+ * @param log The access log.
+ * @param buf_len Pointer to the number of bytes in the buffer, which are written before it fills.
+ * @return The number of records formatted.
+ */
+size_t _drain_access_log(access_log *, size_t *);
+
+/**
+ * @private
+ * @brief Formats a record in the format of the log.
+ *
+ * @param log The access log.
+ * @param record The record.
+ * @param buf The buffer, with at least `ACCESS_LOG_LINE_MAX_SIZE` bytes.
+ * @return The length of the line.
+ */
+size_t _format_access_log_record(access_log *, const access_log_record *, char *);
+
+/**
+ * @private
+ * @brief Copies a string into a line, escaping quotes, backslashes, control characters and bytes
+ * outside ASCII. In JSON, a byte outside ASCII is escaped as the code point of the same value
+ * (`\u00XX`), so a line is valid JSON and valid UTF-8 whatever the client sent.
+ *
+ * @param buf The line.
+ * @param value The string.
+ * @param json Whether the string is escaped for JSON, otherwise for the combined log format.
+ * @return The number of bytes copied.
+ */
+size_t _escape_access_log_field(char *, const char *, const bool);
+
+/**
+ * @private
+ * @brief Writes the buffer to the log file, retrying partial writes.
+ *
+ * @param log The access log.
+ * @param len The number of bytes in the buffer.
+ * @return On success, returns `1`. On failure, returns `0` and the bytes are lost.
+ */
+int _write_access_log(access_log *, const size_t);
+
+/**
+ * @private
+ * @brief Frees the rings, the buffer and the files of a log, and the log itself.
+ *
+ * @param log The access log.
+ * @return void
+ */
+void _free_access_log(access_log *);
+
+/**
+ * @private
+ * @brief Opens the log file.
+ *
+ * @param path The path of the log file, or `ACCESS_LOG_STDOUT`.
+ * @return On success, returns the file descriptor. On failure, returns `-1`.
+ */
+int _open_access_log(const char *);
+#endif
@@ -0,0 +1,213 @@
+/**
+ * @file include/arena.h
+ * @brief Function Prototypes for a bump-pointer arena allocator.
+ *
+ * This file contains the function prototypes to create an arena, allocate from it, rewind it to
+ * a mark, reset it and destroy it. It also contains functions to take arenas from and give them
+ * back to a per-thread list of spare arenas, so connections don't allocate from the heap on the
+ * steady-state request path.
+ *
+ * Implemented in slib/arena.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H 1
+
+/**
+ * @brief Defines the size of a block of an arena. Larger allocations get a block of their own.
+ */
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE 32768
+#endif
+
+/**
+ * @brief Defines the max number of spare arenas kept by a thread. Arenas released beyond that are
+ * destroyed.
+ */
+#ifndef ARENA_MAX_SPARES
+#define ARENA_MAX_SPARES 256
+#endif
+
+#include <stddef.h>
+
+/**
+ * @struct arena_block
+ * @brief Defines a block of memory of an arena, allocated from the heap.
+ *
+ * @property arena_block* arena_block::next
+ * @brief The next block, or `NULL`.
+ *
+ * @property size_t arena_block::size
+ * @brief The number of bytes in `data`.
+ *
+ * @property size_t arena_block::used
+ * @brief The number of bytes of `data` handed out.
+ *
+ * @property char arena_block::data
+ * @brief The memory handed out by the arena, aligned for any type.
+ */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+} arena_block;
+
+/**
+ * @struct arena
+ * @brief Defines a bump-pointer arena.
+ *
+ * Memory is handed out by bumping a pointer in the current block, and is only given back all at
+ * once, by resetting the arena or rewinding it to a mark. The blocks are kept, so an arena that
+ * is reused (e.g. for every request of a keep-alive connection) stops allocating from the heap
+ * once its blocks are large enough.
+ *
+ * @see create_arena
+ * @see arena_alloc
+ * @see reset_arena
+ * @see destroy_arena
+ *
+ * @property arena_block* arena::first
+ * @brief The first block.
+ *
+ * @property arena_block* arena::current
+ * @brief The block memory is handed out from. Blocks after it are unused.
+ *
+ * @property size_t arena::block_size
+ * @brief The size of new blocks.
+ *
+ * @property arena* arena::next_spare
+ * @brief The next arena in the list of spare arenas of a thread.
+ */
+typedef struct arena {
+    arena_block *first;
+    arena_block *current;
+    size_t block_size;
+    struct arena *next_spare;
+} arena;
+
+/**
+ * @struct arena_mark
+ * @brief Defines a position in an arena, to free everything allocated after it at once.
+ *
+ * @see get_arena_mark
+ * @see rewind_arena
+ *
+ * @property arena_block* arena_mark::block
+ * @brief The current block at the time of the mark.
+ *
+ * @property size_t arena_mark::used
+ * @brief The number of bytes used in `block` at the time of the mark.
+ */
+typedef struct arena_mark {
+    arena_block *block;
+    size_t used;
+} arena_mark;
+
+/**
+ * @brief Creates an arena with a first block of `block_size` bytes.
+ *
+ * @param block_size The size of the blocks of the arena.
+ * @return On success, pointer to the arena is returned. On failure, `NULL` is returned.
+ */
+arena *create_arena(const size_t);
+
+/**
+ * @brief Allocates `size` bytes from the arena, aligned for any type.
+ *
+ * The memory is not initialized and is valid until the arena is reset or rewound to a mark taken
+ * before the allocation.
+ *
+ * @param mem The arena.
+ * @param size The number of bytes.
+ * @return On success, pointer to the memory is returned. On failure, `NULL` is returned.
+ */
+void *arena_alloc(arena *, const size_t);
+
+/**
+ * @brief Copies the string `str` into the arena.
+ *
+ * @param mem The arena.
+ * @param str The string to be copied.
+ * @return On success, pointer to the copy is returned. On failure, `NULL` is returned.
+ */
+char *arena_strdup(arena *, const char *);
+
+/**
+ * @brief Returns the current position of the arena.
+ *
+ * @param mem The arena.
+ * @return The mark, to be passed to `rewind_arena()`.
+ */
+arena_mark get_arena_mark(const arena *);
+
+/**
+ * @brief Frees everything allocated from the arena after `mark` was taken.
+ *
+ * @param mem The arena.
+ * @param mark A mark returned by `get_arena_mark()` since the arena was last reset.
+ * @return void
+ */
+void rewind_arena(arena *, const arena_mark);
+
+/**
+ * @brief Frees everything allocated from the arena, keeping its blocks for reuse.
+ *
+ * @param mem The arena.
+ * @return void
+ */
+void reset_arena(arena *);
+
+/**
+ * @brief Frees the arena and all of its blocks.
+ *
+ * @param mem The arena. If `NULL`, the function does nothing.
+ * @return void
+ */
+void destroy_arena(arena *);
+
+/**
+ * @brief Returns an empty arena, taken from the spare arenas of the calling thread if there are
+ * any, or created with `ARENA_BLOCK_SIZE` blocks otherwise.
+ *
+ * @return On success, pointer to the arena is returned. On failure, `NULL` is returned.
+ *
+ * @see release_arena
+ */
+arena *acquire_arena();
+
+/**
+ * @brief Resets the arena and adds it to the spare arenas of the calling thread. Spare arenas of a
+ * thread are destroyed when the thread exits.
+ *
+ * @param mem The arena returned by `acquire_arena()`. If `NULL`, the function does nothing.
+ * @return void
+ */
+void release_arena(arena *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Allocates a block with `size` bytes of data.
+ *
+ * @param size The number of bytes of data.
+ * @return On success, pointer to the block is returned. On failure, `NULL` is returned.
+ */
+arena_block *_create_arena_block(const size_t);
+
+/**
+ * @private
+ * @brief Destroys the spare arenas of a thread, called when the thread exits.
+ *
+ * @param spares Pointer to the list of spare arenas of the thread.
+ * @return void
+ */
+void _destroy_spare_arenas(void *);
+#endif
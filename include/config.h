@@ -57,6 +57,157 @@
 #define PAGE_CONF_KEY "default_page"
 #endif
 
+/**
+ * @brief Defines the default configuration key for server mode (e.g. `thread` or `epoll`).
+ */
+#ifndef MODE_CONF_KEY
+#define MODE_CONF_KEY "server_mode"
+#endif
+
+/**
+ * @brief Defines the default configuration key for number of worker threads in `pool` mode.
+ */
+#ifndef WORKERS_CONF_KEY
+#define WORKERS_CONF_KEY "worker_threads"
+#endif
+
+/**
+ * @brief Defines the default configuration key for max number of connections waiting for a worker
+ * thread in `pool` mode.
+ */
+#ifndef QUEUE_DEPTH_CONF_KEY
+#define QUEUE_DEPTH_CONF_KEY "queue_depth"
+#endif
+
+/**
+ * @brief Defines the default configuration key for number of acceptor threads, each with its own
+ * `SO_REUSEPORT` listening socket.
+ */
+#ifndef ACCEPTORS_CONF_KEY
+#define ACCEPTORS_CONF_KEY "acceptor_threads"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the `backlog` passed to `listen()`.
+ */
+#ifndef BACKLOG_CONF_KEY
+#define BACKLOG_CONF_KEY "listen_backlog"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the number of seconds an idle keep-alive
+ * connection is kept open. `0` disables keep-alive.
+ */
+#ifndef KEEPALIVE_TIMEOUT_CONF_KEY
+#define KEEPALIVE_TIMEOUT_CONF_KEY "keepalive_timeout"
+#endif
+
+/**
+ * @brief Defines the default configuration key for max number of requests served on a single
+ * keep-alive connection. `0` means no limit.
+ */
+#ifndef KEEPALIVE_REQUESTS_CONF_KEY
+#define KEEPALIVE_REQUESTS_CONF_KEY "keepalive_requests"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the max number of bytes of static files cached
+ * in memory. `0` disables the file cache.
+ */
+#ifndef FILE_CACHE_SIZE_CONF_KEY
+#define FILE_CACHE_SIZE_CONF_KEY "file_cache_size"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the size (in bytes) of the largest file cached
+ * in memory.
+ */
+#ifndef FILE_CACHE_MAX_FILE_CONF_KEY
+#define FILE_CACHE_MAX_FILE_CONF_KEY "file_cache_max_file"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the number of seconds a cached file is served
+ * before it is checked for changes again, if the site root isn't watched. `0` means cached files
+ * are never checked.
+ */
+#ifndef FILE_CACHE_REVALIDATE_CONF_KEY
+#define FILE_CACHE_REVALIDATE_CONF_KEY "file_cache_revalidate"
+#endif
+
+/**
+ * @brief Defines the default configuration key for whether the site root is watched with inotify,
+ * so cached files are dropped as soon as they change instead of being revalidated. `0` disables
+ * the watch.
+ */
+#ifndef FILE_CACHE_WATCH_CONF_KEY
+#define FILE_CACHE_WATCH_CONF_KEY "file_cache_watch"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the max number of files too large for the file
+ * cache that are kept open. `0` disables the fd cache.
+ */
+#ifndef FD_CACHE_SIZE_CONF_KEY
+#define FD_CACHE_SIZE_CONF_KEY "fd_cache_size"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the gzip compression level of text files
+ * compressed on the fly, from `1` to `9`. `0` disables compression on the fly.
+ */
+#ifndef GZIP_LEVEL_CONF_KEY
+#define GZIP_LEVEL_CONF_KEY "gzip_level"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the size of the smallest file compressed on the
+ * fly.
+ */
+#ifndef GZIP_MIN_SIZE_CONF_KEY
+#define GZIP_MIN_SIZE_CONF_KEY "gzip_min_size"
+#endif
+
+/**
+ * @brief Defines the default configuration key for a MIME types file overriding the MIME types
+ * built into the server.
+ */
+#ifndef MIME_FILE_CONF_KEY
+#define MIME_FILE_CONF_KEY "mime_types_file"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the access log file, `-` for the standard
+ * output. Requests are not logged without it.
+ */
+#ifndef ACCESS_LOG_CONF_KEY
+#define ACCESS_LOG_CONF_KEY "access_log"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the format of the access log, `combined` or
+ * `json`.
+ */
+#ifndef ACCESS_LOG_FORMAT_CONF_KEY
+#define ACCESS_LOG_FORMAT_CONF_KEY "access_log_format"
+#endif
+
+/**
+ * @brief Defines the default configuration key for the URL path the metrics are served at (e.g.
+ * `/metrics`). Metrics are not collected without it.
+ */
+#ifndef METRICS_PATH_CONF_KEY
+#define METRICS_PATH_CONF_KEY "metrics_path"
+#endif
+
+/**
+ * @brief Defines the default configuration key for whether the metrics are served to clients other
+ * than loopback ones. `0` serves them to loopback clients only.
+ */
+#ifndef METRICS_REMOTE_CONF_KEY
+#define METRICS_REMOTE_CONF_KEY "metrics_remote"
+#endif
+
 #include <glib.h>
 
 /**
@@ -76,6 +227,18 @@
  */
 int load_config();
 
+/**
+ * @brief Loads and parses the configuration file again, and replaces the loaded configuration
+ * with it.
+ *
+ * The current configuration is only replaced if the file is loaded successfully, so a broken
+ * configuration file doesn't leave the server without configuration. Values returned before stay
+ * valid, as they are copies. Must not be called while another thread retrives configurations.
+ *
+ * @return On success, returns `1`. On failure, returns `0` and the loaded configuration is kept.
+ */
+int reload_config();
+
 /**
  * @brief Returns the value for the corresponding configuration key.
  *
@@ -110,6 +273,17 @@ char *get_config_str(const char *);
  */
 int get_config_int(const char *);
 
+/**
+ * @brief Checks whether the configuration key is set in the configuration file.
+ *
+ * Key is checked using the `g_key_file_has_key()` function. Unlike the functions returning values,
+ * this doesn't print an error for a missing key, so it's used to read optional keys quietly.
+ *
+ * @param key The configuration key.
+ * @return If the key is set, returns `1`. Otherwise, or if no configuration is loaded, returns `0`.
+ */
+int has_config_key(const char *);
+
 /**
  * @brief Unloads configuration and frees memory allocated for configuration and any errors.
  *
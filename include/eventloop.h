@@ -0,0 +1,383 @@
+/**
+ * @file include/eventloop.h
+ * @brief Function Prototypes for the epoll based event loop.
+ *
+ * This file contains the function prototypes to run an edge-triggered `epoll` event loop over
+ * non-blocking sockets, as an alternative to creating a new thread for each connection. Each
+ * connection is driven through a small state machine (read head, open file, write head, write
+ * body) by the same thread that accepts the connections. It also contains internal functions to
+ * advance the state of a connection and memory management.
+ *
+ * Implemented in slib/eventloop.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _EVENTLOOP_H
+#define _EVENTLOOP_H 1
+
+/**
+ * @brief Defines the max number of events returned by a single call to `epoll_wait()`.
+ */
+#ifndef MAX_EVENTS
+#define MAX_EVENTS 1024
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "accesslog.h"
+#include "filecache.h"
+#include "request.h"
+#include "response.h"
+
+/**
+ * @enum conn_state
+ * @brief Defines the states of a connection handled by the event loop.
+ *
+ * A connection starts in `CONN_READ_HEAD` and moves through the states in order. Once the response
+ * body is sent, a keep-alive connection moves back to `CONN_READ_HEAD` for the next request.
+ * Otherwise, the connection moves to `CONN_CLOSE` and is closed by the event loop.
+ */
+typedef enum conn_state {
+    CONN_READ_HEAD,
+    CONN_OPEN_FILE,
+    CONN_WRITE_HEAD,
+    CONN_WRITE_BODY,
+    CONN_CLOSE
+} conn_state;
+
+/**
+ * @struct connection
+ * @brief Defines a connection structure used by the event loop.
+ *
+ * This structure stores the state of a single client connection between events. The receive
+ * buffer `buf`, the request, the response and `out_buf` are allocated from the arena `mem`, which
+ * is only held while there are received bytes of requests not yet served, so idle connections only
+ * cost the size of this struct. The request is parsed in place, so `buf` holds the current request
+ * head followed by the bytes of pipelined requests.
+ *
+ * @property int connection::conn_fd
+ * @brief The file descriptor of the accepted (non-blocking) connection.
+ *
+ * @property conn_state connection::state
+ * @brief The current state of the connection.
+ *
+ * @property char* connection::buf
+ * @brief The receive buffer of size `REQ_BUF_SIZE`, or `NULL` if there are no received bytes.
+ *
+ * @property size_t connection::buf_len
+ * @brief The number of received bytes in `buf`, starting with the head of the current request.
+ *
+ * @property char* connection::out_buf
+ * @brief The serialized response head of size `RES_HEAD_MAX_SIZE`, or `NULL`.
+ *
+ * @property size_t connection::out_len
+ * @brief The number of valid bytes in `out_buf`.
+ *
+ * @property size_t connection::out_pos
+ * @brief The number of bytes of `out_buf` that were already sent to the client.
+ *
+ * @property arena* connection::mem
+ * @brief The arena `buf`, `out_buf`, the request and its response are allocated from, or `NULL`.
+ *
+ * @property arena_mark connection::mark
+ * @brief The position of `mem` right after `buf`, rewound to when a request is done.
+ *
+ * @property request* connection::req
+ * @brief The request being parsed or handled, or `NULL`.
+ *
+ * @property int connection::file_fd
+ * @brief The file descriptor of the file sent as response body, or `-1`.
+ *
+ * @property file_entry* connection::entry
+ * @brief The cache entry the response body is sent from instead of `file_fd`, or `NULL`.
+ *
+ * @property body_part* connection::parts
+ * @brief The parts of the response body, allocated from the arena, or `NULL`.
+ *
+ * @property int connection::no_parts
+ * @brief The number of parts in `parts`.
+ *
+ * @property int connection::part_no
+ * @brief The index in `parts` of the part being sent.
+ *
+ * @property off_t connection::file_off
+ * @brief The offset of the next byte of the file to be sent.
+ *
+ * @property off_t connection::file_end
+ * @brief The offset after the last byte of the file to be sent for the current part.
+ *
+ * @property int connection::no_requests
+ * @brief The number of requests received on the connection.
+ *
+ * @property bool connection::keep_alive
+ * @brief Whether the connection is kept open after the current response.
+ *
+ * @property time_t connection::last_active
+ * @brief The monotonic time (in seconds) of the last event on the connection.
+ *
+ * @property uint64_t connection::stage_start
+ * @brief The time the head or the body of the response started being sent, from `metrics_now()`.
+ *
+ * @property access_log_record* connection::log_record
+ * @brief What is logged of the current request, captured when its response is prepared, or `NULL`
+ * if requests are not logged.
+ *
+ * @property uint64_t connection::log_start
+ * @brief The time the current response started being prepared, from `_access_log_now()`.
+ *
+ * @property int connection::status_code
+ * @brief The status code of the current response, logged once it is sent.
+ *
+ * @property size_t connection::head_size
+ * @brief The size of the head of the current response.
+ *
+ * @property size_t connection::res_sent
+ * @brief The bytes of the current response (head and body) sent so far.
+ *
+ * @property connection* connection::prev
+ * @brief The previous (more recently active) connection in the `conn_list`.
+ *
+ * @property connection* connection::next
+ * @brief The next (less recently active) connection in the `conn_list`.
+ */
+typedef struct connection {
+    int conn_fd;
+    conn_state state;
+    char *buf;
+    size_t buf_len;
+    char *out_buf;
+    size_t out_len;
+    size_t out_pos;
+    arena *mem;
+    arena_mark mark;
+    request *req;
+    int file_fd;
+    file_entry *entry;
+    body_part *parts;
+    int no_parts;
+    int part_no;
+    off_t file_off;
+    off_t file_end;
+    int no_requests;
+    bool keep_alive;
+    time_t last_active;
+    uint64_t stage_start;
+    access_log_record *log_record;
+    uint64_t log_start;
+    int status_code;
+    size_t head_size;
+    size_t res_sent;
+    struct connection *prev;
+    struct connection *next;
+} connection;
+
+/**
+ * @struct conn_list
+ * @brief Defines the list of open connections of an event loop, ordered by their last activity.
+ *
+ * A connection is moved to the head of the list on every event, so idle connections collect at
+ * the tail and are closed from there once they exceed the keep-alive timeout, without scanning
+ * the active connections.
+ *
+ * @property connection* conn_list::head
+ * @brief The most recently active connection.
+ *
+ * @property connection* conn_list::tail
+ * @brief The least recently active connection.
+ */
+typedef struct conn_list {
+    connection *head;
+    connection *tail;
+} conn_list;
+
+/**
+ * @brief Runs the event loop for the listening socket `listen_fd`.
+ *
+ * The listening socket is made non-blocking and registered with a new `epoll` instance in
+ * edge-triggered mode. Every accepted connection is made non-blocking and registered for both
+ * read and write events once, so no `epoll_ctl()` calls are needed while the connection is
+ * advanced through its states. Connections idle for longer than `get_keep_alive_timeout()` seconds
+ * are closed. This function never returns unless an error occurs.
+ *
+ * @param listen_fd The file descriptor of the listening socket.
+ * @return void
+ */
+void run_event_loop(const int);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Accepts all pending connections on `listen_fd` and registers them with `epoll_fd`.
+ *
+ * Since the listening socket is edge-triggered, connections are accepted until `accept4()` would
+ * block.
+ *
+ * @param epoll_fd The file descriptor of the epoll instance.
+ * @param listen_fd The file descriptor of the listening socket.
+ * @param conns The list of open connections, accepted connections are added to its head.
+ * @param now The current monotonic time in seconds.
+ * @return Returns the number of connections accepted.
+ */
+int _accept_connections(const int, const int, conn_list *, const time_t);
+
+/**
+ * @private
+ * @brief Advances the connection through its states until it would block, is done or fails.
+ *
+ * @param conn The connection to be advanced.
+ * @return Returns `0` if the connection is waiting for the socket to be ready, or if it reached
+ * `CONN_CLOSE`. On failure, returns `-1`.
+ */
+int _advance_connection(connection *);
+
+/**
+ * @private
+ * @brief Reads the request head into the connection buffer and parses it once it is complete.
+ *
+ * If the buffer already holds a complete (pipelined) request, it is parsed without reading.
+ *
+ * @param conn The connection in `CONN_READ_HEAD` state.
+ * @return Returns `1` if the state changed, `0` if the socket would block and `-1` on failure or
+ * when the client closed the connection.
+ */
+int _read_request_head(connection *);
+
+/**
+ * @private
+ * @brief Opens the requested file and serializes the response head into `out_buf`.
+ *
+ * @param conn The connection in `CONN_OPEN_FILE` state.
+ * @return Returns `1` if the state changed and `-1` on failure.
+ */
+int _open_request_file(connection *);
+
+/**
+ * @private
+ * @brief Sends the serialized response head from `out_buf`, together with the first chunk of the
+ * file in a single `sendmsg()` call.
+ *
+ * @param conn The connection in `CONN_WRITE_HEAD` state.
+ * @return Returns `1` if the state changed, `0` if the socket would block and `-1` on failure.
+ */
+int _write_response_head(connection *);
+
+/**
+ * @private
+ * @brief Sends the requested file as response body.
+ *
+ * The file is sent with `send_file_range()` from the current offset, without copying it into user
+ * space, until the socket would block. Once the file is sent, a keep-alive connection is reset
+ * using `_reset_connection()`.
+ *
+ * @param conn The connection in `CONN_WRITE_BODY` state.
+ * @return Returns `1` if the state changed, `0` if the socket would block and `-1` on failure.
+ */
+int _write_response_body(connection *);
+
+/**
+ * @private
+ * @brief Parses (or resumes parsing) the request at the start of the receive buffer.
+ *
+ * The request points into the buffer, so the bytes following the request head are only moved to
+ * the start of the buffer by `_reset_connection()`.
+ *
+ * @param conn The connection in `CONN_READ_HEAD` state.
+ * @return Returns `1` if a request was parsed, `0` if the buffer doesn't hold a complete request
+ * head yet and `-1` on failure.
+ */
+int _parse_buffered_request(connection *);
+
+/**
+ * @private
+ * @brief Frees the request and closes the file of the finished response and moves the connection
+ * back to `CONN_READ_HEAD`, keeping the connection open.
+ *
+ * @param conn The connection to be reset.
+ * @return void
+ */
+void _reset_connection(connection *);
+
+/**
+ * @private
+ * @brief Moves the connection to the head of the list and sets its last activity to `now`.
+ *
+ * If the connection is not in the list yet, it is added.
+ *
+ * @param conns The list of open connections.
+ * @param conn The connection.
+ * @param now The current monotonic time in seconds.
+ * @return void
+ */
+void _touch_connection(conn_list *, connection *, const time_t);
+
+/**
+ * @private
+ * @brief Closes the connections at the tail of the list that were idle for at least `timeout`
+ * seconds.
+ *
+ * @param conns The list of open connections.
+ * @param now The current monotonic time in seconds.
+ * @param timeout The idle timeout in seconds.
+ * @return Returns the number of connections closed.
+ */
+int _expire_connections(conn_list *, const time_t, const int);
+
+/**
+ * @private
+ * @brief Removes the connection from the list, closes it and frees the connection struct.
+ *
+ * A connection closed in the middle of a request is counted as an error of the request (or of
+ * sending the response) in the metrics, like `serve_connection()` does. A client closing an idle
+ * keep-alive connection, or an idle connection timing out after a request, is not an error.
+ *
+ * @param conns The list of open connections.
+ * @param conn The connection.
+ * @return void
+ */
+void _close_connection(conn_list *, connection *);
+
+/**
+ * @private
+ * @brief Returns the current time of the coarse monotonic clock, in seconds.
+ *
+ * @return The current monotonic time in seconds.
+ */
+time_t _get_monotonic_time();
+
+/**
+ * @private
+ * @brief Allocates memory for a connection struct and initializes it to default values.
+ *
+ * @param conn_fd The file descriptor of the accepted connection.
+ * @return On success, pointer to a newly allocated connection struct is returned. On failure,
+ * `NULL` is returned.
+ */
+connection *_initialize_connection(const int);
+
+/**
+ * @private
+ * @brief Closes the connection and the open file, and frees the connection struct.
+ *
+ * @param conn The connection to be closed and freed.
+ * @return void
+ */
+void _free_connection(connection *);
+
+/**
+ * @private
+ * @brief Sets `O_NONBLOCK` flag on the file descriptor `fd`.
+ *
+ * @param fd The file descriptor.
+ * @return On success, returns `0`. On failure, returns `-1`.
+ */
+int _set_nonblocking(const int);
+#endif
@@ -0,0 +1,565 @@
+/**
+ * @file include/filecache.h
+ * @brief Function Prototypes for an in-memory cache of hot static files.
+ *
+ * This file contains the function prototypes to create a cache of file contents keyed by their
+ * resolved path and content coding, look files up in it, add files to it and release the entries
+ * handed out. Every entry holds the bytes of the file, its MIME type and its serialized
+ * `Content-Type`, `Content-Length` (and `Content-Encoding`), `Accept-Ranges`, `ETag` and
+ * `Last-Modified` header lines, so a hit is served (or revalidated by the client) without opening,
+ * reading or stat-ing the file and without formatting these headers.
+ *
+ * Entries can also hold contents other than the bytes of the file, such as the file compressed on
+ * the fly, under the content coding of the contents. They are revalidated against the file all the
+ * same.
+ *
+ * Entries are revalidated against their file every few seconds, unless the cache is watched, in
+ * which case they are removed as soon as their file changes (see `include/sitewatch.h`).
+ *
+ * Files too large to be kept in memory go to an fd cache instead, a cache of the same kind whose
+ * entries hold the open file descriptor (and the metadata from `fstat()`) instead of the bytes, and
+ * whose budget is a number of file descriptors.
+ *
+ * Implemented in slib/filecache.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _FILECACHE_H
+#define _FILECACHE_H 1
+
+/**
+ * @brief Defines the number of shards of the cache, each with its own lock. Must be a power of 2.
+ */
+#ifndef FILE_CACHE_SHARDS
+#define FILE_CACHE_SHARDS 16
+#endif
+
+/**
+ * @brief Defines the number of hash buckets of a shard. Must be a power of 2.
+ */
+#ifndef FILE_CACHE_BUCKETS
+#define FILE_CACHE_BUCKETS 256
+#endif
+
+/**
+ * @brief Defines the max size of the serialized header lines of an entry.
+ */
+#ifndef FILE_CACHE_HEADERS_SIZE
+#define FILE_CACHE_HEADERS_SIZE 512
+#endif
+
+/**
+ * @brief Defines the size of a buffer for an entity tag, including the quotes and the terminating
+ * `\0`.
+ */
+#define FILE_ETAG_SIZE 96
+
+/**
+ * @brief Defines the `variants` of an entry that weren't looked for yet.
+ */
+#define FILE_VARIANTS_UNKNOWN (~0u)
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "headers.h"
+
+/**
+ * @struct file_entry
+ * @brief Defines a cached file.
+ *
+ * An entry is a single allocation holding the struct, the path, the MIME type, the header lines
+ * and the file contents. Entries of an fd cache hold the open file instead of its contents.
+ *
+ * Entries are reference counted: the cache holds one reference while the entry is in it, and every
+ * lookup hands out another one, so an entry evicted while a response is being sent from it (or a
+ * `sendfile()` from its file descriptor is in flight) is only freed once that response is done.
+ *
+ * @see get_file_cache_entry
+ * @see add_file_cache_entry
+ * @see release_file_cache_entry
+ *
+ * @property atomic_int file_entry::refs
+ * @brief The number of references to the entry.
+ *
+ * @property atomic_bool file_entry::referenced
+ * @brief Set by every lookup and cleared by the eviction hand, used to approximate LRU order.
+ *
+ * @property atomic_llong file_entry::checked_at
+ * @brief The monotonic time (in seconds) the file was last checked for changes.
+ *
+ * @property atomic_uint file_entry::variants
+ * @brief A bitmask of the precompressed variants found next to the file, kept for the server.
+ * `FILE_VARIANTS_UNKNOWN` until they are looked for, and again every time the file is checked for
+ * changes.
+ *
+ * @property file_entry* file_entry::next
+ * @brief The next entry in the same hash bucket.
+ *
+ * @property file_entry* file_entry::clock_prev
+ * @brief The previous entry in the eviction ring of the shard.
+ *
+ * @property file_entry* file_entry::clock_next
+ * @brief The next entry in the eviction ring of the shard.
+ *
+ * @property uint32_t file_entry::hash
+ * @brief The hash of `path` and `coding`.
+ *
+ * @property size_t file_entry::charge
+ * @brief The number of bytes (`1` in an fd cache) the entry counts against the budget of its
+ * shard.
+ *
+ * @property char* file_entry::path
+ * @brief The resolved path of the file.
+ *
+ * @property char* file_entry::coding
+ * @brief The content coding of the file (e.g. `gzip` for a precompressed `.gz` file), empty if the
+ * file is sent as is.
+ *
+ * @property char* file_entry::mimetype
+ * @brief The MIME type of the file.
+ *
+ * @property char* file_entry::etag
+ * @brief The entity tag of the contents, with its quotes, see `format_file_etag()`.
+ *
+ * @property char* file_entry::headers
+ * @brief The serialized `Content-Type`, `Content-Length`, `Content-Encoding` (for an entry with a
+ * coding), `Accept-Ranges`, `ETag` and `Last-Modified` header lines, see
+ * `set_response_raw_headers()`.
+ *
+ * @property size_t file_entry::headers_len
+ * @brief The length of `headers`.
+ *
+ * @property char* file_entry::validators
+ * @brief The `ETag` and `Last-Modified` lines at the end of `headers`, the headers of a
+ * `304 Not Modified` response.
+ *
+ * @property size_t file_entry::validators_len
+ * @brief The length of `validators`.
+ *
+ * @property char* file_entry::data
+ * @brief The contents of the file, or `NULL` if the entry holds `fd` instead.
+ *
+ * @property int file_entry::fd
+ * @brief The open file, or `-1` if the contents are in `data`. It is shared by all responses, so
+ * it is only read at explicit offsets (e.g. `send_response_fd()`, `pread()`) and never closed by
+ * them. It is closed when the entry is freed.
+ *
+ * @property size_t file_entry::size
+ * @brief The size of the contents sent, the value of `Content-Length`.
+ *
+ * @property size_t file_entry::file_size
+ * @brief The size of the file when it was cached. Differs from `size` if the contents are the file
+ * compressed on the fly.
+ *
+ * @property struct timespec file_entry::mtime
+ * @brief The modification time of the file when it was cached.
+ *
+ * @property ino_t file_entry::ino
+ * @brief The inode number of the file when it was cached.
+ */
+typedef struct file_entry {
+    atomic_int refs;
+    atomic_bool referenced;
+    atomic_llong checked_at;
+    atomic_uint variants;
+    struct file_entry *next;
+    struct file_entry *clock_prev;
+    struct file_entry *clock_next;
+    uint32_t hash;
+    size_t charge;
+    char *path;
+    char *coding;
+    char *mimetype;
+    char *etag;
+    char *headers;
+    size_t headers_len;
+    char *validators;
+    size_t validators_len;
+    char *data;
+    int fd;
+    size_t size;
+    size_t file_size;
+    struct timespec mtime;
+    ino_t ino;
+} file_entry;
+
+/**
+ * @struct file_cache_shard
+ * @brief Defines a shard of the cache, a hash table of entries with its own lock and budget.
+ *
+ * Lookups only take the read lock, and mark the entry they find as referenced with an atomic
+ * store instead of moving it, so readers never block each other. The write lock is taken to add
+ * and remove entries. Entries are evicted with the CLOCK algorithm: the hand walks the ring of
+ * entries, gives referenced entries a second chance and evicts the first entry that wasn't looked
+ * up since the hand last passed it.
+ *
+ * @property pthread_rwlock_t file_cache_shard::lock
+ * @brief The lock of the shard.
+ *
+ * @property file_entry* file_cache_shard::buckets
+ * @brief The hash buckets, chains of entries linked by `next`.
+ *
+ * @property file_entry* file_cache_shard::hand
+ * @brief The next entry considered for eviction, or `NULL` if the shard is empty.
+ *
+ * @property size_t file_cache_shard::used
+ * @brief The sum of the charges of the entries in the shard.
+ *
+ * @property atomic_uint file_cache_shard::invalidations
+ * @brief The number of invalidations of the shard, incremented with the write lock held. An entry
+ * read while an invalidation happened is not added to a watched cache.
+ */
+typedef struct file_cache_shard {
+    pthread_rwlock_t lock;
+    file_entry *buckets[FILE_CACHE_BUCKETS];
+    file_entry *hand;
+    size_t used;
+    atomic_uint invalidations;
+} file_cache_shard;
+
+/**
+ * @struct file_cache
+ * @brief Defines a cache of static files, split into `FILE_CACHE_SHARDS` shards by key hash.
+ *
+ * @see create_file_cache
+ * @see destroy_file_cache
+ *
+ * @property file_cache_shard file_cache::shards
+ * @brief The shards.
+ *
+ * @property size_t file_cache::shard_budget
+ * @brief The max number of bytes (file descriptors for an fd cache) cached by a shard, an equal
+ * share of the total budget.
+ *
+ * @property size_t file_cache::max_file_size
+ * @brief The size of the largest file that is cached.
+ *
+ * @property int file_cache::revalidate
+ * @brief The number of seconds an entry is served before the file is checked for changes again,
+ * `0` if files are never checked. Not used while the cache is watched.
+ *
+ * @property bool file_cache::holds_fds
+ * @brief Set for an fd cache, whose entries hold open file descriptors.
+ *
+ * @property atomic_bool file_cache::watched
+ * @brief Set while every change to the cached files is reported with an invalidation (see
+ * `set_file_cache_watched()`), so entries are served without being revalidated.
+ */
+typedef struct file_cache {
+    file_cache_shard shards[FILE_CACHE_SHARDS];
+    size_t shard_budget;
+    size_t max_file_size;
+    int revalidate;
+    bool holds_fds;
+    atomic_bool watched;
+} file_cache;
+
+/**
+ * @brief Creates an empty file cache.
+ *
+ * @param budget The max number of bytes cached, split evenly between the shards.
+ * @param max_file_size The size of the largest file that is cached.
+ * @param revalidate The number of seconds an entry is served before the file is checked for
+ * changes again, `0` to never check.
+ * @return On success, pointer to the cache is returned. On failure, `NULL` is returned.
+ */
+file_cache *create_file_cache(const size_t, const size_t, const int);
+
+/**
+ * @brief Creates an empty fd cache, holding at most about `max_fds` open file descriptors.
+ *
+ * The limit is split evenly between the shards, rounded up.
+ *
+ * @param max_fds The max number of open file descriptors.
+ * @param revalidate The number of seconds an entry is served before the file is checked for
+ * changes again, `0` to never check.
+ * @return On success, pointer to the cache is returned. On failure, `NULL` is returned.
+ */
+file_cache *create_fd_cache(const size_t, const int);
+
+/**
+ * @brief Looks up the file at `path`, sent with the content coding `coding`, and returns its entry
+ * with a reference held.
+ *
+ * On a hit, no system call is made unless the entry is due to be revalidated, in which case the
+ * file is `stat()`-ed and the entry is dropped if the file changed since it was cached.
+ *
+ * @param cache The file cache.
+ * @param path The resolved path of the file.
+ * @param coding The content coding the file is sent with, `NULL` if it is sent as is.
+ * @return The entry, to be released with `release_file_cache_entry()`, or `NULL` if the file is
+ * not cached.
+ */
+file_entry *get_file_cache_entry(file_cache *, const char *, const char *);
+
+/**
+ * @brief Reads the opened file into a new entry, adds it to the cache and returns it with a
+ * reference held.
+ *
+ * Entries are evicted from the shard until the new entry fits in its budget. If another thread
+ * added the same path in the meantime, its entry is returned instead.
+ *
+ * @param cache The file cache.
+ * @param path The resolved path of the file.
+ * @param coding The content coding of the file (e.g. `gzip` for a `.gz` file), `NULL` if it is
+ * sent as is.
+ * @param file_fd The file descriptor of the opened file. Its offset is not changed.
+ * @param file_stat The result of `fstat()` on `file_fd`.
+ * @param mimetype The MIME type of the file.
+ * @return The entry, to be released with `release_file_cache_entry()`, or `NULL` if the file is
+ * too large, cannot be read, `cache` is an fd cache or on any other failure.
+ */
+file_entry *add_file_cache_entry(file_cache *, const char *, const char *, const int,
+                                 const struct stat *, const char *);
+
+/**
+ * @brief Adds an entry holding `data`, contents derived from the file at `path` (e.g. the file
+ * compressed with the content coding `coding`), to the cache and returns it with a reference held.
+ *
+ * The entry is revalidated against `file_stat` like any other entry, so it is dropped once the
+ * file changes. If another thread added the same path and coding in the meantime, its entry is
+ * returned instead.
+ *
+ * @param cache The file cache.
+ * @param path The resolved path of the file.
+ * @param coding The content coding of `data`.
+ * @param file_stat The metadata of the file `data` was derived from.
+ * @param mimetype The MIME type of the file.
+ * @param data The contents, copied into the entry.
+ * @param data_size The number of bytes of `data`.
+ * @return The entry, to be released with `release_file_cache_entry()`, or `NULL` if the contents
+ * are too large, `cache` is an fd cache or on any other failure.
+ */
+file_entry *add_encoded_file_cache_entry(file_cache *, const char *, const char *,
+                                         const struct stat *, const char *, const char *,
+                                         const size_t);
+
+/**
+ * @brief Adds the opened file to the fd cache and returns its entry with a reference held.
+ *
+ * On success, the entry owns `file_fd`, which is closed once the entry is evicted and released. If
+ * another thread added the same path in the meantime, `file_fd` is closed and the entry of the
+ * other thread is returned instead. Either way, `file_fd` must not be used by the caller anymore,
+ * only the `fd` of the returned entry.
+ *
+ * @param cache The fd cache.
+ * @param path The resolved path of the file.
+ * @param coding The content coding of the file, `NULL` if it is sent as is.
+ * @param file_fd The file descriptor of the opened file.
+ * @param file_stat The result of `fstat()` on `file_fd`.
+ * @param mimetype The MIME type of the file.
+ * @return The entry, to be released with `release_file_cache_entry()`, or `NULL` if `cache` is not
+ * an fd cache or on any other failure, in which case `file_fd` is left to the caller.
+ */
+file_entry *add_fd_cache_entry(file_cache *, const char *, const char *, const int,
+                               const struct stat *, const char *);
+
+/**
+ * @brief Formats the entity tag of a file, derived from its inode number, size and modification
+ * time, so it changes whenever the file is replaced or written to.
+ *
+ * Contents derived from the same file with a content coding get a tag of their own, as they are a
+ * different representation of the file.
+ *
+ * @param file_stat The metadata of the file.
+ * @param coding The content coding of the contents, `NULL` or empty if the file is sent as is.
+ * @param buf The buffer of at least `FILE_ETAG_SIZE` bytes to store the tag in, with its quotes.
+ * @param buf_size The size of `buf`.
+ * @return On success, the length of the tag is returned. On failure, `-1` is returned.
+ *
+ * @see https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/ETag
+ */
+int format_file_etag(const struct stat *, const char *, char *, const size_t);
+
+/**
+ * @brief Sets whether every change to the cached files is reported with an invalidation, e.g. by
+ * an inotify watch on the site root.
+ *
+ * A watched cache serves its entries without revalidating them, and only adds an entry if its file
+ * is still unchanged after it was read and wasn't invalidated in the meantime. An unwatched cache
+ * revalidates its entries every `revalidate` seconds.
+ *
+ * @param cache The file cache, `NULL` is ignored.
+ * @param watched Whether the cache is watched.
+ * @return void
+ */
+void set_file_cache_watched(file_cache *, const bool);
+
+/**
+ * @brief Removes the entries of the file at `path`, with any content coding, from the cache.
+ *
+ * @param cache The file cache.
+ * @param path The resolved path of the file.
+ * @return The number of entries removed.
+ */
+int invalidate_file_cache_path(file_cache *, const char *);
+
+/**
+ * @brief Removes the entries of all files below the directory `dir` from the cache.
+ *
+ * Every shard is scanned, so this is meant for rare events like a directory being moved or deleted.
+ *
+ * @param cache The file cache.
+ * @param dir The resolved path of the directory, with or without a trailing `/`.
+ * @return The number of entries removed.
+ */
+int invalidate_file_cache_dir(file_cache *, const char *);
+
+/**
+ * @brief Drops the reference to the entry. The entry is freed (and its file descriptor closed) once
+ * it is evicted and all of its references are released.
+ *
+ * @param entry The entry, `NULL` is ignored.
+ * @return void
+ */
+void release_file_cache_entry(file_entry *);
+
+/**
+ * @brief Destroys the cache and releases its references to all of its entries.
+ *
+ * @param cache The file cache, `NULL` is ignored.
+ * @return void
+ */
+void destroy_file_cache(file_cache *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Creates an empty cache.
+ *
+ * @param shard_budget The budget of every shard.
+ * @param max_file_size The size of the largest file that is cached.
+ * @param revalidate The number of seconds an entry is served before the file is checked again.
+ * @param holds_fds Whether the cache is an fd cache.
+ * @return On success, pointer to the cache is returned. On failure, `NULL` is returned.
+ */
+file_cache *_create_cache(const size_t, const size_t, const int, const bool);
+
+/**
+ * @private
+ * @brief Allocates an entry with room for `data_size` bytes of contents and fills in everything
+ * but the contents. The entry holds two references, one for the cache and one for the caller.
+ *
+ * @param path The resolved path of the file.
+ * @param coding The content coding of the file, `NULL` if it is sent as is.
+ * @param file_stat The result of `fstat()` on the file.
+ * @param mimetype The MIME type of the file.
+ * @param size The size of the contents sent.
+ * @param data_size The number of bytes of contents to make room for, `0` for an fd cache entry.
+ * @return On success, pointer to the entry is returned. On failure, `NULL` is returned.
+ */
+file_entry *_create_file_entry(const char *, const char *, const struct stat *, const char *,
+                               const size_t, const size_t);
+
+/**
+ * @private
+ * @brief Adds a new entry to its shard, evicting entries to make room for it. If the path and
+ * coding are cached already, the new entry is freed (without closing its file descriptor) and the
+ * cached entry is returned instead.
+ *
+ * In a watched cache, an entry whose file changed since it was stat-ed, or that was invalidated
+ * while it was being read, is not added and returned with only the caller's reference.
+ *
+ * @param cache The cache.
+ * @param entry The new entry.
+ * @return The entry in the cache, with a reference held for the caller.
+ */
+file_entry *_insert_file_entry(file_cache *, file_entry *);
+
+/**
+ * @private
+ * @brief Hashes a path (FNV-1a). The content coding is not hashed, so all entries of a file are
+ * in the same bucket and are invalidated together.
+ *
+ * @param path The path.
+ * @return The hash.
+ */
+uint32_t _hash_file_path(const char *);
+
+/**
+ * @private
+ * @brief Finds the entry for `path` and `coding` in the shard. The caller must hold the shard lock.
+ *
+ * @param shard The shard.
+ * @param path The path.
+ * @param coding The content coding, empty for none.
+ * @param hash The hash of `path`.
+ * @return The entry, or `NULL` if the path is not cached with the coding.
+ */
+file_entry *_find_file_entry(const file_cache_shard *, const char *, const char *, const uint32_t);
+
+/**
+ * @private
+ * @brief Adds an entry to the shard's hash table and eviction ring. The caller must hold the write
+ * lock.
+ *
+ * @param shard The shard.
+ * @param entry The entry.
+ * @return void
+ */
+void _link_file_entry(file_cache_shard *, file_entry *);
+
+/**
+ * @private
+ * @brief Removes an entry from the shard, if it is still in it, and drops the cache's reference.
+ * The caller must hold the write lock.
+ *
+ * @param shard The shard.
+ * @param entry The entry.
+ * @return void
+ */
+void _unlink_file_entry(file_cache_shard *, file_entry *);
+
+/**
+ * @private
+ * @brief Evicts entries with the CLOCK hand until `charge` more bytes fit in the shard's budget.
+ * The caller must hold the write lock.
+ *
+ * @param cache The file cache.
+ * @param shard The shard.
+ * @param charge The number of bytes to make room for.
+ * @return void
+ */
+void _evict_file_entries(file_cache *, file_cache_shard *, const size_t);
+
+/**
+ * @private
+ * @brief Checks if the file of the entry is unchanged, once every `revalidate` seconds, unless the
+ * cache is watched. Every check also forgets the `variants` of the entry, so they are looked for
+ * again.
+ *
+ * @param cache The file cache.
+ * @param entry The entry.
+ * @return `true` if the entry can be served, `false` if the file changed or is gone.
+ */
+bool _is_file_entry_fresh(const file_cache *, file_entry *);
+
+/**
+ * @private
+ * @brief Checks if the file of the entry is unchanged since it was cached, using `stat()`.
+ *
+ * @param entry The entry.
+ * @return `true` if the file has the size, inode and modification time it was cached with.
+ */
+bool _is_file_unchanged(const file_entry *);
+
+/**
+ * @private
+ * @brief Returns the coarse monotonic time in seconds, read without a system call.
+ *
+ * @return The time in seconds.
+ */
+long long _file_cache_now();
+#endif
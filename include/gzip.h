@@ -0,0 +1,50 @@
+/**
+ * @file include/gzip.h
+ * @brief Function Prototypes for compressing response bodies with gzip.
+ *
+ * This file contains the function prototypes to compress a buffer into a gzip stream, used to
+ * compress static text files on the fly for clients that accept the `gzip` content coding.
+ *
+ * Implemented in slib/gzip.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _GZIP_H
+#define _GZIP_H 1
+
+/**
+ * @brief Defines the value of `Content-Encoding` for gzip compressed bodies.
+ */
+#define GZIP_CODING "gzip"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Compresses the buffer into a gzip stream (RFC 1952) in a single pass.
+ *
+ * @param src The buffer to compress.
+ * @param src_len The number of bytes in `src`.
+ * @param level The compression level, from `1` (fastest) to `9` (smallest).
+ * @param out_len Pointer to store the length of the gzip stream.
+ * @return On success, pointer to a newly allocated buffer with the gzip stream is returned, to be
+ * freed with `free()`. On failure, `NULL` is returned.
+ */
+char *gzip_compress(const char *, const size_t, const int, size_t *);
+
+/**
+ * @brief Checks if files of the MIME type are worth compressing, i.e. if they are text.
+ *
+ * These are the `text/` types and the text formats of `application/` and `image/` listed in
+ * `etc/mimetypes.conf` (e.g. `application/json`, `image/svg+xml`). Already compressed formats,
+ * like most images, gain nothing from it.
+ *
+ * @param mimetype The MIME type.
+ * @return `true` if files of the MIME type should be compressed, `false` otherwise.
+ */
+bool is_compressible_mimetype(const char *);
+
+#endif
@@ -0,0 +1,173 @@
+/**
+ * @file include/headers.h
+ * @brief Function Prototypes for looking up well-known HTTP header names.
+ *
+ * This file contains the IDs of the HTTP headers nanows knows about, and the function prototypes to
+ * map a header name to its ID using a static perfect hash and back. Requests and responses store
+ * known headers in fixed slots indexed by these IDs, so looking them up doesn't hash or compare the
+ * full names of all headers. It also contains the function prototypes to format and parse the
+ * HTTP dates sent in header values (e.g. `Last-Modified`, `If-Modified-Since`).
+ *
+ * Implemented in slib/headers.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _HEADERS_H
+#define _HEADERS_H 1
+
+/**
+ * @brief Defines the size of the perfect hash table of known headers. Must be a power of 2.
+ */
+#define HEADER_TABLE_SIZE 128
+
+/**
+ * @brief Defines a byte of a header name as it is hashed, letters lowercased. Setting `0x20`
+ * lowercases letters, and header names only differ in case in letters.
+ */
+#define HEADER_HASH_BYTE(c) ((unsigned)(unsigned char)(c) | 0x20u)
+
+/**
+ * @brief Defines the slot of a header name of length `len` in the perfect hash table, from its
+ * first, middle and last bytes (see `HEADER_HASH_BYTE()`) and their weights. The weights are found
+ * by tools/headergen.c, so that no two known headers share a slot.
+ */
+#define HEADER_HASH_SLOT(len, first, middle, last, w_first, w_middle, w_last)                      \
+    (((len) + (w_first) * (first) + (w_middle) * (middle) + (w_last) * (last)) &                   \
+     (HEADER_TABLE_SIZE - 1))
+
+/**
+ * @brief Defines the size of a buffer for an HTTP date, including the terminating `\0`.
+ */
+#define HTTP_DATE_SIZE 30
+
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * @brief Defines the known HTTP headers, in alphabetical order, as `X(id, name)` entries.
+ *
+ * Expands into `enum http_header` and the canonical names in `slib/headers.c`, and is read by
+ * tools/headergen.c to generate the perfect hash table at build time. So adding a header here is
+ * all it takes.
+ */
+#define KNOWN_HEADERS(X)                                                                           \
+    X(HDR_ACCEPT, "Accept")                                                                        \
+    X(HDR_ACCEPT_ENCODING, "Accept-Encoding")                                                      \
+    X(HDR_ACCEPT_LANGUAGE, "Accept-Language")                                                      \
+    X(HDR_ACCEPT_RANGES, "Accept-Ranges")                                                          \
+    X(HDR_AGE, "Age")                                                                              \
+    X(HDR_AUTHORIZATION, "Authorization")                                                          \
+    X(HDR_CACHE_CONTROL, "Cache-Control")                                                          \
+    X(HDR_CONNECTION, "Connection")                                                                \
+    X(HDR_CONTENT_ENCODING, "Content-Encoding")                                                    \
+    X(HDR_CONTENT_LENGTH, "Content-Length")                                                        \
+    X(HDR_CONTENT_RANGE, "Content-Range")                                                          \
+    X(HDR_CONTENT_TYPE, "Content-Type")                                                            \
+    X(HDR_COOKIE, "Cookie")                                                                        \
+    X(HDR_DATE, "Date")                                                                            \
+    X(HDR_ETAG, "ETag")                                                                            \
+    X(HDR_EXPECT, "Expect")                                                                        \
+    X(HDR_EXPIRES, "Expires")                                                                      \
+    X(HDR_HOST, "Host")                                                                            \
+    X(HDR_IF_MATCH, "If-Match")                                                                    \
+    X(HDR_IF_MODIFIED_SINCE, "If-Modified-Since")                                                  \
+    X(HDR_IF_NONE_MATCH, "If-None-Match")                                                          \
+    X(HDR_IF_RANGE, "If-Range")                                                                    \
+    X(HDR_IF_UNMODIFIED_SINCE, "If-Unmodified-Since")                                              \
+    X(HDR_KEEP_ALIVE, "Keep-Alive")                                                                \
+    X(HDR_LAST_MODIFIED, "Last-Modified")                                                          \
+    X(HDR_LOCATION, "Location")                                                                    \
+    X(HDR_ORIGIN, "Origin")                                                                        \
+    X(HDR_PRAGMA, "Pragma")                                                                        \
+    X(HDR_RANGE, "Range")                                                                          \
+    X(HDR_REFERER, "Referer")                                                                      \
+    X(HDR_SERVER, "Server")                                                                        \
+    X(HDR_SET_COOKIE, "Set-Cookie")                                                                \
+    X(HDR_TE, "TE")                                                                                \
+    X(HDR_TRANSFER_ENCODING, "Transfer-Encoding")                                                  \
+    X(HDR_UPGRADE, "Upgrade")                                                                      \
+    X(HDR_UPGRADE_INSECURE_REQUESTS, "Upgrade-Insecure-Requests")                                  \
+    X(HDR_USER_AGENT, "User-Agent")                                                                \
+    X(HDR_VARY, "Vary")                                                                            \
+    X(HDR_VIA, "Via")
+
+/**
+ * @private
+ * @brief Expands a `KNOWN_HEADERS` entry into its ID.
+ */
+#define KNOWN_HEADER_ID(id, name) id,
+
+/**
+ * @enum http_header
+ * @brief Defines the IDs of the known HTTP headers (see `KNOWN_HEADERS`), in alphabetical order.
+ *
+ * `NO_KNOWN_HEADERS` is the number of known headers, used to size the header slots of requests and
+ * responses.
+ */
+typedef enum http_header {
+    HDR_UNKNOWN = -1,
+    KNOWN_HEADERS(KNOWN_HEADER_ID) NO_KNOWN_HEADERS
+} http_header;
+
+/**
+ * @brief Returns the ID of the header with the name `key` of length `len`, compared
+ * case-insensitively.
+ *
+ * The name is hashed using its length and three of its bytes, and compared with the single known
+ * header that hashes to the same slot, so the lookup takes constant time. `key` doesn't need to be
+ * `\0` terminated.
+ *
+ * @param key The header name.
+ * @param len The length of the header name.
+ * @return The ID of the header, or `HDR_UNKNOWN` if it is not a known header.
+ */
+http_header lookup_header(const char *, const size_t);
+
+/**
+ * @brief Returns the canonical name of a known header (e.g. `Content-Type`).
+ *
+ * @param header The ID of the header.
+ * @return The name of the header, or `NULL` if `header` is not a known header.
+ */
+const char *get_header_name(const http_header);
+
+/**
+ * @brief Formats a time as an HTTP date (e.g. `Sun, 06 Nov 1994 08:49:37 GMT`).
+ *
+ * @param timestamp The time, in seconds since the epoch.
+ * @param buf The buffer of at least `HTTP_DATE_SIZE` bytes to store the date in.
+ * @param buf_size The size of `buf`.
+ * @return On success, the length of the date is returned. On failure, `-1` is returned.
+ *
+ * @see https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/Date
+ */
+int format_http_date(const time_t, char *, const size_t);
+
+/**
+ * @brief Parses an HTTP date (e.g. `Sun, 06 Nov 1994 08:49:37 GMT`).
+ *
+ * Only the preferred format of RFC 7231 is accepted, the obsolete formats are treated as invalid,
+ * as all current clients send the preferred one.
+ *
+ * @param value The date.
+ * @return The time in seconds since the epoch, or `-1` if the date is invalid.
+ */
+time_t parse_http_date(const char *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Hashes a header name into a slot of the perfect hash table, ignoring case.
+ *
+ * @param key The header name.
+ * @param len The length of the header name, greater than `0`.
+ * @return The slot, less than `HEADER_TABLE_SIZE`.
+ */
+unsigned _hash_header(const char *, const size_t);
+#endif
@@ -0,0 +1,276 @@
+/**
+ * @file include/metrics.h
+ * @brief Function Prototypes for collecting counters and latency histograms of the server.
+ *
+ * This file contains the function prototypes to count connections, responses and errors, and to
+ * record how long the stages of a request take, in a way cheap enough to be done for every request.
+ * Every thread writes to a shard of its own, so collecting never takes a lock, nor writes a cache
+ * line another thread writes to: a counter is bumped with a plain load and store. The shards are
+ * only summed up when the metrics are formatted (in the Prometheus text format), e.g. when the
+ * metrics URL is requested.
+ *
+ * Durations are recorded in log-linear (HDR-style) histograms of nanoseconds: every power of 2 is
+ * split into `METRICS_HIST_SUB_BUCKETS` buckets, so a duration is known within 12.5%, with a fixed
+ * number of buckets from 1 nanosecond up to a minute.
+ *
+ * Implemented in slib/metrics.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H 1
+
+/**
+ * @brief Defines the size of the buffer the metrics are formatted into.
+ */
+#ifndef METRICS_BUF_SIZE
+#define METRICS_BUF_SIZE 16384
+#endif
+
+/**
+ * @brief Defines the log2 of the number of buckets every power of 2 of a histogram is split into.
+ */
+#define METRICS_HIST_SUB_BITS 3
+
+/**
+ * @brief Defines the number of buckets every power of 2 of a histogram is split into.
+ */
+#define METRICS_HIST_SUB_BUCKETS (1 << METRICS_HIST_SUB_BITS)
+
+/**
+ * @brief Defines the log2 of the first duration (in nanoseconds) too long for the histograms,
+ * longer durations are counted in the last bucket.
+ */
+#define METRICS_HIST_MAX_BITS 36
+
+/**
+ * @brief Defines the number of buckets of a histogram.
+ */
+#define METRICS_HIST_BUCKETS                                                                       \
+    ((METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 1) * METRICS_HIST_SUB_BUCKETS)
+
+/**
+ * @brief Defines the log2 of the first and the last upper bound (in nanoseconds) of the buckets of
+ * the formatted histograms. The formatted buckets are the powers of 2 in between.
+ */
+#define METRICS_HIST_MIN_LE_BITS 7
+#define METRICS_HIST_MAX_LE_BITS 33
+
+/**
+ * @brief Defines the content type of the formatted metrics.
+ */
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+/**
+ * @brief Adds `value` to a value of a shard. Only the thread owning the shard writes to it, so a
+ * relaxed load and store do, which are plain moves, instead of a locked read-modify-write.
+ */
+#define METRICS_ADD(var, value)                                                                    \
+    atomic_store_explicit(&(var), atomic_load_explicit(&(var), memory_order_relaxed) + (value),    \
+                          memory_order_relaxed)
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief Defines the counters of a shard.
+ */
+typedef enum metric_counter {
+    METRIC_CONNECTIONS,     /**< Connections accepted. */
+    METRIC_RESPONSES_2XX,   /**< Responses with a 2xx status. */
+    METRIC_RESPONSES_3XX,   /**< Responses with a 3xx status. */
+    METRIC_RESPONSES_4XX,   /**< Responses with a 4xx status. */
+    METRIC_RESPONSES_5XX,   /**< Responses with a 5xx status. */
+    METRIC_RESPONSES_NONE,  /**< Requests without a response, whose connection is closed. */
+    METRIC_BODY_BYTES,      /**< Bytes of the bodies of the responses. */
+    METRIC_ERRORS_REQUEST,  /**< Connections closed without a request, or a response to it. */
+    METRIC_ERRORS_RESPONSE, /**< Connections closed as a response head couldn't be formatted. */
+    METRIC_ERRORS_SEND,     /**< Connections closed as a response couldn't be sent. */
+    NO_METRIC_COUNTERS
+} metric_counter;
+
+/**
+ * @brief Defines the stages of a request whose durations are recorded.
+ */
+typedef enum metric_stage {
+    STAGE_PARSE,     /**< Parsing the request, once it is received. */
+    STAGE_FILE_OPEN, /**< Opening the requested file, or looking it up in the file cache. */
+    STAGE_HEAD_SEND, /**< Formatting and sending the head of the response. */
+    STAGE_BODY_SEND, /**< Sending the body of the response. */
+    NO_METRIC_STAGES
+} metric_stage;
+
+/**
+ * @struct metric_desc
+ * @brief Defines how a counter is formatted.
+ *
+ * @property char* metric_desc::name
+ * @brief The name of the metric, shared by counters with different labels.
+ *
+ * @property char* metric_desc::labels
+ * @brief The labels of the counter in braces, or an empty string.
+ *
+ * @property char* metric_desc::help
+ * @brief The description of the metric.
+ */
+typedef struct metric_desc {
+    const char *name;
+    const char *labels;
+    const char *help;
+} metric_desc;
+
+/**
+ * @struct metrics_shard
+ * @brief Defines the counters and histograms of a thread.
+ *
+ * Only the thread owning the shard writes to it, the shard is aligned to a cache line so no other
+ * shard shares one of its lines. When its thread exits, the shard is handed over, with its values,
+ * to the next thread that collects metrics, so the sums of all shards never go down.
+ *
+ * @property atomic_uint_fast64_t metrics_shard::counters
+ * @brief The counters, by `metric_counter`.
+ *
+ * @property atomic_uint_fast64_t metrics_shard::buckets
+ * @brief The buckets of the histograms, by `metric_stage`.
+ *
+ * @property atomic_uint_fast64_t metrics_shard::sums
+ * @brief The sums of the durations recorded in the histograms, in nanoseconds.
+ *
+ * @property metrics_shard* metrics_shard::next
+ * @brief The next shard, or `NULL`.
+ *
+ * @property metrics_shard* metrics_shard::next_free
+ * @brief The next shard without a thread, or `NULL`.
+ */
+typedef struct metrics_shard {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t counters[NO_METRIC_COUNTERS];
+    atomic_uint_fast64_t buckets[NO_METRIC_STAGES][METRICS_HIST_BUCKETS];
+    atomic_uint_fast64_t sums[NO_METRIC_STAGES];
+    struct metrics_shard *next;
+    struct metrics_shard *next_free;
+} metrics_shard;
+
+/**
+ * @brief Starts collecting metrics. Until then, collecting does nothing. Metrics can't be stopped,
+ * as they only ever grow.
+ *
+ * @return void
+ */
+void enable_metrics();
+
+/**
+ * @brief Returns whether metrics are collected.
+ *
+ * @return Whether `enable_metrics()` was called.
+ */
+bool metrics_enabled();
+
+/**
+ * @brief Returns the monotonic time in nanoseconds, to be passed to `observe_metric()` at the end
+ * of a stage.
+ *
+ * @return The time, or `0` if metrics are not collected, so no clock is read.
+ */
+uint64_t metrics_now();
+
+/**
+ * @brief Adds `value` to a counter of the shard of the calling thread.
+ *
+ * @param counter The counter.
+ * @param value The value added.
+ * @return void
+ */
+void add_metric(const metric_counter, const uint64_t);
+
+/**
+ * @brief Counts a response in the counter of the class of its status, and its body.
+ *
+ * @param status The status code of the response, `444` if the request had none.
+ * @param body_len The size of the body of the response.
+ * @return void
+ */
+void add_response_metric(const int, const off_t);
+
+/**
+ * @brief Records the duration of a stage, from `start` to now, in the histogram of the stage.
+ *
+ * @param stage The stage.
+ * @param start The time the stage started, from `metrics_now()`. `0` is ignored.
+ * @return void
+ */
+void observe_metric(const metric_stage, const uint64_t);
+
+/**
+ * @brief Sums up the shards of all threads and formats them in the Prometheus text format.
+ *
+ * @param buf The buffer, `METRICS_BUF_SIZE` bytes are enough.
+ * @param size The size of the buffer.
+ * @return The length of the formatted metrics, or `0` if they don't fit.
+ */
+size_t format_metrics(char *, const size_t);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Returns the shard of the calling thread, taking a free shard or creating one on the first
+ * call of the thread.
+ *
+ * @return The shard, or `NULL` if it can't be created.
+ */
+metrics_shard *_get_metrics_shard();
+
+/**
+ * @private
+ * @brief Gives the shard of an exiting thread back. Set as the destructor of the shard key.
+ *
+ * @param shard_ptr The shard.
+ * @return void
+ */
+void _put_metrics_shard(void *);
+
+/**
+ * @private
+ * @brief Records a duration in the histogram of a stage, in the shard of the calling thread.
+ *
+ * @param stage The stage.
+ * @param nsec The duration in nanoseconds.
+ * @return void
+ */
+void _record_metric(const metric_stage, const uint64_t);
+
+/**
+ * @private
+ * @brief Returns the bucket of a histogram a value is in, buckets holding the values from their
+ * lower bound up to (but not including) their upper bound. `_record_metric()` counts a duration in
+ * the bucket of the duration before it, so the upper bounds of the histograms are inclusive.
+ *
+ * @param nsec The value in nanoseconds.
+ * @return The index of the bucket.
+ */
+int _get_metrics_bucket(const uint64_t);
+
+/**
+ * @private
+ * @brief Formats a line (or more) at `len` in the buffer, and advances `len` past it.
+ *
+ * @param buf The buffer.
+ * @param size The size of the buffer.
+ * @param len Pointer to the length of the buffer used so far.
+ * @param format The `printf()` format.
+ * @return If the line fits, returns `1`. Otherwise, returns `0`.
+ */
+int _append_metrics(char *, const size_t, size_t *, const char *, ...);
+
+#endif
@@ -2,8 +2,10 @@
  * @file include/mimetypes.h
  * @brief Function Prototypes for loading and querying MIME types.
  *
- * This file contains function prototypes to load MIME types for different file extensions from
- * etc/mimetypes.conf and retrive MIME type for different file type or url.
+ * This file contains function prototypes to retrive MIME type for different file type or url. MIME
+ * types are looked up in a perfect hash table generated from etc/mimetypes.conf at build time (see
+ * tools/mimegen.c), so they are available without loading anything. A MIME types file can be
+ * loaded at runtime to override the generated table.
  *
  * Implemented in slib/mimetypes.c
  *
@@ -36,29 +38,86 @@
 #define DEFAULT_MIMETYPE_KEY "*"
 #endif
 
-#include <glib.h>
+/**
+ * @brief Defines the max length of a file extension (including the leading '.') looked up. Longer
+ * extensions get the default MIME type.
+ */
+#define MIME_EXT_MAX_LEN 16
+
+/**
+ * @brief Defines the initial hash of an extension, before it is mixed with the seed of the table.
+ */
+#define MIME_HASH_BASIS 2166136261u
 
 /**
- * @brief Loads MIME types from `MIME_CONF_FILE` and stores them in a hash table.
+ * @brief Mixes the byte `c` of an extension into its hash `hash`, a seeded 32-bit FNV-1a.
  *
- * MIME types are stored in `MIME_CONF_FILE` as a series of records. Each record is a key-value pair
- * in the format `<file extension starting with '.'>=<mime type>`. If the line starts with a '#', it
- * is considered a comment. Each line is parsed to extract the key and value and stored in a hash
- * table. If the MIME type already exists in the hash table, the value is overwritten. Hash tables
- * provided by `glib` are used to store MIME types. `g_hash_table_new_full()` is used to create the
- * hash table.
+ * Setting 0x20 lowercases letters, so extensions differing only in case hash alike. Shared by
+ * `_hash_mime_ext()` and tools/mimegen.c, which searches for a seed without collisions.
+ */
+#define MIME_HASH_STEP(hash, c) (((hash) ^ ((unsigned char)(c) | 0x20u)) * 16777619u)
+
+/**
+ * @brief Maps the hash of an extension to a slot of a table of size `size`, a power of 2.
+ */
+#define MIME_HASH_SLOT(hash, size) (((hash) ^ ((hash) >> 16)) & ((size) - 1))
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @struct mime_record
+ * @brief Defines a file extension and its MIME type, a slot of a MIME types table.
+ *
+ * @property const char* mime_record::ext
+ * @brief The lowercase file extension with a leading '.', or `NULL` if the slot is empty.
+ *
+ * @property size_t mime_record::ext_len
+ * @brief The length of `ext`.
+ *
+ * @property const char* mime_record::mimetype
+ * @brief The MIME type.
+ */
+typedef struct mime_record {
+    const char *ext;
+    size_t ext_len;
+    const char *mimetype;
+} mime_record;
+
+/**
+ * @brief Loads MIME types from `MIME_CONF_FILE` to override the generated table.
  *
- * If the MIME types are  loaded successfully, the function returns `1` and the MIME types are
- * stored in the `_mime_htab` variable. If the MIME types are already loaded (i.e. `_mime_htab` is
- * not `NULL`), the function returns `2` without performing any action. If the MIME types are not
- * loaded successfully, the function returns `0`.
+ * Same as `load_mime_table()` with `MIME_CONF_FILE`.
  *
  * @return On success, returns a non-zero value. On failure, returns 0.
+ * @see load_mime_table()
  */
 int create_mime_table();
 
 /**
- * @brief Destroys the MIME types hash table and releases memory allocated for it.
+ * @brief Loads MIME types from a file to override the generated table.
+ *
+ * MIME types are stored in the file as a series of records. Each record is a key-value pair in the
+ * format `<file extension starting with '.'>=<mime type>`. If the line starts with a '#', it is
+ * considered a comment. Extensions are matched case-insensitively. Extensions found in the file
+ * take precedence over the generated table, which still answers all others. The key defined by
+ * `DEFAULT_MIMETYPE_KEY` overrides the default MIME type.
+ *
+ * If the MIME types are loaded successfully, the function returns `1`. If MIME types are already
+ * loaded, the function returns `2` without performing any action. If the MIME types are not loaded
+ * successfully, the function returns `0` and the generated table is used alone.
+ *
+ * Must be called before any thread looks up MIME types.
+ *
+ * @param path The path of the MIME types file.
+ * @return On success, returns a non-zero value. On failure, returns 0.
+ */
+int load_mime_table(const char *);
+
+/**
+ * @brief Destroys the MIME types loaded from a file and releases memory allocated for them. The
+ * generated table is used alone after.
  *
  * @return void
  */
@@ -67,17 +126,15 @@ void destroy_mime_table();
 /**
  * @brief Gets the MIME type for the given file extension.
  *
- * If the MIME type is found in the hash table, the value is copied into `mimetype` and the same is
- * returned. If the MIME type is not found in the hash table, default MIME type (defined by
+ * The extension is matched case-insensitively. If the MIME type is found, the value is copied into
+ * `mimetype` and the same is returned. If the MIME type is not found, default MIME type (defined by
  * `DEFAULT_MIMETYPE_KEY`) is copied into `mimetype` and the same is returned.
  *
  * `mimetype` can be `NULL`, in this case, the function simply returns the MIME type.
  *
- * If any error occurs, the function returns NULL and `mimetype` is not modified.
- *
- * @param ext The file extension with a leading '.'.
+ * @param ext The file extension with a leading '.', or `NULL` for files without an extension.
  * @param mimetype Pointer to a string where the MIME type should be copied.
- * @return On success, returns a pointer to string with the MIME type. On failure, returns `NULL`.
+ * @return Pointer to string with the MIME type, which is valid until `destroy_mime_table()`.
  */
 const char *get_mimetype_for_ext(const char *, char *);
 
@@ -90,7 +147,7 @@ const char *get_mimetype_for_ext(const char *, char *);
  * @see get_mimetype_for_ext()
  * @param url The URL path.
  * @param mimetype Pointer to a string where the MIME type should be copied.
- * @return On success, returns a pointer to string with the MIME type. On failure, returns `NULL`.
+ * @return Pointer to string with the MIME type, which is valid until `destroy_mime_table()`.
  */
 const char *get_mimetype_for_url(const char *, char *);
 
@@ -110,22 +167,39 @@ char *_get_ext_for_url(const char *);
 
 /**
  * @private
- * @brief Releases the memory allocated for the given key, called automatically by
- * `g_hash_table_destroy()`.
+ * @brief Hashes an extension with a seed, ignoring case.
  *
- * @param data Pointer to key in the hash table.
- * @return void
+ * @param ext The file extension.
+ * @param len The length of the extension.
+ * @param seed The seed of the hash.
+ * @return The hash, to be mapped to a slot with `MIME_HASH_SLOT()`.
  */
-void _mime_htab_key_destroy(gpointer);
+uint32_t _hash_mime_ext(const char *, const size_t, const uint32_t);
 
 /**
  * @private
- * @brief Releases the memory allocated for the given value, called automatically by
- * `g_hash_table_destroy()`.
- *
- * @param data Pointer to value in the hash table.
- * @return void
+ * @brief Looks an extension up in a MIME types table, comparing it with the single record in its
+ * slot (or, for the loaded table, the records probed after it).
+ *
+ * @param table The table.
+ * @param size The number of slots in the table, a power of 2.
+ * @param seed The seed the table was built with.
+ * @param probe Whether records are probed linearly after the slot, for tables with collisions.
+ * @param ext The file extension.
+ * @param len The length of the extension.
+ * @return The MIME type, or `NULL` if the extension is not in the table.
  */
-void _mime_htab_value_destroy(gpointer);
+const char *_lookup_mime_table(const mime_record *, const size_t, const uint32_t, const bool,
+                               const char *, const size_t);
 
+/**
+ * @private
+ * @brief Adds an extension and its MIME type to the loaded table, replacing the MIME type of the
+ * extension if it was added before.
+ *
+ * @param ext The file extension, which is lowercased.
+ * @param mimetype The MIME type.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _add_mime_record(char *, const char *);
 #endif
@@ -0,0 +1,161 @@
+/**
+ * @file include/rcu.h
+ * @brief Function Prototypes for a pointer published with read-copy-update (RCU) semantics.
+ *
+ * This file contains the function prototypes to create a shared pointer to an immutable object,
+ * read it from any number of threads without locks, replace it with a new object and reclaim the
+ * old one once no reader can hold it anymore. Readers never wait for a writer, and a writer only
+ * waits for the readers that were already reading when it replaced the object.
+ *
+ * Implemented in slib/rcu.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _RCU_H
+#define _RCU_H 1
+
+/**
+ * @brief Defines the size of a cache line, used to keep the reader counts of different CPUs on
+ * separate cache lines.
+ */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/**
+ * @brief Defines the number of reader counts of a pointer. Readers on different CPUs count
+ * themselves on different cache lines, so reading doesn't bounce a single cache line between CPUs.
+ */
+#ifndef RCU_READER_SHARDS
+#define RCU_READER_SHARDS 16
+#endif
+
+/**
+ * @brief Defines the number of microseconds a writer sleeps between checks for remaining readers.
+ */
+#ifndef RCU_GRACE_POLL_USEC
+#define RCU_GRACE_POLL_USEC 1000
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * @private
+ * @struct rcu_readers
+ * @brief Defines the reader counts of a shard, one for each parity of the grace period.
+ *
+ * @property atomic_long rcu_readers::count
+ * @brief The number of readers that entered during a grace period of the parity.
+ */
+typedef struct rcu_readers {
+    _Alignas(CACHE_LINE_SIZE) atomic_long count[2];
+} rcu_readers;
+
+/**
+ * @struct rcu_ptr
+ * @brief Defines a pointer to an immutable object, published with read-copy-update semantics.
+ *
+ * Readers count themselves for the parity of the current grace period before they load the
+ * pointer. A writer swaps the pointer, flips the parity and waits until the readers of the old
+ * parity are gone, as only they can still hold the old object. Writers are serialized, so the
+ * readers of the other parity were waited for by the previous writer.
+ *
+ * @see create_rcu_ptr
+ * @see acquire_rcu_ptr
+ * @see release_rcu_ptr
+ * @see publish_rcu_ptr
+ * @see destroy_rcu_ptr
+ *
+ * @property void* rcu_ptr::value
+ * @brief The published object.
+ *
+ * @property atomic_ulong rcu_ptr::grace_period
+ * @brief The number of grace periods so far, its lowest bit is the parity readers count for.
+ *
+ * @property rcu_readers rcu_ptr::readers
+ * @brief The reader counts, sharded by CPU.
+ *
+ * @property pthread_mutex_t rcu_ptr::publish_lock
+ * @brief Serializes the writers.
+ */
+typedef struct rcu_ptr {
+    _Atomic(void *) value;
+    atomic_ulong grace_period;
+    rcu_readers readers[RCU_READER_SHARDS];
+    pthread_mutex_t publish_lock;
+} rcu_ptr;
+
+/**
+ * @brief Creates a pointer publishing `value`.
+ *
+ * @param value The initial object, may be `NULL`.
+ * @return On success, pointer to the rcu pointer is returned. On failure, `NULL` is returned.
+ */
+rcu_ptr *create_rcu_ptr(void *);
+
+/**
+ * @brief Enters a read-side section and returns the published object, which stays valid until the
+ * section is left with `release_rcu_ptr()`. Never blocks, and sections may be nested.
+ *
+ * @param ptr The rcu pointer.
+ * @param token Pointer to store the token passed to `release_rcu_ptr()`.
+ * @return The published object.
+ */
+void *acquire_rcu_ptr(rcu_ptr *, int *);
+
+/**
+ * @brief Leaves a read-side section entered with `acquire_rcu_ptr()`.
+ *
+ * @param ptr The rcu pointer.
+ * @param token The token stored by `acquire_rcu_ptr()`.
+ * @return void
+ */
+void release_rcu_ptr(rcu_ptr *, const int);
+
+/**
+ * @brief Publishes `value` and waits until no reader can hold the object it replaces.
+ *
+ * Readers entering after the swap get `value` right away. Only the caller waits, for the sections
+ * entered before the swap, so the returned object can be freed right after. Must not be called
+ * from a read-side section of the same pointer.
+ *
+ * @param ptr The rcu pointer.
+ * @param value The new object.
+ * @return The replaced object.
+ */
+void *publish_rcu_ptr(rcu_ptr *, void *);
+
+/**
+ * @brief Frees the rcu pointer, but not the object it publishes. No readers must be left.
+ *
+ * @param ptr The rcu pointer, `NULL` is ignored.
+ * @return The published object, to be freed by the caller, or `NULL` if `ptr` is `NULL`.
+ */
+void *destroy_rcu_ptr(rcu_ptr *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Returns the shard of the reader counts the calling thread counts itself in.
+ *
+ * @return The index of the shard, below `RCU_READER_SHARDS`.
+ */
+int _get_rcu_shard();
+
+/**
+ * @private
+ * @brief Returns the number of readers counted for a parity, over all shards.
+ *
+ * @param ptr The rcu pointer.
+ * @param parity The parity of the grace period.
+ * @return The number of readers.
+ */
+long _count_rcu_readers(rcu_ptr *, const int);
+#endif
@@ -23,7 +23,113 @@
 #define REQ_BUF_SIZE 8192
 #endif
 
-#include <glib.h>
+/**
+ * @brief Defines the max number of pipelined requests parsed from a connection buffer at once.
+ */
+#ifndef MAX_PIPELINED_REQS
+#define MAX_PIPELINED_REQS 16
+#endif
+
+/**
+ * @brief Defines the max number of headers in a request. Requests with more headers are rejected.
+ */
+#ifndef MAX_REQ_HEADERS
+#define MAX_REQ_HEADERS 64
+#endif
+
+/**
+ * @brief Defines the max number of byte ranges in the `Range` header of a request. The header of
+ * a request asking for more ranges is ignored.
+ */
+#ifndef MAX_REQ_RANGES
+#define MAX_REQ_RANGES 16
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "headers.h"
+
+/**
+ * @enum parse_status
+ * @brief Defines the result of `parse_request_buf()`.
+ */
+typedef enum parse_status { PARSE_ERROR = -1, PARSE_INCOMPLETE, PARSE_COMPLETE } parse_status;
+
+/**
+ * @enum parse_state
+ * @brief Defines the states of the request parser, i.e. the part of the request head the next
+ * byte belongs to.
+ */
+typedef enum parse_state {
+    PARSE_METHOD,
+    PARSE_URL,
+    PARSE_VERSION,
+    PARSE_VERSION_LF,
+    PARSE_HEADER_START,
+    PARSE_HEADER_KEY,
+    PARSE_HEADER_VALUE_START,
+    PARSE_HEADER_VALUE,
+    PARSE_HEADER_LF,
+    PARSE_HEAD_LF,
+    PARSE_DONE
+} parse_state;
+
+/**
+ * @brief Defines the signature of a kernel scanning the request head for the end of a part.
+ *
+ * Starting at `pos`, a kernel returns the offset of the first byte that is a control character
+ * (`<= max_ctl` or `0x7f`) or equal to `delim`, or `buf_len` if there is no such byte.
+ */
+typedef size_t (*request_scanner)(const char *, size_t, const size_t, const unsigned char,
+                                  const unsigned char);
+
+/**
+ * @struct req_slice
+ * @brief Defines a part of the request head as an offset and length into the request buffer.
+ *
+ * @property uint32_t req_slice::off
+ * @brief The offset of the first byte, from the start of the request buffer.
+ *
+ * @property uint32_t req_slice::len
+ * @brief The number of bytes.
+ */
+typedef struct req_slice {
+    uint32_t off;
+    uint32_t len;
+} req_slice;
+
+/**
+ * @struct byte_range
+ * @brief Defines a range of bytes of the response body asked for in the `Range` header.
+ *
+ * @property off_t byte_range::start
+ * @brief The offset of the first byte.
+ *
+ * @property off_t byte_range::end
+ * @brief The offset after the last byte.
+ */
+typedef struct byte_range {
+    off_t start;
+    off_t end;
+} byte_range;
+
+/**
+ * @struct req_header
+ * @brief Defines a request header as slices of its key and value.
+ *
+ * @property req_slice req_header::key
+ * @brief The header key (e.g. `Host`).
+ *
+ * @property req_slice req_header::value
+ * @brief The header value without surrounding whitespace (e.g. `localhost`).
+ */
+typedef struct req_header {
+    req_slice key;
+    req_slice value;
+} req_header;
 
 /**
  * @struct request
@@ -32,8 +138,18 @@
  * This structure defines a request structure. It is used to store the connection file descriptor,
  * HTTP Method, URL, HTTP Version, and the request headers.
  *
+ * Nothing is copied out of the buffer the request is parsed from. The parser only records slices
+ * into the buffer, so the buffer must not be modified or freed while the request is in use. Once
+ * the request head is complete, the byte after each part (the space, `:` or `\r`) is replaced by
+ * `'\0'`, so `http_method`, `url`, `http_ver` and the header keys and values can be used as
+ * strings pointing into the buffer.
+ *
+ * A request created in an arena is allocated from it and is freed with the arena, so freeing the
+ * request itself does nothing.
+ *
  * @see get_request
  * @see parse_request
+ * @see parse_request_buf
  * @see get_request_header
  * @see close_request
  *
@@ -49,17 +165,96 @@
  * @property char* request::http_ver
  * @brief The HTTP version of the request. (e.g. `HTTP/1.1`)
  *
- * @property GHashTable* request::header_htab
- * @brief The hash table of the request headers.
+ * @property char* request::buf
+ * @brief The buffer the request is parsed from. All slices are relative to it.
+ *
+ * @property char* request::owned_buf
+ * @brief A copy of the request data made by `parse_request()`, freed with the request. `NULL`
+ * when the request is parsed straight from a connection buffer.
+ *
+ * @property arena* request::mem
+ * @brief The arena the request was allocated from, or `NULL` if it was allocated from the heap.
+ *
+ * @property req_header request::headers
+ * @brief The request headers, in the order they were sent.
+ *
+ * @property int request::no_headers
+ * @brief The number of headers in `headers`.
+ *
+ * @property uint8_t request::header_slots
+ * @brief The slots of the known headers, indexed by `http_header`. Each slot holds `1` + the index
+ * in `headers` of the first header with that name, or `0` if the header was not sent.
+ *
+ * @property uint8_t request::unknown_headers
+ * @brief The indices in `headers` of the headers that are not known headers.
+ *
+ * @property int request::no_unknown_headers
+ * @brief The number of indices in `unknown_headers`.
+ *
+ * @property parse_state request::state
+ * @brief The state of the parser.
+ *
+ * @property size_t request::parse_pos
+ * @brief The offset of the next byte to be parsed, so parsing resumes where it stopped.
+ *
+ * @property size_t request::tok_off
+ * @brief The offset of the first byte of the part being parsed.
+ *
+ * @property size_t request::tok_end
+ * @brief The offset after the last non-whitespace byte of the header value being parsed.
+ *
+ * @property size_t request::head_size
+ * @brief The size of the request head including the blank line, once the head is complete.
  */
 typedef struct request {
     int conn_fd;
     char *http_method;
     char *url;
     char *http_ver;
-    GHashTable *header_htab;
+    char *buf;
+    char *owned_buf;
+    arena *mem;
+    req_slice method_slice;
+    req_slice url_slice;
+    req_slice ver_slice;
+    req_header headers[MAX_REQ_HEADERS];
+    int no_headers;
+    uint8_t header_slots[NO_KNOWN_HEADERS];
+    uint8_t unknown_headers[MAX_REQ_HEADERS];
+    int no_unknown_headers;
+    parse_state state;
+    size_t parse_pos;
+    size_t tok_off;
+    size_t tok_end;
+    size_t head_size;
 } request;
 
+/**
+ * @struct request_buf
+ * @brief Defines the receive buffer of a connection, kept between requests.
+ *
+ * Pipelining clients send several requests without waiting for the responses, so a single
+ * `recv()` may return more than one request, or a request and the start of the next one. The
+ * requests returned by `get_requests()` point into this buffer, so the parsed bytes are only
+ * dropped on the next call to `get_requests()`, after the requests were freed.
+ *
+ * @see get_requests
+ *
+ * @property char request_buf::data
+ * @brief The received bytes.
+ *
+ * @property size_t request_buf::len
+ * @brief The number of received bytes in `data`.
+ *
+ * @property size_t request_buf::start
+ * @brief The number of bytes at the start of `data` used by the requests of the last batch.
+ */
+typedef struct request_buf {
+    char data[REQ_BUF_SIZE];
+    size_t len;
+    size_t start;
+} request_buf;
+
 /**
  * @brief Receives an accepted connection, parses the request, and returns the request.
  *
@@ -73,12 +268,77 @@ typedef struct request {
  *
  * @param conn_fd The file descriptor of the accepted connection, i.e the file descriptor returned
  * by `accept`.
- * @return On success, pointer to a request struct is returned. On failure, `NULL` is returned.
+ * @return On success, pointer to a request struct is returned. On failure, or if the connection is
+ * closed by the client or timed out, `NULL` is returned.
  *
  * @see parse_request
  */
 request *get_request(const int);
 
+/**
+ * @brief Receives from an accepted connection and parses all complete (pipelined) requests.
+ *
+ * If `req_buf` doesn't hold a complete request head yet, the connection is received from until it
+ * does, resuming the parser after each `recv()`. Then, up to `max_reqs` complete requests are
+ * parsed into `reqs`, in the order they were sent. The requests point into `req_buf`, which must
+ * not be used until they are freed. Any bytes following them are kept for the next call. With a
+ * single request per `recv()`, this behaves like `get_request()`.
+ *
+ * @param conn_fd The file descriptor of the accepted connection.
+ * @param req_buf The receive buffer of the connection, `len` and `start` must be `0` for a new
+ * connection.
+ * @param mem The arena to allocate the requests from, or `NULL` to allocate them from the heap.
+ * @param reqs Array to store the parsed requests, must hold at least `max_reqs` pointers.
+ * @param max_reqs The max number of requests to parse.
+ * @return Returns the number of requests parsed. On failure, if the connection is closed by the
+ * client or timed out, or if a request head doesn't fit into `req_buf`, returns `0`.
+ *
+ * @see parse_request_buf
+ */
+int get_requests(const int, request_buf *, arena *, request **, const int);
+
+/**
+ * @brief Allocates a request struct for the connection, to be parsed with `parse_request_buf()`.
+ *
+ * @param conn_fd The file descriptor of the accepted connection.
+ * @return On success, pointer to a request struct is returned. On failure, `NULL` is returned.
+ *
+ * @see create_request_in_arena
+ */
+request *create_request(const int);
+
+/**
+ * @brief Allocates a request struct for the connection from an arena, to be parsed with
+ * `parse_request_buf()`.
+ *
+ * The request is freed when the arena is reset, so no heap memory is allocated for it.
+ *
+ * @param mem The arena, or `NULL` to allocate the request from the heap.
+ * @param conn_fd The file descriptor of the accepted connection.
+ * @return On success, pointer to a request struct is returned. On failure, `NULL` is returned.
+ */
+request *create_request_in_arena(arena *, const int);
+
+/**
+ * @brief Parses (or resumes parsing) the request head at the start of `buf`.
+ *
+ * The parser is a state machine that stops at the end of the received bytes and continues from
+ * there on the next call, so a request head split over several `recv()` calls is parsed only
+ * once. Every call must pass the same buffer (or a copy with the same bytes at the same offsets)
+ * with `buf_len` covering all bytes received so far. Parsing stops at the end of the request head,
+ * bytes after it (e.g. the next pipelined request) are not touched.
+ *
+ * The call that completes the request head is recorded in the metrics as the parse stage (see
+ * `observe_metric()`).
+ *
+ * @param req The request struct, as returned by `create_request()`.
+ * @param buf The buffer starting with the request head.
+ * @param buf_len The number of received bytes in `buf`.
+ * @return Returns `PARSE_COMPLETE` once the request head is complete, with `head_size` set. Returns
+ * `PARSE_INCOMPLETE` if more bytes are needed and `PARSE_ERROR` if the request is malformed.
+ */
+parse_status parse_request_buf(request *, char *, const size_t);
+
 /**
  * @brief Parses the request buffer and returns the request struct.
  *
@@ -86,7 +346,7 @@ request *get_request(const int);
  * the request. Initially, `_initialize_request` is called to initialize the request struct. Then
  * `_parse_request` is called to parse the request. The request struct is then populated with the
  * data parsed from the request. The same request struct is returned. If an error occurs, `NULL`
- * is returned.
+ * is returned. The request data is copied once, so `req_buf` can be reused right away.
  *
  * @param req_buf The buffer containing the request data (read using `recv()`).
  * @param conn_fd The file descriptor of the accepted connection, i.e the file descriptor returned
@@ -101,19 +361,89 @@ request *parse_request(const char *, const int);
 /**
  * @brief Gets the value of a request header for a given key.
  *
- * If `header_key` is found in header table, the value is copied into `header_val` and the same is
- * returned. If the key is not found or an error occurs, `NULL` is returned and `header_val` is
- * not modified.
+ * If `header_key` is found in the request headers (compared case-insensitively), the value is
+ * copied into `header_val` and the same is returned. If the key is not found or an error occurs,
+ * `NULL` is returned and `header_val` is not modified.
  *
  * `header_val` can be `NULL`, in which case, the function simply returns the value.
  *
+ * Known headers (see `enum http_header`) are read from their slot in constant time, only other
+ * headers are searched for in `unknown_headers`.
+ *
  * @param req The request struct.
  * @param header_key The key of the header.
  * @param header_val Pointer to a string to store the value of the header.
  * @return On success, returns a pointer to the header value. On failure, returns `NULL`.
+ *
+ * @see get_known_request_header
  */
 const char *get_request_header(const request *, const char *, char *);
 
+/**
+ * @brief Gets the value of a known request header from its slot, without looking up its name.
+ *
+ * If the header was sent more than once, the value of the first one is returned.
+ *
+ * @param req The request struct.
+ * @param header The ID of the header (e.g. `HDR_HOST`).
+ * @return On success, returns a pointer to the header value. If the header was not sent or an
+ * error occurs, returns `NULL`.
+ */
+const char *get_known_request_header(const request *, const http_header);
+
+/**
+ * @brief Returns the quality the client gave the content coding `coding` (e.g. `gzip`) in the
+ * `Accept-Encoding` header of the request, in thousandths.
+ *
+ * The header is a comma separated list of codings, compared case-insensitively, each with an
+ * optional `q` parameter that defaults to `1`. A coding that isn't listed gets the quality of `*`,
+ * if it is listed.
+ *
+ * @param req The request struct.
+ * @param coding The content coding.
+ * @return The quality, from `0` (not acceptable) to `1000`. If the request has no
+ * `Accept-Encoding` header, returns `0`, as the response is then sent without a content coding.
+ *
+ * @see https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/Accept-Encoding
+ */
+int get_encoding_quality(const request *, const char *);
+
+/**
+ * @brief Checks if the entity tag `etag` is listed in the header `header` (e.g. `If-None-Match`)
+ * of the request.
+ *
+ * The header is a comma separated list of entity tags, or `*` which matches any tag. Tags are
+ * compared with the weak comparison, i.e. a `W/` prefix is ignored.
+ *
+ * @param req The request struct.
+ * @param header The ID of the header.
+ * @param etag The entity tag, with its quotes.
+ * @return `1` if the tag is listed, `0` if it isn't or the request has no such header.
+ *
+ * @see https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/If-None-Match
+ */
+int match_request_etag(const request *, const http_header, const char *);
+
+/**
+ * @brief Parses the byte ranges in the `Range` header of the request (e.g. `bytes=0-99, -100`),
+ * for a response body of `size` bytes.
+ *
+ * The last byte of a range is clamped to the end of the body. Ranges starting after the end of
+ * the body can't be satisfied and are left out. The ranges are returned in the order they are
+ * listed.
+ *
+ * @param req The request struct.
+ * @param size The size of the response body.
+ * @param ranges The array to store the ranges in.
+ * @param max_ranges The size of `ranges`.
+ * @return The number of ranges stored. `0` if the request has no `Range` header, or the header is
+ * invalid or lists more than `max_ranges` ranges, in which case it is ignored. `-1` if none of the
+ * ranges can be satisfied.
+ *
+ * @see https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/Range
+ */
+int get_request_ranges(const request *, const off_t, byte_range *, const int);
+
 /**
  * @brief Closes the request connection and frees the request struct.
  *
@@ -143,19 +473,44 @@ void close_request(request *);
  *     - http_method = `NULL`
  *     - url = `NULL`
  *     - http_ver = `NULL`
- *     - header_htab = pointer to a newly allocated `GHashTable`
+ *     - no_headers = `0`
+ *     - state = `PARSE_METHOD`
  *
  * @return On success, pointer to a newly allocated request struct is returned. On failure, `NULL`
  * is returned.
  */
 request *_initialize_request();
 
+/**
+ * @private
+ * @brief Allocates memory for a request struct from an arena and initializes it to default
+ * values, as `_initialize_request()` does.
+ *
+ * @param mem The arena, or `NULL` to allocate the request from the heap.
+ * @return On success, pointer to a newly allocated request struct is returned. On failure, `NULL`
+ * is returned.
+ */
+request *_initialize_request_in_arena(arena *);
+
+/**
+ * @private
+ * @brief Does the actual work of `parse_request_buf()`, which records its duration after.
+ *
+ * @see parse_request_buf()
+ * @param req The request struct, not `NULL` and not parsed completely yet.
+ * @param buf The buffer starting with the request head, not `NULL`.
+ * @param buf_len The number of received bytes in `buf`.
+ * @return The result, as returned by `parse_request_buf()`.
+ */
+parse_status _parse_request_buf(request *, char *, const size_t);
+
 /**
  * @private
  * @brief Helper function to parse the request buffer and populate the request struct.
  *
- * Request data is parsed and populated into the request struct. For example, lets take a normal
- * request:
+ * `req_buf` must be a string holding a complete request head. It is copied into `owned_buf` and
+ * parsed with `parse_request_buf()`. Request data is parsed and populated into the request struct.
+ * For example, lets take a normal request:
  * ```
  *   GET /index.html HTTP/1.1
  *   Host: localhost
@@ -174,7 +529,7 @@ request *_initialize_request();
  *     - http_method = `GET`
  *     - url = `/index.html`
  *     - http_ver = `HTTP/1.1`
- *     - header_htab = `GHashTable` containing the following key-value pairs:
+ *     - headers = slices of the following key-value pairs:
  *         - `Host`: `localhost`
  *         - `Accept`: `text/html`
  *         - `Accept-Encoding`: `gzip`
@@ -195,11 +550,10 @@ int _parse_request(const char *, request *);
  * @private
  * @brief Helper function to free the request struct.
  *
- * This function frees the memory allocated for the request struct. This includes freeing the
- * memory allocated for GHashTable using `g_hash_table_destroy()` and freeing the memory allocated
- * to `http_method`, `url`, `http_ver` using `free()`. Once the request struct is freed, `req`
- * parameter is set to `NULL`. If a `NULL` pointer is passed to this function, function does
- * nothing.
+ * This function frees the memory allocated for the request struct and the copy of the request
+ * data in `owned_buf`, if any. A request allocated from an arena is left to the arena. The strings of the request point into the request buffer, so they
+ * are not freed one by one. Once the request struct is freed, `req` parameter is set to `NULL`. If
+ * a `NULL` pointer is passed to this function, function does nothing.
  *
  * @param req The request struct to be freed and set to `NULL`.
  * @return void
@@ -208,21 +562,103 @@ void _free_request(request *);
 
 /**
  * @private
- * @brief Releases the memory allocated for the given key, called automatically by
- * `g_hash_table_destroy()`.
+ * @brief Terminates the parts of a complete request head with `'\0'` and points `http_method`,
+ * `url` and `http_ver` to them.
  *
- * @param data Pointer to key in the hash table.
+ * @param req The request struct with a complete request head.
  * @return void
  */
-void _req_header_htab_key_destroy(gpointer);
+void _complete_request(request *);
 
 /**
  * @private
- * @brief Releases the memory allocated for the given value, called automatically by
- * `g_hash_table_destroy()`.
+ * @brief Records the header being parsed (at index `no_headers`) in its slot if it is a known
+ * header, or in `unknown_headers` otherwise.
  *
- * @param data Pointer to value in the hash table.
+ * @param req The request struct being parsed.
+ * @param header The ID of the header, or `HDR_UNKNOWN`.
  * @return void
  */
-void _req_header_htab_value_destroy(gpointer);
+void _index_request_header(request *, const http_header);
+
+/**
+ * @private
+ * @brief Parses the value of a `q` parameter (e.g. `0.8`) into thousandths.
+ *
+ * @param value The value, followed by the rest of the header.
+ * @return The quality, from `0` to `1000`. Invalid values are `0`.
+ */
+int _parse_quality(const char *);
+
+/**
+ * @private
+ * @brief Parses a decimal byte offset, as in the `Range` header.
+ *
+ * @param value The offset, followed by the rest of the header.
+ * @param end Pointer to store the position after the offset.
+ * @return The offset, or `-1` if `value` doesn't start with a digit or the offset overflows.
+ */
+off_t _parse_byte_offset(const char *, const char **);
+
+/**
+ * @private
+ * @brief Skips the bytes that can't end the part of the request head being parsed.
+ *
+ * Methods, URLs, versions, header keys and header values are scanned for their delimiter with the
+ * fastest kernel the CPU supports, so the state machine only steps through the delimiters. The end
+ * of the non-whitespace part of a header value is updated from the skipped bytes.
+ *
+ * @param req The request struct being parsed.
+ * @param buf The buffer the request is parsed from.
+ * @param pos The offset of the next byte to be parsed.
+ * @param buf_len The number of received bytes in `buf`.
+ * @return Returns the offset of the next byte the state machine must look at, or `buf_len`.
+ */
+size_t _skip_request_bytes(request *, const char *, size_t, const size_t);
+
+/**
+ * @private
+ * @brief Returns the fastest scanning kernel supported by the CPU, detected using CPUID.
+ *
+ * @return The AVX2 kernel, the SSE4.2 kernel or the scalar kernel, in that order of preference.
+ */
+request_scanner _select_request_scanner();
+
+/**
+ * @private
+ * @brief Scans the request head one byte at a time. Used on CPUs without SSE4.2.
+ *
+ * @param buf The buffer the request is parsed from.
+ * @param pos The offset to start scanning at.
+ * @param buf_len The number of received bytes in `buf`.
+ * @param max_ctl The highest byte treated as a control character (`' '` to also stop at spaces).
+ * @param delim An extra byte to stop at (e.g. `':'`).
+ * @return The offset of the first matching byte, or `buf_len`.
+ *
+ * @see request_scanner
+ */
+size_t _scan_request_scalar(const char *, size_t, const size_t, const unsigned char,
+                            const unsigned char);
+
+#if defined(__x86_64__)
+/**
+ * @private
+ * @brief Scans the request head 16 bytes at a time with the SSE4.2 `PCMPESTRI` instruction, which
+ * matches all three byte ranges at once. Must only be called if the CPU supports SSE4.2.
+ *
+ * @see _scan_request_scalar
+ */
+size_t _scan_request_sse42(const char *, size_t, const size_t, const unsigned char,
+                           const unsigned char);
+
+/**
+ * @private
+ * @brief Scans the request head 32 bytes at a time with AVX2 compares. Must only be called if the
+ * CPU supports AVX2.
+ *
+ * @see _scan_request_scalar
+ */
+size_t _scan_request_avx2(const char *, size_t, const size_t, const unsigned char,
+                          const unsigned char);
+#endif
 #endif
@@ -35,11 +35,45 @@
 #define RES_HEADER_BUF_SIZE 1024
 #endif
 
+/**
+ * @brief Defines the max size of a serialized response head (Start line, headers and empty line).
+ */
+#ifndef RES_HEAD_MAX_SIZE
+#define RES_HEAD_MAX_SIZE 8192
+#endif
+
+/**
+ * @brief Defines the max number of headers in a response.
+ */
+#ifndef MAX_RES_HEADERS
+#define MAX_RES_HEADERS 32
+#endif
+
+#include <stdint.h>
 #include <stdio.h>
-#include <glib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
+#include "arena.h"
+#include "headers.h"
 #include "request.h"
 
+/**
+ * @struct res_header
+ * @brief Defines a response header.
+ *
+ * @property char* res_header::key
+ * @brief The header key (e.g. `Content-Type`). Keys of known headers point to their canonical
+ * name, other keys are copies.
+ *
+ * @property char* res_header::value
+ * @brief The header value (e.g. `text/html`).
+ */
+typedef struct res_header {
+    const char *key;
+    char *value;
+} res_header;
+
 /**
  * @struct response
  * @brief Defines a rresponse structure.
@@ -47,6 +81,9 @@
  * This structure defines a response structure. It is used to store the connection file descriptor,
  * HTTP Version, Status Code, and the response headers.
  *
+ * A response created in an arena (e.g. from a request allocated from an arena) is allocated from
+ * it, together with all of its strings, and is freed with the arena.
+ *
  * @see create_response
  * @see create_response_from_request
  * @see get_response_header
@@ -65,16 +102,74 @@
  * @property char* response::status_code
  * @brief The status code of the response. (e.g. `200 OK`)
  *
- * @property GHashTable* response::header_htab
- * @brief The hash table of the response headers.
+ * @property res_header response::headers
+ * @brief The response headers, in the order they were set.
+ *
+ * @property int response::no_headers
+ * @brief The number of headers in `headers`.
+ *
+ * @property uint8_t response::header_slots
+ * @brief The slots of the known headers, indexed by `http_header`. Each slot holds `1` + the index
+ * in `headers` of the header with that name, or `0` if the header is not set.
+ *
+ * @property uint8_t response::unknown_headers
+ * @brief The indices in `headers` of the headers that are not known headers.
+ *
+ * @property int response::no_unknown_headers
+ * @brief The number of indices in `unknown_headers`.
+ *
+ * @property char* response::raw_headers
+ * @brief Header lines serialized ahead of time, appended verbatim after `headers`, or `NULL`. Not
+ * owned by the response.
+ *
+ * @property size_t response::raw_headers_len
+ * @brief The length of `raw_headers`.
+ *
+ * @property arena* response::mem
+ * @brief The arena the response and its strings were allocated from, or `NULL` if they were
+ * allocated from the heap.
  */
 typedef struct response {
     int conn_fd;
     char *http_ver;
     char *status_code;
-    GHashTable *header_htab;
+    res_header headers[MAX_RES_HEADERS];
+    int no_headers;
+    uint8_t header_slots[NO_KNOWN_HEADERS];
+    uint8_t unknown_headers[MAX_RES_HEADERS];
+    int no_unknown_headers;
+    const char *raw_headers;
+    size_t raw_headers_len;
+    arena *mem;
 } response;
 
+/**
+ * @struct body_part
+ * @brief Defines a part of a response body, a range of the file sent after some literal bytes.
+ *
+ * A response body is sent as a list of parts: a whole file is a single part without a prefix, and
+ * a `multipart/byteranges` body has a part per range, with the boundary and headers of the range
+ * as its prefix, and a last part with only the closing boundary.
+ *
+ * @property char* body_part::prefix
+ * @brief The bytes sent before the range, or `NULL`.
+ *
+ * @property size_t body_part::prefix_len
+ * @brief The length of `prefix`.
+ *
+ * @property off_t body_part::start
+ * @brief The offset of the first byte of the file to be sent.
+ *
+ * @property off_t body_part::end
+ * @brief The offset after the last byte of the file to be sent.
+ */
+typedef struct body_part {
+    char *prefix;
+    size_t prefix_len;
+    off_t start;
+    off_t end;
+} body_part;
+
 /**
  * @brief Creates a response struct, duplicates `conn_fd` and returns a pointer to the response
  * struct.
@@ -92,9 +187,22 @@ typedef struct response {
  * @return On success, a pointer to the response struct is returned. On failure, `NULL` is returned.
  *
  * @see _initialize_response
+ * @see create_response_in_arena
  */
 response *create_response(const int);
 
+/**
+ * @brief Similar to `create_response()`, but allocates the response and its strings from an arena.
+ *
+ * `conn_fd` is duplicated the same way, unless it is `-1`, e.g. for connections owned by an event
+ * loop.
+ *
+ * @param mem The arena, or `NULL` to allocate the response from the heap.
+ * @param conn_fd The file descriptor of the connection that will be used to send the response.
+ * @return On success, a pointer to the response struct is returned. On failure, `NULL` is returned.
+ */
+response *create_response_in_arena(arena *, const int);
+
 /**
  * @brief Similar to `create_response()`, but takes a request struct as an argument and copies
  * `http_ver` from the request struct.
@@ -103,7 +211,7 @@ response *create_response(const int);
  * that it takes a request struct as an argument and also copies `http_ver` from the request struct.
  * `http_ver` is a freshly allocated string and is independent of `request:http_ver`. It is adviced
  * to use `create_response_from_request()` instead of `create_response()` if you are using a request
- * struct.
+ * struct. A request allocated from an arena gives a response allocated from the same arena.
  *
  * @param req The request struct that will be used to create the response.
  * @return On success, a pointer to the response struct is returned. On failure, `NULL` is returned.
@@ -115,9 +223,9 @@ response *create_response_from_request(const request *);
 /**
  * @brief Gets the value of the response header for the given key.
  *
- * If `header_key` is found in header table, the value is copied into `header_val` and the same
- * is returned. If the key is not found or an error occurs, `NULL` is returned and `header_val` is
- * not modified.
+ * If `header_key` is found in the response headers (compared case-insensitively), the value is
+ * copied into `header_val` and the same is returned. If the key is not found or an error occurs,
+ * `NULL` is returned and `header_val` is not modified.
  *
  * `header_val` can be `NULL`, in which case, the function simply returns the value.
  *
@@ -136,17 +244,60 @@ const char *get_response_header(const response *, const char *, char *);
  * header table is not modified. If an error occurs, `NULL` is returned and header table is not
  * modified.
  *
- * `header_key` and `header_val` are duplicated using `strdup()` before storing in header table,
- * this is done to prevent from user freeing the original values and leaving dandling pointers in
- * the header table. The freshly allocated strings are freed interally and the user should not free
- * them.
+ * `header_key` and `header_val` are duplicated using `strdup()` (or copied into the arena of the
+ * response) before storing in header table, this is done to prevent from user freeing the original
+ * values and leaving dandling pointers in the header table. The freshly allocated strings are freed
+ * interally and the user should not free them. At most `MAX_RES_HEADERS` headers can be set.
+ *
+ * Known headers (see `enum http_header`) are stored in their slot in constant time, with their
+ * canonical name as key instead of a copy of `header_key`.
  *
  * @param res The response struct.
  * @param header_key The key for the header.
  * @param header_val Header value to be set.
  * @return On success, returns `header_val` that was stored. On failure, returns `NULL`.
+ *
+ * @see set_known_response_header
+ */
+const char *set_response_header(response *, const char *, const char *);
+
+/**
+ * @brief Sets the value of a known response header, without looking up its name.
+ *
+ * Behaves like `set_response_header()` called with the canonical name of `header`.
+ *
+ * @param res The response struct.
+ * @param header The ID of the header (e.g. `HDR_CONTENT_TYPE`).
+ * @param header_val Header value to be set.
+ * @return On success, returns `header_val` that was stored. On failure, returns `NULL`.
+ */
+const char *set_known_response_header(response *, const http_header, const char *);
+
+/**
+ * @brief Sets header lines that were serialized ahead of time (e.g. by the file cache), so they
+ * don't have to be formatted for every response.
+ *
+ * `raw_headers` must hold complete header lines, each terminated by `\r\n`. It is neither copied
+ * nor freed, and must outlive the response. It replaces any previously set raw headers.
+ *
+ * @param res The response struct.
+ * @param raw_headers The serialized header lines.
+ * @param raw_headers_len The length of `raw_headers`.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int set_response_raw_headers(response *, const char *, const size_t);
+
+/**
+ * @brief Sets the HTTP version and the status code of the response.
+ *
+ * Both strings are copied the same way as header values, replacing any previous values.
+ *
+ * @param res The response struct.
+ * @param http_ver The HTTP version (e.g. `HTTP/1.1`).
+ * @param status_code The status code (e.g. `200 OK`).
+ * @return On success, returns `1`. On failure, returns `0`.
  */
-const char *set_response_header(const response *, const char *, const char *);
+int set_response_status(response *, const char *, const char *);
 
 /**
  * @brief Sends the response head (Start line and headers) to the client.
@@ -156,12 +307,51 @@ const char *set_response_header(const response *, const char *, const char *);
  * response body. This function must be called before sending the response body (i.e.,
  * `send_response_file()` or `send_response()`).)
  *
+ * The head is serialized into a single buffer and sent with one system call, so it leaves in one
+ * segment instead of one per line.
+ *
  * @param res The response struct.
  * @return Returns the number of bytes sent. If an error occurs, returns the number of bytes that
  * were sent before the error occurred.
+ *
+ * @see send_response_head_with_body
  */
 ssize_t send_response_head(const response *);
 
+/**
+ * @brief Sends the response head followed by the first `body_len` bytes of the response body in
+ * `body`, with a single `sendmsg()` call.
+ *
+ * The serialized head and the body are passed to the kernel as one I/O vector, so a small response
+ * goes out in a single packet without copying the body next to the head. The rest of the body, if
+ * any, is sent afterwards (e.g. with `send_response_file()`).
+ *
+ * @param res The response struct.
+ * @param body The first bytes of the response body, or `NULL` if `body_len` is `0`.
+ * @param body_len The number of bytes in `body`.
+ * @return Returns the number of bytes sent (head and body). If an error occurs, returns the number
+ * of bytes that were sent before the error occurred.
+ */
+ssize_t send_response_head_with_body(const response *, const char *, const size_t);
+
+/**
+ * @brief Serializes the response head (Start line and headers) into the buffer `buf`.
+ *
+ * This function writes the same bytes that `send_response_head()` sends to the client, i.e. the
+ * response start line, all the response headers set in header table and an empty line, into `buf`
+ * instead of the connection. This is useful when the response is sent on a non-blocking socket and
+ * the head may have to be sent over several calls. The serialized head is `\0` terminated.
+ *
+ * Raw headers (see `set_response_raw_headers()`) are copied after the other headers as they are.
+ *
+ * @param res The response struct.
+ * @param buf The buffer to write the response head into.
+ * @param buf_size The size of the buffer `buf`.
+ * @return On success, returns the length of the serialized head (excluding `\0`). If HTTP version or
+ * status code is not set or the head doesn't fit in `buf`, returns `-1`.
+ */
+ssize_t format_response_head(const response *, char *, size_t);
+
 /**
  * @brief Sends data in a `FILE` stream to the client as response body.
  *
@@ -179,13 +369,58 @@ ssize_t send_response_head(const response *);
  * the returned number of bytes with the actual byte size of the file. This is a known limitation
  * and will be fixed in the future.
  *
+ * Every byte is copied through user space, so this is only meant for bodies that are transformed
+ * while they are read. Files sent as they are should use `send_response_fd()`.
+ *
  * @param res The response struct.
  * @param file The `FILE` stream to be sent as response body to the client.
  * @return Returns the number of bytes sent. If an error occurs, returns the number of bytes that
  * were sent before the error occurred.
+ *
+ * @see send_response_fd
  */
 ssize_t send_response_file(const response *, FILE *);
 
+/**
+ * @brief Sends `len` bytes of the file `file_fd`, starting at `offset`, to the client as response
+ * body without copying them into user space.
+ *
+ * The bytes are sent with `sendfile()`, or spliced through a pipe if `sendfile()` is not supported
+ * for the file. The file offset of `file_fd` is not changed, so a descriptor shared by several
+ * responses (e.g. one held by an fd cache entry) can be sent by all of them at once. Like
+ * `send_response_file()`, the response head is not sent.
+ *
+ * @param res The response struct.
+ * @param file_fd The file descriptor of the file, opened for reading.
+ * @param offset The offset of the first byte to be sent.
+ * @param len The number of bytes to be sent.
+ * @return Returns the number of bytes sent. If an error occurs or the file ends before `len` bytes,
+ * returns the number of bytes that were sent before.
+ *
+ * @see send_file_range
+ */
+ssize_t send_response_fd(const response *, const int, const off_t, const size_t);
+
+/**
+ * @brief Sends up to `len` bytes of the file `file_fd`, starting at `*offset`, on the connection
+ * `conn_fd` with a single zero-copy call, and advances `*offset` past the sent bytes.
+ *
+ * Uses `sendfile()`, falling back to `splice()` through a pipe if `sendfile()` is not supported for
+ * the file. Works on blocking and non-blocking sockets, a socket that would block fails with
+ * `errno` set to `EAGAIN`. The `splice()` fallback waits for the socket to take the bytes it
+ * already moved into the pipe. Neither call can be told `MSG_NOSIGNAL`, so `SIGPIPE` must be
+ * ignored by the caller (as `start_server()` does) for a connection closed by the client to fail
+ * with `EPIPE`.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @param file_fd The file descriptor of the file.
+ * @param offset Pointer to the offset of the next byte of the file to be sent.
+ * @param len The max number of bytes to be sent.
+ * @return Returns the number of bytes sent, `0` if the file ended, or `-1` on failure with `errno`
+ * set.
+ */
+ssize_t send_file_range(const int, const int, off_t *, const size_t);
+
 /**
  * @brief Sends first `buf_size` bytes in `buf` to the client as response body.
  *
@@ -228,21 +463,34 @@ void close_response(response *);
  *     - conn_fd = -1
  *     - http_ver = `NULL`
  *     - status_code = `NULL`
- *     - header_htab = pointer to a newly allocated `GHashTable`
+ *     - no_headers = `0`
  *
  * @return On success, pointer to a newly allocated request struct is returned. On failure, `NULL`
  * is returned.
  */
 response *_initialize_response();
 
+/**
+ * @private
+ * @brief Allocates memory for a response struct from an arena and initializes it to default
+ * values, as `_initialize_response()` does.
+ *
+ * @param mem The arena, or `NULL` to allocate the response from the heap.
+ * @return On success, pointer to a newly allocated response struct is returned. On failure, `NULL`
+ * is returned.
+ */
+response *_initialize_response_in_arena(arena *);
+
 /**
  * @private
  * @brief Helper function to free the response struct.
  *
  * This function frees the memory allocated for the response struct. This includes freeing the
- * memory allocated for GHashTable using `g_hash_table_destroy()` and freeing the memory allocated
- * to `http_ver` and `status_code` using `free()`. Once the request struct is freed, `res` parameter
- * is set to `NULL`. If a `NULL` pointer is passed to this function, function does nothing.
+ * header keys and values and freeing the memory allocated to `http_ver` and `status_code` using
+ * `free()`, except for the canonical names used as keys of known headers. A response allocated from
+ * an arena is left to the arena. Once the request struct is
+ * freed, `res` parameter is set to `NULL`. If a `NULL` pointer is passed to this function, function
+ * does nothing.
  *
  * @param res The response struct to be freed and set to `NULL`.
  * @return void
@@ -251,21 +499,50 @@ void _free_response(response *);
 
 /**
  * @private
- * @brief Releases the memory allocated for the given key, called automatically by
- * `g_hash_table_destroy()`.
+ * @brief Copies a string for the response, into its arena or, without one, using `strdup()`.
  *
- * @param data Pointer to key in the hash table.
- * @return void
+ * @param res The response struct.
+ * @param str The string to be copied.
+ * @return On success, pointer to the copy is returned. On failure, `NULL` is returned.
  */
-void _res_header_htab_key_destroy(gpointer);
+char *_copy_response_str(const response *, const char *);
 
 /**
  * @private
- * @brief Releases the memory allocated for the given value, called automatically by
- * `g_hash_table_destroy()`.
+ * @brief Searches the headers of the response that are not known headers for `header_key`,
+ * compared case-insensitively.
  *
- * @param data Pointer to value in the hash table.
- * @return void
+ * @param res The response struct.
+ * @param header_key The key of the header.
+ * @return The index of the header in `headers`, or `-1` if it is not set.
+ */
+int _find_unknown_response_header(const response *, const char *);
+
+/**
+ * @private
+ * @brief Sends all bytes of the I/O vector `iov` to the connection, calling `sendmsg()` again
+ * after partial sends.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @param iov The I/O vector, advanced past the sent bytes.
+ * @param iov_len The number of entries in `iov`.
+ * @return Returns the number of bytes sent. If an error occurs, returns the number of bytes that
+ * were sent before the error occurred.
+ */
+ssize_t _send_response_iov(const int, struct iovec *, int);
+
+/**
+ * @private
+ * @brief Splices up to `len` bytes of the file `file_fd`, starting at `*offset`, through a pipe
+ * into the connection `conn_fd`, and advances `*offset` past the sent bytes.
+ *
+ * Used by `send_file_range()` when `sendfile()` is not supported for the file.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @param file_fd The file descriptor of the file.
+ * @param offset Pointer to the offset of the next byte of the file to be sent.
+ * @param len The max number of bytes to be sent.
+ * @return Same as `send_file_range()`.
  */
-void _res_header_htab_value_destroy(gpointer);
+ssize_t _splice_file_range(const int, const int, off_t *, const size_t);
 #endif
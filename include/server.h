@@ -13,17 +13,31 @@
 #ifndef _SERVER_H
 #define _SERVER_H 1
 
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "accesslog.h"
 #include "config.h"
+#include "eventloop.h"
+#include "filecache.h"
+#include "gzip.h"
+#include "metrics.h"
 #include "mimetypes.h"
+#include "rcu.h"
 #include "request.h"
 #include "response.h"
+#include "sitewatch.h"
+#include "threadpool.h"
+#include "uring.h"
 
 /**
  * @brief Defines the maximum legnth for the queue of pending connnections, passed to `listen()`
- * function.
+ * function, if not set in the config file.
  *
  * For more Info about `backlog` parameter in `listen()` function, please refer to POSIX Sockets
  * Docs.
+ *
+ * @see BACKLOG_CONF_KEY
  */
 #define BACKLOG 16
 
@@ -44,16 +58,360 @@
  */
 #define FILE_PATH_BUF_SIZE 1024
 
+/**
+ * @brief Defines the value of `MODE_CONF_KEY` for creating a new thread for each connection. This
+ * is the default server mode.
+ *
+ * @see MODE_CONF_KEY
+ */
+#define SERVER_MODE_THREAD "thread"
+
+/**
+ * @brief Defines the value of `MODE_CONF_KEY` for handling all connections on an epoll event loop.
+ *
+ * @see MODE_CONF_KEY
+ * @see run_event_loop()
+ */
+#define SERVER_MODE_EPOLL "epoll"
+
+/**
+ * @brief Defines the value of `MODE_CONF_KEY` for handling connections on a fixed-size pool of
+ * worker threads.
+ *
+ * @see MODE_CONF_KEY
+ * @see WORKERS_CONF_KEY
+ * @see QUEUE_DEPTH_CONF_KEY
+ */
+#define SERVER_MODE_POOL "pool"
+
+/**
+ * @brief Defines the value of `MODE_CONF_KEY` for handling all connections on an io_uring event
+ * loop. Falls back to `thread` mode if io_uring is not available.
+ *
+ * @see MODE_CONF_KEY
+ * @see run_uring_loop()
+ */
+#define SERVER_MODE_URING "uring"
+
+/**
+ * @brief Defines the number of connections that can wait for a worker thread in `pool` mode, if
+ * not set in the config file.
+ *
+ * @see QUEUE_DEPTH_CONF_KEY
+ */
+#define DEFAULT_QUEUE_DEPTH 1024
+
+/**
+ * @brief Defines the number of seconds an idle keep-alive connection is kept open, if not set in
+ * the config file.
+ *
+ * @see KEEPALIVE_TIMEOUT_CONF_KEY
+ */
+#define DEFAULT_KEEPALIVE_TIMEOUT 5
+
+/**
+ * @brief Defines the max number of requests served on a single keep-alive connection, if not set
+ * in the config file.
+ *
+ * @see KEEPALIVE_REQUESTS_CONF_KEY
+ */
+#define DEFAULT_KEEPALIVE_REQUESTS 100
+
+/**
+ * @brief Defines the max number of bytes of static files cached in memory, if not set in the
+ * config file.
+ *
+ * @see FILE_CACHE_SIZE_CONF_KEY
+ */
+#define DEFAULT_FILE_CACHE_SIZE (64 * 1024 * 1024)
+
+/**
+ * @brief Defines the size of the largest file cached in memory, if not set in the config file.
+ *
+ * @see FILE_CACHE_MAX_FILE_CONF_KEY
+ */
+#define DEFAULT_FILE_CACHE_MAX_FILE (1024 * 1024)
+
+/**
+ * @brief Defines the number of seconds a cached file is served before it is checked for changes
+ * again, if not set in the config file.
+ *
+ * @see FILE_CACHE_REVALIDATE_CONF_KEY
+ */
+#define DEFAULT_FILE_CACHE_REVALIDATE 2
+
+/**
+ * @brief Defines whether the site root is watched for changes of cached files, if not set in the
+ * config file.
+ *
+ * @see FILE_CACHE_WATCH_CONF_KEY
+ */
+#define DEFAULT_FILE_CACHE_WATCH 1
+
+/**
+ * @brief Defines the max number of files kept open by the fd cache, if not set in the config file.
+ *
+ * @see FD_CACHE_SIZE_CONF_KEY
+ */
+#define DEFAULT_FD_CACHE_SIZE 256
+
+/**
+ * @brief Defines the gzip level of text files compressed on the fly, if not set in the config
+ * file.
+ *
+ * @see GZIP_LEVEL_CONF_KEY
+ */
+#define DEFAULT_GZIP_LEVEL 6
+
+/**
+ * @brief Defines the size of the smallest file compressed on the fly, if not set in the config
+ * file. Smaller files gain too little to be worth a `Content-Encoding` header.
+ *
+ * @see GZIP_MIN_SIZE_CONF_KEY
+ */
+#define DEFAULT_GZIP_MIN_SIZE 1024
+
+/**
+ * @brief Defines whether the metrics are served to clients other than loopback ones, if not set in
+ * the config file. They tell how busy the server is, so they are kept local unless asked for.
+ *
+ * @see METRICS_REMOTE_CONF_KEY
+ */
+#define DEFAULT_METRICS_REMOTE 0
+
+/**
+ * @brief Defines the number of precompressed variants looked for next to a static file.
+ *
+ * @see file_variants
+ */
+#define NO_FILE_VARIANTS 2
+
+/**
+ * @brief Defines the size of the buffer the responses to a batch of pipelined requests are
+ * collected in before they are sent, in `thread` and `pool` modes.
+ */
+#ifndef PIPELINE_BUF_SIZE
+#define PIPELINE_BUF_SIZE 65536
+#endif
+
+/**
+ * @struct served_response
+ * @brief Defines what is known about a response of a batch of pipelined requests, to log its
+ * request once the batch is sent.
+ *
+ * @property access_log_record* served_response::record
+ * @brief What is logged of the request, or `NULL` if requests are not logged.
+ *
+ * @property uint64_t served_response::start
+ * @brief The time the response started being prepared, from `_access_log_now()`.
+ *
+ * @property int served_response::status_code
+ * @brief The status code of the response.
+ *
+ * @property off_t served_response::body_len
+ * @brief The size of the body of the response.
+ *
+ * @property size_t served_response::body_start
+ * @brief The offset of the body in the bytes sent on the connection for the batch, `SIZE_MAX` if
+ * the head of the response was never added.
+ */
+typedef struct served_response {
+    access_log_record *record;
+    uint64_t start;
+    int status_code;
+    off_t body_len;
+    size_t body_start;
+} served_response;
+
+/**
+ * @enum server_mode
+ * @brief Defines the server modes, parsed from the value of `MODE_CONF_KEY`.
+ */
+typedef enum server_mode { MODE_THREAD, MODE_EPOLL, MODE_POOL, MODE_URING } server_mode;
+
+/**
+ * @struct acceptor
+ * @brief Defines an acceptor, a thread accepting connections on its own listening socket.
+ *
+ * @property int acceptor::listen_fd
+ * @brief The file descriptor of the listening socket.
+ *
+ * @property int acceptor::cpu
+ * @brief The CPU the acceptor thread is pinned to, or `-1` if it is not pinned.
+ *
+ * @property server_mode acceptor::mode
+ * @brief The server mode, decides how accepted connections are handled.
+ *
+ * @property thread_pool* acceptor::pool
+ * @brief The thread pool shared by all acceptors in `pool` mode, otherwise `NULL`.
+ *
+ * @property pthread_t acceptor::tid
+ * @brief The acceptor thread.
+ */
+typedef struct acceptor {
+    int listen_fd;
+    int cpu;
+    server_mode mode;
+    thread_pool *pool;
+    pthread_t tid;
+} acceptor;
+
+/**
+ * @struct file_variant
+ * @brief Defines a precompressed variant of static files, a sidecar file with the same contents
+ * in a content coding (e.g. `style.css.gz` next to `style.css`).
+ *
+ * @property const char* file_variant::coding
+ * @brief The content coding, as listed in `Accept-Encoding` and sent in `Content-Encoding`.
+ *
+ * @property const char* file_variant::suffix
+ * @brief The suffix appended to the path of the file to get the path of the sidecar.
+ */
+typedef struct file_variant {
+    const char *coding;
+    const char *suffix;
+} file_variant;
+
+/**
+ * @struct server_config
+ * @brief Defines an immutable snapshot of the configuration, parsed once from the config file.
+ *
+ * Missing or invalid values are replaced by their defaults when the snapshot is created, so the
+ * values are used as they are. Requests read the current snapshot with `acquire_server_config()`,
+ * and a reload (see `reload_server_config()`) publishes a new one without touching the old one.
+ *
+ * @see create_server_config
+ * @see destroy_server_config
+ *
+ * @property char* server_config::host
+ * @brief The IPv4 address the server listens on (config key defined by `HOST_CONF_KEY`).
+ *
+ * @property int server_config::port
+ * @brief The port the server listens on (config key defined by `PORT_CONF_KEY`).
+ *
+ * @property server_mode server_config::mode
+ * @brief The server mode (config key defined by `MODE_CONF_KEY`).
+ *
+ * @property int server_config::no_acceptors
+ * @brief The number of acceptors (config key defined by `ACCEPTORS_CONF_KEY`), `0` is resolved to
+ * one per CPU.
+ *
+ * @property int server_config::no_workers
+ * @brief The number of worker threads in `pool` mode (config key defined by `WORKERS_CONF_KEY`).
+ *
+ * @property int server_config::queue_depth
+ * @brief The queue depth in `pool` mode (config key defined by `QUEUE_DEPTH_CONF_KEY`).
+ *
+ * @property int server_config::backlog
+ * @brief The `backlog` of the listening sockets (config key defined by `BACKLOG_CONF_KEY`).
+ *
+ * @property char* server_config::site_dir
+ * @brief The website root directory (config key defined by `SITE_DIR_CONF_KEY`), or `NULL`.
+ *
+ * @property char* server_config::default_page
+ * @brief The page served for `/` (config key defined by `PAGE_CONF_KEY`), or `NULL`.
+ *
+ * @property char* server_config::mime_file
+ * @brief The MIME types file overriding the built-in MIME types (config key defined by
+ * `MIME_FILE_CONF_KEY`), or `NULL`.
+ *
+ * @property int server_config::keep_alive_timeout
+ * @brief The keep-alive timeout (config key defined by `KEEPALIVE_TIMEOUT_CONF_KEY`).
+ *
+ * @property int server_config::keep_alive_requests
+ * @brief The max requests on a connection (config key defined by `KEEPALIVE_REQUESTS_CONF_KEY`).
+ *
+ * @property int server_config::file_cache_size
+ * @brief The budget of the file cache (config key defined by `FILE_CACHE_SIZE_CONF_KEY`).
+ *
+ * @property int server_config::file_cache_max_file
+ * @brief The largest file cached (config key defined by `FILE_CACHE_MAX_FILE_CONF_KEY`).
+ *
+ * @property int server_config::file_cache_revalidate
+ * @brief The revalidation interval (config key defined by `FILE_CACHE_REVALIDATE_CONF_KEY`).
+ *
+ * @property bool server_config::file_cache_watch
+ * @brief Whether the site root is watched (config key defined by `FILE_CACHE_WATCH_CONF_KEY`).
+ *
+ * @property int server_config::fd_cache_size
+ * @brief The budget of the fd cache (config key defined by `FD_CACHE_SIZE_CONF_KEY`).
+ *
+ * @property int server_config::gzip_level
+ * @brief The gzip level of files compressed on the fly (config key defined by
+ * `GZIP_LEVEL_CONF_KEY`), `0` if they are not compressed.
+ *
+ * @property int server_config::gzip_min_size
+ * @brief The smallest file compressed on the fly (config key defined by `GZIP_MIN_SIZE_CONF_KEY`).
+ *
+ * @property char* server_config::access_log_file
+ * @brief The access log file (config key defined by `ACCESS_LOG_CONF_KEY`), or `NULL` if requests
+ * are not logged.
+ *
+ * @property access_log_format server_config::access_log_format
+ * @brief The format of the access log (config key defined by `ACCESS_LOG_FORMAT_CONF_KEY`).
+ *
+ * @property char* server_config::metrics_path
+ * @brief The URL path the metrics are served at (config key defined by `METRICS_PATH_CONF_KEY`),
+ * or `NULL` if they are not collected.
+ *
+ * @property bool server_config::metrics_remote
+ * @brief Whether the metrics are served to clients other than loopback ones (config key defined by
+ * `METRICS_REMOTE_CONF_KEY`). Other clients get the file at the metrics path, if any, otherwise.
+ */
+typedef struct server_config {
+    char *host;
+    int port;
+    server_mode mode;
+    int no_acceptors;
+    int no_workers;
+    int queue_depth;
+    int backlog;
+    char *site_dir;
+    char *default_page;
+    char *mime_file;
+    int keep_alive_timeout;
+    int keep_alive_requests;
+    int file_cache_size;
+    int file_cache_max_file;
+    int file_cache_revalidate;
+    bool file_cache_watch;
+    int fd_cache_size;
+    int gzip_level;
+    int gzip_min_size;
+    char *access_log_file;
+    access_log_format access_log_format;
+    char *metrics_path;
+    bool metrics_remote;
+} server_config;
+
 /**
  * @brief Loads the config, sets up the server and starts the main loop.
  *
  * This function is the entry point for the server. It loads the config, sets up the server socket
  * and enters the main loop. This function never returns unless an error occurs or signalled by
- * OS. The server main loop runs on main thread and creates a new thread for each connection.
- * Requests are handled by the `handle_request()` function on the newly created thread.
+ * OS. The main loop is selected by the config key defined by `MODE_CONF_KEY` macro. In the default
+ * `thread` mode, the server main loop runs on main thread and creates a new thread for each
+ * connection. Requests are handled by the `handle_request()` function on the newly created thread.
+ * In `epoll` mode, all connections are handled by `run_event_loop()` on the main thread. In `pool`
+ * mode, the main thread only accepts connections and hands them over to a fixed number of worker
+ * threads (config key defined by `WORKERS_CONF_KEY`, defaults to the number of CPUs) through a
+ * bounded queue (config key defined by `QUEUE_DEPTH_CONF_KEY`). In `uring` mode, all connections
+ * are handled by `run_uring_loop()` on the main thread, or in `thread` mode if the kernel doesn't
+ * support io_uring.
+ *
+ * If the number of acceptors (config key defined by `ACCEPTORS_CONF_KEY`) is more than 1 (or 0 for
+ * one per CPU), each acceptor gets its own `SO_REUSEPORT` listening socket and runs the main loop
+ * of the server mode on its own thread, pinned to a CPU. The kernel then spreads the incoming
+ * connections over the listening sockets.
+ *
+ * The config file is parsed once into a `server_config` snapshot, and parsed again on `SIGHUP` by a
+ * thread started for it (see `reload_server_config()`), so the server is reconfigured without
+ * dropping connections. The same thread reopens the access log on `SIGUSR1`, after it is rotated.
  *
  * @return Never returns unless an error occurs or signalled by OS.
  * @see handle_request()
+ * @see run_event_loop()
+ * @see run_uring_loop()
  */
 void start_server();
 
@@ -85,6 +443,17 @@ void stop_server();
  */
 void setup_socket();
 
+/**
+ * @brief Sets up `no_sockets` listening sockets bound to the same address with `SO_REUSEPORT`.
+ *
+ * Similar to `setup_socket()`, but creates an acceptor for each socket and assigns the acceptors
+ * to CPUs in a round-robin fashion. On failure, it exits with exit code -1.
+ *
+ * @param no_sockets The number of listening sockets.
+ * @return void
+ */
+void setup_reuseport_sockets(const int);
+
 /**
  * @brief Handles the client requests.
  *
@@ -98,9 +467,108 @@ void setup_socket();
  *
  * @param new_conn_fd Pointer to the file descriptor of the new connection.
  * @return void
+ * @see serve_connection()
  */
 void *handle_request(void *);
 
+/**
+ * @brief Serves the requests on the connection and closes the connection.
+ *
+ * This function does the actual work of `handle_request()` and is used directly as the connection
+ * handler of the worker threads in `pool` mode. Requests are served for as long as
+ * `keep_alive_request()` allows it. All complete requests received at once (pipelined requests)
+ * are served as a batch by `_serve_requests()`. In `pool` mode, the connection is closed after the
+ * first batch, so a worker never waits for the next request of an idle client. A receive timeout
+ * of `get_keep_alive_timeout()` seconds is set on the connection, so an idle client doesn't hold
+ * the thread forever.
+ *
+ * The requests and responses of a batch are allocated from an arena taken from the spare arenas of
+ * the thread, which is reset after every batch, so serving a request doesn't allocate from the
+ * heap.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @return On success, returns `0`. If the first request could not be read or the file could not be
+ * opened, returns `1`. If the response head could not be created, returns `2`. If the response
+ * could not be sent, returns `3`.
+ */
+int serve_connection(const int);
+
+/**
+ * @brief Decides whether the connection is kept open after the response to `req`.
+ *
+ * `HTTP/1.1` connections are kept open unless the client sends `Connection: close`. `HTTP/1.0`
+ * connections are only kept open if the client sends `Connection: keep-alive`. In both cases, the
+ * connection is closed if keep-alive is disabled in the config file (config key defined by
+ * `KEEPALIVE_TIMEOUT_CONF_KEY`) or `no_requests` reached the limit (config key defined by
+ * `KEEPALIVE_REQUESTS_CONF_KEY`).
+ *
+ * @param req The request struct.
+ * @param no_requests The number of requests served on the connection, including `req`.
+ * @return `true` if the connection should be kept open, otherwise `false`.
+ */
+bool keep_alive_request(const request *, const int);
+
+/**
+ * @brief Returns the number of seconds an idle keep-alive connection is kept open.
+ *
+ * @return The idle timeout in seconds. `0` if keep-alive is disabled.
+ * @see KEEPALIVE_TIMEOUT_CONF_KEY
+ */
+int get_keep_alive_timeout();
+
+/**
+ * @brief Creates a snapshot of the loaded configuration (see `load_config()`).
+ *
+ * All keys other than the host and the port are optional, missing or invalid values fall back to
+ * their defaults (e.g. `DEFAULT_KEEPALIVE_TIMEOUT`).
+ *
+ * @return On success, pointer to the snapshot is returned. On failure, `NULL` is returned.
+ */
+server_config *create_server_config();
+
+/**
+ * @brief Frees a snapshot created with `create_server_config()`.
+ *
+ * @param config The snapshot, `NULL` is ignored.
+ * @return void
+ */
+void destroy_server_config(server_config *);
+
+/**
+ * @brief Returns the current snapshot of the configuration, which stays valid until it is released
+ * with `release_server_config()`. Never blocks, not even while the configuration is reloaded.
+ *
+ * The snapshot should only be held while a request is handled, not while its response is sent, as
+ * a reload waits for all snapshots acquired before it to be released. If the server is not
+ * started, a snapshot of the defaults is returned.
+ *
+ * @param token Pointer to store the token passed to `release_server_config()`.
+ * @return The snapshot.
+ */
+const server_config *acquire_server_config(int *);
+
+/**
+ * @brief Releases a snapshot acquired with `acquire_server_config()`.
+ *
+ * @param token The token stored by `acquire_server_config()`.
+ * @return void
+ */
+void release_server_config(const int);
+
+/**
+ * @brief Loads the config file again and publishes a new snapshot of it, which is done on
+ * `SIGHUP`.
+ *
+ * Requests being handled keep the snapshot they acquired, later requests get the new one. The old
+ * snapshot is freed once all requests holding it are done. Settings of the listening sockets, the
+ * server mode and the caches only take effect after a restart, a message is printed if they
+ * changed. If the website root directory changed, the site watch is moved to the new one.
+ *
+ * @return On success, returns `1`. If the config file can't be loaded or has no website root
+ * directory, returns `0` and the current snapshot is kept.
+ */
+int reload_server_config();
+
 /**
  * @brief Closes file stream, requests and response objects and free memory allocated for them.
  *
@@ -113,4 +581,501 @@ void *handle_request(void *);
  * @return void
  */
 void clean_request(FILE *, request *, response *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Serves a batch of pipelined requests, in order, and frees the requests.
+ *
+ * The responses (head and file) are collected in `out_buf`, which is only sent when it is full and
+ * once at the end. So, the responses to a batch of small files are sent with a single `send()`.
+ * Serving stops at the first request that fails or closes the connection. The requests served are
+ * logged once the batch is sent, with the bytes of their bodies that went out.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @param reqs The requests, as returned by `get_requests()`.
+ * @param no_reqs The number of requests in `reqs`.
+ * @param out_buf The buffer of size `PIPELINE_BUF_SIZE` to collect the responses in.
+ * @param no_requests Pointer to the number of requests served on the connection, incremented for
+ * every request.
+ * @param last_batch Whether the connection is closed after the batch, so only the last response
+ * carries `Connection: close`.
+ * @param keep_alive Pointer to store whether the connection is kept open after the batch.
+ * @return Same as `serve_connection()`.
+ */
+int _serve_requests(const int, request **, const int, char *, int *, const bool, bool *);
+
+/**
+ * @private
+ * @brief Appends a part of the body (its prefix and its range of the file) to the responses in
+ * `out_buf` if it fits. Otherwise, sends `out_buf` and then the range with `send_file_range()`,
+ * without copying it into user space.
+ *
+ * Files cached in memory are copied (or sent) from their cache entry instead.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @param file_fd The file descriptor of the file, `-1` if the file is cached in memory.
+ * @param entry The cache entry of the file, or `NULL` if the file is not cached.
+ * @param part The part of the body to send.
+ * @param out_buf The buffer of size `PIPELINE_BUF_SIZE`.
+ * @param out_len Pointer to the number of bytes in `out_buf`.
+ * @param sent Pointer to the number of bytes sent on the connection, incremented by the bytes sent.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _append_file_body(const int, const int, const file_entry *, const body_part *, char *,
+                      size_t *, size_t *);
+
+/**
+ * @private
+ * @brief Sends all `buf_len` bytes of `buf` on the connection.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @param buf The buffer.
+ * @param buf_len The number of bytes to send.
+ * @param sent Pointer to the number of bytes sent on the connection, incremented by the bytes sent
+ * (even if not all of them could be), or `NULL`.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _send_all(const int, const char *, const size_t, size_t *);
+
+/**
+ * @private
+ * @brief Accepts connections on `listen_fd` and creates a new thread for each connection.
+ *
+ * This is the main loop of the `thread` server mode. Never returns.
+ *
+ * @param listen_fd The file descriptor of the listening socket.
+ * @return void
+ */
+void _run_thread_loop(const int);
+
+/**
+ * @private
+ * @brief Accepts connections on `listen_fd` and submits them to a pool of worker threads.
+ *
+ * This is the main loop of the `pool` server mode. Never returns.
+ *
+ * @param listen_fd The file descriptor of the listening socket.
+ * @param pool The thread pool.
+ * @return void
+ */
+void _run_pool_loop(const int, thread_pool *);
+
+/**
+ * @private
+ * @brief Pins the calling thread to the acceptor's CPU and runs the main loop of the server mode.
+ *
+ * Used as the main function of acceptor threads. Never returns.
+ *
+ * @param acceptor Pointer to the acceptor.
+ * @return Never returns.
+ */
+void *_run_acceptor(void *);
+
+/**
+ * @private
+ * @brief Creates the thread pool for `pool` mode with the size set in the config file.
+ *
+ * On failure, it exits with exit code -1.
+ *
+ * @return Pointer to the thread pool.
+ */
+thread_pool *_create_server_pool();
+
+/**
+ * @private
+ * @brief Creates a TCP socket, binds it to the host and port in the config file and listens on it.
+ *
+ * On failure, it exits with exit code -1.
+ *
+ * @param reuseport If `true`, `SO_REUSEPORT` is set on the socket before binding.
+ * @return The file descriptor of the listening socket.
+ */
+int _create_listen_socket(const bool);
+
+/**
+ * @private
+ * @brief Creates the in-memory file cache and the fd cache with the budgets set in the config
+ * snapshot, unless their budget is `0`, and the watch on the site root invalidating them (see
+ * `_watch_site_config()`), unless it is disabled.
+ *
+ * @param config The config snapshot.
+ * @return void
+ */
+void _load_file_cache_config(const server_config *);
+
+/**
+ * @private
+ * @brief Creates the watch on the website root directory of the config snapshot, invalidating the
+ * caches, and prints why cached files are revalidated instead if it can't be watched completely.
+ *
+ * @param config The config snapshot.
+ * @return void
+ */
+void _watch_site_config(const server_config *);
+
+/**
+ * @private
+ * @brief Waits for `SIGHUP` and reloads the configuration with `reload_server_config()`, or for
+ * `SIGUSR1` and reopens the access log with `reopen_access_log()`, until the server is stopped.
+ *
+ * Used as the main function of the reload thread. `SIGHUP` and `SIGUSR1` must be blocked in all
+ * threads, so they are only taken by this thread, and never handled in a signal handler.
+ *
+ * @param arg Unused.
+ * @return `NULL`
+ */
+void *_run_config_reload(void *);
+
+/**
+ * @private
+ * @brief Checks if settings that only take effect after a restart differ between two snapshots.
+ *
+ * @param old_config The current snapshot.
+ * @param new_config The reloaded snapshot.
+ * @return `true` if a restart is needed to apply `new_config` completely, `false` otherwise.
+ */
+bool _needs_restart(const server_config *, const server_config *);
+
+/**
+ * @private
+ * @brief Returns the value of the key from the loaded configuration, or `def_value` if it is
+ * missing or negative. A missing key is not reported as an error.
+ *
+ * @param key The configuration key.
+ * @param def_value The default value.
+ * @return The value.
+ */
+int _get_config_int_or(const char *, const int);
+
+/**
+ * @private
+ * @brief Returns the value of an optional key from the loaded configuration, like
+ * `get_config_str()`, without reporting a missing key as an error.
+ *
+ * @param key The configuration key.
+ * @return A newly allocated string, or `NULL` if the key is missing.
+ */
+char *_get_optional_config_str(const char *);
+
+/**
+ * @private
+ * @brief Parses the value of `MODE_CONF_KEY`. Unknown values fall back to `MODE_THREAD`.
+ *
+ * @param mode_str The server mode string.
+ * @return The server mode.
+ */
+server_mode _parse_server_mode(const char *);
+
+/**
+ * @private
+ * @brief Resolves the URL of the request to a path of a file in website root directory.
+ *
+ * If the URL of the request is `/`, it is replaced by the default page (config key defined by
+ * `PAGE_CONF_KEY`). The resolved path is written into `file_path`, which must be at least
+ * `FILE_PATH_BUF_SIZE` bytes long.
+ *
+ * @param config The config snapshot.
+ * @param req The request struct.
+ * @param file_path The buffer to write the resolved path into.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _resolve_request_path(const server_config *, request *, char *);
+
+/**
+ * @private
+ * @brief Opens the file requested by `req` and creates the response to be sent before the file.
+ *
+ * Resolves the request URL using `_resolve_request_path()`, opens the file and creates a response
+ * in the arena of the request using `create_response_in_arena()` with status code,
+ * `content-type`, `content-length`, `connection` and `server` headers set. This is shared by all
+ * server modes, so the response only differs in how it is sent.
+ *
+ * Files in the file cache are not opened, the entry is returned instead and its serialized
+ * `content-type` and `content-length` lines are used as raw headers of the response. Files that
+ * are not cached yet are added to the cache, if they fit. Files too large for it are added to the
+ * fd cache, and are served from the descriptor of their entry from then on.
+ *
+ * If a precompressed variant of the file exists (see `file_variants`) and the client accepts its
+ * coding, the variant is served instead, the same way, with `content-encoding` set. Text files
+ * without variants are compressed with gzip on the fly instead (see `_get_gzip_file_entry()`).
+ * Responses for files with variants, or files compressed on the fly, carry
+ * `vary: accept-encoding`.
+ *
+ * Every response carries the `etag` and `last-modified` validators of the file sent. If the
+ * request's `if-none-match` (or, without it, `if-modified-since`) shows that the client has that
+ * file already, a `304 Not Modified` response is created instead, with only the validators, and
+ * without body parts.
+ *
+ * Otherwise, the byte ranges of the request's `range` header are served with a
+ * `206 Partial Content` response (see `_create_body_parts()`), unless `if-range` shows that the
+ * client has a different version of the file (see `_is_range_current()`). Ranges that can't be
+ * satisfied get a `416 Range Not Satisfiable` response without body parts. Ranges are of the
+ * file as it is sent, so a precompressed or compressed file is served a single range of the
+ * compressed bytes. Every other response carries `accept-ranges: bytes`.
+ *
+ * The request is not logged here, but by the caller once the response is sent (see
+ * `_log_served_record()`), with `status_code`. Requests without a response, whose connection is
+ * closed, get status `444`, like nginx does. Every request is also counted in the metrics, by the
+ * class of its status (see `add_response_metric()`), and a request for the metrics URL gets the
+ * metrics instead of a file (see `_build_metrics_response()`).
+ *
+ * @param config The config snapshot, acquired by the caller for the request.
+ * @param req The request struct.
+ * @param conn_fd The file descriptor of the connection, duplicated into the response. `-1` if the
+ * caller serializes the response head itself (e.g. using `format_response_head()`).
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @param res Pointer to store the response struct.
+ * @param file_fd Pointer to store the file descriptor of the opened file, `-1` if the file is
+ * cached in memory. The descriptor of an fd cache entry is owned by the entry and must not be
+ * closed.
+ * @param parts Pointer to store the parts of the body, allocated from the arena of the request.
+ * @param no_parts Pointer to store the number of parts, `0` if the response has no body.
+ * @param entry Pointer to store the cache entry of the file, or `NULL` if the file is not cached.
+ * The entry must be released with `release_file_cache_entry()` once the response is sent.
+ * @param status_code Pointer to store the status code of the response, `444` if it has none.
+ * @param body_len Pointer to store the size of the body of the response.
+ * @return On success, returns `1`. If the file is not a regular file or cannot be opened, or on any
+ * other failure, returns `0` and nothing needs to be freed.
+ */
+int _prepare_file_response(const server_config *, request *, const int, const bool, response **,
+                           int *, body_part **, int *, file_entry **, int *, off_t *);
+
+/**
+ * @private
+ * @brief Returns the monotonic time in nanoseconds, to be passed to `_log_served_record()` once the
+ * response is sent.
+ *
+ * @return The time, or `0` if requests are not logged, so no clock is read.
+ */
+uint64_t _access_log_now();
+
+/**
+ * @private
+ * @brief Captures what is logged of a request into the arena, so it can be logged with
+ * `_log_served_record()` once the response is sent. The client is captured while the connection is
+ * known to be open, and the request can be freed before the response is sent.
+ *
+ * @param mem The arena the record is allocated from.
+ * @param req The request.
+ * @return The record, or `NULL` if requests are not logged (or it can't be allocated).
+ */
+access_log_record *_capture_served_request(arena *, const request *);
+
+/**
+ * @private
+ * @brief Logs a request captured by `_capture_served_request()` to the access log of the server,
+ * once its response is sent or failed.
+ *
+ * @param record The record, `NULL` is ignored.
+ * @param status_code The status code of the response, `444` if it had none.
+ * @param body_sent The bytes of the body of the response that were sent.
+ * @param start The time the response started being prepared, from `_access_log_now()`.
+ * @return void
+ */
+void _log_served_record(const access_log_record *, const int, const off_t, const uint64_t);
+
+/**
+ * @private
+ * @brief Returns the microseconds since `start`, from `_access_log_now()`.
+ *
+ * @param start The start time, `0` if requests are not logged.
+ * @return The microseconds, `0` if `start` is `0`.
+ */
+long _get_access_log_latency(const uint64_t);
+
+/**
+ * @private
+ * @brief Does the actual work of `_prepare_file_response()`, which counts the response after.
+ *
+ * @see _prepare_file_response()
+ * @param status_code Pointer to store the status code of the response, `444` if there is none.
+ * @param body_len Pointer to store the size of the response body.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _build_file_response(const server_config *, request *, const int, const bool, response **,
+                         int *, body_part **, int *, file_entry **, int *, off_t *);
+
+/**
+ * @private
+ * @brief Creates the response to a request for the metrics URL (config key defined by
+ * `METRICS_PATH_CONF_KEY`), with the metrics of all threads formatted by `format_metrics()`.
+ *
+ * The metrics are formatted into the arena of the request, and are the prefix of the only body
+ * part, which has no range of a file, so they are sent like any other response, without a file.
+ *
+ * @see _build_file_response()
+ * @return On success, returns `1`. On failure, returns `0` and nothing needs to be freed.
+ */
+int _build_metrics_response(request *, const int, const bool, response **, body_part **, int *,
+                            int *, off_t *);
+
+/**
+ * @private
+ * @brief Returns whether the client of a connection is a loopback one (`127.0.0.0/8`), the only
+ * clients the metrics are served to unless `metrics_remote` is set.
+ *
+ * @param conn_fd The file descriptor of the connection.
+ * @return Whether the client is a loopback one, `false` if its address can't be read.
+ */
+bool _is_loopback_client(const int);
+
+/**
+ * @private
+ * @brief Creates the parts of the body of a response for the byte ranges of a file.
+ *
+ * Without ranges, the body is a single part for the whole file. A single range is a single part
+ * for that range. Multiple ranges are sent as a `multipart/byteranges` body, with a part per
+ * range, whose prefix is the boundary and the `content-type` and `content-range` of the range,
+ * and a last part with only the closing boundary. The boundary is `nanows-` followed by the entity
+ * tag of the file, without its quotes.
+ *
+ * @param req The request struct, the parts are allocated from its arena.
+ * @param ranges The ranges, as returned by `get_request_ranges()`.
+ * @param no_ranges The number of ranges, `0` for the whole file and `-1` for no body.
+ * @param file_size The size of the file.
+ * @param mimetype The MIME type of the file.
+ * @param etag The entity tag of the file.
+ * @param parts Pointer to store the parts.
+ * @param no_parts Pointer to store the number of parts.
+ * @return On success, returns the size of the body (the value of `content-length`). On failure,
+ * returns `-1`.
+ */
+off_t _create_body_parts(request *, const byte_range *, const int, const off_t, const char *,
+                         const char *, body_part **, int *);
+
+/**
+ * @private
+ * @brief Looks the file up in the file cache and the fd cache, or opens it and adds it to them.
+ *
+ * @param config The config snapshot.
+ * @param file_path The resolved path of the file.
+ * @param coding The content coding of the file, `NULL` if it is sent as is.
+ * @param mime_path The path the MIME type is looked up for, which is `file_path` without the
+ * suffix of a precompressed variant.
+ * Only files requested by a canonical URL (see `_is_canonical_url()`) are added to the caches, as
+ * the site watch invalidates entries by the canonical paths of the files.
+ *
+ * @param file_fd Pointer to store the file descriptor, as in `_prepare_file_response()`.
+ * @param file_size Pointer to store the size of the file.
+ * @param file_stat Pointer to store the metadata of the file. For a cached file, only the size,
+ * modification time and inode number it was cached with are set.
+ * @param entry Pointer to store the cache entry of the file, or `NULL` if the file is not cached.
+ * @param mimetype Pointer to store the MIME type, only set if the file is not cached.
+ * @return On success, returns `1`. If the file is not a regular file or cannot be opened, returns
+ * `0` and nothing needs to be freed.
+ */
+int _open_site_file(const server_config *, const char *, const char *, const char *, int *, off_t *,
+                    struct stat *, file_entry **, const char **);
+
+/**
+ * @private
+ * @brief Closes a file opened with `_open_site_file()`, or releases its cache entry.
+ *
+ * @param file_fd The file descriptor of the file.
+ * @param entry The cache entry of the file, or `NULL` if the file is not cached.
+ * @return void
+ */
+void _close_site_file(const int, file_entry *);
+
+/**
+ * @private
+ * @brief Returns the precompressed variants of the file that exist next to it, a bitmask of
+ * indices into `file_variants`.
+ *
+ * The sidecars are only `stat()`-ed if the cache entry of the file doesn't know its variants yet,
+ * and the result is stored in the entry.
+ *
+ * @param file_path The resolved path of the file.
+ * @param entry The cache entry of the file, or `NULL` if the file is not cached.
+ * @return The bitmask of variants, `0` if there are none.
+ */
+unsigned int _get_file_variants(const char *, file_entry *);
+
+/**
+ * @private
+ * @brief Selects the variant with the highest quality in the `Accept-Encoding` header of the
+ * request. On equal quality, the earlier variant in `file_variants` is preferred.
+ *
+ * @param req The request struct.
+ * @param variants The bitmask of variants that exist, from `_get_file_variants()`.
+ * @return The index of the variant in `file_variants`, or `-1` if the client accepts none of them.
+ */
+int _select_file_variant(const request *, const unsigned int);
+
+/**
+ * @private
+ * @brief Checks if the file is compressed with gzip on the fly for clients that accept it.
+ *
+ * Only text files (see `is_compressible_mimetype()`) of at least `gzip_min_size` bytes are, and
+ * only while the file cache is enabled and the file is small enough for it, as the compressed file
+ * is served from there.
+ *
+ * @param config The config snapshot.
+ * @param mimetype The MIME type of the file.
+ * @param file_size The size of the file.
+ * @return `true` if the file is compressed on the fly, `false` otherwise.
+ */
+bool _is_gzip_file(const server_config *, const char *, const off_t);
+
+/**
+ * @private
+ * @brief Returns the entry of the file compressed with gzip from the file cache. On a miss, the
+ * file is compressed and added to the cache, so every file is only compressed once, until it
+ * changes.
+ *
+ * @param config The config snapshot.
+ * @param file_path The resolved path of the file.
+ * @param file_fd The file descriptor of the file, from `_open_site_file()`.
+ * @param entry The cache entry of the file, or `NULL` if the file is not cached. Its contents are
+ * compressed instead of reading the file, if it holds them.
+ * @param file_stat The metadata of the file, from `_open_site_file()`.
+ * @param mimetype The MIME type of the file.
+ * @return The entry, to be released with `release_file_cache_entry()`, or `NULL` on failure.
+ */
+file_entry *_get_gzip_file_entry(const server_config *, const char *, const int, const file_entry *,
+                                 const struct stat *, const char *);
+
+/**
+ * @private
+ * @brief Evaluates the conditional headers of the request against the validators of the file.
+ *
+ * `If-None-Match` takes precedence: if it is sent, the file is not modified only if its entity tag
+ * is listed. Otherwise, the file is not modified if it wasn't modified after the date in
+ * `If-Modified-Since`.
+ *
+ * @param req The request struct.
+ * @param etag The entity tag of the file sent.
+ * @param mtime The modification time of the file, in seconds since the epoch.
+ * @return `true` if a `304 Not Modified` response is sent instead of the file, `false` otherwise.
+ */
+bool _is_not_modified(const request *, const char *, const time_t);
+
+/**
+ * @private
+ * @brief Evaluates the `If-Range` header of the request against the validators of the file.
+ *
+ * An entity tag must match the entity tag of the file using the strong comparison, so a weak tag
+ * never matches. A date must be the exact modification time of the file.
+ *
+ * @param req The request struct.
+ * @param etag The entity tag of the file sent.
+ * @param mtime The modification time of the file, in seconds since the epoch.
+ * @return `true` if the request has no `If-Range` header or it matches the file, so the ranges are
+ * served. `false` if the whole file is sent instead.
+ */
+bool _is_range_current(const request *, const char *, const time_t);
+
+/**
+ * @private
+ * @brief Checks if the URL has no empty, `.` or `..` segments, so the path it resolves to is the
+ * only path of the file.
+ *
+ * @param url The URL path (e.g. `/index.html`).
+ * @return `true` if the URL is canonical, `false` otherwise.
+ */
+bool _is_canonical_url(const char *);
 #endif
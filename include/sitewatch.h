@@ -0,0 +1,223 @@
+/**
+ * @file include/sitewatch.h
+ * @brief Function Prototypes for invalidating cached files as they change on disk.
+ *
+ * This file contains the function prototypes to watch the site root (recursively) with inotify and
+ * remove the cache entries of files as soon as they are modified, moved or deleted, so a deploy
+ * takes effect without a restart and the caches are served without revalidating every entry.
+ *
+ * If the site root can't be watched completely (e.g. the limit of inotify watches is reached), the
+ * caches fall back to revalidating their entries with `stat()` every few seconds.
+ *
+ * Implemented in slib/sitewatch.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _SITEWATCH_H
+#define _SITEWATCH_H 1
+
+/**
+ * @brief Defines the max number of caches invalidated by a watch.
+ */
+#ifndef SITE_WATCH_MAX_CACHES
+#define SITE_WATCH_MAX_CACHES 4
+#endif
+
+/**
+ * @brief Defines the size of the buffer events are read into.
+ */
+#ifndef SITE_WATCH_BUF_SIZE
+#define SITE_WATCH_BUF_SIZE 16384
+#endif
+
+/**
+ * @brief Defines the max length of the path of a watched file or directory.
+ */
+#ifndef SITE_WATCH_PATH_SIZE
+#define SITE_WATCH_PATH_SIZE 1024
+#endif
+
+/**
+ * @brief Defines the inotify events a directory is watched for.
+ */
+#define SITE_WATCH_EVENTS                                                                          \
+    (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |             \
+     IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+#include "filecache.h"
+
+/**
+ * @struct watched_dir
+ * @brief Defines a directory watched by a site watch.
+ *
+ * @property char* watched_dir::path
+ * @brief The path of the directory, as the server resolves it, or `NULL` if the slot is unused.
+ *
+ * @property ino_t watched_dir::ino
+ * @brief The inode number of the directory, to tell if it is still at `path` after it moved.
+ */
+typedef struct watched_dir {
+    char *path;
+    ino_t ino;
+} watched_dir;
+
+/**
+ * @struct site_watch
+ * @brief Defines a recursive inotify watch on the site root, invalidating the caches.
+ *
+ * The paths of the watched directories are joined with the names in the events exactly like the
+ * server joins the site root with request URLs, so the invalidated paths match the cache keys.
+ * Only the watch thread touches the directories after the watch is created.
+ *
+ * @see create_site_watch
+ * @see destroy_site_watch
+ *
+ * @property int site_watch::inotify_fd
+ * @brief The inotify instance.
+ *
+ * @property int site_watch::stop_fd
+ * @brief An eventfd written to stop the watch thread.
+ *
+ * @property pthread_t site_watch::thread
+ * @brief The thread reading the events.
+ *
+ * @property file_cache* site_watch::caches
+ * @brief The caches invalidated.
+ *
+ * @property int site_watch::no_caches
+ * @brief The number of caches in `caches`.
+ *
+ * @property char* site_watch::root
+ * @brief The site root.
+ *
+ * @property watched_dir* site_watch::dirs
+ * @brief The watched directories, indexed by their watch descriptor.
+ *
+ * @property int site_watch::dirs_size
+ * @brief The number of slots in `dirs`.
+ *
+ * @property bool site_watch::complete
+ * @brief Set while every directory below the root is watched, and so the caches are watched.
+ */
+typedef struct site_watch {
+    int inotify_fd;
+    int stop_fd;
+    pthread_t thread;
+    file_cache *caches[SITE_WATCH_MAX_CACHES];
+    int no_caches;
+    char *root;
+    watched_dir *dirs;
+    int dirs_size;
+    bool complete;
+} site_watch;
+
+/**
+ * @brief Watches the directory `root` and all directories below it, and starts a thread that
+ * invalidates the caches whenever a file in them changes.
+ *
+ * Once all directories are watched, the caches are marked as watched (see
+ * `set_file_cache_watched()`) and emptied, as entries cached before may be stale already. If not
+ * all directories can be watched, the caches keep revalidating their entries.
+ *
+ * @param root The site root, as used to resolve request URLs.
+ * @param caches The caches to invalidate. `NULL` caches are skipped.
+ * @param no_caches The number of caches in `caches`, at most `SITE_WATCH_MAX_CACHES`.
+ * @return On success, pointer to the watch is returned. On failure (e.g. inotify is not available),
+ * `NULL` is returned and the caches are left unwatched.
+ */
+site_watch *create_site_watch(const char *, file_cache **, const int);
+
+/**
+ * @brief Stops the watch thread, marks the caches as unwatched and frees the watch.
+ *
+ * @param watch The site watch, `NULL` is ignored.
+ * @return void
+ */
+void destroy_site_watch(site_watch *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Watches the directory at `path` and, recursively, the directories in it.
+ *
+ * A directory that is watched already keeps its watch descriptor, and only its path is updated,
+ * so a directory moved within the root is watched under its new path.
+ *
+ * @param watch The site watch.
+ * @param path The path of the directory.
+ * @return On success, returns `1`. If a directory couldn't be watched, returns `0`.
+ */
+int _watch_site_dir(site_watch *, const char *);
+
+/**
+ * @private
+ * @brief Reads and handles events until the watch is stopped.
+ *
+ * @param watch_ptr The site watch.
+ * @return `NULL`
+ */
+void *_run_site_watch(void *);
+
+/**
+ * @private
+ * @brief Invalidates the caches for a single event, and watches directories created in or moved
+ * into a watched directory.
+ *
+ * @param watch The site watch.
+ * @param event The event.
+ * @return void
+ */
+void _handle_site_event(site_watch *, const struct inotify_event *);
+
+/**
+ * @private
+ * @brief Removes the entries of the file at `path` from all caches, and the entries of the file
+ * it is a variant of (`path` without its last extension, e.g. `a.html` for `a.html.gz`), which
+ * are cached with the variants the file has.
+ *
+ * @param watch The site watch.
+ * @param path The path of the file.
+ * @return void
+ */
+void _invalidate_site_file(site_watch *, const char *);
+
+/**
+ * @private
+ * @brief Removes the entries of all files below the directory at `path` from all caches.
+ *
+ * @param watch The site watch.
+ * @param path The path of the directory.
+ * @return void
+ */
+void _invalidate_site_dir(site_watch *, const char *);
+
+/**
+ * @private
+ * @brief Marks the caches as watched or not, after (not) all directories could be watched.
+ *
+ * @param watch The site watch.
+ * @param complete Whether all directories are watched.
+ * @return void
+ */
+void _set_site_watch_complete(site_watch *, const bool);
+
+/**
+ * @private
+ * @brief Closes the descriptors of the watch and frees it. The watch thread must not be running.
+ *
+ * @param watch The site watch.
+ * @return void
+ */
+void _free_site_watch(site_watch *);
+#endif
@@ -0,0 +1,121 @@
+/**
+ * @file include/threadpool.h
+ * @brief Function Prototypes for a fixed-size pool of worker threads.
+ *
+ * This file contains the function prototypes to create a pool of worker threads fed by a bounded
+ * work queue, submit connections to the pool and destroy the pool.
+ *
+ * Implemented in slib/threadpool.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H 1
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "workqueue.h"
+
+/**
+ * @brief Defines the type of the function called by the worker threads for each connection.
+ *
+ * The function takes the file descriptor of the connection and is responsible for closing it.
+ */
+typedef int (*conn_handler)(const int);
+
+/**
+ * @struct thread_pool
+ * @brief Defines a pool of worker threads.
+ *
+ * Connections are handed over to the workers through a lock-free `work_queue`. Two semaphores count
+ * the queued connections and the free cells of the queue, so idle workers sleep instead of
+ * spinning and `submit_to_thread_pool()` blocks while the queue is full.
+ *
+ * @see create_thread_pool
+ * @see submit_to_thread_pool
+ * @see destroy_thread_pool
+ *
+ * @property work_queue* thread_pool::queue
+ * @brief The work queue of connections waiting for a worker.
+ *
+ * @property sem_t thread_pool::queued
+ * @brief Counts the connections in the work queue.
+ *
+ * @property sem_t thread_pool::free
+ * @brief Counts the free cells in the work queue.
+ *
+ * @property pthread_t* thread_pool::threads
+ * @brief The worker threads.
+ *
+ * @property int thread_pool::no_threads
+ * @brief The number of worker threads.
+ *
+ * @property conn_handler thread_pool::handler
+ * @brief The function called by the workers for each connection.
+ *
+ * @property atomic_bool thread_pool::stopping
+ * @brief Set when the pool is being destroyed.
+ */
+typedef struct thread_pool {
+    work_queue *queue;
+    sem_t queued;
+    sem_t free;
+    pthread_t *threads;
+    int no_threads;
+    conn_handler handler;
+    atomic_bool stopping;
+} thread_pool;
+
+/**
+ * @brief Creates a pool of `no_threads` worker threads with a work queue of `queue_depth`
+ * connections.
+ *
+ * @param no_threads The number of worker threads. Must be greater than 0.
+ * @param queue_depth The minimum number of connections that can wait for a worker. Must be greater
+ * than 0.
+ * @param handler The function called by the workers for each connection.
+ * @return On success, a pointer to the thread pool is returned. On failure, `NULL` is returned.
+ */
+thread_pool *create_thread_pool(const int, const int, conn_handler);
+
+/**
+ * @brief Submits a connection to be handled by one of the worker threads.
+ *
+ * If the work queue is full, this function blocks until a worker takes a connection from the queue.
+ * Meanwhile, new connections wait in the listening socket's backlog.
+ *
+ * @param pool The thread pool.
+ * @param conn_fd The file descriptor of the connection.
+ * @return On success, returns `1`. On failure, returns `0` and the connection is not closed.
+ */
+int submit_to_thread_pool(thread_pool *, const int);
+
+/**
+ * @brief Stops the worker threads, closes the connections left in the queue and frees the pool.
+ *
+ * Workers finish the connection they are handling before they exit.
+ *
+ * @param pool The thread pool.
+ * @return void
+ */
+void destroy_thread_pool(thread_pool *);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief The main function of the worker threads.
+ *
+ * @param pool Pointer to the thread pool.
+ * @return Always returns `NULL`.
+ */
+void *_thread_pool_worker(void *);
+#endif
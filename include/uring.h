@@ -0,0 +1,470 @@
+/**
+ * @file include/uring.h
+ * @brief Function Prototypes for the io_uring based event loop.
+ *
+ * This file contains the function prototypes to run an `io_uring` event loop, which accepts
+ * connections with a multishot accept, reads requests into a ring of provided buffers and sends
+ * files with linked send and splice operations. The ring is set up using the raw `io_uring`
+ * system calls, so no extra library is needed. It also contains internal functions to manage the
+ * rings and to advance the state of a connection.
+ *
+ * Implemented in slib/uring.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _URING_H
+#define _URING_H 1
+
+/**
+ * @brief Defines the number of entries in the submission queue.
+ */
+#ifndef URING_ENTRIES
+#define URING_ENTRIES 4096
+#endif
+
+/**
+ * @brief Defines the number of provided buffers used to receive requests. Must be a power of 2.
+ *
+ * Each buffer is `REQ_BUF_SIZE` bytes long.
+ */
+#ifndef URING_BUF_COUNT
+#define URING_BUF_COUNT 512
+#endif
+
+/**
+ * @brief Defines the ID of the provided buffer group.
+ */
+#ifndef URING_BUF_GROUP
+#define URING_BUF_GROUP 0
+#endif
+
+/**
+ * @brief Defines the max number of bytes moved by a single pair of splice operations.
+ */
+#ifndef URING_SPLICE_CHUNK
+#define URING_SPLICE_CHUNK 65536
+#endif
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "accesslog.h"
+#include "eventloop.h"
+#include "request.h"
+
+/**
+ * @enum uring_op
+ * @brief Defines the operations submitted to the ring, stored in the low bits of `user_data`.
+ */
+typedef enum uring_op {
+    URING_ACCEPT,
+    URING_RECV,
+    URING_SEND_HEAD,
+    URING_SPLICE_IN,
+    URING_SPLICE_OUT,
+    URING_TIMEOUT,
+    URING_SEND_BODY
+} uring_op;
+
+/**
+ * @brief Defines the mask of `user_data` bits used for `uring_op`. The remaining bits store the
+ * pointer to the connection, which is at least 8 byte aligned.
+ */
+#define URING_OP_MASK 0x7ULL
+
+/**
+ * @struct uring
+ * @brief Defines an io_uring instance with its mapped rings and provided buffers.
+ *
+ * @property int uring::ring_fd
+ * @brief The file descriptor returned by `io_uring_setup()`.
+ *
+ * @property unsigned uring::sq_entries
+ * @brief The number of entries in the submission queue.
+ *
+ * @property unsigned uring::sq_tail_local
+ * @brief The tail of the submission queue, including entries not yet published to the kernel.
+ *
+ * @property unsigned uring::to_submit
+ * @brief The number of entries prepared since the last `io_uring_enter()`.
+ *
+ * @property bool uring::multishot_accept
+ * @brief Set if multishot accept is supported, cleared after the kernel rejects it.
+ *
+ * @property unsigned short uring::buf_tail
+ * @brief The tail of the provided buffer ring.
+ *
+ * @property struct __kernel_timespec uring::idle_timeout
+ * @brief The keep-alive timeout, linked to every receive. Zero if keep-alive is disabled.
+ */
+typedef struct uring {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned sq_tail_local;
+    unsigned to_submit;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;
+    unsigned short buf_tail;
+    bool multishot_accept;
+    struct __kernel_timespec idle_timeout;
+} uring;
+
+/**
+ * @struct uring_conn
+ * @brief Defines a connection handled by the io_uring event loop.
+ *
+ * A connection is only advanced to its next state when all of its submitted operations completed,
+ * so it can be freed safely at that point.
+ *
+ * @property int uring_conn::conn_fd
+ * @brief The file descriptor of the accepted connection.
+ *
+ * @property conn_state uring_conn::state
+ * @brief The current state of the connection.
+ *
+ * @property int uring_conn::no_inflight
+ * @brief The number of submitted operations that have not completed yet.
+ *
+ * @property bool uring_conn::failed
+ * @brief Set when an operation failed, the connection is closed once no operation is inflight.
+ *
+ * @property char* uring_conn::buf
+ * @brief Buffer of size `REQ_BUF_SIZE` for received bytes not yet served, i.e. a request head split
+ * over several reads or pipelined requests. `NULL` while the connection holds no arena.
+ *
+ * @property size_t uring_conn::buf_len
+ * @brief The number of valid bytes in `buf`.
+ *
+ * @property char* uring_conn::out_buf
+ * @brief The serialized response head of size `RES_HEAD_MAX_SIZE`, or `NULL`.
+ *
+ * @property arena* uring_conn::mem
+ * @brief The arena `buf`, `out_buf`, the request and its response are allocated from, or `NULL`.
+ * It is only held while a request is being parsed or handled, or bytes are buffered.
+ *
+ * @property arena_mark uring_conn::mark
+ * @brief The position of `mem` right after `buf`, rewound to when a response is done.
+ *
+ * @property request* uring_conn::req
+ * @brief The request being parsed or handled, or `NULL`. It is closed as soon as the response head
+ * is formatted.
+ *
+ * @property int uring_conn::held_bid
+ * @brief The provided buffer `req` was parsed in, or `-1` if it was parsed in `buf`.
+ *
+ * @property size_t uring_conn::out_len
+ * @brief The number of valid bytes in `out_buf`.
+ *
+ * @property file_entry* uring_conn::entry
+ * @brief The cache entry the response body is sent from instead of the file, or `NULL`.
+ *
+ * @property body_part* uring_conn::parts
+ * @brief The parts of the response body, allocated from the arena, or `NULL`.
+ *
+ * @property int uring_conn::no_parts
+ * @brief The number of parts in `parts`.
+ *
+ * @property int uring_conn::part_no
+ * @brief The index in `parts` of the part being sent. The prefix of every part after the first is
+ * sent as if it was a response head.
+ *
+ * @property off_t uring_conn::file_end
+ * @brief The offset after the last byte of the file to be sent for the current part.
+ *
+ * @property int uring_conn::pipe_fds
+ * @brief The pipe used to splice the file into the socket.
+ *
+ * @property size_t uring_conn::pipe_len
+ * @brief The number of bytes spliced into the pipe but not yet out of it.
+ *
+ * @property int uring_conn::no_requests
+ * @brief The number of requests received on the connection.
+ *
+ * @property bool uring_conn::keep_alive
+ * @brief Whether the connection is kept open after the current response.
+ *
+ * @property uint64_t uring_conn::stage_start
+ * @brief The time the head or the body of the response started being sent, from `metrics_now()`.
+ *
+ * @property access_log_record* uring_conn::log_record
+ * @brief What is logged of the current request, captured before the request is released, or
+ * `NULL` if requests are not logged.
+ *
+ * @property uint64_t uring_conn::log_start
+ * @brief The time the current response started being prepared, from `_access_log_now()`.
+ *
+ * @property int uring_conn::status_code
+ * @brief The status code of the current response, logged once it is sent.
+ *
+ * @property size_t uring_conn::head_size
+ * @brief The size of the head of the current response.
+ *
+ * @property size_t uring_conn::res_sent
+ * @brief The bytes of the current response (head and body) sent so far.
+ */
+typedef struct uring_conn {
+    int conn_fd;
+    conn_state state;
+    int no_inflight;
+    bool failed;
+    char *buf;
+    size_t buf_len;
+    char *out_buf;
+    size_t out_len;
+    arena *mem;
+    arena_mark mark;
+    request *req;
+    int held_bid;
+    int file_fd;
+    file_entry *entry;
+    body_part *parts;
+    int no_parts;
+    int part_no;
+    off_t file_off;
+    off_t file_end;
+    int pipe_fds[2];
+    size_t pipe_len;
+    int no_requests;
+    bool keep_alive;
+    uint64_t stage_start;
+    access_log_record *log_record;
+    uint64_t log_start;
+    int status_code;
+    size_t head_size;
+    size_t res_sent;
+} uring_conn;
+
+/**
+ * @brief Runs the io_uring event loop for the listening socket `listen_fd`.
+ *
+ * Sets up the rings and provided buffers and then never returns unless an error occurs. If
+ * io_uring, or a feature it needs, is not available (e.g. older kernels or io_uring disabled by
+ * the system), returns immediately so the caller can fall back to another server mode.
+ *
+ * @param listen_fd The file descriptor of the listening socket.
+ * @return Returns `0` if io_uring is not available. Otherwise, doesn't return unless an error
+ * occurs, in which case, returns `-1`.
+ */
+int run_uring_loop(const int);
+
+// ==============================
+// Internal Helper Functions
+// ==============================
+
+/**
+ * @private
+ * @brief Sets up the io_uring instance and maps its rings.
+ *
+ * @param ring The uring struct to be set up.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _setup_uring(uring *);
+
+/**
+ * @private
+ * @brief Registers a ring of `URING_BUF_COUNT` provided buffers with the io_uring instance.
+ *
+ * @param ring The uring struct.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _setup_uring_buffers(uring *);
+
+/**
+ * @private
+ * @brief Unmaps the rings, frees the buffers and closes the io_uring instance.
+ *
+ * @param ring The uring struct.
+ * @return void
+ */
+void _destroy_uring(uring *);
+
+/**
+ * @private
+ * @brief Returns the next free submission queue entry, cleared and ready to be filled.
+ *
+ * If the submission queue is full, pending entries are submitted first.
+ *
+ * @param ring The uring struct.
+ * @return Pointer to the entry, or `NULL` if the queue is still full.
+ */
+struct io_uring_sqe *_get_uring_sqe(uring *);
+
+/**
+ * @private
+ * @brief Publishes the prepared entries to the kernel and waits for at least `min_complete`
+ * completions, using a single `io_uring_enter()` call.
+ *
+ * @param ring The uring struct.
+ * @param min_complete The number of completions to wait for.
+ * @return Returns the number of entries submitted, or `-1` on failure with `errno` set.
+ */
+int _submit_uring(uring *, const unsigned);
+
+/**
+ * @private
+ * @brief Gives the provided buffer `bid` back to the kernel.
+ *
+ * @param ring The uring struct.
+ * @param bid The ID of the buffer.
+ * @return void
+ */
+void _recycle_uring_buffer(uring *, const unsigned short);
+
+/**
+ * @private
+ * @brief Submits an accept on the listening socket, multishot if it is supported.
+ *
+ * @param ring The uring struct.
+ * @param listen_fd The file descriptor of the listening socket.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _prep_uring_accept(uring *, const int);
+
+/**
+ * @private
+ * @brief Submits a receive into one of the provided buffers for the connection.
+ *
+ * If keep-alive is enabled, the receive is linked to a timeout, so an idle connection is closed
+ * once the receive is cancelled.
+ *
+ * @param ring The uring struct.
+ * @param conn The connection.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _prep_uring_recv(uring *, uring_conn *);
+
+/**
+ * @private
+ * @brief Submits the next part of the response as one chain of linked operations.
+ *
+ * With `with_head` set, the chain starts with sending the response head, flagged with `MSG_MORE` so
+ * it leaves in the same segment as the start of the body. It is followed by a splice of the next
+ * chunk of the file into the pipe and a splice from the pipe into the socket. If bytes are still
+ * left in the pipe from a short splice, only those are spliced into the socket. A cached body is
+ * sent straight from its cache entry instead.
+ *
+ * @param ring The uring struct.
+ * @param conn The connection.
+ * @param with_head Whether to send the response head first.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _prep_uring_response(uring *, uring_conn *, const bool);
+
+/**
+ * @private
+ * @brief Handles a single completion.
+ *
+ * @param ring The uring struct.
+ * @param listen_fd The file descriptor of the listening socket.
+ * @param cqe The completion queue entry.
+ * @return void
+ */
+void _handle_uring_cqe(uring *, const int, const struct io_uring_cqe *);
+
+/**
+ * @private
+ * @brief Handles a completed receive, parses the request head once it is complete.
+ *
+ * If no bytes are buffered, the request is parsed straight from the provided buffer, which is held
+ * if the head is complete. Any other received bytes are copied into the connection buffer.
+ *
+ * @param ring The uring struct.
+ * @param conn The connection.
+ * @param res The result of the receive.
+ * @param flags The flags of the completion.
+ * @return void
+ */
+void _on_uring_recv(uring *, uring_conn *, const int, const unsigned);
+
+/**
+ * @private
+ * @brief Resumes parsing the request at the start of the connection buffer.
+ *
+ * @param conn The connection in `CONN_READ_HEAD` state.
+ * @return Returns `1` if a request was parsed, `0` if the buffer doesn't hold a complete request
+ * head yet and `-1` on failure.
+ */
+int _parse_buffered_uring_request(uring_conn *);
+
+/**
+ * @private
+ * @brief Advances a connection that has no operations inflight to its next state.
+ *
+ * @param ring The uring struct.
+ * @param conn The connection.
+ * @return void
+ */
+void _advance_uring_conn(uring *, uring_conn *);
+
+/**
+ * @private
+ * @brief Frees the request of the connection and releases the bytes of its head, by giving the held
+ * provided buffer back to the kernel or by dropping the head from the connection buffer.
+ *
+ * @param ring The uring struct.
+ * @param conn The connection.
+ * @return void
+ */
+void _release_uring_request(uring *, uring_conn *);
+
+/**
+ * @private
+ * @brief Frees the request and response and closes the file of the finished response and moves the
+ * connection back to `CONN_READ_HEAD`, keeping the connection and its pipe open.
+ *
+ * @param ring The uring struct.
+ * @param conn The connection.
+ * @return void
+ */
+void _reset_uring_conn(uring *, uring_conn *);
+
+/**
+ * @private
+ * @brief Allocates memory for a uring connection struct and initializes it to default values.
+ *
+ * @param conn_fd The file descriptor of the accepted connection.
+ * @return On success, pointer to a newly allocated connection is returned. On failure, `NULL` is
+ * returned.
+ */
+uring_conn *_initialize_uring_conn(const int);
+
+/**
+ * @private
+ * @brief Closes the connection, its file and pipe and frees the connection struct.
+ *
+ * A connection that failed in the middle of a request is counted as an error of the request (or of
+ * sending the response) in the metrics, like `_close_connection()` does.
+ *
+ * @param ring The uring struct, a held provided buffer is given back to it.
+ * @param conn The connection.
+ * @return void
+ */
+void _free_uring_conn(uring *, uring_conn *);
+
+/**
+ * @private
+ * @brief Takes an arena for the connection, if it doesn't hold one, and allocates `buf` from it.
+ *
+ * @param conn The connection.
+ * @return On success, returns `1`. On failure, returns `0`.
+ */
+int _acquire_uring_arena(uring_conn *);
+#endif
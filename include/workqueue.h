@@ -0,0 +1,129 @@
+/**
+ * @file include/workqueue.h
+ * @brief Function Prototypes for a bounded, lock-free, multi-producer multi-consumer work queue.
+ *
+ * This file contains the function prototypes to create a bounded work queue of connection file
+ * descriptors, push and pop connections from any number of threads, and destroy the queue. The
+ * queue never blocks, a push to a full queue or a pop from an empty queue fails immediately. The
+ * blocking is left to the user of the queue (e.g. `thread_pool`).
+ *
+ * Implemented in slib/workqueue.c
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H 1
+
+/**
+ * @brief Defines the size of a cache line, used to keep the producer and consumer positions of the
+ * queue on separate cache lines.
+ */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * @private
+ * @struct work_queue_cell
+ * @brief Defines a cell of the work queue.
+ *
+ * @property atomic_size_t work_queue_cell::sequence
+ * @brief The sequence number of the cell, used to find out if the cell is empty or full for a given
+ * position in the queue.
+ *
+ * @property int work_queue_cell::conn_fd
+ * @brief The file descriptor of the connection stored in the cell.
+ */
+typedef struct work_queue_cell {
+    atomic_size_t sequence;
+    int conn_fd;
+} work_queue_cell;
+
+/**
+ * @struct work_queue
+ * @brief Defines a bounded multi-producer multi-consumer work queue.
+ *
+ * The queue is an array of cells with a power of 2 size, where every cell carries a sequence
+ * number. Producers and consumers claim a position with a single compare-and-swap and publish the
+ * cell by updating its sequence number, so no locks are needed.
+ *
+ * @see create_work_queue
+ * @see work_queue_push
+ * @see work_queue_pop
+ * @see destroy_work_queue
+ *
+ * @property work_queue_cell* work_queue::cells
+ * @brief The array of cells.
+ *
+ * @property size_t work_queue::mask
+ * @brief The number of cells minus 1, used to map a position to a cell.
+ *
+ * @property atomic_size_t work_queue::enqueue_pos
+ * @brief The position of the next push.
+ *
+ * @property atomic_size_t work_queue::dequeue_pos
+ * @brief The position of the next pop.
+ */
+typedef struct work_queue {
+    work_queue_cell *cells;
+    size_t mask;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+} work_queue;
+
+/**
+ * @brief Creates a work queue that can hold at least `capacity` connections.
+ *
+ * The capacity is rounded up to the next power of 2.
+ *
+ * @param capacity The minimum number of connections the queue can hold. Must be greater than 0.
+ * @return On success, a pointer to the work queue is returned. On failure, `NULL` is returned.
+ */
+work_queue *create_work_queue(const size_t);
+
+/**
+ * @brief Pushes a connection to the end of the work queue.
+ *
+ * Safe to be called from multiple threads at the same time.
+ *
+ * @param queue The work queue.
+ * @param conn_fd The file descriptor of the connection.
+ * @return On success, returns `1`. If the queue is full, returns `0`.
+ */
+int work_queue_push(work_queue *, const int);
+
+/**
+ * @brief Pops a connection from the front of the work queue.
+ *
+ * Safe to be called from multiple threads at the same time.
+ *
+ * @param queue The work queue.
+ * @param conn_fd Pointer to an int to store the file descriptor of the connection.
+ * @return On success, returns `1`. If the queue is empty, returns `0` and `conn_fd` is not modified.
+ */
+int work_queue_pop(work_queue *, int *);
+
+/**
+ * @brief Returns the number of connections the work queue can hold.
+ *
+ * @param queue The work queue.
+ * @return The capacity of the work queue.
+ */
+size_t work_queue_capacity(const work_queue *);
+
+/**
+ * @brief Destroys the work queue and releases memory allocated for it.
+ *
+ * Connections still in the queue are not closed.
+ *
+ * @param queue The work queue.
+ * @return void
+ */
+void destroy_work_queue(work_queue *);
+#endif
@@ -0,0 +1,425 @@
+/**
+ * @file slib/accesslog.c
+ * @brief Functions for logging requests without blocking them.
+ *
+ * Implements functions defined in `include/accesslog.h`. Used by the server to log every request.
+ *
+ * A thread handling requests gets a ring of its own on its first request, so writing a record is a
+ * copy and a release store of the head, with no lock and no syscall other than `getpeername()`.
+ * The log thread wakes up every `ACCESS_LOG_FLUSH_MSEC` milliseconds (or when it is woken to reopen
+ * the file or to stop), formats the records of all rings into a single buffer and writes it with
+ * as few `write()` calls as the buffer allows.
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "accesslog.h"
+#include "headers.h"
+
+access_log *create_access_log(const char *path, const access_log_format format) {
+    access_log *log = NULL;
+
+    if (path == NULL || (log = calloc(1, sizeof(access_log))) == NULL)
+        return NULL;
+
+    log->format = format;
+    log->buf_time = (time_t)-1;
+    atomic_init(&log->rings, NULL);
+    atomic_init(&log->reopen, false);
+    atomic_init(&log->stop, false);
+    atomic_init(&log->dropped, 0);
+
+    log->fd = -1;
+    log->wake_fd = -1;
+
+    if ((log->path = strdup(path)) == NULL || (log->buf = malloc(ACCESS_LOG_BUF_SIZE)) == NULL ||
+        (log->fd = _open_access_log(path)) < 0 ||
+        (log->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+        pthread_mutex_init(&log->rings_lock, NULL) != 0) {
+        _free_access_log(log);
+        return NULL;
+    }
+
+    if (pthread_key_create(&log->ring_key, _put_access_log_ring) != 0) {
+        pthread_mutex_destroy(&log->rings_lock);
+        _free_access_log(log);
+        return NULL;
+    }
+
+    if (pthread_create(&log->thread, NULL, _run_access_log, log) != 0) {
+        pthread_key_delete(log->ring_key);
+        pthread_mutex_destroy(&log->rings_lock);
+        _free_access_log(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+int log_access(access_log *log, const request *req, const int status, const off_t bytes,
+               const long latency_usec) {
+    access_log_ring *ring = NULL;
+    access_log_record *record = NULL;
+    size_t head = 0;
+
+    if (log == NULL || req == NULL ||
+        (record = _claim_access_log_record(log, &ring, &head)) == NULL)
+        return 0;
+
+    capture_access_log_record(record, req);
+    record->bytes = bytes;
+    record->latency_usec = latency_usec;
+    record->status = status;
+    _commit_access_log_record(log, ring, head);
+    return 1;
+}
+
+int log_access_record(access_log *log, const access_log_record *captured, const int status,
+                      const off_t bytes, const long latency_usec) {
+    access_log_ring *ring = NULL;
+    access_log_record *record = NULL;
+    size_t head = 0;
+
+    if (log == NULL || captured == NULL ||
+        (record = _claim_access_log_record(log, &ring, &head)) == NULL)
+        return 0;
+
+    *record = *captured;
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->bytes = bytes;
+    record->latency_usec = latency_usec;
+    record->status = status;
+    _commit_access_log_record(log, ring, head);
+    return 1;
+}
+
+void capture_access_log_record(access_log_record *record, const request *req) {
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->bytes = 0;
+    record->latency_usec = 0;
+    record->status = 0;
+    record->has_client = req->conn_fd != -1 &&
+                         getpeername(req->conn_fd, (struct sockaddr *)&client_addr,
+                                     &client_addr_len) == 0 &&
+                         client_addr.sin_family == AF_INET;
+    if (record->has_client)
+        record->client_addr = client_addr.sin_addr;
+    _copy_access_log_field(record->method, sizeof(record->method), req->http_method);
+    _copy_access_log_field(record->http_ver, sizeof(record->http_ver), req->http_ver);
+    _copy_access_log_field(record->url, sizeof(record->url), req->url);
+    _copy_access_log_field(record->referer, sizeof(record->referer),
+                           get_known_request_header(req, HDR_REFERER));
+    _copy_access_log_field(record->user_agent, sizeof(record->user_agent),
+                           get_known_request_header(req, HDR_USER_AGENT));
+}
+
+void reopen_access_log(access_log *log) {
+    if (log == NULL)
+        return;
+
+    atomic_store(&log->reopen, true);
+    _wake_access_log(log);
+}
+
+void destroy_access_log(access_log *log) {
+    if (log == NULL)
+        return;
+
+    // The log thread writes the remaining records before it exits, it only waits less if woken.
+    atomic_store(&log->stop, true);
+    _wake_access_log(log);
+    pthread_join(log->thread, NULL);
+
+    pthread_key_delete(log->ring_key);
+    pthread_mutex_destroy(&log->rings_lock);
+    _free_access_log(log);
+}
+
+access_log_format parse_access_log_format(const char *format_str) {
+    if (format_str != NULL && strcmp(format_str, ACCESS_LOG_FORMAT_JSON) == 0)
+        return LOG_FORMAT_JSON;
+    return LOG_FORMAT_COMBINED;
+}
+
+access_log_record *_claim_access_log_record(access_log *log, access_log_ring **ring,
+                                            size_t *head) {
+    if ((*ring = _get_access_log_ring(log)) == NULL) {
+        atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    // Only this thread writes the head, and a slot is only reused once the log thread is past it.
+    *head = atomic_load_explicit(&(*ring)->head, memory_order_relaxed);
+    if (*head - atomic_load_explicit(&(*ring)->tail, memory_order_acquire) >=
+        ACCESS_LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    return &(*ring)->records[*head & (ACCESS_LOG_RING_SIZE - 1)];
+}
+
+void _commit_access_log_record(access_log *log, access_log_ring *ring, const size_t head) {
+    size_t no_pending = head + 1 - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    // A burst wakes the log thread early, once per ring it half fills. The eventfd never blocks.
+    if (no_pending == ACCESS_LOG_RING_SIZE / 2)
+        _wake_access_log(log);
+}
+
+access_log_ring *_get_access_log_ring(access_log *log) {
+    access_log_ring *ring = pthread_getspecific(log->ring_key), **free_ring = NULL;
+
+    if (ring != NULL)
+        return ring;
+
+    // Short-lived threads (e.g. a thread per connection) take over a ring faster than the log
+    // thread drains it, so only rings with room for a burst are taken over.
+    pthread_mutex_lock(&log->rings_lock);
+    for (free_ring = &log->free_rings; *free_ring != NULL; free_ring = &(*free_ring)->next_free)
+        if (atomic_load(&(*free_ring)->head) - atomic_load(&(*free_ring)->tail) <=
+            ACCESS_LOG_RING_SIZE / 2)
+            break;
+
+    if ((ring = *free_ring) != NULL) {
+        *free_ring = ring->next_free;
+    } else if ((ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(access_log_ring))) != NULL) {
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        ring->log = log;
+        ring->next_free = NULL;
+        // The log thread walks the rings without the lock, so the ring is set up before it is seen.
+        ring->next = atomic_load(&log->rings);
+        atomic_store(&log->rings, ring);
+    }
+    pthread_mutex_unlock(&log->rings_lock);
+
+    if (ring != NULL)
+        pthread_setspecific(log->ring_key, ring);
+    return ring;
+}
+
+void _put_access_log_ring(void *ring_ptr) {
+    access_log_ring *ring = ring_ptr;
+
+    // The records left in the ring are still written, the next thread appends after them.
+    pthread_mutex_lock(&ring->log->rings_lock);
+    ring->next_free = ring->log->free_rings;
+    ring->log->free_rings = ring;
+    pthread_mutex_unlock(&ring->log->rings_lock);
+}
+
+void _copy_access_log_field(char *field, const size_t size, const char *value) {
+    size_t len = (value != NULL) ? strnlen(value, size - 1) : 0;
+
+    if (len > 0)
+        memcpy(field, value, len);
+    field[len] = '\0';
+}
+
+int _wake_access_log(access_log *log) {
+    uint64_t wake = 1;
+
+    return write(log->wake_fd, &wake, sizeof(wake)) == sizeof(wake);
+}
+
+void *_run_access_log(void *log_ptr) {
+    access_log *log = log_ptr;
+    struct pollfd wake_poll = {.fd = log->wake_fd, .events = POLLIN};
+    unsigned long dropped = 0;
+    uint64_t wake = 0;
+    size_t buf_len = 0;
+    bool stop = false;
+    int fd = -1;
+
+    while (!stop) {
+        // Records logged before the stop was seen are still drained below.
+        stop = atomic_load(&log->stop);
+
+        _drain_access_log(log, &buf_len);
+        if (buf_len > 0)
+            _write_access_log(log, buf_len);
+        buf_len = 0;
+
+        if ((dropped = atomic_exchange(&log->dropped, 0)) != 0)
+            fprintf(stderr, "Access log dropped %lu records, its rings were full\n", dropped);
+
+        if (atomic_exchange(&log->reopen, false)) {
+            if ((fd = _open_access_log(log->path)) < 0) {
+                fprintf(stderr, "Unable to reopen access log %s: %s\n", log->path, strerror(errno));
+            } else {
+                close(log->fd);
+                log->fd = fd;
+            }
+        }
+
+        if (stop || poll(&wake_poll, 1, ACCESS_LOG_FLUSH_MSEC) <= 0)
+            continue;
+        // Reading resets the eventfd, so the next poll() waits again.
+        if (read(log->wake_fd, &wake, sizeof(wake)) < 0)
+            wake = 0;
+    }
+
+    return NULL;
+}
+
+size_t _drain_access_log(access_log *log, size_t *buf_len) {
+    access_log_ring *ring = NULL;
+    size_t no_records = 0, head = 0, tail = 0;
+
+    for (ring = atomic_load(&log->rings); ring != NULL; ring = ring->next) {
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++, no_records++) {
+            if (*buf_len + ACCESS_LOG_LINE_MAX_SIZE > ACCESS_LOG_BUF_SIZE) {
+                _write_access_log(log, *buf_len);
+                *buf_len = 0;
+            }
+            *buf_len += _format_access_log_record(
+                log, &ring->records[tail & (ACCESS_LOG_RING_SIZE - 1)], log->buf + *buf_len);
+        }
+
+        // The slots are only handed back once their records are formatted.
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    return no_records;
+}
+
+size_t _format_access_log_record(access_log *log, const access_log_record *record, char *buf) {
+    char client[INET_ADDRSTRLEN] = "-", bytes[24] = "-";
+    struct tm time_tm;
+    size_t len = 0;
+    bool json = (log->format == LOG_FORMAT_JSON);
+
+    if (record->has_client && inet_ntop(AF_INET, &record->client_addr, client, sizeof(client)) ==
+                                  NULL)
+        strcpy(client, "-");
+
+    // Records come in roughly in order, so the date is only formatted again on a new second.
+    if (record->time.tv_sec != log->buf_time) {
+        log->buf_time = record->time.tv_sec;
+        if (json)
+            strftime(log->buf_date, sizeof(log->buf_date), "%Y-%m-%dT%H:%M:%S",
+                     gmtime_r(&log->buf_time, &time_tm));
+        else
+            strftime(log->buf_date, sizeof(log->buf_date), "%d/%b/%Y:%H:%M:%S %z",
+                     localtime_r(&log->buf_time, &time_tm));
+    }
+
+    if (json) {
+        len += sprintf(buf + len, "{\"time\":\"%s.%03ldZ\",\"client\":\"%s\",\"method\":\"",
+                       log->buf_date, record->time.tv_nsec / 1000000, client);
+        len += _escape_access_log_field(buf + len, record->method, true);
+        len += sprintf(buf + len, "\",\"url\":\"");
+        len += _escape_access_log_field(buf + len, record->url, true);
+        len += sprintf(buf + len, "\",\"protocol\":\"");
+        len += _escape_access_log_field(buf + len, record->http_ver, true);
+        len += sprintf(buf + len, "\",\"status\":%d,\"bytes\":%lld,\"latency_us\":%ld",
+                       record->status, (long long)record->bytes, record->latency_usec);
+        len += sprintf(buf + len, ",\"referer\":\"");
+        len += _escape_access_log_field(buf + len, record->referer, true);
+        len += sprintf(buf + len, "\",\"user_agent\":\"");
+        len += _escape_access_log_field(buf + len, record->user_agent, true);
+        len += sprintf(buf + len, "\"}\n");
+        return len;
+    }
+
+    // Like Apache and nginx, missing values and empty bodies are written as "-".
+    if (record->bytes > 0)
+        snprintf(bytes, sizeof(bytes), "%lld", (long long)record->bytes);
+    len += sprintf(buf + len, "%s - - [%s] \"", client, log->buf_date);
+    len += _escape_access_log_field(buf + len, record->method, false);
+    buf[len++] = ' ';
+    len += _escape_access_log_field(buf + len, record->url, false);
+    buf[len++] = ' ';
+    len += _escape_access_log_field(buf + len, record->http_ver, false);
+    len += sprintf(buf + len, "\" %d %s \"", record->status, bytes);
+    len += _escape_access_log_field(buf + len, (record->referer[0] != '\0') ? record->referer : "-",
+                                    false);
+    len += sprintf(buf + len, "\" \"");
+    len += _escape_access_log_field(
+        buf + len, (record->user_agent[0] != '\0') ? record->user_agent : "-", false);
+    len += sprintf(buf + len, "\"\n");
+    return len;
+}
+
+size_t _escape_access_log_field(char *buf, const char *value, const bool json) {
+    size_t len = 0;
+    unsigned char c = 0;
+
+    for (; *value != '\0'; value++) {
+        c = (unsigned char)*value;
+        if (c == '"' || c == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = c;
+        } else if (json && (c < 0x20 || c >= 0x7f))
+            // Bytes are escaped one by one, so a line stays valid UTF-8 whatever the client sent.
+            len += sprintf(buf + len, "\\u%04x", c);
+        else if (!json && (c < 0x20 || c >= 0x7f))
+            len += sprintf(buf + len, "\\x%02X", c);
+        else
+            buf[len++] = c;
+    }
+
+    return len;
+}
+
+int _write_access_log(access_log *log, const size_t len) {
+    ssize_t write_size = 0;
+    size_t written = 0;
+
+    while (written < len) {
+        if ((write_size = write(log->fd, log->buf + written, len - written)) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Unable to write access log %s: %s\n", log->path, strerror(errno));
+            return 0;
+        }
+        written += write_size;
+    }
+
+    return 1;
+}
+
+void _free_access_log(access_log *log) {
+    access_log_ring *ring = NULL, *next = NULL;
+
+    for (ring = atomic_load(&log->rings); ring != NULL; ring = next) {
+        next = ring->next;
+        free(ring);
+    }
+
+    if (log->wake_fd >= 0)
+        close(log->wake_fd);
+    if (log->fd >= 0)
+        close(log->fd);
+    free(log->buf);
+    free(log->path);
+    free(log);
+}
+
+int _open_access_log(const char *path) {
+    if (strcmp(path, ACCESS_LOG_STDOUT) == 0)
+        return fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    return open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+}
@@ -0,0 +1,206 @@
+/**
+ * @file slib/arena.c
+ * @brief A bump-pointer arena allocator.
+ *
+ * Implements functions defined in `include/arena.h`. Used to allocate the request, the response
+ * and the scratch buffers of a connection, which are all freed at once when the request is done.
+ *
+ * Spare arenas are kept in a list per thread, so an event loop or a worker thread reuses the same
+ * few arenas for all of its connections.
+ *
+ * @see typedef struct arena
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/**
+ * @private
+ * @brief The spare arenas of the thread, linked by `next_spare`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+static __thread arena *spare_arenas = NULL;
+
+/**
+ * @private
+ * @brief The number of arenas in `spare_arenas`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+static __thread int no_spare_arenas = 0;
+
+/**
+ * @private
+ * @brief Set once the thread registered the destructor of its spare arenas.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+static __thread bool spare_arenas_registered = false;
+
+/**
+ * @private
+ * @brief Key used only for its destructor, which destroys the spare arenas of an exiting thread.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+pthread_key_t spare_arenas_key;
+
+/**
+ * @private
+ * @brief Makes sure `spare_arenas_key` is created only once.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+pthread_once_t spare_arenas_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @private
+ * @brief Creates `spare_arenas_key`.
+ */
+static void _create_spare_arenas_key() {
+    pthread_key_create(&spare_arenas_key, _destroy_spare_arenas);
+}
+
+arena *create_arena(const size_t block_size) {
+    arena *mem = malloc(sizeof(arena));
+    if (mem == NULL)
+        return NULL;
+
+    if ((mem->first = _create_arena_block(block_size)) == NULL) {
+        free(mem);
+        return NULL;
+    }
+
+    mem->current = mem->first;
+    mem->block_size = block_size;
+    mem->next_spare = NULL;
+    return mem;
+}
+
+void *arena_alloc(arena *mem, const size_t size) {
+    arena_block *block = mem->current, *new_block = NULL;
+    size_t aligned_size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    void *ptr = NULL;
+
+    // Blocks after the current one are unused, so they are emptied when moved to.
+    while (block->size - block->used < aligned_size) {
+        if (block->next == NULL || block->next->size < aligned_size) {
+            new_block = _create_arena_block((aligned_size > mem->block_size) ? aligned_size
+                                                                              : mem->block_size);
+            if (new_block == NULL)
+                return NULL;
+            new_block->next = block->next;
+            block->next = new_block;
+        }
+
+        block = block->next;
+        block->used = 0;
+    }
+
+    mem->current = block;
+    ptr = block->data + block->used;
+    block->used += aligned_size;
+    return ptr;
+}
+
+char *arena_strdup(arena *mem, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(mem, len);
+
+    if (copy != NULL)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+arena_mark get_arena_mark(const arena *mem) {
+    return (arena_mark){.block = mem->current, .used = mem->current->used};
+}
+
+void rewind_arena(arena *mem, const arena_mark mark) {
+    mem->current = mark.block;
+    mem->current->used = mark.used;
+}
+
+void reset_arena(arena *mem) {
+    mem->current = mem->first;
+    mem->first->used = 0;
+}
+
+void destroy_arena(arena *mem) {
+    arena_block *block = NULL;
+
+    if (mem == NULL)
+        return;
+
+    while ((block = mem->first) != NULL) {
+        mem->first = block->next;
+        free(block);
+    }
+
+    free(mem);
+    mem = NULL;
+}
+
+arena *acquire_arena() {
+    arena *mem = spare_arenas;
+
+    if (mem == NULL)
+        return create_arena(ARENA_BLOCK_SIZE);
+
+    spare_arenas = mem->next_spare;
+    no_spare_arenas--;
+    mem->next_spare = NULL;
+    return mem;
+}
+
+void release_arena(arena *mem) {
+    if (mem == NULL)
+        return;
+
+    if (no_spare_arenas >= ARENA_MAX_SPARES) {
+        destroy_arena(mem);
+        return;
+    }
+
+    // The first spare arena of a thread registers the destructor freeing them on thread exit.
+    if (!spare_arenas_registered) {
+        pthread_once(&spare_arenas_once, _create_spare_arenas_key);
+        pthread_setspecific(spare_arenas_key, &spare_arenas);
+        spare_arenas_registered = true;
+    }
+
+    reset_arena(mem);
+    mem->next_spare = spare_arenas;
+    spare_arenas = mem;
+    no_spare_arenas++;
+}
+
+arena_block *_create_arena_block(const size_t size) {
+    arena_block *block = malloc(sizeof(arena_block) + size);
+    if (block == NULL)
+        return NULL;
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void _destroy_spare_arenas(void *spares) {
+    arena **list = spares, *mem = NULL;
+
+    while ((mem = *list) != NULL) {
+        *list = mem->next_spare;
+        destroy_arena(mem);
+    }
+    no_spare_arenas = 0;
+}
@@ -58,6 +58,22 @@ int load_config() {
     return 1;
 }
 
+int reload_config() {
+    GKeyFile *new_config = g_key_file_new();
+
+    if (!g_key_file_load_from_file(new_config, CONF_FILE, 0, &error)) {
+        printf("%s\n", error->message);
+        free_gerror(&error);
+        g_key_file_free(new_config);
+        return 0;
+    }
+
+    if (config != NULL)
+        g_key_file_free(config);
+    config = new_config;
+    return 1;
+}
+
 char *get_config(const char *key) {
     if (config == NULL)
         return NULL;
@@ -104,6 +120,13 @@ int get_config_int(const char *key) {
     return value;
 }
 
+int has_config_key(const char *key) {
+    if (config == NULL)
+        return 0;
+
+    return g_key_file_has_key(config, GROUP_NAME, key, NULL);
+}
+
 void unload_config() {
     if (config == NULL)
         return;
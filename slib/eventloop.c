@@ -0,0 +1,575 @@
+/**
+ * @file slib/eventloop.c
+ * @brief Functions for handling connections on an epoll based event loop.
+ *
+ * Implements functions defined in `include/eventloop.h`. Used to accept and handle all connections
+ * on a single thread using an edge-triggered `epoll` instance and non-blocking sockets.
+ *
+ * The state of each connection is stored in `struct connection` (defined in
+ * `include/eventloop.h`). Whenever the socket of a connection is ready, the connection is advanced
+ * through its states (read head, open file, write head, write body) until the socket would block.
+ * Since the sockets are edge-triggered, every state reads or writes until `EAGAIN` is returned.
+ * Keep-alive connections go back to reading the next request head and are closed once they are
+ * idle for longer than the keep-alive timeout.
+ *
+ * @see typedef struct connection
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "eventloop.h"
+#include "server.h"
+
+void run_event_loop(const int listen_fd) {
+    struct epoll_event event, events[MAX_EVENTS];
+    struct rlimit fd_limit;
+    conn_list conns = {.head = NULL, .tail = NULL};
+    int epoll_fd = -1, no_events = 0, idle_timeout = get_keep_alive_timeout();
+    time_t now = 0;
+
+    // Idle connections only cost a file descriptor, so allow as many as the hard limit.
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max) {
+        fd_limit.rlim_cur = fd_limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fd_limit);
+    }
+
+    if (_set_nonblocking(listen_fd) < 0) {
+        perror("Unable to set listening socket to non-blocking");
+        exit(-1);
+    }
+
+    if ((epoll_fd = epoll_create1(0)) < 0) {
+        perror("Unable to create epoll instance");
+        exit(-1);
+    }
+
+    // Listening socket is identified by a NULL pointer, connections by their connection struct.
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0) {
+        perror("Unable to add listening socket to epoll instance");
+        exit(-1);
+    }
+
+    while (true) {
+        // Wake up every second to close idle connections, if there are any.
+        no_events = epoll_wait(epoll_fd, events, MAX_EVENTS,
+                               (idle_timeout > 0 && conns.tail != NULL) ? 1000 : -1);
+        if (no_events < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Unable to wait for events");
+            break;
+        }
+        now = _get_monotonic_time();
+        idle_timeout = get_keep_alive_timeout();
+
+        for (int e_no = 0; e_no < no_events; e_no++) {
+            connection *conn = events[e_no].data.ptr;
+
+            if (conn == NULL) {
+                _accept_connections(epoll_fd, listen_fd, &conns, now);
+                continue;
+            }
+
+            _touch_connection(&conns, conn, now);
+            if ((events[e_no].events & (EPOLLERR | EPOLLHUP)) != 0 ||
+                _advance_connection(conn) < 0 || conn->state == CONN_CLOSE)
+                _close_connection(&conns, conn);
+        }
+
+        if (idle_timeout > 0)
+            _expire_connections(&conns, now, idle_timeout);
+    }
+
+    close(epoll_fd);
+}
+
+int _accept_connections(const int epoll_fd, const int listen_fd, conn_list *conns,
+                        const time_t now) {
+    struct epoll_event event;
+    int conn_fd = -1, no_accepted = 0;
+
+    while (true) {
+        if ((conn_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("Unable to accept new connection");
+            break;
+        }
+
+        connection *conn = _initialize_connection(conn_fd);
+        if (conn == NULL) {
+            close(conn_fd);
+            continue;
+        }
+
+        // Registered once for both directions, the state machine decides what to do on an event.
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn_fd, &event) < 0) {
+            perror("Unable to add connection to epoll instance");
+            _free_connection(conn);
+            continue;
+        }
+
+        _touch_connection(conns, conn, now);
+        add_metric(METRIC_CONNECTIONS, 1);
+        no_accepted++;
+    }
+
+    return no_accepted;
+}
+
+int _advance_connection(connection *conn) {
+    int r_val = 1;
+
+    while (r_val > 0 && conn->state != CONN_CLOSE) {
+        switch (conn->state) {
+        case CONN_READ_HEAD:
+            r_val = _read_request_head(conn);
+            break;
+        case CONN_OPEN_FILE:
+            r_val = _open_request_file(conn);
+            break;
+        case CONN_WRITE_HEAD:
+            r_val = _write_response_head(conn);
+            break;
+        case CONN_WRITE_BODY:
+            r_val = _write_response_body(conn);
+            break;
+        default:
+            r_val = -1;
+        }
+    }
+
+    return (r_val < 0) ? -1 : 0;
+}
+
+int _read_request_head(connection *conn) {
+    ssize_t recv_size = 0;
+    int r_val = 0;
+
+    // A pipelined request may already be in the buffer.
+    if ((r_val = _parse_buffered_request(conn)) != 0)
+        return r_val;
+
+    // The buffer is the first allocation of the arena, requests are allocated after the mark.
+    if (conn->buf == NULL) {
+        if (conn->mem == NULL && (conn->mem = acquire_arena()) == NULL)
+            return -1;
+        if ((conn->buf = arena_alloc(conn->mem, REQ_BUF_SIZE)) == NULL)
+            return -1;
+        conn->mark = get_arena_mark(conn->mem);
+    }
+
+    while (true) {
+        if (conn->buf_len >= REQ_BUF_SIZE)
+            return -1;
+
+        recv_size = recv(conn->conn_fd, conn->buf + conn->buf_len, REQ_BUF_SIZE - conn->buf_len, 0);
+        if (recv_size == 0)
+            return -1;
+        if (recv_size < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+
+            // Idle keep-alive connections don't hold an arena.
+            if (conn->buf_len == 0) {
+                release_arena(conn->mem);
+                conn->mem = NULL;
+                conn->buf = NULL;
+            }
+            return 0;
+        }
+
+        conn->buf_len += recv_size;
+        if ((r_val = _parse_buffered_request(conn)) != 0)
+            return r_val;
+    }
+}
+
+int _open_request_file(connection *conn) {
+    ssize_t head_size = 0;
+    size_t prefix_len = 0;
+    response *res = NULL;
+    const server_config *config = NULL;
+    off_t body_len = 0;
+    int token = 0, r_val = 0;
+
+    conn->keep_alive = keep_alive_request(conn->req, ++conn->no_requests);
+    conn->log_start = _access_log_now();
+    conn->head_size = 0;
+    conn->res_sent = 0;
+
+    // The connection is owned by the event loop, so the response doesn't need a dup of conn_fd.
+    config = acquire_server_config(&token);
+    r_val = _prepare_file_response(config, conn->req, -1, conn->keep_alive, &res, &conn->file_fd,
+                                   &conn->parts, &conn->no_parts, &conn->entry, &conn->status_code,
+                                   &body_len);
+    release_server_config(token);
+    // The client is captured now, as it is unknown once the connection is reset.
+    conn->log_record = _capture_served_request(conn->mem, conn->req);
+    if (r_val == 0) {
+        _log_served_record(conn->log_record, conn->status_code, 0, conn->log_start);
+        conn->log_record = NULL;
+        return -1;
+    }
+    conn->part_no = 0;
+    if (conn->no_parts > 0) {
+        conn->file_off = conn->parts[0].start;
+        conn->file_end = conn->parts[0].end;
+        prefix_len = conn->parts[0].prefix_len;
+    }
+
+    // The response is allocated from the arena, so it is freed when the connection is reset. The
+    // prefix of the first part of the body is sent with the head.
+    if ((conn->out_buf = arena_alloc(conn->mem, RES_HEAD_MAX_SIZE + prefix_len)) == NULL) {
+        _log_served_record(conn->log_record, conn->status_code, 0, conn->log_start);
+        conn->log_record = NULL;
+        return -1;
+    }
+
+    // The connection is closed without a response, which is counted here as it isn't a failure of
+    // the request.
+    if ((head_size = format_response_head(res, conn->out_buf, RES_HEAD_MAX_SIZE)) < 0) {
+        add_metric(METRIC_ERRORS_RESPONSE, 1);
+        _log_served_record(conn->log_record, conn->status_code, 0, conn->log_start);
+        conn->log_record = NULL;
+        conn->state = CONN_CLOSE;
+        return -1;
+    }
+    if (prefix_len > 0)
+        memcpy(conn->out_buf + head_size, conn->parts[0].prefix, prefix_len);
+
+    conn->out_len = head_size + prefix_len;
+    conn->out_pos = 0;
+    conn->head_size = head_size;
+    conn->stage_start = metrics_now();
+    conn->state = CONN_WRITE_HEAD;
+    return 1;
+}
+
+int _write_response_head(connection *conn) {
+    char buf[RES_BUF_SIZE];
+    const char *cached = (conn->entry != NULL) ? conn->entry->data : NULL;
+    struct iovec iov[2];
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 1};
+    ssize_t read_size = 0, send_size = 0;
+    size_t head_left = 0;
+
+    while (conn->out_pos < conn->out_len) {
+        head_left = conn->out_len - conn->out_pos;
+        iov[0] = (struct iovec){.iov_base = conn->out_buf + conn->out_pos, .iov_len = head_left};
+        msg.msg_iovlen = 1;
+
+        // The first chunk of the body goes out with the head, so a small file takes one packet. A
+        // cached body is sent from memory, as much of it as the socket takes.
+        if (cached != NULL && conn->file_off < conn->file_end) {
+            iov[1] = (struct iovec){.iov_base = (char *)cached + conn->file_off,
+                                    .iov_len = conn->file_end - conn->file_off};
+            msg.msg_iovlen = 2;
+        } else if (conn->file_off < conn->file_end) {
+            read_size = conn->file_end - conn->file_off;
+            if ((read_size = pread(conn->file_fd, buf,
+                                   (read_size < RES_BUF_SIZE) ? read_size : RES_BUF_SIZE,
+                                   conn->file_off)) <= 0)
+                return -1;
+            iov[1] = (struct iovec){.iov_base = buf, .iov_len = read_size};
+            msg.msg_iovlen = 2;
+        }
+
+        send_size = sendmsg(conn->conn_fd, &msg, MSG_NOSIGNAL);
+        if (send_size < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        conn->res_sent += send_size;
+        if ((size_t)send_size <= head_left)
+            conn->out_pos += send_size;
+        else {
+            conn->out_pos = conn->out_len;
+            conn->file_off += send_size - head_left;
+        }
+    }
+
+    // Head is sent, its buffer is freed with the arena when the connection is reset.
+    conn->out_buf = NULL;
+    conn->out_len = 0;
+    conn->out_pos = 0;
+
+    // Prefixes of the later parts of a multipart body are sent as heads too, but are of the body.
+    if (conn->part_no == 0) {
+        observe_metric(STAGE_HEAD_SEND, conn->stage_start);
+        conn->stage_start = metrics_now();
+    }
+
+    conn->state = CONN_WRITE_BODY;
+    return 1;
+}
+
+int _write_response_body(connection *conn) {
+    ssize_t send_size = 0;
+
+    while (conn->file_off < conn->file_end) {
+        if (conn->entry != NULL && conn->entry->data != NULL) {
+            send_size = send(conn->conn_fd, conn->entry->data + conn->file_off,
+                             conn->file_end - conn->file_off, MSG_NOSIGNAL);
+            if (send_size > 0)
+                conn->file_off += send_size;
+        } else
+            send_size = send_file_range(conn->conn_fd, conn->file_fd, &conn->file_off,
+                                        conn->file_end - conn->file_off);
+        if (send_size > 0)
+            conn->res_sent += send_size;
+        if (send_size < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        // 0 means the file was truncated after it was opened.
+        if (send_size == 0)
+            return -1;
+    }
+
+    // The prefix of the next part of a multipart body is sent like a head, with the part's range.
+    if (++conn->part_no < conn->no_parts) {
+        conn->out_buf = conn->parts[conn->part_no].prefix;
+        conn->out_len = conn->parts[conn->part_no].prefix_len;
+        conn->out_pos = 0;
+        conn->file_off = conn->parts[conn->part_no].start;
+        conn->file_end = conn->parts[conn->part_no].end;
+        conn->state = CONN_WRITE_HEAD;
+        return 1;
+    }
+
+    if (conn->no_parts > 0)
+        observe_metric(STAGE_BODY_SEND, conn->stage_start);
+    _log_served_record(conn->log_record, conn->status_code, conn->res_sent - conn->head_size,
+                       conn->log_start);
+    conn->log_record = NULL;
+    if (conn->keep_alive)
+        _reset_connection(conn);
+    else
+        conn->state = CONN_CLOSE;
+    return 1;
+}
+
+int _parse_buffered_request(connection *conn) {
+    parse_status status = PARSE_INCOMPLETE;
+
+    if (conn->buf_len == 0)
+        return 0;
+
+    // The parser resumes where it stopped on the previous read.
+    if (conn->req == NULL &&
+        (conn->req = create_request_in_arena(conn->mem, conn->conn_fd)) == NULL)
+        return -1;
+
+    if ((status = parse_request_buf(conn->req, conn->buf, conn->buf_len)) != PARSE_COMPLETE)
+        return (status == PARSE_INCOMPLETE) ? 0 : -1;
+
+    conn->state = CONN_OPEN_FILE;
+    return 1;
+}
+
+void _reset_connection(connection *conn) {
+    // The file of an fd cache entry stays open for other responses.
+    if (conn->file_fd != -1 && conn->entry == NULL)
+        close(conn->file_fd);
+    conn->file_fd = -1;
+    release_file_cache_entry(conn->entry);
+    conn->entry = NULL;
+    conn->parts = NULL;
+    conn->no_parts = 0;
+    conn->part_no = 0;
+    conn->file_off = 0;
+    conn->file_end = 0;
+
+    // The connection outlives the request, so closing the request must not close it. Bytes of
+    // pipelined requests after the request head are moved to the start of the buffer.
+    if (conn->req != NULL) {
+        conn->buf_len -= conn->req->head_size;
+        memmove(conn->buf, conn->buf + conn->req->head_size, conn->buf_len);
+        conn->req->conn_fd = -1;
+        close_request(conn->req);
+        conn->req = NULL;
+    }
+
+    // Frees the request and response at once, keeping the buffer. Idle connections drop the arena.
+    conn->out_buf = NULL;
+    conn->log_record = NULL;
+    if (conn->mem != NULL) {
+        rewind_arena(conn->mem, conn->mark);
+        if (conn->buf_len == 0) {
+            release_arena(conn->mem);
+            conn->mem = NULL;
+            conn->buf = NULL;
+        }
+    }
+
+    conn->keep_alive = false;
+    conn->state = CONN_READ_HEAD;
+}
+
+void _touch_connection(conn_list *conns, connection *conn, const time_t now) {
+    conn->last_active = now;
+    if (conns->head == conn)
+        return;
+
+    // Unlink, if already in the list.
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    if (conns->tail == conn)
+        conns->tail = conn->prev;
+
+    conn->prev = NULL;
+    conn->next = conns->head;
+    if (conns->head != NULL)
+        conns->head->prev = conn;
+    conns->head = conn;
+    if (conns->tail == NULL)
+        conns->tail = conn;
+}
+
+int _expire_connections(conn_list *conns, const time_t now, const int timeout) {
+    int no_expired = 0;
+
+    while (conns->tail != NULL && now - conns->tail->last_active >= timeout) {
+        _close_connection(conns, conns->tail);
+        no_expired++;
+    }
+
+    return no_expired;
+}
+
+void _close_connection(conn_list *conns, connection *conn) {
+    // A response that couldn't be sent is logged with the bytes of its body that went out.
+    if (conn->state == CONN_WRITE_HEAD || conn->state == CONN_WRITE_BODY) {
+        add_metric(METRIC_ERRORS_SEND, 1);
+        _log_served_record(conn->log_record, conn->status_code,
+                           (conn->res_sent > conn->head_size) ? conn->res_sent - conn->head_size
+                                                              : 0,
+                           conn->log_start);
+    } else if (conn->state == CONN_OPEN_FILE ||
+             (conn->state == CONN_READ_HEAD && (conn->buf_len > 0 || conn->no_requests == 0)))
+        add_metric(METRIC_ERRORS_REQUEST, 1);
+
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else if (conns->head == conn)
+        conns->head = conn->next;
+
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    else if (conns->tail == conn)
+        conns->tail = conn->prev;
+
+    _free_connection(conn);
+}
+
+time_t _get_monotonic_time() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec;
+}
+
+connection *_initialize_connection(const int conn_fd) {
+    connection *conn = malloc(sizeof(connection));
+    if (conn == NULL)
+        return NULL;
+
+    conn->conn_fd = conn_fd;
+    conn->state = CONN_READ_HEAD;
+    conn->buf = NULL;
+    conn->buf_len = 0;
+    conn->out_buf = NULL;
+    conn->out_len = 0;
+    conn->out_pos = 0;
+    conn->mem = NULL;
+    conn->req = NULL;
+    conn->file_fd = -1;
+    conn->entry = NULL;
+    conn->parts = NULL;
+    conn->no_parts = 0;
+    conn->part_no = 0;
+    conn->file_off = 0;
+    conn->file_end = 0;
+    conn->no_requests = 0;
+    conn->keep_alive = false;
+    conn->last_active = 0;
+    conn->stage_start = 0;
+    conn->log_record = NULL;
+    conn->log_start = 0;
+    conn->status_code = 444;
+    conn->head_size = 0;
+    conn->res_sent = 0;
+    conn->prev = NULL;
+    conn->next = NULL;
+
+    return conn;
+}
+
+void _free_connection(connection *conn) {
+    if (conn == NULL)
+        return;
+
+    // The file of an fd cache entry stays open for other responses.
+    if (conn->file_fd != -1 && conn->entry == NULL)
+        close(conn->file_fd);
+    conn->file_fd = -1;
+    release_file_cache_entry(conn->entry);
+    conn->entry = NULL;
+
+    // Closing the connection also removes it from the epoll instance.
+    if (conn->req != NULL) {
+        close_request(conn->req);
+        conn->req = NULL;
+        conn->conn_fd = -1;
+    }
+
+    if (conn->conn_fd != -1) {
+        close(conn->conn_fd);
+        conn->conn_fd = -1;
+    }
+
+    release_arena(conn->mem);
+    conn->mem = NULL;
+    conn->buf = NULL;
+    conn->out_buf = NULL;
+
+    free(conn);
+}
+
+int _set_nonblocking(const int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
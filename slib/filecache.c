@@ -0,0 +1,508 @@
+/**
+ * @file slib/filecache.c
+ * @brief Functions for caching hot static files in memory, and open descriptors of larger files.
+ *
+ * Implements functions defined in `include/filecache.h`. Used by the server to serve frequently
+ * requested files without touching the file system, or at least without opening them again.
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "filecache.h"
+
+file_cache *create_file_cache(const size_t budget, const size_t max_file_size,
+                              const int revalidate) {
+    return _create_cache(budget / FILE_CACHE_SHARDS, max_file_size, revalidate, false);
+}
+
+file_cache *create_fd_cache(const size_t max_fds, const int revalidate) {
+    // Rounded up, so a small limit still leaves room for a descriptor in every shard.
+    return _create_cache((max_fds + FILE_CACHE_SHARDS - 1) / FILE_CACHE_SHARDS, SIZE_MAX,
+                         revalidate, true);
+}
+
+file_entry *get_file_cache_entry(file_cache *cache, const char *path, const char *coding) {
+    file_entry *entry = NULL;
+    file_cache_shard *shard = NULL;
+    uint32_t hash = 0;
+
+    if (cache == NULL || path == NULL)
+        return NULL;
+    if (coding == NULL)
+        coding = "";
+
+    hash = _hash_file_path(path);
+    shard = &cache->shards[hash & (FILE_CACHE_SHARDS - 1)];
+
+    pthread_rwlock_rdlock(&shard->lock);
+    if ((entry = _find_file_entry(shard, path, coding, hash)) != NULL) {
+        atomic_fetch_add_explicit(&entry->refs, 1, memory_order_relaxed);
+        // Hot entries are already marked, skipping the store keeps their cache line shared.
+        if (!atomic_load_explicit(&entry->referenced, memory_order_relaxed))
+            atomic_store_explicit(&entry->referenced, true, memory_order_relaxed);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (entry == NULL || _is_file_entry_fresh(cache, entry))
+        return entry;
+
+    pthread_rwlock_wrlock(&shard->lock);
+    _unlink_file_entry(shard, entry);
+    pthread_rwlock_unlock(&shard->lock);
+    release_file_cache_entry(entry);
+
+    return NULL;
+}
+
+file_entry *add_file_cache_entry(file_cache *cache, const char *path, const char *coding,
+                                 const int file_fd, const struct stat *file_stat,
+                                 const char *mimetype) {
+    file_entry *entry = NULL;
+    size_t read_off = 0;
+    ssize_t read_size = 0;
+
+    if (cache == NULL || cache->holds_fds || file_fd < 0 || file_stat == NULL)
+        return NULL;
+    if (file_stat->st_size < 0 || (size_t)file_stat->st_size > cache->max_file_size)
+        return NULL;
+
+    entry = _create_file_entry(path, coding, file_stat, mimetype, file_stat->st_size,
+                               file_stat->st_size);
+    if (entry == NULL)
+        return NULL;
+    if (entry->charge > cache->shard_budget) {
+        free(entry);
+        return NULL;
+    }
+
+    while (read_off < entry->size) {
+        read_size = pread(file_fd, entry->data + read_off, entry->size - read_off, read_off);
+        if (read_size < 0 && errno == EINTR)
+            continue;
+        // 0 means the file was truncated after it was stat-ed.
+        if (read_size <= 0) {
+            free(entry);
+            return NULL;
+        }
+        read_off += read_size;
+    }
+
+    return _insert_file_entry(cache, entry);
+}
+
+file_entry *add_encoded_file_cache_entry(file_cache *cache, const char *path, const char *coding,
+                                         const struct stat *file_stat, const char *mimetype,
+                                         const char *data, const size_t data_size) {
+    file_entry *entry = NULL;
+
+    if (cache == NULL || cache->holds_fds || file_stat == NULL || data == NULL)
+        return NULL;
+    if (data_size > cache->max_file_size)
+        return NULL;
+
+    entry = _create_file_entry(path, coding, file_stat, mimetype, data_size, data_size);
+    if (entry == NULL)
+        return NULL;
+    if (entry->charge > cache->shard_budget) {
+        free(entry);
+        return NULL;
+    }
+
+    memcpy(entry->data, data, data_size);
+    return _insert_file_entry(cache, entry);
+}
+
+file_entry *add_fd_cache_entry(file_cache *cache, const char *path, const char *coding,
+                               const int file_fd, const struct stat *file_stat,
+                               const char *mimetype) {
+    file_entry *entry = NULL, *cached = NULL;
+
+    if (cache == NULL || !cache->holds_fds || file_fd < 0 || file_stat == NULL)
+        return NULL;
+    if (file_stat->st_size < 0)
+        return NULL;
+    entry = _create_file_entry(path, coding, file_stat, mimetype, file_stat->st_size, 0);
+    if (entry == NULL)
+        return NULL;
+
+    // Every entry counts as one file descriptor against the budget.
+    entry->charge = 1;
+    entry->data = NULL;
+    entry->fd = file_fd;
+
+    // The path was cached in the meantime, its descriptor is used instead.
+    if ((cached = _insert_file_entry(cache, entry)) != entry)
+        close(file_fd);
+    return cached;
+}
+
+int format_file_etag(const struct stat *file_stat, const char *coding, char *buf,
+                     const size_t buf_size) {
+    unsigned long long mtime = 0;
+    int len = 0;
+
+    if (file_stat == NULL || buf == NULL)
+        return -1;
+    if (coding == NULL)
+        coding = "";
+
+    mtime = (unsigned long long)file_stat->st_mtim.tv_sec * 1000000000ull +
+            (unsigned long long)file_stat->st_mtim.tv_nsec;
+    len = snprintf(buf, buf_size, "\"%llx-%llx-%llx%s%s\"", (unsigned long long)file_stat->st_ino,
+                   (unsigned long long)file_stat->st_size, mtime, (*coding) ? "-" : "", coding);
+    return (len < 0 || (size_t)len >= buf_size) ? -1 : len;
+}
+
+void set_file_cache_watched(file_cache *cache, const bool watched) {
+    if (cache != NULL)
+        atomic_store(&cache->watched, watched);
+}
+
+int invalidate_file_cache_path(file_cache *cache, const char *path) {
+    file_entry *entry = NULL, *next = NULL;
+    file_cache_shard *shard = NULL;
+    uint32_t hash = 0;
+    int no_removed = 0;
+
+    if (cache == NULL || path == NULL)
+        return 0;
+
+    hash = _hash_file_path(path);
+    shard = &cache->shards[hash & (FILE_CACHE_SHARDS - 1)];
+
+    pthread_rwlock_wrlock(&shard->lock);
+    atomic_fetch_add(&shard->invalidations, 1);
+    entry = shard->buckets[(hash / FILE_CACHE_SHARDS) & (FILE_CACHE_BUCKETS - 1)];
+    for (; entry != NULL; entry = next) {
+        next = entry->next;
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            _unlink_file_entry(shard, entry);
+            no_removed++;
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    return no_removed;
+}
+
+int invalidate_file_cache_dir(file_cache *cache, const char *dir) {
+    file_entry *entry = NULL, *next = NULL;
+    file_cache_shard *shard = NULL;
+    size_t dir_len = 0;
+    int no_removed = 0;
+
+    if (cache == NULL || dir == NULL)
+        return 0;
+
+    // A trailing `/` is part of the prefix, otherwise the next character of the path must be one.
+    dir_len = strlen(dir);
+    if (dir_len > 0 && dir[dir_len - 1] == '/')
+        dir_len--;
+
+    for (int s_no = 0; s_no < FILE_CACHE_SHARDS; s_no++) {
+        shard = &cache->shards[s_no];
+        pthread_rwlock_wrlock(&shard->lock);
+        atomic_fetch_add(&shard->invalidations, 1);
+        for (int b_no = 0; b_no < FILE_CACHE_BUCKETS; b_no++) {
+            for (entry = shard->buckets[b_no]; entry != NULL; entry = next) {
+                next = entry->next;
+                if (strncmp(entry->path, dir, dir_len) == 0 && entry->path[dir_len] == '/') {
+                    _unlink_file_entry(shard, entry);
+                    no_removed++;
+                }
+            }
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return no_removed;
+}
+
+void release_file_cache_entry(file_entry *entry) {
+    if (entry == NULL)
+        return;
+
+    // The last reference frees the entry, the acquire pairs with the release of other threads.
+    if (atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_acq_rel) == 1) {
+        if (entry->fd != -1)
+            close(entry->fd);
+        free(entry);
+    }
+}
+
+void destroy_file_cache(file_cache *cache) {
+    file_cache_shard *shard = NULL;
+
+    if (cache == NULL)
+        return;
+
+    for (int s_no = 0; s_no < FILE_CACHE_SHARDS; s_no++) {
+        shard = &cache->shards[s_no];
+        while (shard->hand != NULL)
+            _unlink_file_entry(shard, shard->hand);
+        pthread_rwlock_destroy(&shard->lock);
+    }
+
+    free(cache);
+}
+
+file_cache *_create_cache(const size_t shard_budget, const size_t max_file_size,
+                          const int revalidate, const bool holds_fds) {
+    file_cache *cache = NULL;
+
+    if (shard_budget == 0 || (cache = calloc(1, sizeof(file_cache))) == NULL)
+        return NULL;
+
+    for (int s_no = 0; s_no < FILE_CACHE_SHARDS; s_no++) {
+        if (pthread_rwlock_init(&cache->shards[s_no].lock, NULL) != 0) {
+            for (int d_no = 0; d_no < s_no; d_no++)
+                pthread_rwlock_destroy(&cache->shards[d_no].lock);
+            free(cache);
+            return NULL;
+        }
+    }
+
+    cache->shard_budget = shard_budget;
+    cache->max_file_size = max_file_size;
+    cache->revalidate = (revalidate > 0) ? revalidate : 0;
+    cache->holds_fds = holds_fds;
+    atomic_init(&cache->watched, false);
+    for (int s_no = 0; s_no < FILE_CACHE_SHARDS; s_no++)
+        atomic_init(&cache->shards[s_no].invalidations, 0);
+
+    return cache;
+}
+
+file_entry *_create_file_entry(const char *path, const char *coding,
+                               const struct stat *file_stat, const char *mimetype,
+                               const size_t size, const size_t data_size) {
+    char headers[FILE_CACHE_HEADERS_SIZE], etag[FILE_ETAG_SIZE], last_modified[HTTP_DATE_SIZE];
+    file_entry *entry = NULL;
+    size_t path_size = 0, coding_size = 0, mime_size = 0, etag_size = 0, charge = 0;
+    int headers_len = 0, validators_len = 0;
+
+    if (path == NULL || mimetype == NULL)
+        return NULL;
+    if (coding == NULL)
+        coding = "";
+    if (format_file_etag(file_stat, coding, etag, sizeof(etag)) < 0 ||
+        format_http_date(file_stat->st_mtim.tv_sec, last_modified, sizeof(last_modified)) < 0)
+        return NULL;
+
+    // The validators come last, so they double as the headers of a 304 response.
+    headers_len = snprintf(headers, sizeof(headers),
+                           "Content-Type: %s\r\nContent-Length: %lld\r\n%s%s%s"
+                           "Accept-Ranges: bytes\r\n",
+                           mimetype, (long long)size, (*coding) ? "Content-Encoding: " : "",
+                           coding, (*coding) ? "\r\n" : "");
+    if (headers_len < 0 || (size_t)headers_len >= sizeof(headers))
+        return NULL;
+    validators_len = snprintf(headers + headers_len, sizeof(headers) - headers_len,
+                              "ETag: %s\r\nLast-Modified: %s\r\n", etag, last_modified);
+    if (validators_len < 0 || (size_t)validators_len >= sizeof(headers) - headers_len)
+        return NULL;
+
+    path_size = strlen(path) + 1;
+    coding_size = strlen(coding) + 1;
+    mime_size = strlen(mimetype) + 1;
+    etag_size = strlen(etag) + 1;
+    charge = sizeof(file_entry) + path_size + coding_size + mime_size + etag_size + headers_len +
+             validators_len + 1 + data_size;
+    if ((entry = malloc(charge)) == NULL)
+        return NULL;
+
+    // The strings and the contents follow the struct in the same allocation.
+    entry->path = (char *)(entry + 1);
+    entry->coding = entry->path + path_size;
+    entry->mimetype = entry->coding + coding_size;
+    entry->etag = entry->mimetype + mime_size;
+    entry->headers = entry->etag + etag_size;
+    entry->data = entry->headers + headers_len + validators_len + 1;
+    memcpy(entry->path, path, path_size);
+    memcpy(entry->coding, coding, coding_size);
+    memcpy(entry->mimetype, mimetype, mime_size);
+    memcpy(entry->etag, etag, etag_size);
+    memcpy(entry->headers, headers, headers_len + validators_len + 1);
+    entry->validators = entry->headers + headers_len;
+    entry->validators_len = validators_len;
+    entry->headers_len = headers_len + validators_len;
+    entry->size = size;
+    entry->file_size = file_stat->st_size;
+    entry->fd = -1;
+
+    // One reference for the cache and one for the caller.
+    atomic_init(&entry->refs, 2);
+    atomic_init(&entry->referenced, false);
+    atomic_init(&entry->checked_at, _file_cache_now());
+    atomic_init(&entry->variants, FILE_VARIANTS_UNKNOWN);
+    entry->hash = _hash_file_path(path);
+    entry->charge = charge;
+    entry->mtime = file_stat->st_mtim;
+    entry->ino = file_stat->st_ino;
+
+    return entry;
+}
+
+file_entry *_insert_file_entry(file_cache *cache, file_entry *entry) {
+    file_entry *existing = NULL;
+    file_cache_shard *shard = &cache->shards[entry->hash & (FILE_CACHE_SHARDS - 1)];
+    unsigned int invalidations = atomic_load(&shard->invalidations);
+    bool watched = atomic_load(&cache->watched);
+
+    // Entries of a watched cache are never revalidated. A change before this check is caught by
+    // it, and the invalidation of a change after it is caught under the lock.
+    if (watched && !_is_file_unchanged(entry)) {
+        atomic_store_explicit(&entry->refs, 1, memory_order_relaxed);
+        return entry;
+    }
+
+    pthread_rwlock_wrlock(&shard->lock);
+    existing = _find_file_entry(shard, entry->path, entry->coding, entry->hash);
+    if (existing != NULL) {
+        atomic_fetch_add_explicit(&existing->refs, 1, memory_order_relaxed);
+        pthread_rwlock_unlock(&shard->lock);
+        free(entry);
+        return existing;
+    }
+    if (watched && atomic_load(&shard->invalidations) != invalidations) {
+        pthread_rwlock_unlock(&shard->lock);
+        atomic_store_explicit(&entry->refs, 1, memory_order_relaxed);
+        return entry;
+    }
+
+    _evict_file_entries(cache, shard, entry->charge);
+    _link_file_entry(shard, entry);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return entry;
+}
+
+uint32_t _hash_file_path(const char *path) {
+    uint32_t hash = 2166136261u;
+
+    for (const unsigned char *c = (const unsigned char *)path; *c != '\0'; c++)
+        hash = (hash ^ *c) * 16777619u;
+
+    return hash;
+}
+
+file_entry *_find_file_entry(const file_cache_shard *shard, const char *path, const char *coding,
+                             const uint32_t hash) {
+    file_entry *entry = shard->buckets[(hash / FILE_CACHE_SHARDS) & (FILE_CACHE_BUCKETS - 1)];
+
+    while (entry != NULL && (entry->hash != hash || strcmp(entry->path, path) != 0 ||
+                             strcmp(entry->coding, coding) != 0))
+        entry = entry->next;
+
+    return entry;
+}
+
+void _link_file_entry(file_cache_shard *shard, file_entry *entry) {
+    file_entry **bucket = &shard->buckets[(entry->hash / FILE_CACHE_SHARDS) &
+                                          (FILE_CACHE_BUCKETS - 1)];
+
+    entry->next = *bucket;
+    *bucket = entry;
+
+    // New entries are added right behind the hand, so they are the last to be considered.
+    if (shard->hand == NULL) {
+        entry->clock_prev = entry;
+        entry->clock_next = entry;
+        shard->hand = entry;
+    } else {
+        entry->clock_next = shard->hand;
+        entry->clock_prev = shard->hand->clock_prev;
+        entry->clock_prev->clock_next = entry;
+        shard->hand->clock_prev = entry;
+    }
+
+    shard->used += entry->charge;
+}
+
+void _unlink_file_entry(file_cache_shard *shard, file_entry *entry) {
+    file_entry **link = &shard->buckets[(entry->hash / FILE_CACHE_SHARDS) &
+                                        (FILE_CACHE_BUCKETS - 1)];
+
+    // Another thread may have removed the entry already.
+    while (*link != NULL && *link != entry)
+        link = &(*link)->next;
+    if (*link == NULL)
+        return;
+    *link = entry->next;
+
+    if (entry->clock_next == entry)
+        shard->hand = NULL;
+    else {
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+        if (shard->hand == entry)
+            shard->hand = entry->clock_next;
+    }
+
+    shard->used -= entry->charge;
+    release_file_cache_entry(entry);
+}
+
+void _evict_file_entries(file_cache *cache, file_cache_shard *shard, const size_t charge) {
+    file_entry *victim = NULL;
+
+    // Every referenced entry passed is cleared, so the hand evicts within two rounds.
+    while (shard->hand != NULL && shard->used + charge > cache->shard_budget) {
+        victim = shard->hand;
+        if (atomic_exchange_explicit(&victim->referenced, false, memory_order_relaxed)) {
+            shard->hand = victim->clock_next;
+            continue;
+        }
+        _unlink_file_entry(shard, victim);
+    }
+}
+
+bool _is_file_entry_fresh(const file_cache *cache, file_entry *entry) {
+    long long now = 0, checked_at = 0;
+
+    if (cache->revalidate == 0 || atomic_load_explicit(&cache->watched, memory_order_relaxed))
+        return true;
+
+    now = _file_cache_now();
+    checked_at = atomic_load_explicit(&entry->checked_at, memory_order_relaxed);
+    if (now - checked_at < cache->revalidate)
+        return true;
+
+    // Only the thread that moves the check time forward checks the file, the others serve the
+    // entry in the meantime.
+    if (!atomic_compare_exchange_strong(&entry->checked_at, &checked_at, now))
+        return true;
+
+    // Precompressed variants may have been added or removed since the last check.
+    atomic_store_explicit(&entry->variants, FILE_VARIANTS_UNKNOWN, memory_order_relaxed);
+
+    return _is_file_unchanged(entry);
+}
+
+bool _is_file_unchanged(const file_entry *entry) {
+    struct stat file_stat;
+
+    if (stat(entry->path, &file_stat) < 0)
+        return false;
+    return S_ISREG(file_stat.st_mode) && (size_t)file_stat.st_size == entry->file_size &&
+           file_stat.st_ino == entry->ino && file_stat.st_mtim.tv_sec == entry->mtime.tv_sec &&
+           file_stat.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+long long _file_cache_now() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec;
+}
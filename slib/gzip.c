@@ -0,0 +1,72 @@
+/**
+ * @file slib/gzip.c
+ * @brief Functions for compressing response bodies with gzip.
+ *
+ * Implements functions defined in `include/gzip.h`, on top of zlib. Used by the server to compress
+ * static text files once, before they are cached.
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "gzip.h"
+
+char *gzip_compress(const char *src, const size_t src_len, const int level, size_t *out_len) {
+    z_stream stream;
+    char *out = NULL;
+    size_t out_size = 0;
+
+    if (src == NULL || out_len == NULL || src_len > UINT_MAX)
+        return NULL;
+
+    memset(&stream, 0, sizeof(stream));
+    // 16 added to the window bits selects the gzip wrapper instead of the zlib one.
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    // The bound fits the whole stream, so a single deflate() call finishes it.
+    out_size = deflateBound(&stream, src_len);
+    if (out_size > UINT_MAX || (out = malloc(out_size)) == NULL) {
+        deflateEnd(&stream);
+        return NULL;
+    }
+
+    stream.next_in = (Bytef *)src;
+    stream.avail_in = src_len;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = out_size;
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&stream);
+        free(out);
+        return NULL;
+    }
+
+    *out_len = stream.total_out;
+    deflateEnd(&stream);
+    return out;
+}
+
+bool is_compressible_mimetype(const char *mimetype) {
+    static const char *const text_types[] = {"application/json", "application/ld+json",
+                                             "application/xhtml+xml", "application/xml",
+                                             "application/javascript", "image/svg+xml"};
+
+    if (mimetype == NULL)
+        return false;
+    if (strncmp(mimetype, "text/", 5) == 0)
+        return true;
+
+    for (size_t t_no = 0; t_no < sizeof(text_types) / sizeof(text_types[0]); t_no++) {
+        if (strcmp(mimetype, text_types[t_no]) == 0)
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file slib/headers.c
+ * @brief Functions for looking up well-known HTTP header names.
+ *
+ * Implements functions defined in `include/headers.h`. Used by requests and responses to find the
+ * fixed slot of a header.
+ *
+ * Known headers are found with a perfect hash: the sum of the length and three bytes of the name
+ * (the first, the middle and the last, lowercased), each weighted by a constant, is distinct for
+ * every known header modulo `HEADER_TABLE_SIZE`. `header_table` maps these hashes to header IDs, it
+ * is generated into `headertable.h` with its weights from `KNOWN_HEADERS` at build time (see
+ * tools/headergen.c). Any name hashing to a slot is compared with the one candidate in it, so
+ * lookups of unknown names fail after a single comparison.
+ *
+ * HTTP dates are formatted and parsed with fixed English names, independent of the locale.
+ *
+ * @see enum http_header
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "headers.h"
+#include "headertable.h"
+
+/**
+ * @private
+ * @brief Expands a `KNOWN_HEADERS` entry into its name and length, indexed by its ID.
+ */
+#define KNOWN_HEADER(id, name) [id] = {name, sizeof(name) - 1},
+
+/**
+ * @private
+ * @brief The canonical names of the known headers, indexed by their ID.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+static const struct {
+    const char *name;
+    size_t len;
+} known_headers[NO_KNOWN_HEADERS] = {KNOWN_HEADERS(KNOWN_HEADER)};
+
+http_header lookup_header(const char *key, const size_t len) {
+    int header = HDR_UNKNOWN;
+
+    if (key == NULL || len == 0)
+        return HDR_UNKNOWN;
+
+    if ((header = header_table[_hash_header(key, len)]) < 0)
+        return HDR_UNKNOWN;
+    if (known_headers[header].len != len || strncasecmp(known_headers[header].name, key, len) != 0)
+        return HDR_UNKNOWN;
+
+    return header;
+}
+
+const char *get_header_name(const http_header header) {
+    if (header < 0 || header >= NO_KNOWN_HEADERS)
+        return NULL;
+    return known_headers[header].name;
+}
+
+int format_http_date(const time_t timestamp, char *buf, const size_t buf_size) {
+    static const char days[][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char months[][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm tm;
+    int len = 0;
+
+    if (buf == NULL || gmtime_r(&timestamp, &tm) == NULL)
+        return -1;
+
+    len = snprintf(buf, buf_size, "%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm.tm_wday],
+                   tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min,
+                   tm.tm_sec);
+    return (len < 0 || (size_t)len >= buf_size) ? -1 : len;
+}
+
+time_t parse_http_date(const char *value) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    const char *month_pos = NULL;
+    char month[4];
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    if (value == NULL ||
+        sscanf(value, "%*3[A-Za-z], %2d %3[A-Za-z] %4d %2d:%2d:%2d GMT", &tm.tm_mday, month,
+               &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+        return -1;
+    if (strlen(month) != 3 || (month_pos = strstr(months, month)) == NULL ||
+        (month_pos - months) % 3 != 0)
+        return -1;
+
+    tm.tm_mon = (month_pos - months) / 3;
+    tm.tm_year -= 1900;
+    return timegm(&tm);
+}
+
+unsigned _hash_header(const char *key, const size_t len) {
+    return HEADER_HASH_SLOT(len, HEADER_HASH_BYTE(key[0]), HEADER_HASH_BYTE(key[len / 2]),
+                            HEADER_HASH_BYTE(key[len - 1]), HEADER_HASH_FIRST, HEADER_HASH_MIDDLE,
+                            HEADER_HASH_LAST);
+}
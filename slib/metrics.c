@@ -0,0 +1,309 @@
+/**
+ * @file slib/metrics.c
+ * @brief Functions for collecting counters and latency histograms of the server.
+ *
+ * Implements functions defined in `include/metrics.h`. Used by the server to count connections,
+ * responses and errors, and to record how long the stages of every request take.
+ *
+ * A thread gets a shard of its own the first time it collects a metric, and keeps a pointer to it
+ * in a thread-local variable, so collecting a metric is a load of that pointer and a load and
+ * store of a value in a cache line only the thread writes to. Recording a duration also reads the
+ * monotonic clock, which is done from the vDSO without a syscall. Shards are only ever prepended
+ * to the list of shards, so `format_metrics()` walks it without a lock, while threads collect.
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+/**
+ * @private
+ * @brief Whether metrics are collected, only set before the threads collecting them are started.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+bool _metrics_on = false;
+
+/**
+ * @private
+ * @brief The shard of the calling thread, or `NULL` before it collected a metric.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+static __thread metrics_shard *_metrics_shard = NULL;
+
+/**
+ * @private
+ * @brief The shards of all threads that collected metrics so far.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+_Atomic(metrics_shard *) _metrics_shards = NULL;
+
+/**
+ * @private
+ * @brief The shards whose threads exited.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+metrics_shard *_free_metrics_shards = NULL;
+
+/**
+ * @private
+ * @brief Serializes threads taking and giving back shards, once per thread.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+pthread_mutex_t _metrics_shards_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @private
+ * @brief The key whose destructor gives the shard of an exiting thread back.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+pthread_key_t _metrics_shard_key;
+
+/**
+ * @private
+ * @brief Creates `_metrics_shard_key` once.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+pthread_once_t _metrics_shard_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @private
+ * @brief How the counters are formatted, by `metric_counter`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+const metric_desc _metric_counter_descs[NO_METRIC_COUNTERS] = {
+    {"nanows_connections_total", "", "Connections accepted."},
+    {"nanows_responses_total", "{class=\"2xx\"}", "Requests, by the class of their response."},
+    {"nanows_responses_total", "{class=\"3xx\"}", NULL},
+    {"nanows_responses_total", "{class=\"4xx\"}", NULL},
+    {"nanows_responses_total", "{class=\"5xx\"}", NULL},
+    {"nanows_responses_total", "{class=\"none\"}", NULL},
+    {"nanows_response_body_bytes_total", "", "Bytes of the bodies of the responses."},
+    {"nanows_connection_errors_total", "{reason=\"request\"}",
+     "Connections closed on an error, by what failed."},
+    {"nanows_connection_errors_total", "{reason=\"response\"}", NULL},
+    {"nanows_connection_errors_total", "{reason=\"send\"}", NULL}};
+
+/**
+ * @private
+ * @brief The names of the stages, by `metric_stage`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+const char *_metric_stage_names[NO_METRIC_STAGES] = {"parse", "file_open", "head_send",
+                                                     "body_send"};
+
+/**
+ * @private
+ * @brief Creates `_metrics_shard_key`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+void _create_metrics_shard_key() { pthread_key_create(&_metrics_shard_key, _put_metrics_shard); }
+
+void enable_metrics() { _metrics_on = true; }
+
+bool metrics_enabled() { return _metrics_on; }
+
+uint64_t metrics_now() {
+    struct timespec now;
+
+    if (!_metrics_on)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void add_metric(const metric_counter counter, const uint64_t value) {
+    metrics_shard *shard = _metrics_shard;
+
+    if (!_metrics_on || (shard == NULL && (shard = _get_metrics_shard()) == NULL))
+        return;
+    METRICS_ADD(shard->counters[counter], value);
+}
+
+void add_response_metric(const int status, const off_t body_len) {
+    metrics_shard *shard = _metrics_shard;
+
+    if (!_metrics_on || (shard == NULL && (shard = _get_metrics_shard()) == NULL))
+        return;
+
+    // Statuses outside 200-599 are requests whose connection was closed instead (444).
+    if (status >= 200 && status < 600 && status != 444) {
+        METRICS_ADD(shard->counters[METRIC_RESPONSES_2XX + status / 100 - 2], 1);
+        METRICS_ADD(shard->counters[METRIC_BODY_BYTES], (uint64_t)body_len);
+    } else
+        METRICS_ADD(shard->counters[METRIC_RESPONSES_NONE], 1);
+}
+
+void observe_metric(const metric_stage stage, const uint64_t start) {
+    uint64_t now = 0;
+
+    if (start == 0 || !_metrics_on)
+        return;
+
+    // The clock is monotonic, but a stage may have been started on another CPU.
+    now = metrics_now();
+    _record_metric(stage, (now > start) ? now - start : 0);
+}
+
+size_t format_metrics(char *buf, const size_t size) {
+    uint64_t counters[NO_METRIC_COUNTERS] = {0}, buckets[NO_METRIC_STAGES][METRICS_HIST_BUCKETS],
+             sums[NO_METRIC_STAGES] = {0}, count = 0;
+    const metric_desc *desc = NULL;
+    size_t len = 0;
+    int b_no = 0;
+
+    if (buf == NULL || size == 0)
+        return 0;
+
+    // Each value is read once, so a sum may miss what was collected while summing, but it never
+    // goes down between two calls.
+    memset(buckets, 0, sizeof(buckets));
+    for (metrics_shard *shard = atomic_load(&_metrics_shards); shard != NULL; shard = shard->next) {
+        for (int c_no = 0; c_no < NO_METRIC_COUNTERS; c_no++)
+            counters[c_no] += atomic_load_explicit(&shard->counters[c_no], memory_order_relaxed);
+        for (int s_no = 0; s_no < NO_METRIC_STAGES; s_no++) {
+            for (b_no = 0; b_no < METRICS_HIST_BUCKETS; b_no++)
+                buckets[s_no][b_no] +=
+                    atomic_load_explicit(&shard->buckets[s_no][b_no], memory_order_relaxed);
+            sums[s_no] += atomic_load_explicit(&shard->sums[s_no], memory_order_relaxed);
+        }
+    }
+
+    for (int c_no = 0; c_no < NO_METRIC_COUNTERS; c_no++) {
+        desc = &_metric_counter_descs[c_no];
+        if (desc->help != NULL &&
+            _append_metrics(buf, size, &len, "# HELP %s %s\n# TYPE %s counter\n", desc->name,
+                            desc->help, desc->name) == 0)
+            return 0;
+        if (_append_metrics(buf, size, &len, "%s%s %llu\n", desc->name, desc->labels,
+                            (unsigned long long)counters[c_no]) == 0)
+            return 0;
+    }
+
+    if (_append_metrics(buf, size, &len,
+                        "# HELP nanows_stage_duration_seconds Time taken by the stages of requests."
+                        "\n# TYPE nanows_stage_duration_seconds histogram\n") == 0)
+        return 0;
+
+    // The formatted buckets end at powers of 2, each including the bucket that holds exactly its
+    // power of 2, which is the last bucket of a group (see `_record_metric()`).
+    for (int s_no = 0; s_no < NO_METRIC_STAGES; s_no++) {
+        count = 0;
+        b_no = 0;
+        for (int le_bits = METRICS_HIST_MIN_LE_BITS; le_bits <= METRICS_HIST_MAX_LE_BITS;
+             le_bits++) {
+            for (; b_no <= _get_metrics_bucket(((uint64_t)1 << le_bits) - 1); b_no++)
+                count += buckets[s_no][b_no];
+            if (_append_metrics(buf, size, &len,
+                                "nanows_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} "
+                                "%llu\n",
+                                _metric_stage_names[s_no], (double)((uint64_t)1 << le_bits) / 1e9,
+                                (unsigned long long)count) == 0)
+                return 0;
+        }
+        for (; b_no < METRICS_HIST_BUCKETS; b_no++)
+            count += buckets[s_no][b_no];
+
+        if (_append_metrics(buf, size, &len,
+                            "nanows_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                            "nanows_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n"
+                            "nanows_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+                            _metric_stage_names[s_no], (unsigned long long)count,
+                            _metric_stage_names[s_no], (double)sums[s_no] / 1e9,
+                            _metric_stage_names[s_no], (unsigned long long)count) == 0)
+            return 0;
+    }
+
+    return len;
+}
+
+metrics_shard *_get_metrics_shard() {
+    metrics_shard *shard = NULL;
+
+    pthread_once(&_metrics_shard_once, _create_metrics_shard_key);
+
+    // Threads exiting hand their shard over, so a thread per connection doesn't add a shard each.
+    pthread_mutex_lock(&_metrics_shards_lock);
+    if ((shard = _free_metrics_shards) != NULL) {
+        _free_metrics_shards = shard->next_free;
+    } else if ((shard = aligned_alloc(CACHE_LINE_SIZE, sizeof(metrics_shard))) != NULL) {
+        memset(shard, 0, sizeof(metrics_shard));
+        shard->next_free = NULL;
+        // Shards are summed up without the lock, so the shard is set up before it is seen.
+        shard->next = atomic_load(&_metrics_shards);
+        atomic_store(&_metrics_shards, shard);
+    }
+    pthread_mutex_unlock(&_metrics_shards_lock);
+
+    if (shard != NULL)
+        pthread_setspecific(_metrics_shard_key, shard);
+    return _metrics_shard = shard;
+}
+
+void _put_metrics_shard(void *shard_ptr) {
+    metrics_shard *shard = shard_ptr;
+
+    pthread_mutex_lock(&_metrics_shards_lock);
+    shard->next_free = _free_metrics_shards;
+    _free_metrics_shards = shard;
+    pthread_mutex_unlock(&_metrics_shards_lock);
+}
+
+void _record_metric(const metric_stage stage, const uint64_t nsec) {
+    metrics_shard *shard = _metrics_shard;
+
+    if (!_metrics_on || (shard == NULL && (shard = _get_metrics_shard()) == NULL))
+        return;
+
+    // Prometheus bounds include themselves, so a bucket holds the durations above its lower bound
+    // up to its upper bound: a duration is counted in the bucket of the duration before it.
+    METRICS_ADD(shard->buckets[stage][_get_metrics_bucket((nsec > 0) ? nsec - 1 : 0)], 1);
+    METRICS_ADD(shard->sums[stage], nsec);
+}
+
+int _get_metrics_bucket(const uint64_t nsec) {
+    int msb = 0;
+
+    if (nsec < METRICS_HIST_SUB_BUCKETS)
+        return (int)nsec;
+    if ((nsec >> METRICS_HIST_MAX_BITS) != 0)
+        return METRICS_HIST_BUCKETS - 1;
+
+    // The group of a value is its highest bit, and its bucket in the group the bits below that.
+    msb = 63 - __builtin_clzll(nsec);
+    return (msb - METRICS_HIST_SUB_BITS + 1) * METRICS_HIST_SUB_BUCKETS +
+           (int)(nsec >> (msb - METRICS_HIST_SUB_BITS)) - METRICS_HIST_SUB_BUCKETS;
+}
+
+int _append_metrics(char *buf, const size_t size, size_t *len, const char *format, ...) {
+    va_list args;
+    int line_len = 0;
+
+    va_start(args, format);
+    line_len = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+
+    if (line_len < 0 || (size_t)line_len >= size - *len)
+        return 0;
+    *len += line_len;
+    return 1;
+}
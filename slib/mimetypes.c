@@ -5,123 +5,229 @@
  * Implements functions defined in `include/mimetypes.h`. Used to load and retrive MIME types for
  * file types.
  *
- * MIME types in `mimetypes.h` are defined as a hash table. The hash table is loaded from the file
- * defined by `MIME_CONF_FILE` macro (defined in `include/mimetypes/h`). MIME types file can be
- * changed by defining `CONF_FILE` macro before `#include "mimetypes.h"`.
+ * MIME types are looked up in `mime_table`, a perfect hash table generated into `mimetable.h` from
+ * etc/mimetypes.conf at build time by tools/mimegen.c. The generator searches for a seed with
+ * which every extension gets a slot of its own, so a lookup hashes the extension once and compares
+ * it with the single record in its slot, without touching the heap.
  *
- * `MIME_CONF_FILE` can be expected to be a file where each line is a key-value pair with the format
+ * A MIME types file (by default `MIME_CONF_FILE`) can still be loaded at runtime to override the
+ * generated table. It is expected to be a file where each line is a key-value pair with the format
  * <file extension starting with '.'>=<mime type>. If the line starts with a '#', it is considered a
- *  comment. Keys in `MIME_CONF_FILE` must always be file extensions starting with '.'. With the
- * only exception being *default* case that is used to define the default MIME type for all unknown
- * file extensions. And max length of a value is defined by `MIME_BUF_SIZE` macro (defined in
- * `include/mimetypes/h`).
- *
- * The default case key is defined by `DEFAULT_MIMETYPE_KEY` macro (defined in
- * `include/mimetypes/h`). If `DEFAULT_MIMETYPE_KEY` can be changed by defining `CONF_FILE` macro
- * before `#include "mimetypes.h"`. In which case, the key for default MIME type must be changed as
- * well.
+ * comment. Keys must always be file extensions starting with '.'. With the only exception being
+ * *default* case (defined by `DEFAULT_MIMETYPE_KEY`) that is used to define the default MIME type
+ * for all unknown file extensions. And max length of a record is defined by `MIME_BUF_SIZE` macro.
+ * Loaded records are kept in an open addressing hash table, looked up before the generated one.
  *
  * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
  * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
  * @bug No known bugs.
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include "helpers.h"
 #include "mimetypes.h"
+#include "mimetable.h"
+
+/**
+ * @private
+ * @brief Hash table of the MIME types loaded from a file, `NULL` if none are loaded.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+mime_record *_mime_overrides = NULL;
 
 /**
  * @private
- * @brief Hash table for MIME types.
+ * @brief The number of slots in `_mime_overrides`, a power of 2.
  *
  * This is a private object and should not be accessed directly.
  */
-GHashTable *_mime_htab = NULL;
+size_t _mime_overrides_size = 0;
 
-int create_mime_table() {
-    if (_mime_htab != NULL)
+/**
+ * @private
+ * @brief The number of records in `_mime_overrides`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+size_t _mime_overrides_count = 0;
+
+/**
+ * @private
+ * @brief The default MIME type loaded from a file, `NULL` if the generated one is used.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+char *_mime_default_override = NULL;
+
+int create_mime_table() { return load_mime_table(MIME_CONF_FILE); }
+
+int load_mime_table(const char *path) {
+    if (_mime_overrides != NULL || _mime_default_override != NULL)
         return 2;
 
     FILE *mime_file = NULL;
-    char *buf = calloc(MIME_BUF_SIZE, sizeof(char));
+    char buf[MIME_BUF_SIZE], *line = NULL, *key = NULL, *value = NULL;
+    int r_val = 1;
 
-    if ((_mime_htab = g_hash_table_new_full(g_str_hash, g_str_equal, _mime_htab_key_destroy,
-                                            _mime_htab_value_destroy)) == NULL)
+    if (path == NULL || (mime_file = fopen(path, "r")) == NULL)
         return 0;
 
-    if ((mime_file = fopen(MIME_CONF_FILE, "r")) == NULL)
-        return 0;
+    while (r_val == 1 && fgets(buf, MIME_BUF_SIZE, mime_file) != NULL) {
+        line = trim(buf);
+        if (line[0] == '#' || (value = strchr(line, '=')) == NULL)
+            continue;
 
-    while (fgets(buf, MIME_BUF_SIZE, mime_file) != NULL) {
-        buf = trim(buf);
-        if (buf[0] == '#')
+        *value++ = '\0';
+        key = trim(line);
+        value = trim(value);
+        if (value[0] == '\0')
             continue;
 
-        char *key = strdup(strtok(buf, "="));
-        char *value = strdup(strtok(NULL, "\n"));
-        g_hash_table_insert(_mime_htab, key, value);
+        if (strcmp(key, DEFAULT_MIMETYPE_KEY) == 0) {
+            free(_mime_default_override);
+            if ((_mime_default_override = strdup(value)) == NULL)
+                r_val = 0;
+        } else if (key[0] == '.' && strlen(key) <= MIME_EXT_MAX_LEN) {
+            r_val = _add_mime_record(key, value);
+        }
     }
 
-    if (mime_file != NULL)
-        fclose(mime_file);
-    free(buf);
-    return 1;
+    fclose(mime_file);
+    if (r_val == 0)
+        destroy_mime_table();
+    return r_val;
 }
 
 void destroy_mime_table() {
-    if (_mime_htab == NULL)
-        return;
+    if (_mime_overrides != NULL) {
+        for (size_t s_no = 0; s_no < _mime_overrides_size; s_no++) {
+            free((char *)_mime_overrides[s_no].ext);
+            free((char *)_mime_overrides[s_no].mimetype);
+        }
+        free(_mime_overrides);
+    }
+    free(_mime_default_override);
 
-    g_hash_table_destroy(_mime_htab);
-    _mime_htab = NULL;
+    _mime_overrides = NULL;
+    _mime_overrides_size = _mime_overrides_count = 0;
+    _mime_default_override = NULL;
 }
 
 const char *get_mimetype_for_ext(const char *ext, char *mimetype) {
-    // TODO: create errno with message "Mime table not found. Call create_mime_table()"
-    if (_mime_htab == NULL)
-        return NULL;
-
-    // TODO: create errno with message "mimetype is NULL."
-    // if(mimetype == NULL) return NULL;
-
-    const char *_minetype = NULL;
-    if ((_minetype = g_hash_table_lookup(_mime_htab, ext)) != NULL) {
-        if (mimetype != NULL)
-            strcpy(mimetype, _minetype);
-        return _minetype;
+    const char *_mimetype = NULL;
+    size_t len = (ext != NULL) ? strnlen(ext, MIME_EXT_MAX_LEN + 1) : 0;
+
+    if (len > 0 && len <= MIME_EXT_MAX_LEN) {
+        if (_mime_overrides != NULL)
+            _mimetype =
+                _lookup_mime_table(_mime_overrides, _mime_overrides_size, 0, true, ext, len);
+        if (_mimetype == NULL)
+            _mimetype = _lookup_mime_table(mime_table, MIME_TABLE_SIZE, MIME_TABLE_SEED, false, ext,
+                                           len);
     }
 
-    if ((_minetype = g_hash_table_lookup(_mime_htab, DEFAULT_MIMETYPE_KEY)) != NULL) {
-        if (mimetype != NULL)
-            strcpy(mimetype, _minetype);
-        return _minetype;
-    }
+    if (_mimetype == NULL)
+        _mimetype = (_mime_default_override != NULL) ? _mime_default_override : MIME_TABLE_DEFAULT;
 
-    return NULL;
+    if (mimetype != NULL)
+        strcpy(mimetype, _mimetype);
+    return _mimetype;
 }
 
 const char *get_mimetype_for_url(const char *url, char *mimetype) {
     return get_mimetype_for_ext(_get_ext_for_url(url), mimetype);
-    return NULL;
 }
 
 char *_get_ext_for_url(const char *url) {
     char *dot = strrchr(url, '.');
-    if (!dot || dot == url)
+
+    // A dot before the last '/' belongs to a directory, not to the file.
+    if (!dot || dot == url || strchr(dot, '/') != NULL)
         return NULL;
     return dot;
 }
 
-void _mime_htab_key_destroy(gpointer data) {
-    free(data);
-    data = NULL;
+uint32_t _hash_mime_ext(const char *ext, const size_t len, const uint32_t seed) {
+    uint32_t hash = MIME_HASH_BASIS ^ seed;
+
+    for (size_t c_no = 0; c_no < len; c_no++)
+        hash = MIME_HASH_STEP(hash, ext[c_no]);
+    return hash;
+}
+
+const char *_lookup_mime_table(const mime_record *table, const size_t size, const uint32_t seed,
+                               const bool probe, const char *ext, const size_t len) {
+    size_t slot = MIME_HASH_SLOT(_hash_mime_ext(ext, len, seed), size);
+
+    for (; table[slot].ext != NULL; slot = (slot + 1) & (size - 1)) {
+        if (table[slot].ext_len == len && strncasecmp(table[slot].ext, ext, len) == 0)
+            return table[slot].mimetype;
+        if (!probe)
+            break;
+    }
+
+    return NULL;
 }
 
-void _mime_htab_value_destroy(gpointer data) {
-    free(data);
-    data = NULL;
+int _add_mime_record(char *ext, const char *mimetype) {
+    size_t len = strlen(ext), slot = 0;
+    mime_record *records = NULL;
+    char *_mimetype = NULL;
+
+    for (size_t c_no = 0; c_no < len; c_no++)
+        ext[c_no] = tolower((unsigned char)ext[c_no]);
+
+    // Keep the table at most half full, so probing stays short and always ends at an empty slot.
+    if ((_mime_overrides_count + 1) * 2 > _mime_overrides_size) {
+        size_t size = (_mime_overrides_size != 0) ? _mime_overrides_size * 2 : 64;
+
+        if ((records = calloc(size, sizeof(mime_record))) == NULL)
+            return 0;
+
+        for (size_t s_no = 0; s_no < _mime_overrides_size; s_no++) {
+            if (_mime_overrides[s_no].ext == NULL)
+                continue;
+
+            slot = MIME_HASH_SLOT(_hash_mime_ext(_mime_overrides[s_no].ext,
+                                                 _mime_overrides[s_no].ext_len, 0),
+                                  size);
+            while (records[slot].ext != NULL)
+                slot = (slot + 1) & (size - 1);
+            records[slot] = _mime_overrides[s_no];
+        }
+
+        free(_mime_overrides);
+        _mime_overrides = records;
+        _mime_overrides_size = size;
+    }
+
+    if ((_mimetype = strdup(mimetype)) == NULL)
+        return 0;
+
+    slot = MIME_HASH_SLOT(_hash_mime_ext(ext, len, 0), _mime_overrides_size);
+    while (_mime_overrides[slot].ext != NULL) {
+        if (_mime_overrides[slot].ext_len == len && strcmp(_mime_overrides[slot].ext, ext) == 0) {
+            free((char *)_mime_overrides[slot].mimetype);
+            _mime_overrides[slot].mimetype = _mimetype;
+            return 1;
+        }
+        slot = (slot + 1) & (_mime_overrides_size - 1);
+    }
+
+    if ((_mime_overrides[slot].ext = strdup(ext)) == NULL) {
+        free(_mimetype);
+        return 0;
+    }
+    _mime_overrides[slot].ext_len = len;
+    _mime_overrides[slot].mimetype = _mimetype;
+    _mime_overrides_count++;
+
+    return 1;
 }
@@ -0,0 +1,114 @@
+/**
+ * @file slib/rcu.c
+ * @brief A pointer published with read-copy-update (RCU) semantics.
+ *
+ * Implements functions defined in `include/rcu.h`. Used to publish the configuration of the server,
+ * so requests read it without locks while it is reloaded.
+ *
+ * A reader increments the count of the current parity, then checks that the parity didn't flip in
+ * between. If it did, the writer may have missed the increment, so the reader moves to the new
+ * parity. A reader that got past the check is seen by the writer waiting for that parity, and it
+ * only loads the pointer after the check, so a reader holding the old object is always waited for.
+ *
+ * @see typedef struct rcu_ptr
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rcu.h"
+
+rcu_ptr *create_rcu_ptr(void *value) {
+    rcu_ptr *ptr = NULL;
+
+    if ((ptr = aligned_alloc(CACHE_LINE_SIZE, sizeof(rcu_ptr))) == NULL)
+        return NULL;
+
+    if (pthread_mutex_init(&ptr->publish_lock, NULL) != 0) {
+        free(ptr);
+        return NULL;
+    }
+    atomic_init(&ptr->value, value);
+    atomic_init(&ptr->grace_period, 0);
+    for (int s_no = 0; s_no < RCU_READER_SHARDS; s_no++) {
+        atomic_init(&ptr->readers[s_no].count[0], 0);
+        atomic_init(&ptr->readers[s_no].count[1], 0);
+    }
+
+    return ptr;
+}
+
+void *acquire_rcu_ptr(rcu_ptr *ptr, int *token) {
+    int shard = _get_rcu_shard(), parity = 0;
+    unsigned long grace_period = 0;
+
+    while (true) {
+        grace_period = atomic_load(&ptr->grace_period);
+        parity = grace_period & 1;
+        atomic_fetch_add(&ptr->readers[shard].count[parity], 1);
+        if (atomic_load(&ptr->grace_period) == grace_period)
+            break;
+        atomic_fetch_sub(&ptr->readers[shard].count[parity], 1);
+    }
+
+    *token = shard * 2 + parity;
+    return atomic_load(&ptr->value);
+}
+
+void release_rcu_ptr(rcu_ptr *ptr, const int token) {
+    atomic_fetch_sub_explicit(&ptr->readers[token / 2].count[token % 2], 1, memory_order_release);
+}
+
+void *publish_rcu_ptr(rcu_ptr *ptr, void *value) {
+    void *old_value = NULL;
+    int parity = 0;
+
+    pthread_mutex_lock(&ptr->publish_lock);
+    old_value = atomic_exchange(&ptr->value, value);
+    parity = atomic_fetch_add(&ptr->grace_period, 1) & 1;
+
+    // New readers count for the other parity now, so only the readers entered before are left.
+    while (_count_rcu_readers(ptr, parity) != 0)
+        usleep(RCU_GRACE_POLL_USEC);
+    pthread_mutex_unlock(&ptr->publish_lock);
+
+    return old_value;
+}
+
+void *destroy_rcu_ptr(rcu_ptr *ptr) {
+    void *value = NULL;
+
+    if (ptr == NULL)
+        return NULL;
+
+    value = atomic_load(&ptr->value);
+    pthread_mutex_destroy(&ptr->publish_lock);
+    free(ptr);
+    return value;
+}
+
+int _get_rcu_shard() {
+    int cpu = sched_getcpu();
+
+    // Without the CPU number, threads are spread by their (aligned) thread id instead.
+    if (cpu < 0)
+        cpu = (int)(((uintptr_t)pthread_self() >> 12) & INT32_MAX);
+    return cpu % RCU_READER_SHARDS;
+}
+
+long _count_rcu_readers(rcu_ptr *ptr, const int parity) {
+    long no_readers = 0;
+
+    for (int s_no = 0; s_no < RCU_READER_SHARDS; s_no++)
+        no_readers += atomic_load(&ptr->readers[s_no].count[parity]);
+    return no_readers;
+}
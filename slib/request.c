@@ -10,6 +10,14 @@
  * file descriptor. `struct request` can be used to created a response (defined in
  * `include/response.h`) to send the response back to the client.
  *
+ * Requests are parsed by a resumable state machine, which records the parts of the request head as
+ * slices (offset and length) into the buffer the request was received into, instead of copying
+ * them. A request head received over several `recv()` calls is parsed as the bytes arrive.
+ *
+ * Most bytes of a request head can't end the part they belong to, so the parser skips them with a
+ * vectorized scanning kernel (AVX2 or SSE4.2 on x86-64, chosen at load time using CPUID, with a
+ * scalar fallback) and only steps through the delimiters one byte at a time.
+ *
  * Max size of a request is defined by `REQ_BUF_SIZE` macro (defined in `include/request.h`). This
  * value can be changed by defining `REQ_BUF_SIZE` before `#include "request.h"`.
  *
@@ -24,28 +32,234 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "metrics.h"
 #include "request.h"
 
+/**
+ * @private
+ * @brief The scanning kernel used by the parser, selected when the library is loaded.
+ */
+static request_scanner request_scan = _scan_request_scalar;
+
+/**
+ * @private
+ * @brief Selects the scanning kernel once, before any request can be parsed.
+ */
+__attribute__((constructor)) static void _init_request_scanner() {
+    request_scan = _select_request_scanner();
+}
+
 request *get_request(const int conn_fd) {
     char req_buf[REQ_BUF_SIZE];
-    if (recv(conn_fd, req_buf, REQ_BUF_SIZE, 0) < 0)
+    ssize_t recv_size = 0;
+
+    // A closed connection (0) or an idle timeout (-1) ends a keep-alive connection.
+    if ((recv_size = recv(conn_fd, req_buf, REQ_BUF_SIZE - 1, 0)) <= 0)
         return NULL;
+    req_buf[recv_size] = '\0';
 
     return parse_request(req_buf, conn_fd);
 }
 
-request *parse_request(const char *req_buf, const int conn_fd) {
-    request *req = _initialize_request();
+int get_requests(const int conn_fd, request_buf *req_buf, arena *mem, request **reqs,
+                 const int max_reqs) {
+    request *req = NULL;
+    parse_status status = PARSE_INCOMPLETE;
+    ssize_t recv_size = 0;
+    int no_reqs = 0;
+
+    // The requests of the last batch were freed, so their bytes can be dropped.
+    if (req_buf->start > 0) {
+        req_buf->len -= req_buf->start;
+        memmove(req_buf->data, req_buf->data + req_buf->start, req_buf->len);
+        req_buf->start = 0;
+    }
+
+    while (no_reqs < max_reqs) {
+        if ((req = create_request_in_arena(mem, conn_fd)) == NULL)
+            break;
+
+        while ((status = parse_request_buf(req, req_buf->data + req_buf->start,
+                                           req_buf->len - req_buf->start)) == PARSE_INCOMPLETE) {
+            // Only wait for more bytes if no request is complete yet. A partial request after
+            // complete ones is parsed again on the next call.
+            if (no_reqs > 0 || req_buf->len >= REQ_BUF_SIZE)
+                break;
+
+            // A closed connection (0) or an idle timeout (-1) ends a keep-alive connection.
+            recv_size = recv(conn_fd, req_buf->data + req_buf->len, REQ_BUF_SIZE - req_buf->len, 0);
+            if (recv_size <= 0)
+                break;
+            req_buf->len += recv_size;
+        }
+
+        if (status != PARSE_COMPLETE) {
+            _free_request(req);
+            break;
+        }
+
+        reqs[no_reqs++] = req;
+        req_buf->start += req->head_size;
+    }
+
+    return no_reqs;
+}
+
+request *create_request(const int conn_fd) { return create_request_in_arena(NULL, conn_fd); }
+
+request *create_request_in_arena(arena *mem, const int conn_fd) {
+    request *req = _initialize_request_in_arena(mem);
     if (req == NULL)
         return NULL;
 
     req->conn_fd = conn_fd;
-    if (_parse_request(req_buf, req) == 0)
+    return req;
+}
+
+parse_status parse_request_buf(request *req, char *buf, const size_t buf_len) {
+    parse_status status = PARSE_ERROR;
+    uint64_t start = 0;
+
+    if (req == NULL || buf == NULL)
+        return PARSE_ERROR;
+    if (req->state == PARSE_DONE)
+        return PARSE_COMPLETE;
+
+    start = metrics_now();
+    if ((status = _parse_request_buf(req, buf, buf_len)) == PARSE_COMPLETE)
+        observe_metric(STAGE_PARSE, start);
+    return status;
+}
+
+parse_status _parse_request_buf(request *req, char *buf, const size_t buf_len) {
+    unsigned char c = 0;
+
+    req->buf = buf;
+    for (size_t pos = req->parse_pos; pos < buf_len; pos++) {
+        if ((pos = _skip_request_bytes(req, buf, pos, buf_len)) == buf_len)
+            break;
+        c = buf[pos];
+
+        switch (req->state) {
+        case PARSE_METHOD:
+            if (c == ' ') {
+                if (pos == 0)
+                    return PARSE_ERROR;
+                req->method_slice = (req_slice){.off = 0, .len = pos};
+                req->tok_off = pos + 1;
+                req->state = PARSE_URL;
+            } else if (c < ' ' || c == 0x7f)
+                return PARSE_ERROR;
+            break;
+
+        case PARSE_URL:
+            if (c == ' ') {
+                if (pos == req->tok_off)
+                    return PARSE_ERROR;
+                req->url_slice = (req_slice){.off = req->tok_off, .len = pos - req->tok_off};
+                req->tok_off = pos + 1;
+                req->state = PARSE_VERSION;
+            } else if (c < ' ' || c == 0x7f)
+                return PARSE_ERROR;
+            break;
+
+        case PARSE_VERSION:
+            if (c == '\r') {
+                if (pos == req->tok_off)
+                    return PARSE_ERROR;
+                req->ver_slice = (req_slice){.off = req->tok_off, .len = pos - req->tok_off};
+                req->state = PARSE_VERSION_LF;
+            } else if (c < ' ' || c == 0x7f)
+                return PARSE_ERROR;
+            break;
+
+        case PARSE_VERSION_LF:
+        case PARSE_HEADER_LF:
+            if (c != '\n')
+                return PARSE_ERROR;
+            if (req->state == PARSE_HEADER_LF)
+                req->no_headers++;
+            req->state = PARSE_HEADER_START;
+            break;
+
+        case PARSE_HEADER_START:
+            if (c == '\r') {
+                req->state = PARSE_HEAD_LF;
+                break;
+            }
+            if (req->no_headers >= MAX_REQ_HEADERS || c == ':' || c <= ' ' || c == 0x7f)
+                return PARSE_ERROR;
+            req->tok_off = pos;
+            req->state = PARSE_HEADER_KEY;
+            break;
+
+        case PARSE_HEADER_KEY:
+            if (c == ':') {
+                req->headers[req->no_headers].key =
+                    (req_slice){.off = req->tok_off, .len = pos - req->tok_off};
+                _index_request_header(req, lookup_header(buf + req->tok_off, pos - req->tok_off));
+                req->state = PARSE_HEADER_VALUE_START;
+            } else if (c <= ' ' || c == 0x7f)
+                return PARSE_ERROR;
+            break;
+
+        case PARSE_HEADER_VALUE_START:
+            if (c == ' ' || c == '\t')
+                break;
+            // The byte is the first byte of the value, or the end of an empty value.
+            req->tok_off = pos;
+            req->tok_end = pos;
+            req->state = PARSE_HEADER_VALUE;
+            // fall through
+
+        case PARSE_HEADER_VALUE:
+            if (c == '\r') {
+                req->headers[req->no_headers].value =
+                    (req_slice){.off = req->tok_off, .len = req->tok_end - req->tok_off};
+                req->state = PARSE_HEADER_LF;
+            } else if (c != ' ' && c != '\t') {
+                if (c < ' ' || c == 0x7f)
+                    return PARSE_ERROR;
+                req->tok_end = pos + 1;
+            }
+            break;
+
+        case PARSE_HEAD_LF:
+            if (c != '\n')
+                return PARSE_ERROR;
+            req->head_size = pos + 1;
+            req->parse_pos = pos + 1;
+            req->state = PARSE_DONE;
+            _complete_request(req);
+            return PARSE_COMPLETE;
+
+        default:
+            return PARSE_ERROR;
+        }
+    }
+
+    req->parse_pos = buf_len;
+    return PARSE_INCOMPLETE;
+}
+
+request *parse_request(const char *req_buf, const int conn_fd) {
+    request *req = create_request(conn_fd);
+    if (req == NULL)
         return NULL;
 
+    if (_parse_request(req_buf, req) == 0) {
+        _free_request(req);
+        return NULL;
+    }
+
     return req;
 }
 
@@ -58,21 +272,148 @@ void close_request(request *req) {
 }
 
 const char *get_request_header(const request *req, const char *header_key, char *header_val) {
-    if (req == NULL || header_key == NULL)
+    const char *_header_val = NULL;
+    http_header header = HDR_UNKNOWN;
+
+    if (req == NULL || header_key == NULL || req->state != PARSE_DONE)
         return NULL;
 
-    const char *_header_val = NULL;
-    if ((_header_val = g_hash_table_lookup(req->header_htab, header_key)) != NULL) {
-        if (header_val != NULL)
-            strcpy(header_val, _header_val);
-        return _header_val;
+    if ((header = lookup_header(header_key, strlen(header_key))) != HDR_UNKNOWN)
+        _header_val = get_known_request_header(req, header);
+    else {
+        for (int u_no = 0; u_no < req->no_unknown_headers; u_no++) {
+            const req_header *unknown = &req->headers[req->unknown_headers[u_no]];
+            if (strcasecmp(req->buf + unknown->key.off, header_key) == 0) {
+                _header_val = req->buf + unknown->value.off;
+                break;
+            }
+        }
+    }
+
+    if (_header_val != NULL && header_val != NULL)
+        strcpy(header_val, _header_val);
+    return _header_val;
+}
+
+const char *get_known_request_header(const request *req, const http_header header) {
+    if (req == NULL || req->state != PARSE_DONE || header < 0 || header >= NO_KNOWN_HEADERS)
+        return NULL;
+    if (req->header_slots[header] == 0)
+        return NULL;
+
+    return req->buf + req->headers[req->header_slots[header] - 1].value.off;
+}
+
+int get_encoding_quality(const request *req, const char *coding) {
+    const char *accept = get_known_request_header(req, HDR_ACCEPT_ENCODING), *param = NULL;
+    size_t coding_len = (coding != NULL) ? strlen(coding) : 0, token_len = 0;
+    int quality = 0, wildcard = 0;
+
+    if (accept == NULL || coding_len == 0)
+        return 0;
+
+    while (*accept != '\0') {
+        accept += strspn(accept, " \t,");
+        token_len = strcspn(accept, " \t,;");
+        if (token_len == 0)
+            break;
+
+        // Only the `q` parameter matters, anything else is skipped up to the next coding.
+        quality = 1000;
+        param = accept + token_len;
+        while (*param != '\0' && *param != ',') {
+            if (*param++ != ';')
+                continue;
+            param += strspn(param, " \t");
+            if ((*param == 'q' || *param == 'Q') && param[1] == '=')
+                quality = _parse_quality(param + 2);
+        }
+
+        if (token_len == coding_len && strncasecmp(accept, coding, coding_len) == 0)
+            return quality;
+        if (token_len == 1 && *accept == '*')
+            wildcard = quality;
+        accept = param;
     }
 
-    return NULL;
+    return wildcard;
 }
 
-request *_initialize_request() {
-    request *req = malloc(sizeof(request));
+int match_request_etag(const request *req, const http_header header, const char *etag) {
+    const char *tags = get_known_request_header(req, header);
+    size_t etag_len = (etag != NULL) ? strlen(etag) : 0, tag_len = 0;
+
+    if (tags == NULL || etag_len == 0)
+        return 0;
+    if (etag_len > 2 && strncmp(etag, "W/", 2) == 0) {
+        etag += 2;
+        etag_len -= 2;
+    }
+
+    while (*tags != '\0') {
+        tags += strspn(tags, " \t,");
+        tag_len = strcspn(tags, ",");
+        while (tag_len > 0 && (tags[tag_len - 1] == ' ' || tags[tag_len - 1] == '\t'))
+            tag_len--;
+
+        if (tag_len == 1 && *tags == '*')
+            return 1;
+        if ((tag_len == etag_len && strncmp(tags, etag, etag_len) == 0) ||
+            (tag_len == etag_len + 2 && strncmp(tags, "W/", 2) == 0 &&
+             strncmp(tags + 2, etag, etag_len) == 0))
+            return 1;
+        tags += tag_len;
+    }
+
+    return 0;
+}
+
+int get_request_ranges(const request *req, const off_t size, byte_range *ranges,
+                       const int max_ranges) {
+    const char *spec = get_known_request_header(req, HDR_RANGE);
+    off_t first = 0, last = 0;
+    int no_ranges = 0, no_listed = 0;
+
+    if (spec == NULL || ranges == NULL || strncasecmp(spec, "bytes=", 6) != 0)
+        return 0;
+
+    for (spec += 6; *(spec += strspn(spec, " \t,")) != '\0'; no_listed++) {
+        // A suffix range (`-N`) asks for the last N bytes.
+        if (*spec == '-') {
+            if ((last = _parse_byte_offset(spec + 1, &spec)) < 0)
+                return 0;
+            first = (last < size) ? size - last : 0;
+            last = (last > 0) ? size - 1 : -1;
+        } else {
+            if ((first = _parse_byte_offset(spec, &spec)) < 0 || *spec++ != '-')
+                return 0;
+            last = size - 1;
+            if (*spec >= '0' && *spec <= '9' &&
+                ((last = _parse_byte_offset(spec, &spec)) < first))
+                return 0;
+        }
+
+        spec += strspn(spec, " \t");
+        if (*spec != ',' && *spec != '\0')
+            return 0;
+        if (first >= size || last < first)
+            continue;
+        if (no_ranges == max_ranges)
+            return 0;
+
+        ranges[no_ranges].start = first;
+        ranges[no_ranges++].end = (last < size) ? last + 1 : size;
+    }
+
+    if (no_listed == 0)
+        return 0;
+    return (no_ranges > 0) ? no_ranges : -1;
+}
+
+request *_initialize_request() { return _initialize_request_in_arena(NULL); }
+
+request *_initialize_request_in_arena(arena *mem) {
+    request *req = (mem != NULL) ? arena_alloc(mem, sizeof(request)) : malloc(sizeof(request));
     if (req == NULL)
         return NULL;
 
@@ -80,10 +421,17 @@ request *_initialize_request() {
     req->http_method = NULL;
     req->url = NULL;
     req->http_ver = NULL;
-    if ((req->header_htab =
-             g_hash_table_new_full(g_str_hash, g_str_equal, _req_header_htab_key_destroy,
-                                   _req_header_htab_value_destroy)) == NULL)
-        return NULL;
+    req->buf = NULL;
+    req->owned_buf = NULL;
+    req->mem = mem;
+    req->no_headers = 0;
+    memset(req->header_slots, 0, sizeof(req->header_slots));
+    req->no_unknown_headers = 0;
+    req->state = PARSE_METHOD;
+    req->parse_pos = 0;
+    req->tok_off = 0;
+    req->tok_end = 0;
+    req->head_size = 0;
 
     return req;
 }
@@ -94,59 +442,174 @@ int _parse_request(const char *req_buf, request *req) {
     if (req == NULL)
         return 0;
 
-    char *req_buff = strdup(req_buf);
+    if ((req->owned_buf = strdup(req_buf)) == NULL)
+        return 0;
 
-    req->http_method = strdup(strtok(req_buff, " "));
-    req->url = strdup(strtok(NULL, " "));
-    req->http_ver = strdup(strtok(NULL, "\r"));
+    return parse_request_buf(req, req->owned_buf, strlen(req->owned_buf)) == PARSE_COMPLETE;
+}
 
-    char *header_key, *header_val;
-    char *key, *value;
+void _free_request(request *req) {
+    if (req == NULL || req->mem != NULL)
+        return;
 
-    while ((header_key = strtok(NULL, ":")) != NULL && (header_val = strtok(NULL, "\r")) != NULL) {
-        key = strdup(header_key + 1);
-        value = strdup(header_val + 1);
-        g_hash_table_insert(req->header_htab, key, value);
-    }
+    free(req->owned_buf);
+    req->owned_buf = NULL;
 
-    free(req_buff);
-    return 1;
+    free(req);
+    req = NULL;
 }
 
-void _free_request(request *req) {
-    if (req == NULL)
-        return;
+void _complete_request(request *req) {
+    char *buf = req->buf;
 
-    if (req->header_htab != NULL) {
-        g_hash_table_destroy(req->header_htab);
-        req->header_htab = NULL;
+    // Each part is followed by its delimiter (' ', ':' or '\r'), which is no longer needed.
+    buf[req->method_slice.off + req->method_slice.len] = '\0';
+    buf[req->url_slice.off + req->url_slice.len] = '\0';
+    buf[req->ver_slice.off + req->ver_slice.len] = '\0';
+
+    for (int h_no = 0; h_no < req->no_headers; h_no++) {
+        buf[req->headers[h_no].key.off + req->headers[h_no].key.len] = '\0';
+        buf[req->headers[h_no].value.off + req->headers[h_no].value.len] = '\0';
     }
 
-    if (req->http_method != NULL) {
-        free(req->http_method);
-        req->http_method = NULL;
+    req->http_method = buf + req->method_slice.off;
+    req->url = buf + req->url_slice.off;
+    req->http_ver = buf + req->ver_slice.off;
+}
+
+void _index_request_header(request *req, const http_header header) {
+    // Only the first of repeated known headers gets the slot, like a search in order would find.
+    if (header == HDR_UNKNOWN)
+        req->unknown_headers[req->no_unknown_headers++] = req->no_headers;
+    else if (req->header_slots[header] == 0)
+        req->header_slots[header] = req->no_headers + 1;
+}
+
+int _parse_quality(const char *value) {
+    int quality = 0, scale = 100;
+
+    // A quality is `0` or `1`, with up to three decimals.
+    if (*value != '0' && *value != '1')
+        return 0;
+    quality = (*value++ - '0') * 1000;
+    if (*value++ != '.')
+        return quality;
+
+    for (; scale > 0 && *value >= '0' && *value <= '9'; scale /= 10)
+        quality += (*value++ - '0') * scale;
+
+    return (quality > 1000) ? 1000 : quality;
+}
+
+off_t _parse_byte_offset(const char *value, const char **end) {
+    off_t offset = 0;
+
+    if (*value < '0' || *value > '9')
+        return -1;
+
+    for (; *value >= '0' && *value <= '9'; value++) {
+        if (offset > (INT64_MAX - 9) / 10)
+            return -1;
+        offset = offset * 10 + (*value - '0');
     }
 
-    if (req->url != NULL) {
-        free(req->url);
-        req->url = NULL;
+    *end = value;
+    return offset;
+}
+
+size_t _skip_request_bytes(request *req, const char *buf, size_t pos, const size_t buf_len) {
+    size_t end = pos;
+
+    switch (req->state) {
+    case PARSE_METHOD:
+    case PARSE_URL:
+        return request_scan(buf, pos, buf_len, ' ', 0x7f);
+
+    case PARSE_VERSION:
+        return request_scan(buf, pos, buf_len, ' ' - 1, 0x7f);
+
+    case PARSE_HEADER_KEY:
+        return request_scan(buf, pos, buf_len, ' ', ':');
+
+    case PARSE_HEADER_VALUE:
+        // Stops at '\r' and at tabs, which are allowed in values but are whitespace.
+        end = request_scan(buf, pos, buf_len, ' ' - 1, 0x7f);
+        for (size_t v_pos = end; v_pos > pos; v_pos--) {
+            if (buf[v_pos - 1] != ' ') {
+                req->tok_end = v_pos;
+                break;
+            }
+        }
+        return end;
+
+    default:
+        return pos;
     }
+}
 
-    if (req->http_ver != NULL) {
-        free(req->http_ver);
-        req->http_ver = NULL;
+request_scanner _select_request_scanner() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return _scan_request_avx2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return _scan_request_sse42;
+#endif
+    return _scan_request_scalar;
+}
+
+size_t _scan_request_scalar(const char *buf, size_t pos, const size_t buf_len,
+                            const unsigned char max_ctl, const unsigned char delim) {
+    for (; pos < buf_len; pos++) {
+        unsigned char c = buf[pos];
+        if (c <= max_ctl || c == 0x7f || c == delim)
+            break;
     }
 
-    free(req);
-    req = NULL;
+    return pos;
 }
 
-void _req_header_htab_key_destroy(gpointer data) {
-    free(data);
-    data = NULL;
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) size_t _scan_request_sse42(const char *buf, size_t pos,
+                                                             const size_t buf_len,
+                                                             const unsigned char max_ctl,
+                                                             const unsigned char delim) {
+    // Three ranges of bytes to stop at: control characters, DEL and the delimiter.
+    const __m128i ranges = _mm_setr_epi8(0, max_ctl, 0x7f, 0x7f, delim, delim, 0, 0, 0, 0, 0, 0, 0,
+                                         0, 0, 0);
+
+    for (; pos + 16 <= buf_len; pos += 16) {
+        __m128i data = _mm_loadu_si128((const __m128i *)(buf + pos));
+        int idx = _mm_cmpestri(ranges, 6, data, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16)
+            return pos + idx;
+    }
+
+    return _scan_request_scalar(buf, pos, buf_len, max_ctl, delim);
 }
 
-void _req_header_htab_value_destroy(gpointer data) {
-    free(data);
-    data = NULL;
+__attribute__((target("avx2"))) size_t _scan_request_avx2(const char *buf, size_t pos,
+                                                           const size_t buf_len,
+                                                           const unsigned char max_ctl,
+                                                           const unsigned char delim) {
+    const __m256i ctl_max = _mm256_set1_epi8(max_ctl);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i delims = _mm256_set1_epi8(delim);
+
+    for (; pos + 32 <= buf_len; pos += 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i *)(buf + pos));
+
+        // Unsigned `data <= max_ctl`, as there is no unsigned byte compare.
+        __m256i match = _mm256_cmpeq_epi8(_mm256_min_epu8(data, ctl_max), data);
+        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(data, del));
+        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(data, delims));
+
+        unsigned mask = _mm256_movemask_epi8(match);
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+    }
+
+    return _scan_request_scalar(buf, pos, buf_len, max_ctl, delim);
 }
+#endif
@@ -22,98 +22,198 @@
  * @bug No known bugs.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "response.h"
 
-response *create_response(const int conn_fd) {
-    response *res = _initialize_response();
+response *create_response(const int conn_fd) { return create_response_in_arena(NULL, conn_fd); }
+
+response *create_response_in_arena(arena *mem, const int conn_fd) {
+    response *res = _initialize_response_in_arena(mem);
     if (res == NULL)
         return NULL;
 
-    res->conn_fd = dup(conn_fd);
+    if (conn_fd != -1)
+        res->conn_fd = dup(conn_fd);
     return res;
 }
 
 response *create_response_from_request(const request *req) {
-    response *res = create_response(req->conn_fd);
+    response *res = create_response_in_arena(req->mem, req->conn_fd);
     if (res == NULL)
         return NULL;
 
-    res->http_ver = strdup(req->http_ver);
+    res->http_ver = _copy_response_str(res, req->http_ver);
     return res;
 }
 
 const char *get_response_header(const response *res, const char *header_key, char *header_val) {
+    const char *_header_val = NULL;
+    http_header header = HDR_UNKNOWN;
+    int h_no = -1;
+
     if (res == NULL || header_key == NULL)
         return NULL;
 
-    const char *_header_val = NULL;
-    if ((_header_val = g_hash_table_lookup(res->header_htab, header_key)) != NULL) {
-        if (header_val != NULL)
-            strcpy(header_val, _header_val);
-        return _header_val;
-    }
+    if ((header = lookup_header(header_key, strlen(header_key))) != HDR_UNKNOWN)
+        h_no = res->header_slots[header] - 1;
+    else
+        h_no = _find_unknown_response_header(res, header_key);
+    if (h_no < 0)
+        return NULL;
 
-    return NULL;
+    _header_val = res->headers[h_no].value;
+    if (header_val != NULL)
+        strcpy(header_val, _header_val);
+    return _header_val;
 }
 
-const char *set_response_header(const response *res, const char *header_key,
-                                const char *header_val) {
+const char *set_response_header(response *res, const char *header_key, const char *header_val) {
+    res_header *header = NULL;
+    char *key = NULL;
+    http_header known_header = HDR_UNKNOWN;
+
     if (res == NULL || header_key == NULL || header_val == NULL)
         return NULL;
+    if ((known_header = lookup_header(header_key, strlen(header_key))) != HDR_UNKNOWN)
+        return set_known_response_header(res, known_header, header_val);
+
+    if (res->no_headers >= MAX_RES_HEADERS || _find_unknown_response_header(res, header_key) >= 0)
+        return NULL;
+
+    header = &res->headers[res->no_headers];
+    if ((key = _copy_response_str(res, header_key)) == NULL)
+        return NULL;
+    if ((header->value = _copy_response_str(res, header_val)) == NULL) {
+        if (res->mem == NULL)
+            free(key);
+        return NULL;
+    }
+
+    header->key = key;
+    res->unknown_headers[res->no_unknown_headers++] = res->no_headers;
+    res->no_headers++;
+    return header->value;
+}
+
+const char *set_known_response_header(response *res, const http_header header,
+                                      const char *header_val) {
+    res_header *_header = NULL;
+
+    if (res == NULL || header < 0 || header >= NO_KNOWN_HEADERS || header_val == NULL)
+        return NULL;
+    if (res->no_headers >= MAX_RES_HEADERS || res->header_slots[header] != 0)
+        return NULL;
+
+    _header = &res->headers[res->no_headers];
+    if ((_header->value = _copy_response_str(res, header_val)) == NULL)
+        return NULL;
+
+    _header->key = get_header_name(header);
+    res->header_slots[header] = ++res->no_headers;
+    return _header->value;
+}
+
+int set_response_raw_headers(response *res, const char *raw_headers, const size_t raw_headers_len) {
+    if (res == NULL || (raw_headers == NULL && raw_headers_len > 0))
+        return 0;
 
-    if (g_hash_table_lookup(res->header_htab, header_key) == NULL) {
-        char *key = strdup(header_key);
-        char *val = strdup(header_val);
+    res->raw_headers = raw_headers;
+    res->raw_headers_len = raw_headers_len;
+    return 1;
+}
+
+int set_response_status(response *res, const char *http_ver, const char *status_code) {
+    char *_http_ver = NULL, *_status_code = NULL;
 
-        g_hash_table_insert(res->header_htab, key, val);
-        return g_hash_table_lookup(res->header_htab, key);
+    if (res == NULL || http_ver == NULL || status_code == NULL)
+        return 0;
+
+    _http_ver = _copy_response_str(res, http_ver);
+    _status_code = _copy_response_str(res, status_code);
+    if (_http_ver == NULL || _status_code == NULL) {
+        if (res->mem == NULL) {
+            free(_http_ver);
+            free(_status_code);
+        }
+        return 0;
     }
 
-    return NULL;
+    if (res->mem == NULL) {
+        free(res->http_ver);
+        free(res->status_code);
+    }
+    res->http_ver = _http_ver;
+    res->status_code = _status_code;
+    return 1;
 }
 
-// TODO: Only 1 send() call
 ssize_t send_response_head(const response *res) {
-    char buf[RES_HEADER_BUF_SIZE];
-    ssize_t buf_size = 0, total_buf_size = 0;
+    return send_response_head_with_body(res, NULL, 0);
+}
+
+ssize_t send_response_head_with_body(const response *res, const char *body, const size_t body_len) {
+    char buf[RES_HEAD_MAX_SIZE];
+    ssize_t head_size = 0;
 
     // HTTP Version and Status Code needs to be set.
-    if (res->http_ver == NULL || res->status_code == NULL)
+    if ((head_size = format_response_head(res, buf, sizeof(buf))) < 0)
         return 0;
 
-    // Sending first line of response head
-    sprintf(buf, "%s %s\r\n", res->http_ver, res->status_code);
-    buf_size = strlen(buf);
-    if (send(res->conn_fd, buf, buf_size, 0) != buf_size)
-        return total_buf_size;
-    total_buf_size += buf_size;
+    struct iovec iov[2] = {{.iov_base = buf, .iov_len = head_size},
+                           {.iov_base = (void *)body, .iov_len = (body != NULL) ? body_len : 0}};
+    return _send_response_iov(res->conn_fd, iov, (iov[1].iov_len > 0) ? 2 : 1);
+}
 
-    // TODO: Send response headers
-    GHashTableIter iter;
-    gpointer header_key, header_value;
-    g_hash_table_iter_init(&iter, res->header_htab);
+ssize_t format_response_head(const response *res, char *buf, size_t buf_size) {
+    size_t head_size = 0;
+    int line_size = 0;
 
-    while (g_hash_table_iter_next(&iter, &header_key, &header_value)) {
-        sprintf(buf, "%s: %s\r\n", (char *)header_key, (char *)header_value);
-        buf_size = strlen(buf);
-        if (send(res->conn_fd, buf, buf_size, 0) != buf_size)
-            return total_buf_size;
-        total_buf_size += buf_size;
+    // HTTP Version and Status Code needs to be set.
+    if (res == NULL || buf == NULL || res->http_ver == NULL || res->status_code == NULL)
+        return -1;
+
+    // First line of response head
+    line_size = snprintf(buf, buf_size, "%s %s\r\n", res->http_ver, res->status_code);
+    if (line_size < 0 || (size_t)line_size >= buf_size)
+        return -1;
+    head_size += line_size;
+
+    // Response headers
+    for (int h_no = 0; h_no < res->no_headers; h_no++) {
+        line_size = snprintf(buf + head_size, buf_size - head_size, "%s: %s\r\n",
+                             res->headers[h_no].key, res->headers[h_no].value);
+        if (line_size < 0 || (size_t)line_size >= buf_size - head_size)
+            return -1;
+        head_size += line_size;
     }
 
-    // Sending last line of response head
-    strcpy(buf, "\r\n");
-    buf_size = strlen(buf);
-    if (send(res->conn_fd, buf, buf_size, 0) != buf_size)
-        return total_buf_size;
-    total_buf_size += buf_size;
+    // Raw headers are already serialized
+    if (res->raw_headers_len > 0) {
+        if (res->raw_headers_len >= buf_size - head_size)
+            return -1;
+        memcpy(buf + head_size, res->raw_headers, res->raw_headers_len);
+        head_size += res->raw_headers_len;
+    }
 
-    return total_buf_size;
+    // Last line of response head
+    if (buf_size - head_size < 3)
+        return -1;
+    strcpy(buf + head_size, "\r\n");
+    head_size += 2;
+
+    return head_size;
 }
 
 ssize_t send_response_file(const response *res, FILE *file) {
@@ -131,6 +231,35 @@ ssize_t send_response_file(const response *res, FILE *file) {
     return total_buf_size;
 }
 
+ssize_t send_response_fd(const response *res, const int file_fd, const off_t offset,
+                         const size_t len) {
+    off_t file_off = offset;
+    ssize_t send_size = 0;
+    size_t total_size = 0;
+
+    while (total_size < len) {
+        if ((send_size = send_file_range(res->conn_fd, file_fd, &file_off, len - total_size)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (send_size == 0)
+            break;
+        total_size += send_size;
+    }
+
+    return total_size;
+}
+
+ssize_t send_file_range(const int conn_fd, const int file_fd, off_t *offset, const size_t len) {
+    ssize_t send_size = sendfile(conn_fd, file_fd, offset, len);
+
+    // Files that can't be mmapped (e.g. some special file systems) are spliced instead.
+    if (send_size < 0 && (errno == EINVAL || errno == ENOSYS))
+        return _splice_file_range(conn_fd, file_fd, offset, len);
+    return send_size;
+}
+
 ssize_t send_response(const response *res, const char *buf, ssize_t buf_size) {
     if (buf_size == -1)
         buf_size = strlen(buf);
@@ -145,30 +274,38 @@ void close_response(response *res) {
     _free_response(res);
 }
 
-response *_initialize_response() {
-    response *res = malloc(sizeof(response));
+response *_initialize_response() { return _initialize_response_in_arena(NULL); }
+
+response *_initialize_response_in_arena(arena *mem) {
+    response *res = (mem != NULL) ? arena_alloc(mem, sizeof(response)) : malloc(sizeof(response));
     if (res == NULL)
         return NULL;
 
     res->conn_fd = -1;
     res->http_ver = NULL;
     res->status_code = NULL;
-    if ((res->header_htab =
-             g_hash_table_new_full(g_str_hash, g_str_equal, _res_header_htab_key_destroy,
-                                   _res_header_htab_value_destroy)) == NULL)
-        return NULL;
+    res->no_headers = 0;
+    memset(res->header_slots, 0, sizeof(res->header_slots));
+    res->no_unknown_headers = 0;
+    res->raw_headers = NULL;
+    res->raw_headers_len = 0;
+    res->mem = mem;
 
     return res;
 }
 
 void _free_response(response *res) {
-    if (res == NULL)
+    if (res == NULL || res->mem != NULL)
         return;
 
-    if (res->header_htab != NULL) {
-        g_hash_table_destroy(res->header_htab);
-        res->header_htab = NULL;
-    }
+    // Only keys of unknown headers were copied, known headers use their canonical name.
+    for (int u_no = 0; u_no < res->no_unknown_headers; u_no++)
+        free((char *)res->headers[res->unknown_headers[u_no]].key);
+    for (int h_no = 0; h_no < res->no_headers; h_no++)
+        free(res->headers[h_no].value);
+    res->no_headers = 0;
+    res->no_unknown_headers = 0;
+
     if (res->status_code != NULL) {
         free(res->status_code);
         res->status_code = NULL;
@@ -182,12 +319,81 @@ void _free_response(response *res) {
     res = NULL;
 }
 
-void _res_header_htab_key_destroy(gpointer data) {
-    free(data);
-    data = NULL;
+char *_copy_response_str(const response *res, const char *str) {
+    return (res->mem != NULL) ? arena_strdup(res->mem, str) : strdup(str);
 }
 
-void _res_header_htab_value_destroy(gpointer data) {
-    free(data);
-    data = NULL;
+int _find_unknown_response_header(const response *res, const char *header_key) {
+    for (int u_no = 0; u_no < res->no_unknown_headers; u_no++) {
+        if (strcasecmp(res->headers[res->unknown_headers[u_no]].key, header_key) == 0)
+            return res->unknown_headers[u_no];
+    }
+
+    return -1;
+}
+
+ssize_t _send_response_iov(const int conn_fd, struct iovec *iov, int iov_len) {
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iov_len};
+    ssize_t total_size = 0, send_size = 0;
+
+    while (msg.msg_iovlen > 0) {
+        if ((send_size = sendmsg(conn_fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return total_size;
+        }
+        total_size += send_size;
+
+        // Skips the fully sent entries and advances into a partially sent one.
+        while (msg.msg_iovlen > 0 && (size_t)send_size >= msg.msg_iov->iov_len) {
+            send_size -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + send_size;
+            msg.msg_iov->iov_len -= send_size;
+        }
+    }
+
+    return total_size;
+}
+
+ssize_t _splice_file_range(const int conn_fd, const int file_fd, off_t *offset, const size_t len) {
+    int pipe_fds[2];
+    ssize_t in_size = 0, out_size = 0, total_size = 0;
+
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0)
+        return -1;
+
+    if ((in_size = splice(file_fd, offset, pipe_fds[1], NULL, len, SPLICE_F_MOVE)) <= 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return in_size;
+    }
+
+    // Bytes left in the pipe are lost with it, so they are sent even if the socket blocks.
+    while (total_size < in_size) {
+        out_size = splice(pipe_fds[0], NULL, conn_fd, NULL, in_size - total_size,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (out_size > 0) {
+            total_size += out_size;
+            continue;
+        }
+        if (out_size < 0 && errno == EINTR)
+            continue;
+        if (out_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd poll_fd = {.fd = conn_fd, .events = POLLOUT};
+            poll(&poll_fd, 1, -1);
+            continue;
+        }
+        break;
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    // Bytes that were read into the pipe but not sent are read again on the next call.
+    *offset -= in_size - total_size;
+    return (total_size > 0) ? total_size : -1;
 }
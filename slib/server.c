@@ -11,8 +11,13 @@
  * @bug No known bugs.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <limits.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +28,8 @@
 #include <pthread.h>
 #include <signal.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include "server.h"
@@ -38,20 +45,649 @@
  */
 int tcp_socket = -1;
 
+/**
+ * @private
+ * @brief Acceptors with their own `SO_REUSEPORT` listening sockets, when more than one acceptor
+ * is configured.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+acceptor *acceptors = NULL;
+
+/**
+ * @private
+ * @brief Number of acceptors in `acceptors`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+int no_acceptors = 0;
+
+/**
+ * @private
+ * @brief The snapshot of the configuration used before the config file is loaded, with the default
+ * values.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+const server_config default_server_config = {
+    .host = NULL,
+    .port = 0,
+    .mode = MODE_THREAD,
+    .no_acceptors = 1,
+    .no_workers = 1,
+    .queue_depth = DEFAULT_QUEUE_DEPTH,
+    .backlog = BACKLOG,
+    .site_dir = NULL,
+    .default_page = NULL,
+    .mime_file = NULL,
+    .keep_alive_timeout = DEFAULT_KEEPALIVE_TIMEOUT,
+    .keep_alive_requests = DEFAULT_KEEPALIVE_REQUESTS,
+    .file_cache_size = DEFAULT_FILE_CACHE_SIZE,
+    .file_cache_max_file = DEFAULT_FILE_CACHE_MAX_FILE,
+    .file_cache_revalidate = DEFAULT_FILE_CACHE_REVALIDATE,
+    .file_cache_watch = DEFAULT_FILE_CACHE_WATCH,
+    .fd_cache_size = DEFAULT_FD_CACHE_SIZE,
+    .gzip_level = DEFAULT_GZIP_LEVEL,
+    .gzip_min_size = DEFAULT_GZIP_MIN_SIZE,
+    .access_log_file = NULL,
+    .access_log_format = LOG_FORMAT_COMBINED,
+    .metrics_path = NULL,
+    .metrics_remote = DEFAULT_METRICS_REMOTE};
+
+/**
+ * @private
+ * @brief The current snapshot of the configuration, or `NULL` until the server is started. Created
+ * from the config file by `start_server()`, replaced by `reload_server_config()`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+rcu_ptr *current_config = NULL;
+
+/**
+ * @private
+ * @brief The thread reloading the configuration on `SIGHUP`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+pthread_t config_reload_thread;
+
+/**
+ * @private
+ * @brief Set once `config_reload_thread` is started.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+bool config_reload_started = false;
+
+/**
+ * @private
+ * @brief Set to stop `config_reload_thread`, before it is woken up.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+atomic_bool config_reload_stop = false;
+
+/**
+ * @private
+ * @brief The in-memory cache of static files, or `NULL` if it is disabled. Created from the config
+ * file by `start_server()`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+file_cache *site_cache = NULL;
+
+/**
+ * @private
+ * @brief The cache of open descriptors of files too large for `site_cache`, or `NULL` if it is
+ * disabled. Created from the config file by `start_server()`.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+file_cache *site_fd_cache = NULL;
+
+/**
+ * @private
+ * @brief The inotify watch invalidating `site_cache` and `site_fd_cache`, or `NULL` if the site
+ * root isn't watched.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+site_watch *site_watcher = NULL;
+
+/**
+ * @private
+ * @brief The access log requests are logged to, or `NULL` if they are not logged.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+access_log *server_access_log = NULL;
+
+/**
+ * @private
+ * @brief The precompressed variants looked for next to static files, in order of preference.
+ *
+ * This is a private object and should not be accessed directly.
+ */
+const file_variant file_variants[NO_FILE_VARIANTS] = {{"br", ".br"}, {"gzip", ".gz"}};
+
 void start_server() {
-    int conn_fd = -1;
-    pthread_t tid;
+    const char *mode_names[] = {SERVER_MODE_THREAD, SERVER_MODE_EPOLL, SERVER_MODE_POOL,
+                                SERVER_MODE_URING};
+    server_config *config = NULL;
+    thread_pool *pool = NULL;
+    sigset_t reload_signals;
+
+    // SIGHUP and SIGUSR1 are only taken by the reload thread, so they are blocked before any
+    // thread is started.
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    sigaddset(&reload_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, NULL);
+    // sendfile() and splice() can't be told MSG_NOSIGNAL, so a client that closes its connection
+    // while a file is sent must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
 
     // Setup
     load_config();
-    create_mime_table();
-    setup_socket();
+    if ((config = create_server_config()) == NULL ||
+        (current_config = create_rcu_ptr(config)) == NULL) {
+        perror("Unable to create config snapshot");
+        exit(-1);
+    }
+    // MIME types are built in, a MIME types file is only loaded to override them.
+    if (config->mime_file != NULL && !load_mime_table(config->mime_file))
+        printf("Unable to load MIME types from %s, using the built-in ones\n", config->mime_file);
+    if (config->access_log_file != NULL &&
+        (server_access_log = create_access_log(config->access_log_file,
+                                               config->access_log_format)) == NULL)
+        printf("Unable to open access log %s, requests are not logged\n", config->access_log_file);
+    if (config->metrics_path != NULL)
+        enable_metrics();
+    _load_file_cache_config(config);
+
+    if (pthread_create(&config_reload_thread, NULL, _run_config_reload, NULL) == 0)
+        config_reload_started = true;
+    else
+        printf("Unable to create reload thread, SIGHUP and SIGUSR1 are ignored\n");
+
+    // A single pool is shared by all acceptors.
+    if (config->mode == MODE_POOL)
+        pool = _create_server_pool();
+
+    printf("Server Started...\nListening on http://%s:%d (%s mode, %d acceptor%s)\n"
+           "Press Ctrl+C to exit.\n\n",
+           config->host, config->port, mode_names[config->mode], config->no_acceptors,
+           (config->no_acceptors == 1) ? "" : "s");
+
+    if (config->no_acceptors == 1) {
+        setup_socket();
+        acceptor single = {.listen_fd = tcp_socket, .cpu = -1, .mode = config->mode,
+                           .pool = pool};
+        _run_acceptor(&single);
+        return;
+    }
+
+    setup_reuseport_sockets(config->no_acceptors);
+    for (int a_no = 0; a_no < no_acceptors; a_no++) {
+        acceptors[a_no].mode = config->mode;
+        acceptors[a_no].pool = pool;
+        if (pthread_create(&acceptors[a_no].tid, NULL, _run_acceptor, &acceptors[a_no]) != 0) {
+            perror("Unable to create acceptor thread");
+            exit(-1);
+        }
+    }
+
+    for (int a_no = 0; a_no < no_acceptors; a_no++)
+        pthread_join(acceptors[a_no].tid, NULL);
+}
+
+void stop_server() {
+    printf("\nShutting down server.....\n");
+    if (tcp_socket != -1)
+        close(tcp_socket);
+    tcp_socket = -1;
+
+    for (int a_no = 0; a_no < no_acceptors; a_no++)
+        if (acceptors[a_no].listen_fd != -1)
+            close(acceptors[a_no].listen_fd);
+    free(acceptors);
+    acceptors = NULL;
+    no_acceptors = 0;
+
+    if (config_reload_started) {
+        atomic_store(&config_reload_stop, true);
+        pthread_kill(config_reload_thread, SIGHUP);
+        pthread_join(config_reload_thread, NULL);
+        config_reload_started = false;
+        atomic_store(&config_reload_stop, false);
+    }
+
+    // Records of requests still being handled are dropped with their rings.
+    destroy_access_log(server_access_log);
+    server_access_log = NULL;
+
+    destroy_site_watch(site_watcher);
+    site_watcher = NULL;
+    destroy_file_cache(site_cache);
+    site_cache = NULL;
+    destroy_file_cache(site_fd_cache);
+    site_fd_cache = NULL;
+
+    // Like the caches, the snapshot is freed without waiting for requests still being handled, as
+    // the server may be stopped from a signal handler interrupting one of them.
+    destroy_server_config(destroy_rcu_ptr(current_config));
+    current_config = NULL;
 
-    printf("Server Started...\nListening on http://%s:%d\nPress Ctrl+C to exit.\n\n",
-           get_config_str(HOST_CONF_KEY), get_config_int(PORT_CONF_KEY));
+    destroy_mime_table();
+    unload_config();
+}
+
+void setup_socket() { tcp_socket = _create_listen_socket(false); }
+
+void setup_reuseport_sockets(const int no_sockets) {
+    int no_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ((acceptors = calloc(no_sockets, sizeof(acceptor))) == NULL) {
+        perror("Unable to allocate acceptors");
+        exit(-1);
+    }
+
+    for (int a_no = 0; a_no < no_sockets; a_no++) {
+        acceptors[a_no].listen_fd = _create_listen_socket(true);
+        acceptors[a_no].cpu = (no_cpus > 0) ? a_no % no_cpus : -1;
+        no_acceptors++;
+    }
+}
+
+void *handle_request(void *new_conn_fd) {
+    int conn_fd = *((int *)new_conn_fd);
+    free(new_conn_fd);
+
+    return (void *)(intptr_t)serve_connection(conn_fd);
+}
+
+int serve_connection(const int conn_fd) {
+    request_buf req_buf = {.len = 0, .start = 0};
+    request *reqs[MAX_PIPELINED_REQS];
+    char out_buf[PIPELINE_BUF_SIZE];
+    arena *mem = NULL;
+    int no_reqs = 0, no_requests = 0, r_val = 0, token = 0;
+    bool keep_alive = true, single_batch = false;
+    struct timeval idle_timeout = {.tv_sec = get_keep_alive_timeout(), .tv_usec = 0};
+
+    // A worker of the pool would be held by an idle keep-alive connection, which starves the queue
+    // of accepted connections once as many clients as workers are idle. So the connection is
+    // closed after its first batch of requests, instead of waiting for the next one.
+    single_batch = acquire_server_config(&token)->mode == MODE_POOL;
+    release_server_config(token);
+
+    add_metric(METRIC_CONNECTIONS, 1);
+    if (idle_timeout.tv_sec > 0)
+        setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &idle_timeout, sizeof(idle_timeout));
+
+    if ((mem = acquire_arena()) == NULL) {
+        add_metric(METRIC_ERRORS_REQUEST, 1);
+        close(conn_fd);
+        return 1;
+    }
+
+    while (keep_alive && r_val == 0) {
+        // A client closing an idle keep-alive connection is not an error.
+        if ((no_reqs = get_requests(conn_fd, &req_buf, mem, reqs, MAX_PIPELINED_REQS)) == 0) {
+            r_val = (no_requests == 0) ? 1 : 0;
+            break;
+        }
+
+        r_val = _serve_requests(conn_fd, reqs, no_reqs, out_buf, &no_requests, single_batch,
+                                &keep_alive);
+        reset_arena(mem);
+    }
+
+    release_arena(mem);
+    close(conn_fd);
+
+    // The error codes are in the order of their counters.
+    if (r_val >= 1 && r_val <= 3)
+        add_metric(METRIC_ERRORS_REQUEST + r_val - 1, 1);
+    return r_val;
+}
+
+bool keep_alive_request(const request *req, const int no_requests) {
+    const char *conn_header = NULL;
+    const server_config *config = NULL;
+    int token = 0, timeout = 0, max_requests = 0;
+
+    config = acquire_server_config(&token);
+    timeout = config->keep_alive_timeout;
+    max_requests = config->keep_alive_requests;
+    release_server_config(token);
+
+    if (req == NULL || req->http_ver == NULL || timeout <= 0)
+        return false;
+    if (max_requests > 0 && no_requests >= max_requests)
+        return false;
+
+    conn_header = get_known_request_header(req, HDR_CONNECTION);
+
+    if (strcmp(req->http_ver, "HTTP/1.0") == 0)
+        return conn_header != NULL && strcasestr(conn_header, "keep-alive") != NULL;
+    return conn_header == NULL || strcasestr(conn_header, "close") == NULL;
+}
+
+int get_keep_alive_timeout() {
+    int token = 0, timeout = acquire_server_config(&token)->keep_alive_timeout;
+
+    release_server_config(token);
+    return timeout;
+}
+
+server_config *create_server_config() {
+    server_config *config = NULL;
+    char *mode_str = NULL, *format_str = NULL;
+
+    if ((config = calloc(1, sizeof(server_config))) == NULL)
+        return NULL;
+
+    config->host = get_config_str(HOST_CONF_KEY);
+    config->port = get_config_int(PORT_CONF_KEY);
+    config->site_dir = get_config_str(SITE_DIR_CONF_KEY);
+    config->default_page = get_config_str(PAGE_CONF_KEY);
+    config->mime_file = _get_optional_config_str(MIME_FILE_CONF_KEY);
+    mode_str = _get_optional_config_str(MODE_CONF_KEY);
+    config->mode = _parse_server_mode(mode_str);
+    free(mode_str);
+
+    // Acceptors are optional in config, 0 means one per CPU.
+    if ((config->no_acceptors = get_config_int(ACCEPTORS_CONF_KEY)) == INT_MIN)
+        config->no_acceptors = 1;
+    else if (config->no_acceptors <= 0)
+        config->no_acceptors = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((config->no_workers = get_config_int(WORKERS_CONF_KEY)) <= 0)
+        config->no_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((config->queue_depth = get_config_int(QUEUE_DEPTH_CONF_KEY)) <= 0)
+        config->queue_depth = DEFAULT_QUEUE_DEPTH;
+    if ((config->backlog = get_config_int(BACKLOG_CONF_KEY)) <= 0)
+        config->backlog = BACKLOG;
+
+    // All other keys are optional in config, missing or negative values fall back to the defaults.
+    config->keep_alive_timeout =
+        _get_config_int_or(KEEPALIVE_TIMEOUT_CONF_KEY, DEFAULT_KEEPALIVE_TIMEOUT);
+    config->keep_alive_requests =
+        _get_config_int_or(KEEPALIVE_REQUESTS_CONF_KEY, DEFAULT_KEEPALIVE_REQUESTS);
+    config->file_cache_size = _get_config_int_or(FILE_CACHE_SIZE_CONF_KEY, DEFAULT_FILE_CACHE_SIZE);
+    config->file_cache_max_file =
+        _get_config_int_or(FILE_CACHE_MAX_FILE_CONF_KEY, DEFAULT_FILE_CACHE_MAX_FILE);
+    config->file_cache_revalidate =
+        _get_config_int_or(FILE_CACHE_REVALIDATE_CONF_KEY, DEFAULT_FILE_CACHE_REVALIDATE);
+    config->file_cache_watch =
+        _get_config_int_or(FILE_CACHE_WATCH_CONF_KEY, DEFAULT_FILE_CACHE_WATCH) != 0;
+    config->fd_cache_size = _get_config_int_or(FD_CACHE_SIZE_CONF_KEY, DEFAULT_FD_CACHE_SIZE);
+    config->gzip_level = _get_config_int_or(GZIP_LEVEL_CONF_KEY, DEFAULT_GZIP_LEVEL);
+    if (config->gzip_level > 9)
+        config->gzip_level = 9;
+    config->gzip_min_size = _get_config_int_or(GZIP_MIN_SIZE_CONF_KEY, DEFAULT_GZIP_MIN_SIZE);
+    config->access_log_file = _get_optional_config_str(ACCESS_LOG_CONF_KEY);
+    format_str = _get_optional_config_str(ACCESS_LOG_FORMAT_CONF_KEY);
+    config->access_log_format = parse_access_log_format(format_str);
+    free(format_str);
+    config->metrics_path = _get_optional_config_str(METRICS_PATH_CONF_KEY);
+    config->metrics_remote =
+        _get_config_int_or(METRICS_REMOTE_CONF_KEY, DEFAULT_METRICS_REMOTE) != 0;
+
+    return config;
+}
+
+void destroy_server_config(server_config *config) {
+    if (config == NULL)
+        return;
+
+    free(config->host);
+    free(config->site_dir);
+    free(config->default_page);
+    free(config->mime_file);
+    free(config->access_log_file);
+    free(config->metrics_path);
+    free(config);
+}
+
+const server_config *acquire_server_config(int *token) {
+    *token = -1;
+    if (current_config == NULL)
+        return &default_server_config;
+    return acquire_rcu_ptr(current_config, token);
+}
+
+void release_server_config(const int token) {
+    if (token != -1)
+        release_rcu_ptr(current_config, token);
+}
+
+int reload_server_config() {
+    server_config *config = NULL, *old_config = NULL;
+
+    if (current_config == NULL || reload_config() == 0 ||
+        (config = create_server_config()) == NULL) {
+        printf("Unable to reload config, keeping the current config\n");
+        return 0;
+    }
+
+    // A config file without a site root would leave every request unanswered.
+    if (config->site_dir == NULL) {
+        printf("Reloaded config has no %s, keeping the current config\n", SITE_DIR_CONF_KEY);
+        destroy_server_config(config);
+        return 0;
+    }
+
+    // Requests still holding the old snapshot are waited for, the new requests aren't held up.
+    old_config = publish_rcu_ptr(current_config, config);
+    if (_needs_restart(old_config, config))
+        printf("Reloaded config, changes to sockets, server mode and caches need a restart\n");
+    else
+        printf("Reloaded config\n");
+
+    // Files cached from the old root are never requested again, unless it is the new root too.
+    if (site_watcher != NULL && (config->site_dir == NULL || old_config->site_dir == NULL ||
+                                 strcmp(config->site_dir, old_config->site_dir) != 0)) {
+        destroy_site_watch(site_watcher);
+        site_watcher = NULL;
+        if (old_config->site_dir != NULL) {
+            invalidate_file_cache_dir(site_cache, old_config->site_dir);
+            invalidate_file_cache_dir(site_fd_cache, old_config->site_dir);
+        }
+        _watch_site_config(config);
+    }
+
+    destroy_server_config(old_config);
+    return 1;
+}
+
+void clean_request(FILE *file, request *req, response *res) {
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+
+    if (req != NULL) {
+        close_request(req);
+        req = NULL;
+    }
+
+    if (res != NULL) {
+        close_response(res);
+        res = NULL;
+    }
+}
+
+int _serve_requests(const int conn_fd, request **reqs, const int no_reqs, char *out_buf,
+                    int *no_requests, const bool last_batch, bool *keep_alive) {
+    served_response served[MAX_PIPELINED_REQS];
+    response *res = NULL;
+    file_entry *entry = NULL;
+    size_t out_len = 0, sent = 0;
+    ssize_t head_size = 0;
+    body_part *parts = NULL;
+    int file_fd = -1, no_parts = 0, no_served = 0, r_val = 0;
+    uint64_t stage_start = 0;
+
+    const server_config *config = NULL;
+    int token = 0;
+
+    for (int r_no = 0; r_no < no_reqs && r_no < MAX_PIPELINED_REQS && r_val == 0 && *keep_alive;
+         r_no++) {
+        *keep_alive = keep_alive_request(reqs[r_no], ++(*no_requests)) &&
+                      (!last_batch || r_no < no_reqs - 1);
+        served[no_served] = (served_response){
+            .start = _access_log_now(), .status_code = 444, .body_len = 0, .body_start = SIZE_MAX};
+        config = acquire_server_config(&token);
+        r_val = _prepare_file_response(config, reqs[r_no], -1, *keep_alive, &res, &file_fd, &parts,
+                                       &no_parts, &entry, &served[no_served].status_code,
+                                       &served[no_served].body_len) == 0;
+        release_server_config(token);
+        served[no_served++].record = _capture_served_request(reqs[r_no]->mem, reqs[r_no]);
+        if (r_val != 0)
+            break;
+
+        // Responses are appended to the buffer and only sent once it is full, so the send stages
+        // of most responses are only the copies into the buffer.
+        stage_start = metrics_now();
+        if (out_len + RES_HEAD_MAX_SIZE > PIPELINE_BUF_SIZE) {
+            if (_send_all(conn_fd, out_buf, out_len, &sent) == 0)
+                r_val = 3;
+            out_len = 0;
+        }
+
+        head_size = format_response_head(res, out_buf + out_len, PIPELINE_BUF_SIZE - out_len);
+        close_response(res);
+        if (r_val == 0 && head_size < 0)
+            r_val = 2;
+        else if (r_val == 0) {
+            out_len += head_size;
+            // Every byte is either sent or in the buffer, so this is where the body starts in the
+            // bytes sent on the connection.
+            served[no_served - 1].body_start = sent + out_len;
+            observe_metric(STAGE_HEAD_SEND, stage_start);
+            stage_start = metrics_now();
+            for (int p_no = 0; p_no < no_parts && r_val == 0; p_no++) {
+                if (_append_file_body(conn_fd, file_fd, entry, &parts[p_no], out_buf, &out_len,
+                                      &sent) == 0) {
+                    printf("Error Sending File for URL: %s. %s\n", reqs[r_no]->url,
+                           strerror(errno));
+                    r_val = 3;
+                }
+            }
+            if (r_val == 0 && no_parts > 0)
+                observe_metric(STAGE_BODY_SEND, stage_start);
+        }
+        _close_site_file(file_fd, entry);
+    }
+
+    // Responses of the whole batch usually go out with this single send. Responses to the requests
+    // before a failed request are still sent.
+    if (r_val != 3 && out_len > 0 && _send_all(conn_fd, out_buf, out_len, &sent) == 0)
+        r_val = 3;
+
+    // Requests are logged once the batch is sent, with the bytes of their bodies that went out.
+    for (int s_no = 0; s_no < no_served; s_no++) {
+        const served_response *served_res = &served[s_no];
+        off_t body_sent = 0;
+
+        if (sent > served_res->body_start)
+            body_sent = ((off_t)(sent - served_res->body_start) < served_res->body_len)
+                            ? (off_t)(sent - served_res->body_start)
+                            : served_res->body_len;
+        _log_served_record(served_res->record, served_res->status_code, body_sent,
+                           served_res->start);
+    }
+
+    // The connection outlives the requests, so closing the requests must not close it.
+    for (int r_no = 0; r_no < no_reqs; r_no++) {
+        reqs[r_no]->conn_fd = -1;
+        close_request(reqs[r_no]);
+    }
+
+    return r_val;
+}
+
+int _append_file_body(const int conn_fd, const int file_fd, const file_entry *entry,
+                      const body_part *part, char *out_buf, size_t *out_len, size_t *sent) {
+    ssize_t read_size = 0, send_size = 0;
+    off_t file_off = part->start;
+
+    if (part->prefix_len > PIPELINE_BUF_SIZE - *out_len) {
+        if (_send_all(conn_fd, out_buf, *out_len, sent) == 0)
+            return 0;
+        *out_len = 0;
+    }
+    if (part->prefix_len > 0) {
+        memcpy(out_buf + *out_len, part->prefix, part->prefix_len);
+        *out_len += part->prefix_len;
+    }
+
+    // Files that don't fit are sent straight from the page cache, after the responses before them.
+    if ((size_t)(part->end - part->start) > PIPELINE_BUF_SIZE - *out_len) {
+        if (_send_all(conn_fd, out_buf, *out_len, sent) == 0)
+            return 0;
+        *out_len = 0;
+
+        if (entry != NULL && entry->data != NULL)
+            return _send_all(conn_fd, entry->data + part->start, part->end - part->start, sent);
+
+        while (file_off < part->end) {
+            send_size = send_file_range(conn_fd, file_fd, &file_off, part->end - file_off);
+            if (send_size < 0 && errno == EINTR)
+                continue;
+            if (send_size <= 0)
+                return 0;
+            *sent += send_size;
+        }
+        return 1;
+    }
+
+    // Small files are copied next to their head, so a batch of responses goes out with one send.
+    if (entry != NULL && entry->data != NULL) {
+        memcpy(out_buf + *out_len, entry->data + part->start, part->end - part->start);
+        *out_len += part->end - part->start;
+        return 1;
+    }
+
+    while (file_off < part->end) {
+        read_size = pread(file_fd, out_buf + *out_len, part->end - file_off, file_off);
+        if (read_size < 0 && errno == EINTR)
+            continue;
+        if (read_size <= 0)
+            return 0;
+
+        *out_len += read_size;
+        file_off += read_size;
+    }
+
+    return 1;
+}
+
+int _send_all(const int conn_fd, const char *buf, const size_t buf_len, size_t *sent) {
+    ssize_t send_size = 0;
+    size_t buf_sent = 0;
+
+    while (buf_sent < buf_len) {
+        if ((send_size = send(conn_fd, buf + buf_sent, buf_len - buf_sent, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        buf_sent += send_size;
+        if (sent != NULL)
+            *sent += send_size;
+    }
+
+    return 1;
+}
+
+void _run_thread_loop(const int listen_fd) {
+    int conn_fd = -1;
+    pthread_t tid;
 
     while (true) {
-        if ((conn_fd = accept(tcp_socket, NULL, NULL)) < 0) {
+        if ((conn_fd = accept(listen_fd, NULL, NULL)) < 0) {
             perror("Unable to accept new connection");
             continue;
         }
@@ -72,97 +708,714 @@ void start_server() {
     }
 }
 
-void stop_server() {
-    printf("\nShutting down server.....\n");
-    if (tcp_socket != -1)
-        close(tcp_socket);
-    tcp_socket = -1;
-    destroy_mime_table();
-    unload_config();
+void _run_pool_loop(const int listen_fd, thread_pool *pool) {
+    int conn_fd = -1;
+
+    while (true) {
+        if ((conn_fd = accept(listen_fd, NULL, NULL)) < 0) {
+            perror("Unable to accept new connection");
+            continue;
+        }
+
+        if (submit_to_thread_pool(pool, conn_fd) == 0) {
+            perror("Unable to submit connection to thread pool");
+            close(conn_fd);
+        }
+    }
 }
 
-void setup_socket() {
-    if ((tcp_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+void *_run_acceptor(void *acceptor_ptr) {
+    acceptor *accptr = (acceptor *)acceptor_ptr;
+
+    // Threads created by the acceptor (thread mode) inherit the CPU affinity.
+    if (accptr->cpu >= 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(accptr->cpu, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+            printf("Unable to pin acceptor to CPU %d\n", accptr->cpu);
+    }
+
+    switch (accptr->mode) {
+    case MODE_EPOLL:
+        run_event_loop(accptr->listen_fd);
+        break;
+    case MODE_POOL:
+        _run_pool_loop(accptr->listen_fd, accptr->pool);
+        break;
+    case MODE_URING:
+        if (run_uring_loop(accptr->listen_fd) == 0) {
+            printf("io_uring is not available, falling back to %s mode\n", SERVER_MODE_THREAD);
+            _run_thread_loop(accptr->listen_fd);
+        }
+        break;
+    default:
+        _run_thread_loop(accptr->listen_fd);
+    }
+
+    return NULL;
+}
+
+thread_pool *_create_server_pool() {
+    thread_pool *pool = NULL;
+    int token = 0;
+    const server_config *config = acquire_server_config(&token);
+    int no_threads = config->no_workers, queue_depth = config->queue_depth;
+
+    release_server_config(token);
+
+    if ((pool = create_thread_pool(no_threads, queue_depth, serve_connection)) == NULL) {
+        perror("Unable to create thread pool");
+        exit(-1);
+    }
+    printf("Started %d worker threads with a queue of %d connections\n", no_threads, queue_depth);
+
+    return pool;
+}
+
+int _create_listen_socket(const bool reuseport) {
+    int listen_fd = -1, on = 1, token = 0;
+    const server_config *config = acquire_server_config(&token);
+
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
         perror("Unable to get IPv4 TCP Socket using socket()");
         exit(-1);
     }
 
-    int on = 1;
-    setsockopt(tcp_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuseport && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        perror("Unable to set SO_REUSEPORT on socket");
+        exit(-1);
+    }
 
     struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(get_config_int(PORT_CONF_KEY));
-    inet_pton(AF_INET, get_config_str(HOST_CONF_KEY), &(server_addr.sin_addr));
+    server_addr.sin_port = htons(config->port);
+    if (config->host != NULL)
+        inet_pton(AF_INET, config->host, &(server_addr.sin_addr));
     socklen_t server_addr_len = sizeof(server_addr);
 
-    if (bind(tcp_socket, (struct sockaddr *)&server_addr, server_addr_len) < 0) {
+    if (bind(listen_fd, (struct sockaddr *)&server_addr, server_addr_len) < 0) {
         perror("Unable to bind socket to server address");
         exit(-1);
     }
 
-    if (listen(tcp_socket, BACKLOG) < 0) {
+    if (listen(listen_fd, config->backlog) < 0) {
         perror("Unable to listen to socket");
         exit(-1);
     }
+
+    release_server_config(token);
+    return listen_fd;
 }
 
-void *handle_request(void *new_conn_fd) {
-    char file_path[FILE_PATH_BUF_SIZE];
-    int conn_fd = *((int *)new_conn_fd);
-    free(new_conn_fd);
+int _prepare_file_response(const server_config *config, request *req, const int conn_fd,
+                           const bool keep_alive, response **res, int *file_fd, body_part **parts,
+                           int *no_parts, file_entry **entry, int *status_code, off_t *body_len) {
+    int r_val = 0;
 
-    FILE *file = NULL;
-    request *req = NULL;
-    response *res = NULL;
+    *status_code = 444;
+    *body_len = 0;
+    r_val = _build_file_response(config, req, conn_fd, keep_alive, res, file_fd, parts, no_parts,
+                                 entry, status_code, body_len);
+    add_response_metric(*status_code, *body_len);
+
+    return r_val;
+}
+
+uint64_t _access_log_now() {
+    struct timespec now;
+
+    if (server_access_log == NULL)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+access_log_record *_capture_served_request(arena *mem, const request *req) {
+    access_log_record *record = NULL;
 
-    req = get_request(conn_fd);
-    if (strcmp(req->url, "/") == 0) {
-        free(req->url);
-        req->url = get_config_str(PAGE_CONF_KEY);
+    if (server_access_log == NULL || mem == NULL || req == NULL ||
+        (record = arena_alloc(mem, sizeof(access_log_record))) == NULL)
+        return NULL;
+
+    capture_access_log_record(record, req);
+    return record;
+}
+
+void _log_served_record(const access_log_record *record, const int status_code,
+                        const off_t body_sent, const uint64_t start) {
+    if (server_access_log == NULL || record == NULL)
+        return;
+    log_access_record(server_access_log, record, status_code, body_sent,
+                      _get_access_log_latency(start));
+}
+
+long _get_access_log_latency(const uint64_t start) {
+    uint64_t now = _access_log_now();
+
+    return (start == 0 || now < start) ? 0 : (long)((now - start) / 1000);
+}
+
+int _build_file_response(const server_config *config, request *req, const int conn_fd,
+                         const bool keep_alive, response **res, int *file_fd, body_part **parts,
+                         int *no_parts, file_entry **entry, int *status_code, off_t *body_len) {
+    char file_path[FILE_PATH_BUF_SIZE], variant_path[FILE_PATH_BUF_SIZE], content_length[24],
+        content_type[RES_HEADER_BUF_SIZE], content_range[64], etag_buf[FILE_ETAG_SIZE],
+        last_modified[HTTP_DATE_SIZE];
+    const char *mimetype = NULL, *variant_mimetype = NULL, *etag = etag_buf, *coding = "",
+               *status = "200 OK";
+    file_entry *variant_entry = NULL;
+    byte_range ranges[MAX_REQ_RANGES];
+    int variant = -1, variant_fd = -1, no_ranges = 0;
+    unsigned int variants = 0;
+    off_t file_size = 0, variant_size = 0, body_size = 0;
+    struct stat file_stat, variant_stat;
+    bool gzip_file = false, not_modified = false;
+    uint64_t open_start = 0;
+
+    *res = NULL;
+    *file_fd = -1;
+    *parts = NULL;
+    *no_parts = 0;
+    *entry = NULL;
+    *status_code = 444;
+    *body_len = 0;
+
+    if (config->metrics_path != NULL && req != NULL && req->url != NULL &&
+        strcmp(req->url, config->metrics_path) == 0 &&
+        (config->metrics_remote || _is_loopback_client(req->conn_fd)))
+        return _build_metrics_response(req, conn_fd, keep_alive, res, parts, no_parts, status_code,
+                                       body_len);
+
+    if (_resolve_request_path(config, req, file_path) == 0)
+        return 0;
+
+    open_start = metrics_now();
+    if (_open_site_file(config, file_path, NULL, file_path, file_fd, &file_size, &file_stat, entry,
+                        &mimetype) == 0)
+        return 0;
+    observe_metric(STAGE_FILE_OPEN, open_start);
+
+    // A precompressed sidecar the client accepts is served instead, if it can still be opened.
+    if ((variants = _get_file_variants(file_path, *entry)) != 0 &&
+        (variant = _select_file_variant(req, variants)) != -1) {
+        if (snprintf(variant_path, sizeof(variant_path), "%s%s", file_path,
+                     file_variants[variant].suffix) < (int)sizeof(variant_path) &&
+            _open_site_file(config, variant_path, file_variants[variant].coding, file_path,
+                            &variant_fd, &variant_size, &variant_stat, &variant_entry,
+                            &variant_mimetype) == 1) {
+            _close_site_file(*file_fd, *entry);
+            *file_fd = variant_fd;
+            file_size = variant_size;
+            file_stat = variant_stat;
+            *entry = variant_entry;
+            mimetype = variant_mimetype;
+            coding = file_variants[variant].coding;
+        } else
+            variant = -1;
     }
-    printf("> (%s) (%s) (%s)\n", req->http_method, req->url, req->http_ver);
-    sprintf(file_path, "%s%s", get_config_str(SITE_DIR_CONF_KEY), req->url);
 
-    file = NULL;
-    if ((file = fopen(file_path, "rb")) == NULL) {
-        clean_request(file, req, res);
-        return 1;
+    // Text files without a sidecar are compressed once, and served from the file cache after.
+    if (*entry != NULL)
+        mimetype = (*entry)->mimetype;
+    gzip_file = (variants == 0 && _is_gzip_file(config, mimetype, file_size));
+    if (gzip_file && get_encoding_quality(req, GZIP_CODING) > 0 &&
+        (variant_entry = _get_gzip_file_entry(config, file_path, *file_fd, *entry, &file_stat,
+                                              mimetype)) != NULL) {
+        _close_site_file(*file_fd, *entry);
+        *file_fd = -1;
+        file_size = variant_entry->size;
+        *entry = variant_entry;
+        coding = GZIP_CODING;
+    }
+
+    // Validators of cached files are serialized with the entry, the others are formatted here.
+    if (*entry == NULL &&
+        (format_file_etag(&file_stat, (variant != -1) ? coding : NULL, etag_buf,
+                          sizeof(etag_buf)) < 0 ||
+         format_http_date(file_stat.st_mtim.tv_sec, last_modified, sizeof(last_modified)) < 0)) {
+        _close_site_file(*file_fd, *entry);
+        *file_fd = -1;
+        return 0;
+    }
+    if (*entry != NULL)
+        etag = (*entry)->etag;
+    not_modified = _is_not_modified(req, etag, file_stat.st_mtim.tv_sec);
+
+    // Ranges are of the representation selected above, and are only served if the client still
+    // has the same one. Encoded representations are only served a single range.
+    if (!not_modified && _is_range_current(req, etag, file_stat.st_mtim.tv_sec))
+        no_ranges = get_request_ranges(req, file_size, ranges,
+                                       (*coding != '\0') ? 1 : MAX_REQ_RANGES);
+
+    if (not_modified)
+        status = "304 Not Modified";
+    else if (no_ranges < 0)
+        status = "416 Range Not Satisfiable";
+    else if (no_ranges > 0)
+        status = "206 Partial Content";
+
+    if ((*res = create_response_in_arena(req->mem, conn_fd)) == NULL ||
+        set_response_status(*res, req->http_ver, status) == 0 ||
+        (!not_modified && (body_size = _create_body_parts(req, ranges, no_ranges, file_size,
+                                                          mimetype, etag, parts, no_parts)) < 0)) {
+        if (*res != NULL)
+            close_response(*res);
+        *res = NULL;
+        _close_site_file(*file_fd, *entry);
+        *file_fd = -1;
+        *parts = NULL;
+        *no_parts = 0;
+        *entry = NULL;
+        return 0;
+    }
+
+    set_known_response_header(*res, HDR_CONNECTION, keep_alive ? "keep-alive" : "close");
+    set_known_response_header(*res, HDR_SERVER, SERVER_NAME);
+    // The raw headers of an entry carry the headers of the whole file, and only its validators
+    // are sent with a 304, which has no body, or with a range of the file.
+    if (*entry != NULL && !not_modified && no_ranges == 0)
+        set_response_raw_headers(*res, (*entry)->headers, (*entry)->headers_len);
+    else if (*entry != NULL)
+        set_response_raw_headers(*res, (*entry)->validators, (*entry)->validators_len);
+    else {
+        set_known_response_header(*res, HDR_ETAG, etag);
+        set_known_response_header(*res, HDR_LAST_MODIFIED, last_modified);
     }
 
-    res = create_response_from_request(req);
-    res->status_code = strdup("200 OK");
-    set_response_header(res, "content-type", get_mimetype_for_url(req->url, NULL));
-    set_response_header(res, "server", SERVER_NAME);
+    if (!not_modified && (*entry == NULL || no_ranges != 0)) {
+        if (no_ranges > 1) {
+            snprintf(content_type, sizeof(content_type),
+                     "multipart/byteranges; boundary=nanows-%.*s", (int)strlen(etag) - 2, etag + 1);
+            set_known_response_header(*res, HDR_CONTENT_TYPE, content_type);
+        } else if (no_ranges >= 0)
+            set_known_response_header(*res, HDR_CONTENT_TYPE, mimetype);
+        snprintf(content_length, sizeof(content_length), "%lld", (long long)body_size);
+        set_known_response_header(*res, HDR_CONTENT_LENGTH, content_length);
+        if (no_ranges >= 0 && *coding != '\0')
+            set_known_response_header(*res, HDR_CONTENT_ENCODING, coding);
+        set_known_response_header(*res, HDR_ACCEPT_RANGES, "bytes");
 
-    if (send_response_head(res) == 0) {
-        clean_request(file, req, res);
-        return 2;
-    };
+        if (no_ranges == 1)
+            snprintf(content_range, sizeof(content_range), "bytes %lld-%lld/%lld",
+                     (long long)ranges[0].start, (long long)ranges[0].end - 1,
+                     (long long)file_size);
+        else if (no_ranges < 0)
+            snprintf(content_range, sizeof(content_range), "bytes */%lld", (long long)file_size);
+        if (no_ranges == 1 || no_ranges < 0)
+            set_known_response_header(*res, HDR_CONTENT_RANGE, content_range);
+    }
+    if (variants != 0 || gzip_file)
+        set_known_response_header(*res, HDR_VARY, "Accept-Encoding");
 
-    if (send_response_file(res, file) == 0) {
-        printf("Error Sending File: %s for URL: %s. %s\n", file_path, req->url, strerror(errno));
-        clean_request(file, req, res);
-        return 3;
+    // The entry is kept until the response is sent, as its validators are the raw headers.
+    if (not_modified || no_ranges < 0) {
+        if (*entry == NULL)
+            close(*file_fd);
+        *file_fd = (*entry != NULL) ? (*entry)->fd : -1;
     }
 
-    clean_request(file, req, res);
-    return 0;
+    *status_code = atoi(status);
+    *body_len = body_size;
+    return 1;
 }
 
-void clean_request(FILE *file, request *req, response *res) {
-    if (file != NULL) {
-        fclose(file);
-        file = NULL;
+int _build_metrics_response(request *req, const int conn_fd, const bool keep_alive, response **res,
+                            body_part **parts, int *no_parts, int *status_code, off_t *body_len) {
+    char content_length[24], *body = NULL;
+    size_t body_size = 0;
+
+    // The metrics are formatted into the arena and sent as the prefix of a part without a file.
+    if (req->mem == NULL || (body = arena_alloc(req->mem, METRICS_BUF_SIZE)) == NULL ||
+        (body_size = format_metrics(body, METRICS_BUF_SIZE)) == 0 ||
+        (*parts = arena_alloc(req->mem, sizeof(body_part))) == NULL)
+        return 0;
+    (*parts)[0] = (body_part){.prefix = body, .prefix_len = body_size, .start = 0, .end = 0};
+
+    if ((*res = create_response_in_arena(req->mem, conn_fd)) == NULL ||
+        set_response_status(*res, req->http_ver, "200 OK") == 0) {
+        if (*res != NULL)
+            close_response(*res);
+        *res = NULL;
+        *parts = NULL;
+        return 0;
     }
 
-    if (req != NULL) {
-        close_request(req);
-        req = NULL;
+    snprintf(content_length, sizeof(content_length), "%zu", body_size);
+    set_known_response_header(*res, HDR_CONNECTION, keep_alive ? "keep-alive" : "close");
+    set_known_response_header(*res, HDR_SERVER, SERVER_NAME);
+    set_known_response_header(*res, HDR_CONTENT_TYPE, METRICS_CONTENT_TYPE);
+    set_known_response_header(*res, HDR_CONTENT_LENGTH, content_length);
+    set_known_response_header(*res, HDR_CACHE_CONTROL, "no-store");
+
+    *no_parts = 1;
+    *status_code = 200;
+    *body_len = body_size;
+    return 1;
+}
+
+bool _is_loopback_client(const int conn_fd) {
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+
+    if (getpeername(conn_fd, (struct sockaddr *)&client_addr, &client_addr_len) < 0 ||
+        client_addr.sin_family != AF_INET)
+        return false;
+    return (ntohl(client_addr.sin_addr.s_addr) >> 24) == IN_LOOPBACKNET;
+}
+
+off_t _create_body_parts(request *req, const byte_range *ranges, const int no_ranges,
+                         const off_t file_size, const char *mimetype, const char *etag,
+                         body_part **parts, int *no_parts) {
+    char prefix[RES_HEADER_BUF_SIZE];
+    int prefix_len = 0, etag_len = (int)strlen(etag);
+    off_t body_size = 0;
+
+    *no_parts = (no_ranges > 1) ? no_ranges + 1 : (no_ranges < 0) ? 0 : 1;
+    if (*no_parts > 0 && (req->mem == NULL ||
+                          (*parts = arena_alloc(req->mem, *no_parts * sizeof(body_part))) == NULL))
+        return -1;
+
+    if (no_ranges <= 1) {
+        if (*no_parts > 0) {
+            (*parts)[0] = (body_part){.prefix = NULL, .prefix_len = 0, .start = 0,
+                                      .end = file_size};
+            if (no_ranges == 1) {
+                (*parts)[0].start = ranges[0].start;
+                (*parts)[0].end = ranges[0].end;
+            }
+            body_size = (*parts)[0].end - (*parts)[0].start;
+        }
+        return body_size;
     }
 
-    if (res != NULL) {
-        close_response(res);
-        res = NULL;
+    // Each range is preceded by a boundary and its own headers. The boundary is derived from the
+    // entity tag (without its quotes), so it is the same for every response for the file.
+    for (int p_no = 0; p_no < *no_parts; p_no++) {
+        if (p_no < no_ranges)
+            prefix_len = snprintf(prefix, sizeof(prefix),
+                                  "\r\n--nanows-%.*s\r\nContent-Type: %s\r\n"
+                                  "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                                  etag_len - 2, etag + 1, mimetype, (long long)ranges[p_no].start,
+                                  (long long)ranges[p_no].end - 1, (long long)file_size);
+        else
+            prefix_len = snprintf(prefix, sizeof(prefix), "\r\n--nanows-%.*s--\r\n",
+                                  etag_len - 2, etag + 1);
+        if (prefix_len < 0 || prefix_len >= (int)sizeof(prefix) ||
+            ((*parts)[p_no].prefix = arena_alloc(req->mem, prefix_len)) == NULL)
+            return -1;
+
+        memcpy((*parts)[p_no].prefix, prefix, prefix_len);
+        (*parts)[p_no].prefix_len = prefix_len;
+        (*parts)[p_no].start = (p_no < no_ranges) ? ranges[p_no].start : 0;
+        (*parts)[p_no].end = (p_no < no_ranges) ? ranges[p_no].end : 0;
+        body_size += prefix_len + (*parts)[p_no].end - (*parts)[p_no].start;
+    }
+
+    return body_size;
+}
+
+int _open_site_file(const server_config *config, const char *file_path, const char *coding,
+                    const char *mime_path, int *file_fd, off_t *file_size, struct stat *file_stat,
+                    file_entry **entry, const char **mimetype) {
+    *file_fd = -1;
+
+    // A cached file is served from memory, without touching the file system. Larger files are
+    // served from their cached descriptor, without opening them again.
+    if ((*entry = get_file_cache_entry(site_cache, file_path, coding)) == NULL &&
+        (*entry = get_file_cache_entry(site_fd_cache, file_path, coding)) == NULL) {
+        if ((*file_fd = open(file_path, O_RDONLY)) < 0)
+            return 0;
+
+        if (fstat(*file_fd, file_stat) < 0 || !S_ISREG(file_stat->st_mode)) {
+            close(*file_fd);
+            *file_fd = -1;
+            return 0;
+        }
+
+        // MIME type of the resolved file name, as `/` is resolved to the default page.
+        *mimetype = get_mimetype_for_url(strrchr(mime_path, '/'), NULL);
+        // Files are only cached under their canonical path, which the site watch invalidates.
+        if (_is_canonical_url(file_path + strlen(config->site_dir))) {
+            if (site_cache != NULL &&
+                (*entry = add_file_cache_entry(site_cache, file_path, coding, *file_fd,
+                                               file_stat, *mimetype)) != NULL) {
+                close(*file_fd);
+                *file_fd = -1;
+            } else if (site_fd_cache != NULL)
+                *entry = add_fd_cache_entry(site_fd_cache, file_path, coding, *file_fd,
+                                            file_stat, *mimetype);
+        }
+    } else {
+        // The metadata of a cached file is the one it was cached with.
+        memset(file_stat, 0, sizeof(*file_stat));
+        file_stat->st_size = (*entry)->file_size;
+        file_stat->st_mtim = (*entry)->mtime;
+        file_stat->st_ino = (*entry)->ino;
     }
+    if (*entry != NULL)
+        *file_fd = (*entry)->fd;
+    *file_size = (*entry != NULL) ? (off_t)(*entry)->size : file_stat->st_size;
+
+    return 1;
+}
+
+void _close_site_file(const int file_fd, file_entry *entry) {
+    // The file of an fd cache entry stays open for other responses.
+    if (file_fd != -1 && entry == NULL)
+        close(file_fd);
+    release_file_cache_entry(entry);
+}
+
+unsigned int _get_file_variants(const char *file_path, file_entry *entry) {
+    char variant_path[FILE_PATH_BUF_SIZE];
+    struct stat variant_stat;
+    unsigned int variants = FILE_VARIANTS_UNKNOWN;
+
+    if (entry != NULL &&
+        (variants = atomic_load_explicit(&entry->variants, memory_order_relaxed)) !=
+            FILE_VARIANTS_UNKNOWN)
+        return variants;
+
+    variants = 0;
+    for (int v_no = 0; v_no < NO_FILE_VARIANTS; v_no++) {
+        if (snprintf(variant_path, sizeof(variant_path), "%s%s", file_path,
+                     file_variants[v_no].suffix) >= (int)sizeof(variant_path))
+            continue;
+        if (stat(variant_path, &variant_stat) == 0 && S_ISREG(variant_stat.st_mode))
+            variants |= 1u << v_no;
+    }
+
+    if (entry != NULL)
+        atomic_store_explicit(&entry->variants, variants, memory_order_relaxed);
+    return variants;
+}
+
+int _select_file_variant(const request *req, const unsigned int variants) {
+    int variant = -1, quality = 0, best_quality = 0;
+
+    for (int v_no = 0; v_no < NO_FILE_VARIANTS; v_no++) {
+        if ((variants & (1u << v_no)) == 0)
+            continue;
+        if ((quality = get_encoding_quality(req, file_variants[v_no].coding)) > best_quality) {
+            variant = v_no;
+            best_quality = quality;
+        }
+    }
+
+    return variant;
+}
+
+bool _is_gzip_file(const server_config *config, const char *mimetype, const off_t file_size) {
+    return config->gzip_level > 0 && site_cache != NULL && file_size > 0 &&
+           file_size >= config->gzip_min_size && (size_t)file_size <= site_cache->max_file_size &&
+           is_compressible_mimetype(mimetype);
+}
+
+file_entry *_get_gzip_file_entry(const server_config *config, const char *file_path,
+                                 const int file_fd, const file_entry *entry,
+                                 const struct stat *file_stat, const char *mimetype) {
+    char *file_data = NULL, *gzip_data = NULL;
+    const char *src = NULL;
+    file_entry *gzip_entry = NULL;
+    off_t file_size = file_stat->st_size, read_off = 0;
+    size_t gzip_size = 0;
+    ssize_t read_size = 0;
+
+    if ((gzip_entry = get_file_cache_entry(site_cache, file_path, GZIP_CODING)) != NULL)
+        return gzip_entry;
+    if (!_is_canonical_url(file_path + strlen(config->site_dir)))
+        return NULL;
+
+    if (entry != NULL && entry->data != NULL)
+        src = entry->data;
+    else {
+        if ((file_data = malloc(file_size)) == NULL)
+            return NULL;
+        while (read_off < file_size) {
+            read_size = pread(file_fd, file_data + read_off, file_size - read_off, read_off);
+            if (read_size < 0 && errno == EINTR)
+                continue;
+            if (read_size <= 0) {
+                free(file_data);
+                return NULL;
+            }
+            read_off += read_size;
+        }
+        src = file_data;
+    }
+
+    gzip_data = gzip_compress(src, file_size, config->gzip_level, &gzip_size);
+    free(file_data);
+    if (gzip_data == NULL)
+        return NULL;
+
+    // The compressed file is revalidated against the file it was compressed from.
+    gzip_entry = add_encoded_file_cache_entry(site_cache, file_path, GZIP_CODING, file_stat,
+                                              mimetype, gzip_data, gzip_size);
+    free(gzip_data);
+    return gzip_entry;
+}
+
+bool _is_not_modified(const request *req, const char *etag, const time_t mtime) {
+    const char *since = NULL;
+    time_t since_time = -1;
+
+    // If-Modified-Since is only evaluated if the client sent no entity tags.
+    if (get_known_request_header(req, HDR_IF_NONE_MATCH) != NULL)
+        return match_request_etag(req, HDR_IF_NONE_MATCH, etag) == 1;
+    if ((since = get_known_request_header(req, HDR_IF_MODIFIED_SINCE)) == NULL ||
+        (since_time = parse_http_date(since)) == -1)
+        return false;
+    return mtime <= since_time;
+}
+
+bool _is_range_current(const request *req, const char *etag, const time_t mtime) {
+    const char *if_range = get_known_request_header(req, HDR_IF_RANGE);
+
+    // If-Range holds either an entity tag, compared strongly, or the exact Last-Modified date.
+    if (if_range == NULL)
+        return true;
+    if (*if_range == '"')
+        return strcmp(if_range, etag) == 0;
+    if (strncmp(if_range, "W/", 2) == 0)
+        return false;
+    return parse_http_date(if_range) == mtime;
+}
+
+bool _is_canonical_url(const char *url) {
+    for (const char *segment = strchr(url, '/'); segment != NULL;
+         segment = strchr(segment + 1, '/')) {
+        if (segment[1] == '/')
+            return false;
+        if (segment[1] == '.' && (segment[2] == '/' || segment[2] == '\0'))
+            return false;
+        if (segment[1] == '.' && segment[2] == '.' && (segment[3] == '/' || segment[3] == '\0'))
+            return false;
+    }
+
+    return true;
+}
+
+void _load_file_cache_config(const server_config *config) {
+    if (config->file_cache_size > 0 &&
+        (site_cache = create_file_cache(config->file_cache_size, config->file_cache_max_file,
+                                        config->file_cache_revalidate)) == NULL)
+        printf("Unable to create file cache, files are read from disk\n");
+    if (config->fd_cache_size > 0 &&
+        (site_fd_cache = create_fd_cache(config->fd_cache_size, config->file_cache_revalidate)) ==
+            NULL)
+        printf("Unable to create fd cache, files are opened for every request\n");
+
+    _watch_site_config(config);
+}
+
+void _watch_site_config(const server_config *config) {
+    file_cache *caches[2] = {site_cache, site_fd_cache};
+
+    if (!config->file_cache_watch || config->site_dir == NULL ||
+        (site_cache == NULL && site_fd_cache == NULL))
+        return;
+
+    if ((site_watcher = create_site_watch(config->site_dir, caches, 2)) == NULL)
+        printf("Unable to watch %s, cached files are revalidated instead\n", config->site_dir);
+    else if (!site_watcher->complete)
+        printf("Unable to watch all of %s, cached files are revalidated instead\n",
+               config->site_dir);
+}
+
+void *_run_config_reload(void *arg) {
+    sigset_t reload_signals;
+    int signal_no = 0;
+
+    (void)arg;
+
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    sigaddset(&reload_signals, SIGUSR1);
+
+    while (true) {
+        if (sigwait(&reload_signals, &signal_no) != 0 || atomic_load(&config_reload_stop))
+            break;
+
+        // SIGUSR1 follows a log rotation, only the access log is reopened.
+        if (signal_no == SIGUSR1) {
+            reopen_access_log(server_access_log);
+            printf("Reopening access log\n");
+        } else
+            reload_server_config();
+    }
+
+    return NULL;
+}
+
+bool _needs_restart(const server_config *old_config, const server_config *new_config) {
+    return (old_config->host == NULL) != (new_config->host == NULL) ||
+           (old_config->host != NULL && strcmp(old_config->host, new_config->host) != 0) ||
+           (old_config->mime_file == NULL) != (new_config->mime_file == NULL) ||
+           (old_config->mime_file != NULL &&
+            strcmp(old_config->mime_file, new_config->mime_file) != 0) ||
+           (old_config->access_log_file == NULL) != (new_config->access_log_file == NULL) ||
+           (old_config->access_log_file != NULL &&
+            strcmp(old_config->access_log_file, new_config->access_log_file) != 0) ||
+           old_config->access_log_format != new_config->access_log_format ||
+           (old_config->metrics_path == NULL) != (new_config->metrics_path == NULL) ||
+           old_config->port != new_config->port || old_config->mode != new_config->mode ||
+           old_config->no_acceptors != new_config->no_acceptors ||
+           old_config->no_workers != new_config->no_workers ||
+           old_config->queue_depth != new_config->queue_depth ||
+           old_config->backlog != new_config->backlog ||
+           old_config->file_cache_size != new_config->file_cache_size ||
+           old_config->file_cache_max_file != new_config->file_cache_max_file ||
+           old_config->file_cache_revalidate != new_config->file_cache_revalidate ||
+           old_config->file_cache_watch != new_config->file_cache_watch ||
+           old_config->fd_cache_size != new_config->fd_cache_size;
+}
+
+int _get_config_int_or(const char *key, const int def_value) {
+    int value = 0;
+
+    // A missing key is checked first, as get_config_int() prints an error for it.
+    if (!has_config_key(key))
+        return def_value;
+    value = get_config_int(key);
+
+    return (value < 0) ? def_value : value;
+}
+
+char *_get_optional_config_str(const char *key) {
+    return has_config_key(key) ? get_config_str(key) : NULL;
+}
+
+server_mode _parse_server_mode(const char *mode_str) {
+    if (mode_str == NULL)
+        return MODE_THREAD;
+    if (strcmp(mode_str, SERVER_MODE_EPOLL) == 0)
+        return MODE_EPOLL;
+    if (strcmp(mode_str, SERVER_MODE_POOL) == 0)
+        return MODE_POOL;
+    if (strcmp(mode_str, SERVER_MODE_URING) == 0)
+        return MODE_URING;
+    return MODE_THREAD;
+}
+
+int _resolve_request_path(const server_config *config, request *req, char *file_path) {
+    const char *url = NULL;
+
+    if (req == NULL || req->url == NULL || file_path == NULL || config->site_dir == NULL)
+        return 0;
+
+    // The URL points into the request buffer, so the default page is not written back to it.
+    url = req->url;
+    if (strcmp(url, "/") == 0) {
+        if (config->default_page == NULL)
+            return 0;
+        url = config->default_page;
+    }
+
+    snprintf(file_path, FILE_PATH_BUF_SIZE, "%s%s", config->site_dir, url);
+    return 1;
 }
@@ -0,0 +1,269 @@
+/**
+ * @file slib/sitewatch.c
+ * @brief Functions for invalidating cached files as they change on disk.
+ *
+ * Implements functions defined in `include/sitewatch.h`. Used by the server to remove the cache
+ * entries of files as soon as they are modified, moved or deleted below the site root.
+ *
+ * @see typedef struct site_watch
+ * @see typedef struct file_cache
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sitewatch.h"
+
+site_watch *create_site_watch(const char *root, file_cache **caches, const int no_caches) {
+    site_watch *watch = NULL;
+
+    if (root == NULL || caches == NULL || no_caches > SITE_WATCH_MAX_CACHES)
+        return NULL;
+
+    if ((watch = calloc(1, sizeof(site_watch))) == NULL)
+        return NULL;
+    watch->inotify_fd = -1;
+    watch->stop_fd = -1;
+    for (int c_no = 0; c_no < no_caches; c_no++)
+        if (caches[c_no] != NULL)
+            watch->caches[watch->no_caches++] = caches[c_no];
+
+    if ((watch->root = strdup(root)) == NULL ||
+        (watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+        (watch->stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        _free_site_watch(watch);
+        return NULL;
+    }
+
+    // The caches are only marked as watched once every directory is.
+    _set_site_watch_complete(watch, _watch_site_dir(watch, watch->root) == 1);
+
+    if (pthread_create(&watch->thread, NULL, _run_site_watch, watch) != 0) {
+        _set_site_watch_complete(watch, false);
+        _free_site_watch(watch);
+        return NULL;
+    }
+
+    return watch;
+}
+
+void destroy_site_watch(site_watch *watch) {
+    uint64_t stop = 1;
+
+    if (watch == NULL)
+        return;
+
+    if (write(watch->stop_fd, &stop, sizeof(stop)) == sizeof(stop))
+        pthread_join(watch->thread, NULL);
+    else
+        pthread_cancel(watch->thread);
+    _set_site_watch_complete(watch, false);
+    _free_site_watch(watch);
+}
+
+int _watch_site_dir(site_watch *watch, const char *path) {
+    char child[SITE_WATCH_PATH_SIZE];
+    watched_dir *dirs = NULL;
+    struct stat dir_stat, child_stat;
+    struct dirent *dirent = NULL;
+    DIR *dir = NULL;
+    int wd = -1, dirs_size = 0, r_val = 1;
+
+    if ((wd = inotify_add_watch(watch->inotify_fd, path, SITE_WATCH_EVENTS)) < 0)
+        return 0;
+    if (stat(path, &dir_stat) < 0)
+        return 1;
+
+    // Watch descriptors are small and only grow, so they index the directories directly.
+    if (wd >= watch->dirs_size) {
+        dirs_size = (watch->dirs_size == 0) ? 64 : watch->dirs_size;
+        while (dirs_size <= wd)
+            dirs_size *= 2;
+        if ((dirs = realloc(watch->dirs, dirs_size * sizeof(watched_dir))) == NULL) {
+            inotify_rm_watch(watch->inotify_fd, wd);
+            return 0;
+        }
+        memset(dirs + watch->dirs_size, 0, (dirs_size - watch->dirs_size) * sizeof(watched_dir));
+        watch->dirs = dirs;
+        watch->dirs_size = dirs_size;
+    }
+
+    // A directory still found at its old path is reachable by two paths (e.g. through a symlink),
+    // and only one of them would be invalidated. Otherwise, it moved and is watched at `path` now.
+    if (watch->dirs[wd].path != NULL && strcmp(watch->dirs[wd].path, path) != 0) {
+        if (stat(watch->dirs[wd].path, &child_stat) == 0 && child_stat.st_ino == dir_stat.st_ino)
+            return 0;
+        free(watch->dirs[wd].path);
+        watch->dirs[wd].path = NULL;
+    }
+    if (watch->dirs[wd].path == NULL && (watch->dirs[wd].path = strdup(path)) == NULL)
+        return 0;
+    watch->dirs[wd].ino = dir_stat.st_ino;
+
+    // The directory may be gone already, its events tell.
+    if ((dir = opendir(path)) == NULL)
+        return 1;
+
+    while ((dirent = readdir(dir)) != NULL) {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+            continue;
+        if (dirent->d_type != DT_DIR && dirent->d_type != DT_LNK && dirent->d_type != DT_UNKNOWN)
+            continue;
+        if (snprintf(child, sizeof(child), "%s/%s", path, dirent->d_name) >= (int)sizeof(child)) {
+            r_val = 0;
+            continue;
+        }
+
+        // Symlinks to directories are served like directories, so they are watched as well.
+        if (dirent->d_type != DT_DIR &&
+            (stat(child, &child_stat) < 0 || !S_ISDIR(child_stat.st_mode)))
+            continue;
+        if (_watch_site_dir(watch, child) == 0)
+            r_val = 0;
+    }
+
+    closedir(dir);
+    return r_val;
+}
+
+void *_run_site_watch(void *watch_ptr) {
+    site_watch *watch = watch_ptr;
+    char buf[SITE_WATCH_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {{.fd = watch->inotify_fd, .events = POLLIN},
+                            {.fd = watch->stop_fd, .events = POLLIN}};
+    const struct inotify_event *event = NULL;
+    ssize_t read_size = 0;
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Unable to wait for site changes");
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+
+        // The descriptor is non-blocking, so all queued events are handled before polling again.
+        while ((read_size = read(watch->inotify_fd, buf, sizeof(buf))) > 0) {
+            for (char *pos = buf; pos < buf + read_size;
+                 pos += sizeof(struct inotify_event) + event->len) {
+                event = (const struct inotify_event *)pos;
+                _handle_site_event(watch, event);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void _handle_site_event(site_watch *watch, const struct inotify_event *event) {
+    char path[SITE_WATCH_PATH_SIZE];
+    watched_dir *dir = NULL;
+    struct stat dir_stat;
+
+    // Events were lost, so any file may have changed.
+    if (event->mask & IN_Q_OVERFLOW) {
+        _invalidate_site_dir(watch, watch->root);
+        return;
+    }
+    if (event->wd < 0 || event->wd >= watch->dirs_size || watch->dirs[event->wd].path == NULL)
+        return;
+    dir = &watch->dirs[event->wd];
+
+    if (event->mask & IN_IGNORED) {
+        free(dir->path);
+        dir->path = NULL;
+        return;
+    }
+
+    // The directory itself was deleted or moved. A directory moved within the root was watched
+    // under its new path already, when it appeared there.
+    if (event->len == 0) {
+        if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) == 0)
+            return;
+        _invalidate_site_dir(watch, dir->path);
+        if (stat(dir->path, &dir_stat) == 0 && dir_stat.st_ino == dir->ino)
+            return;
+
+        if (strcmp(dir->path, watch->root) == 0 && watch->complete) {
+            printf("Site root %s moved, cached files are revalidated instead\n", watch->root);
+            _set_site_watch_complete(watch, false);
+        }
+        inotify_rm_watch(watch->inotify_fd, event->wd);
+        return;
+    }
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir->path, event->name) >= (int)sizeof(path))
+        return;
+    if ((event->mask & IN_ISDIR) == 0) {
+        _invalidate_site_file(watch, path);
+        return;
+    }
+
+    // Files cached from a new directory before it was watched are dropped after it is.
+    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && _watch_site_dir(watch, path) == 0 &&
+        watch->complete) {
+        printf("Unable to watch %s, cached files are revalidated instead\n", path);
+        _set_site_watch_complete(watch, false);
+    }
+    _invalidate_site_dir(watch, path);
+}
+
+void _invalidate_site_file(site_watch *watch, const char *path) {
+    char base_path[SITE_WATCH_PATH_SIZE];
+    const char *ext = strrchr(path, '.'), *name = strrchr(path, '/');
+
+    for (int c_no = 0; c_no < watch->no_caches; c_no++)
+        invalidate_file_cache_path(watch->caches[c_no], path);
+
+    if (ext == NULL || name == NULL || ext <= name + 1 ||
+        (size_t)(ext - path) >= sizeof(base_path))
+        return;
+    memcpy(base_path, path, ext - path);
+    base_path[ext - path] = '\0';
+    for (int c_no = 0; c_no < watch->no_caches; c_no++)
+        invalidate_file_cache_path(watch->caches[c_no], base_path);
+}
+
+void _invalidate_site_dir(site_watch *watch, const char *path) {
+    for (int c_no = 0; c_no < watch->no_caches; c_no++)
+        invalidate_file_cache_dir(watch->caches[c_no], path);
+}
+
+void _set_site_watch_complete(site_watch *watch, const bool complete) {
+    watch->complete = complete;
+    for (int c_no = 0; c_no < watch->no_caches; c_no++)
+        set_file_cache_watched(watch->caches[c_no], complete);
+
+    // Entries cached while the caches were revalidated may be stale until their next check.
+    if (complete)
+        _invalidate_site_dir(watch, watch->root);
+}
+
+void _free_site_watch(site_watch *watch) {
+    for (int d_no = 0; d_no < watch->dirs_size; d_no++)
+        free(watch->dirs[d_no].path);
+    free(watch->dirs);
+    if (watch->inotify_fd != -1)
+        close(watch->inotify_fd);
+    if (watch->stop_fd != -1)
+        close(watch->stop_fd);
+    free(watch->root);
+    free(watch);
+}
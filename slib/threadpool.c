@@ -0,0 +1,120 @@
+/**
+ * @file slib/threadpool.c
+ * @brief A fixed-size pool of worker threads.
+ *
+ * Implements functions defined in `include/threadpool.h`. Used to handle connections on a fixed
+ * number of threads instead of creating a new thread for each connection.
+ *
+ * @see typedef struct thread_pool
+ * @see typedef struct work_queue
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+thread_pool *create_thread_pool(const int no_threads, const int queue_depth,
+                                conn_handler handler) {
+    thread_pool *pool = NULL;
+
+    if (no_threads <= 0 || queue_depth <= 0 || handler == NULL)
+        return NULL;
+
+    if ((pool = malloc(sizeof(thread_pool))) == NULL)
+        return NULL;
+
+    if ((pool->queue = create_work_queue(queue_depth)) == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    if ((pool->threads = calloc(no_threads, sizeof(pthread_t))) == NULL) {
+        destroy_work_queue(pool->queue);
+        free(pool);
+        return NULL;
+    }
+
+    sem_init(&pool->queued, 0, 0);
+    sem_init(&pool->free, 0, work_queue_capacity(pool->queue));
+    pool->no_threads = 0;
+    pool->handler = handler;
+    atomic_init(&pool->stopping, false);
+
+    for (int t_no = 0; t_no < no_threads; t_no++) {
+        if (pthread_create(&pool->threads[t_no], NULL, _thread_pool_worker, pool) != 0) {
+            perror("Unable to create worker thread");
+            destroy_thread_pool(pool);
+            return NULL;
+        }
+        pool->no_threads++;
+    }
+
+    return pool;
+}
+
+int submit_to_thread_pool(thread_pool *pool, const int conn_fd) {
+    if (pool == NULL || atomic_load(&pool->stopping))
+        return 0;
+
+    while (sem_wait(&pool->free) != 0)
+        if (errno != EINTR)
+            return 0;
+
+    // A free cell is reserved by the semaphore, push only fails while a worker is finishing a pop.
+    while (!work_queue_push(pool->queue, conn_fd))
+        sched_yield();
+
+    sem_post(&pool->queued);
+    return 1;
+}
+
+void destroy_thread_pool(thread_pool *pool) {
+    int conn_fd = -1;
+
+    if (pool == NULL)
+        return;
+
+    atomic_store(&pool->stopping, true);
+    for (int t_no = 0; t_no < pool->no_threads; t_no++)
+        sem_post(&pool->queued);
+    for (int t_no = 0; t_no < pool->no_threads; t_no++)
+        pthread_join(pool->threads[t_no], NULL);
+
+    while (work_queue_pop(pool->queue, &conn_fd))
+        close(conn_fd);
+
+    sem_destroy(&pool->queued);
+    sem_destroy(&pool->free);
+    destroy_work_queue(pool->queue);
+    free(pool->threads);
+    free(pool);
+}
+
+void *_thread_pool_worker(void *pool_ptr) {
+    thread_pool *pool = (thread_pool *)pool_ptr;
+    int conn_fd = -1;
+
+    while (true) {
+        if (sem_wait(&pool->queued) != 0)
+            continue;
+        if (atomic_load(&pool->stopping))
+            break;
+
+        // The semaphore guarantees a queued connection, pop only fails while a push is finishing.
+        while (!work_queue_pop(pool->queue, &conn_fd))
+            sched_yield();
+        sem_post(&pool->free);
+
+        pool->handler(conn_fd);
+    }
+
+    return NULL;
+}
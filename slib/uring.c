@@ -0,0 +1,770 @@
+/**
+ * @file slib/uring.c
+ * @brief Functions for handling connections on an io_uring based event loop.
+ *
+ * Implements functions defined in `include/uring.h`. Used to accept and handle all connections on
+ * a single thread with as few system calls as possible. All operations of a loop iteration are
+ * submitted and all completions are reaped with a single `io_uring_enter()` call.
+ *
+ * - Connections are accepted with a multishot accept, a single submission keeps accepting.
+ * - Requests are received into a ring of provided buffers, so idle connections don't hold a
+ *   buffer. A request head is parsed in place and its buffer is given back to the kernel as soon
+ *   as the response head is formatted.
+ * - Files are sent by a chain of linked operations, the response head is sent and the file is
+ *   spliced through a pipe into the socket, without copying the file into user space.
+ * - Keep-alive connections go back to receiving, with a linked timeout closing idle connections.
+ *
+ * @see typedef struct uring
+ * @see typedef struct uring_conn
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "uring.h"
+
+int run_uring_loop(const int listen_fd) {
+    uring ring;
+    unsigned cq_head = 0, cq_tail = 0;
+
+    if (_setup_uring(&ring) == 0)
+        return 0;
+
+    if (_setup_uring_buffers(&ring) == 0) {
+        _destroy_uring(&ring);
+        return 0;
+    }
+
+    if (_prep_uring_accept(&ring, listen_fd) == 0) {
+        _destroy_uring(&ring);
+        return 0;
+    }
+
+    while (true) {
+        if (_submit_uring(&ring, 1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Unable to submit to io_uring");
+            break;
+        }
+
+        cq_head = *ring.cq_head;
+        cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq_head != cq_tail; cq_head++)
+            _handle_uring_cqe(&ring, listen_fd, &ring.cqes[cq_head & *ring.cq_mask]);
+        __atomic_store_n(ring.cq_head, cq_head, __ATOMIC_RELEASE);
+
+        // Picks up a reloaded timeout for the receives prepared next.
+        ring.idle_timeout.tv_sec = get_keep_alive_timeout();
+    }
+
+    _destroy_uring(&ring);
+    return -1;
+}
+
+int _setup_uring(uring *ring) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(uring));
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = -1;
+
+    if ((ring->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) < 0)
+        return 0;
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Both rings can share one mapping on newer kernels.
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        _destroy_uring(ring);
+        return 0;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            _destroy_uring(ring);
+            return 0;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        _destroy_uring(ring);
+        return 0;
+    }
+
+    ring->sq_head = (unsigned *)((char *)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+
+    // Entries are always used in order, so the indirection array is filled once.
+    unsigned *sq_array = (unsigned *)((char *)ring->sq_ptr + params.sq_off.array);
+    for (unsigned e_no = 0; e_no < ring->sq_entries; e_no++)
+        sq_array[e_no] = e_no;
+
+    ring->sq_tail_local = *ring->sq_tail;
+    ring->multishot_accept = true;
+    ring->idle_timeout.tv_sec = get_keep_alive_timeout();
+    ring->idle_timeout.tv_nsec = 0;
+    return 1;
+}
+
+int _setup_uring_buffers(uring *ring) {
+    struct io_uring_buf_reg reg;
+    size_t ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+
+    ring->buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1,
+                          0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return 0;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return 0;
+
+    if ((ring->bufs = malloc((size_t)URING_BUF_COUNT * REQ_BUF_SIZE)) == NULL)
+        return 0;
+
+    ring->buf_tail = 0;
+    for (unsigned bid = 0; bid < URING_BUF_COUNT; bid++)
+        _recycle_uring_buffer(ring, bid);
+
+    return 1;
+}
+
+void _destroy_uring(uring *ring) {
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != NULL)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->ring_fd != -1)
+        close(ring->ring_fd);
+    if (ring->buf_ring != NULL)
+        munmap(ring->buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    free(ring->bufs);
+
+    memset(ring, 0, sizeof(uring));
+    ring->ring_fd = -1;
+}
+
+struct io_uring_sqe *_get_uring_sqe(uring *ring) {
+    struct io_uring_sqe *sqe = NULL;
+    unsigned sq_head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (ring->sq_tail_local - sq_head >= ring->sq_entries) {
+        if (_submit_uring(ring, 0) < 0)
+            return NULL;
+        sq_head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_tail_local - sq_head >= ring->sq_entries)
+            return NULL;
+    }
+
+    sqe = &ring->sqes[ring->sq_tail_local & *ring->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_tail_local++;
+    ring->to_submit++;
+    return sqe;
+}
+
+int _submit_uring(uring *ring, const unsigned min_complete) {
+    int submitted = 0;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_tail_local, __ATOMIC_RELEASE);
+    submitted = syscall(__NR_io_uring_enter, ring->ring_fd, ring->to_submit, min_complete,
+                        (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted < 0)
+        return -1;
+
+    ring->to_submit -= submitted;
+    return submitted;
+}
+
+void _recycle_uring_buffer(uring *ring, const unsigned short bid) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (URING_BUF_COUNT - 1)];
+
+    // One byte is kept for '\0', so the buffer can be parsed as a string.
+    buf->addr = (unsigned long)(ring->bufs + (size_t)bid * REQ_BUF_SIZE);
+    buf->len = REQ_BUF_SIZE - 1;
+    buf->bid = bid;
+
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+int _prep_uring_accept(uring *ring, const int listen_fd) {
+    struct io_uring_sqe *sqe = _get_uring_sqe(ring);
+    if (sqe == NULL)
+        return 0;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = ring->multishot_accept ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = URING_ACCEPT;
+    return 1;
+}
+
+int _prep_uring_recv(uring *ring, uring_conn *conn) {
+    struct io_uring_sqe *sqe = _get_uring_sqe(ring);
+    if (sqe == NULL)
+        return 0;
+
+    // Length 0 lets the kernel use the full length of the selected buffer.
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->conn_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = (uintptr_t)conn | URING_RECV;
+    conn->no_inflight++;
+
+    if (ring->idle_timeout.tv_sec <= 0)
+        return 1;
+
+    // The timespec is copied when the entry is submitted, so it can be shared by all connections.
+    sqe->flags |= IOSQE_IO_LINK;
+    if ((sqe = _get_uring_sqe(ring)) == NULL)
+        return 0;
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&ring->idle_timeout;
+    sqe->len = 1;
+    sqe->user_data = (uintptr_t)conn | URING_TIMEOUT;
+    conn->no_inflight++;
+    return 1;
+}
+
+int _prep_uring_response(uring *ring, uring_conn *conn, const bool with_head) {
+    struct io_uring_sqe *sqe = NULL;
+    size_t chunk_size = conn->pipe_len;
+    bool with_splice_in = (conn->pipe_len == 0 && conn->file_off < conn->file_end);
+
+    if (conn->entry != NULL && conn->entry->data != NULL) {
+        chunk_size = conn->file_end - conn->file_off;
+        with_splice_in = false;
+    } else if (with_splice_in) {
+        // Chunks end at a multiple of the chunk size, so a range starting mid-page takes no more
+        // pages than the pipe holds. A short splice would cancel the linked splice out.
+        size_t to_boundary = URING_SPLICE_CHUNK - (size_t)(conn->file_off % URING_SPLICE_CHUNK);
+
+        chunk_size = conn->file_end - conn->file_off;
+        if (chunk_size > to_boundary)
+            chunk_size = to_boundary;
+    }
+
+    if (with_head) {
+        if ((sqe = _get_uring_sqe(ring)) == NULL)
+            return 0;
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->conn_fd;
+        sqe->addr = (unsigned long)conn->out_buf;
+        sqe->len = conn->out_len;
+        // With a body following, the head is held back and leaves together with the first chunk.
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | ((chunk_size > 0) ? MSG_MORE : 0);
+        sqe->flags = (chunk_size > 0) ? IOSQE_IO_LINK : 0;
+        sqe->user_data = (uintptr_t)conn | URING_SEND_HEAD;
+        conn->no_inflight++;
+    }
+
+    if (chunk_size == 0)
+        return 1;
+
+    if (conn->entry != NULL && conn->entry->data != NULL) {
+        if ((sqe = _get_uring_sqe(ring)) == NULL)
+            return 0;
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->conn_fd;
+        sqe->addr = (unsigned long)(conn->entry->data + conn->file_off);
+        sqe->len = chunk_size;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = (uintptr_t)conn | URING_SEND_BODY;
+        conn->no_inflight++;
+        return 1;
+    }
+
+    if (with_splice_in) {
+        if ((sqe = _get_uring_sqe(ring)) == NULL)
+            return 0;
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = conn->file_fd;
+        sqe->splice_off_in = conn->file_off;
+        sqe->fd = conn->pipe_fds[1];
+        sqe->off = (uint64_t)-1;
+        sqe->len = chunk_size;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (uintptr_t)conn | URING_SPLICE_IN;
+        conn->no_inflight++;
+    }
+
+    if ((sqe = _get_uring_sqe(ring)) == NULL)
+        return 0;
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = conn->pipe_fds[0];
+    sqe->splice_off_in = (uint64_t)-1;
+    sqe->fd = conn->conn_fd;
+    sqe->off = (uint64_t)-1;
+    sqe->len = chunk_size;
+    sqe->user_data = (uintptr_t)conn | URING_SPLICE_OUT;
+    conn->no_inflight++;
+
+    return 1;
+}
+
+void _handle_uring_cqe(uring *ring, const int listen_fd, const struct io_uring_cqe *cqe) {
+    uring_op op = cqe->user_data & URING_OP_MASK;
+    uring_conn *conn = (uring_conn *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+    int res = cqe->res;
+
+    if (op == URING_ACCEPT) {
+        if (res >= 0) {
+            if ((conn = _initialize_uring_conn(res)) == NULL || _prep_uring_recv(ring, conn) == 0)
+                _free_uring_conn(ring, conn);
+            else
+                add_metric(METRIC_CONNECTIONS, 1);
+        } else if (res == -EINVAL && ring->multishot_accept) {
+            // Kernel doesn't support multishot accept, fall back to one accept per connection.
+            ring->multishot_accept = false;
+        } else if (res != -EINTR && res != -ECONNABORTED) {
+            errno = -res;
+            perror("Unable to accept new connection");
+        }
+
+        if ((cqe->flags & IORING_CQE_F_MORE) == 0 && _prep_uring_accept(ring, listen_fd) == 0)
+            perror("Unable to submit accept to io_uring");
+        return;
+    }
+
+    conn->no_inflight--;
+    switch (op) {
+    case URING_RECV:
+        _on_uring_recv(ring, conn, res, cqe->flags);
+        break;
+    case URING_SEND_HEAD:
+        if (res > 0)
+            conn->res_sent += res;
+        if (res < 0 || (size_t)res != conn->out_len)
+            conn->failed = true;
+        else if (conn->part_no == 0) {
+            // Prefixes of the later parts of a multipart body are sent as heads too.
+            observe_metric(STAGE_HEAD_SEND, conn->stage_start);
+            conn->stage_start = metrics_now();
+        }
+        break;
+    case URING_SPLICE_IN:
+        // 0 means the file was truncated after it was opened.
+        if (res <= 0)
+            conn->failed = true;
+        else {
+            conn->file_off += res;
+            conn->pipe_len += res;
+        }
+        break;
+    case URING_SPLICE_OUT:
+        if (res <= 0)
+            conn->failed = true;
+        else {
+            conn->pipe_len -= res;
+            conn->res_sent += res;
+        }
+        break;
+    case URING_SEND_BODY:
+        if (res <= 0)
+            conn->failed = true;
+        else {
+            conn->file_off += res;
+            conn->res_sent += res;
+        }
+        break;
+    case URING_TIMEOUT:
+        // The receive is cancelled by the timeout and fails on its own.
+        break;
+    default:
+        conn->failed = true;
+    }
+
+    if (conn->no_inflight == 0)
+        _advance_uring_conn(ring, conn);
+}
+
+void _on_uring_recv(uring *ring, uring_conn *conn, const int res, const unsigned flags) {
+    char *data = NULL;
+    unsigned short bid = 0;
+    size_t data_len = 0;
+    parse_status status = PARSE_INCOMPLETE;
+
+    // No buffer was free, try again once the loop has recycled some.
+    if (res == -ENOBUFS)
+        return;
+
+    if (res <= 0 || (flags & IORING_CQE_F_BUFFER) == 0) {
+        conn->failed = true;
+        return;
+    }
+
+    bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    data = ring->bufs + (size_t)bid * REQ_BUF_SIZE;
+    data_len = res;
+
+    // Fast path, the head is parsed in place and the provided buffer is held until the response
+    // head is formatted.
+    if (conn->buf_len == 0) {
+        if (conn->req == NULL && (_acquire_uring_arena(conn) == 0 ||
+                                  (conn->req = create_request_in_arena(conn->mem,
+                                                                       conn->conn_fd)) == NULL))
+            status = PARSE_ERROR;
+        else
+            status = parse_request_buf(conn->req, data, data_len);
+
+        if (status == PARSE_COMPLETE) {
+            conn->held_bid = bid;
+            conn->state = CONN_OPEN_FILE;
+            data += conn->req->head_size;
+            data_len -= conn->req->head_size;
+        } else if (status == PARSE_ERROR)
+            conn->failed = true;
+    }
+
+    // A partial head, or pipelined requests following the head, are kept for later. A partial
+    // head is copied to the start of the buffer, so the parse resumes at the same offsets.
+    if (!conn->failed && data_len > 0) {
+        if (_acquire_uring_arena(conn) == 0)
+            conn->failed = true;
+        else if (conn->buf_len + data_len >= REQ_BUF_SIZE)
+            conn->failed = true;
+        else {
+            memcpy(conn->buf + conn->buf_len, data, data_len);
+            conn->buf_len += data_len;
+        }
+    }
+    if (conn->held_bid != bid)
+        _recycle_uring_buffer(ring, bid);
+
+    if (!conn->failed && conn->state == CONN_READ_HEAD && _parse_buffered_uring_request(conn) < 0)
+        conn->failed = true;
+}
+
+int _parse_buffered_uring_request(uring_conn *conn) {
+    parse_status status = PARSE_INCOMPLETE;
+
+    if (conn->buf_len == 0)
+        return 0;
+
+    if (conn->req == NULL &&
+        (conn->req = create_request_in_arena(conn->mem, conn->conn_fd)) == NULL)
+        return -1;
+
+    if ((status = parse_request_buf(conn->req, conn->buf, conn->buf_len)) == PARSE_INCOMPLETE)
+        return 0;
+    if (status == PARSE_ERROR)
+        return -1;
+
+    conn->state = CONN_OPEN_FILE;
+    return 1;
+}
+
+void _advance_uring_conn(uring *ring, uring_conn *conn) {
+    response *res = NULL;
+    ssize_t head_size = 0;
+    size_t prefix_len = 0;
+    off_t body_len = 0;
+    const server_config *config = NULL;
+    int r_val = 0, token = 0;
+
+    while (!conn->failed) {
+        switch (conn->state) {
+        case CONN_READ_HEAD:
+            // A pipelined request may already be in the buffer.
+            if ((r_val = _parse_buffered_uring_request(conn)) != 0) {
+                conn->failed = (r_val < 0);
+                break;
+            }
+            if (_prep_uring_recv(ring, conn) == 0)
+                conn->failed = true;
+            return;
+
+        case CONN_OPEN_FILE:
+            conn->keep_alive = keep_alive_request(conn->req, ++conn->no_requests);
+            conn->log_start = _access_log_now();
+            conn->head_size = 0;
+            conn->res_sent = 0;
+            config = acquire_server_config(&token);
+            r_val = _prepare_file_response(config, conn->req, -1, conn->keep_alive, &res,
+                                           &conn->file_fd, &conn->parts, &conn->no_parts,
+                                           &conn->entry, &conn->status_code, &body_len);
+            release_server_config(token);
+            // The request is released before its response is sent, so what is logged is kept.
+            conn->log_record = _capture_served_request(conn->mem, conn->req);
+            _release_uring_request(ring, conn);
+            if (r_val == 0) {
+                _log_served_record(conn->log_record, conn->status_code, 0, conn->log_start);
+                conn->log_record = NULL;
+                conn->failed = true;
+                break;
+            }
+            conn->part_no = 0;
+            prefix_len = 0;
+            if (conn->no_parts > 0) {
+                conn->file_off = conn->parts[0].start;
+                conn->file_end = conn->parts[0].end;
+                prefix_len = conn->parts[0].prefix_len;
+            }
+
+            // The response and the head stay in the arena until the connection is reset. The
+            // prefix of the first part of the body is sent with the head.
+            head_size = -1;
+            if ((conn->out_buf = arena_alloc(conn->mem, RES_HEAD_MAX_SIZE + prefix_len)) != NULL)
+                head_size = format_response_head(res, conn->out_buf, RES_HEAD_MAX_SIZE);
+            if (head_size < 0 ||
+                (conn->file_fd != -1 && conn->no_parts > 0 && conn->pipe_fds[0] == -1 &&
+                 pipe2(conn->pipe_fds, O_CLOEXEC) < 0)) {
+                // Counted here, as it isn't a failure of the request.
+                add_metric(METRIC_ERRORS_RESPONSE, 1);
+                _log_served_record(conn->log_record, conn->status_code, 0, conn->log_start);
+                conn->log_record = NULL;
+                conn->state = CONN_CLOSE;
+                conn->failed = true;
+                break;
+            }
+            if (prefix_len > 0)
+                memcpy(conn->out_buf + head_size, conn->parts[0].prefix, prefix_len);
+
+            conn->out_len = head_size + prefix_len;
+            conn->head_size = head_size;
+            conn->stage_start = metrics_now();
+            conn->state = CONN_WRITE_HEAD;
+            break;
+
+        case CONN_WRITE_HEAD:
+            conn->state = CONN_WRITE_BODY;
+            if (_prep_uring_response(ring, conn, true) == 0)
+                conn->failed = true;
+            return;
+
+        case CONN_WRITE_BODY:
+            // The prefix of the next part of a multipart body is sent like a head.
+            if (conn->pipe_len == 0 && conn->file_off >= conn->file_end &&
+                ++conn->part_no < conn->no_parts) {
+                conn->out_buf = conn->parts[conn->part_no].prefix;
+                conn->out_len = conn->parts[conn->part_no].prefix_len;
+                conn->file_off = conn->parts[conn->part_no].start;
+                conn->file_end = conn->parts[conn->part_no].end;
+                if (_prep_uring_response(ring, conn, true) == 0)
+                    conn->failed = true;
+                return;
+            }
+            if (conn->pipe_len == 0 && conn->file_off >= conn->file_end) {
+                if (conn->no_parts > 0)
+                    observe_metric(STAGE_BODY_SEND, conn->stage_start);
+                _log_served_record(conn->log_record, conn->status_code,
+                                   conn->res_sent - conn->head_size, conn->log_start);
+                conn->log_record = NULL;
+                if (conn->keep_alive)
+                    _reset_uring_conn(ring, conn);
+                else
+                    conn->state = CONN_CLOSE;
+                break;
+            }
+            if (_prep_uring_response(ring, conn, false) == 0)
+                conn->failed = true;
+            return;
+
+        default:
+            _free_uring_conn(ring, conn);
+            return;
+        }
+    }
+
+    // Operations submitted before the failure must complete before the connection is freed.
+    if (conn->no_inflight == 0)
+        _free_uring_conn(ring, conn);
+}
+
+void _release_uring_request(uring *ring, uring_conn *conn) {
+    if (conn->req == NULL)
+        return;
+
+    // The head was parsed either in a held provided buffer or at the start of the connection
+    // buffer.
+    if (conn->held_bid != -1) {
+        _recycle_uring_buffer(ring, conn->held_bid);
+        conn->held_bid = -1;
+    } else {
+        conn->buf_len -= conn->req->head_size;
+        memmove(conn->buf, conn->buf + conn->req->head_size, conn->buf_len);
+    }
+
+    // The connection outlives the request, so closing the request must not close it.
+    conn->req->conn_fd = -1;
+    close_request(conn->req);
+    conn->req = NULL;
+}
+
+void _reset_uring_conn(uring *ring, uring_conn *conn) {
+    // The file of an fd cache entry stays open for other responses.
+    if (conn->file_fd != -1 && conn->entry == NULL)
+        close(conn->file_fd);
+    conn->file_fd = -1;
+    release_file_cache_entry(conn->entry);
+    conn->entry = NULL;
+    conn->parts = NULL;
+    conn->no_parts = 0;
+    conn->part_no = 0;
+    conn->file_off = 0;
+    conn->file_end = 0;
+    _release_uring_request(ring, conn);
+
+    conn->out_buf = NULL;
+    conn->out_len = 0;
+
+    // Frees the request and response at once, keeping the buffer. Without buffered bytes, the
+    // arena is released and the next head can be parsed straight from a provided buffer.
+    if (conn->mem != NULL) {
+        rewind_arena(conn->mem, conn->mark);
+        if (conn->buf_len == 0) {
+            release_arena(conn->mem);
+            conn->mem = NULL;
+            conn->buf = NULL;
+        }
+    }
+
+    conn->keep_alive = false;
+    conn->state = CONN_READ_HEAD;
+}
+
+uring_conn *_initialize_uring_conn(const int conn_fd) {
+    uring_conn *conn = malloc(sizeof(uring_conn));
+    if (conn == NULL) {
+        close(conn_fd);
+        return NULL;
+    }
+
+    conn->conn_fd = conn_fd;
+    conn->state = CONN_READ_HEAD;
+    conn->no_inflight = 0;
+    conn->failed = false;
+    conn->buf = NULL;
+    conn->buf_len = 0;
+    conn->out_buf = NULL;
+    conn->out_len = 0;
+    conn->mem = NULL;
+    conn->req = NULL;
+    conn->held_bid = -1;
+    conn->file_fd = -1;
+    conn->entry = NULL;
+    conn->parts = NULL;
+    conn->no_parts = 0;
+    conn->part_no = 0;
+    conn->file_off = 0;
+    conn->file_end = 0;
+    conn->pipe_fds[0] = -1;
+    conn->pipe_fds[1] = -1;
+    conn->pipe_len = 0;
+    conn->no_requests = 0;
+    conn->keep_alive = false;
+    conn->stage_start = 0;
+    conn->log_record = NULL;
+    conn->log_start = 0;
+    conn->status_code = 444;
+    conn->head_size = 0;
+    conn->res_sent = 0;
+
+    return conn;
+}
+
+void _free_uring_conn(uring *ring, uring_conn *conn) {
+    if (conn == NULL)
+        return;
+
+    // A client closing an idle keep-alive connection (or its timeout) fails its receive, but is not
+    // an error.
+    // A response that couldn't be sent is logged with the bytes of its body that went out.
+    if (conn->failed && (conn->state == CONN_WRITE_HEAD || conn->state == CONN_WRITE_BODY)) {
+        add_metric(METRIC_ERRORS_SEND, 1);
+        _log_served_record(conn->log_record, conn->status_code,
+                           (conn->res_sent > conn->head_size) ? conn->res_sent - conn->head_size
+                                                              : 0,
+                           conn->log_start);
+    } else if (conn->failed &&
+             (conn->state == CONN_OPEN_FILE ||
+              (conn->state == CONN_READ_HEAD && (conn->buf_len > 0 || conn->no_requests == 0))))
+        add_metric(METRIC_ERRORS_REQUEST, 1);
+
+    if (conn->held_bid != -1)
+        _recycle_uring_buffer(ring, conn->held_bid);
+
+    if (conn->file_fd != -1 && conn->entry == NULL)
+        close(conn->file_fd);
+    release_file_cache_entry(conn->entry);
+    if (conn->pipe_fds[0] != -1)
+        close(conn->pipe_fds[0]);
+    if (conn->pipe_fds[1] != -1)
+        close(conn->pipe_fds[1]);
+
+    if (conn->req != NULL) {
+        close_request(conn->req);
+        conn->conn_fd = -1;
+    }
+    if (conn->conn_fd != -1)
+        close(conn->conn_fd);
+
+    release_arena(conn->mem);
+    free(conn);
+}
+
+int _acquire_uring_arena(uring_conn *conn) {
+    if (conn->mem != NULL)
+        return 1;
+
+    // The buffer is the first allocation of the arena, requests are allocated after the mark.
+    if ((conn->mem = acquire_arena()) == NULL)
+        return 0;
+    if ((conn->buf = arena_alloc(conn->mem, REQ_BUF_SIZE)) == NULL)
+        return 0;
+    conn->mark = get_arena_mark(conn->mem);
+    return 1;
+}
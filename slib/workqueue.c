@@ -0,0 +1,114 @@
+/**
+ * @file slib/workqueue.c
+ * @brief A bounded, lock-free, multi-producer multi-consumer work queue.
+ *
+ * Implements functions defined in `include/workqueue.h`. Used to hand over accepted connections
+ * from the accepting thread to the worker threads.
+ *
+ * Every cell of the queue has a sequence number. A cell at position `pos` is free for a producer
+ * when its sequence is `pos` and is ready for a consumer when its sequence is `pos + 1`. After a
+ * consumer empties the cell, the sequence is set to `pos + capacity`, i.e. the position at which
+ * the cell is reused on the next lap. Producers and consumers only contend on their own position
+ * counter, which are kept on separate cache lines.
+ *
+ * @see typedef struct work_queue
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "workqueue.h"
+
+work_queue *create_work_queue(const size_t capacity) {
+    size_t no_cells = 1;
+    work_queue *queue = NULL;
+
+    if (capacity == 0)
+        return NULL;
+    while (no_cells < capacity)
+        no_cells <<= 1;
+
+    if ((queue = aligned_alloc(CACHE_LINE_SIZE, sizeof(work_queue))) == NULL)
+        return NULL;
+
+    if ((queue->cells = malloc(no_cells * sizeof(work_queue_cell))) == NULL) {
+        free(queue);
+        return NULL;
+    }
+
+    for (size_t pos = 0; pos < no_cells; pos++)
+        atomic_init(&queue->cells[pos].sequence, pos);
+    queue->mask = no_cells - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+
+    return queue;
+}
+
+int work_queue_push(work_queue *queue, const int conn_fd) {
+    work_queue_cell *cell = NULL;
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+    while (true) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            // On failure, pos is updated to the current enqueue_pos.
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Cell still holds a connection from the previous lap, queue is full.
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->conn_fd = conn_fd;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+int work_queue_pop(work_queue *queue, int *conn_fd) {
+    work_queue_cell *cell = NULL;
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+    while (true) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Cell was not published by a producer yet, queue is empty.
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *conn_fd = cell->conn_fd;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return 1;
+}
+
+size_t work_queue_capacity(const work_queue *queue) { return queue->mask + 1; }
+
+void destroy_work_queue(work_queue *queue) {
+    if (queue == NULL)
+        return;
+
+    free(queue->cells);
+    free(queue);
+}
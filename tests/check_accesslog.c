@@ -0,0 +1,231 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "accesslog.h"
+
+#define NO_THREADS 4
+#define NO_RECORDS_PER_THREAD 256
+
+const char *log_req_buf = "GET /index.html HTTP/1.1\r\n"
+                          "Host: localhost\r\n"
+                          "Referer: http://localhost/\"home\"\r\n"
+                          "User-Agent: check\r\n"
+                          "\r\n";
+
+access_log *mt_log = NULL;
+
+int read_log(const char *path, char *buf, const size_t size) {
+    FILE *log_file = fopen(path, "r");
+    size_t len = 0;
+    int no_lines = 0;
+
+    if (log_file == NULL)
+        return -1;
+    len = fread(buf, 1, size - 1, log_file);
+    buf[len] = '\0';
+    fclose(log_file);
+
+    for (size_t c_no = 0; c_no < len; c_no++)
+        if (buf[c_no] == '\n')
+            no_lines++;
+    return no_lines;
+}
+
+void *log_requests(void *arg) {
+    request *req = parse_request(log_req_buf, -1);
+
+    for (int r_no = 0; r_no < NO_RECORDS_PER_THREAD; r_no++)
+        log_access(mt_log, req, 200, r_no, 1);
+    close_request(req);
+
+    return NULL;
+}
+
+START_TEST(test_create_access_log) {
+    char path[] = "/tmp/check_accesslog_XXXXXX";
+    close(mkstemp(path));
+
+    // call create_access_log() and check if it opens the log
+    access_log *log = create_access_log(path, LOG_FORMAT_COMBINED);
+    ck_assert_ptr_ne(log, NULL);
+    destroy_access_log(log);
+    destroy_access_log(NULL);
+
+    // call create_access_log() with a path that can't be opened and check if it returns NULL
+    ck_assert_ptr_eq(create_access_log("/nonexistent/access.log", LOG_FORMAT_COMBINED), NULL);
+    ck_assert_ptr_eq(create_access_log(NULL, LOG_FORMAT_COMBINED), NULL);
+
+    // call parse_access_log_format() and check if it falls back to the combined format
+    ck_assert_int_eq(parse_access_log_format(ACCESS_LOG_FORMAT_JSON), LOG_FORMAT_JSON);
+    ck_assert_int_eq(parse_access_log_format(ACCESS_LOG_FORMAT_COMBINED), LOG_FORMAT_COMBINED);
+    ck_assert_int_eq(parse_access_log_format("xml"), LOG_FORMAT_COMBINED);
+    ck_assert_int_eq(parse_access_log_format(NULL), LOG_FORMAT_COMBINED);
+
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_log_access_combined) {
+    char path[] = "/tmp/check_accesslog_XXXXXX", buf[4096];
+    request *req = parse_request(log_req_buf, -1);
+    access_log *log = NULL;
+    close(mkstemp(path));
+
+    // call log_access() and check if destroy_access_log() writes the line in the combined format
+    log = create_access_log(path, LOG_FORMAT_COMBINED);
+    ck_assert_int_eq(log_access(log, req, 200, 1234, 56), 1);
+    ck_assert_int_eq(log_access(log, req, 304, 0, 7), 1);
+    ck_assert_int_eq(log_access(NULL, req, 200, 0, 0), 0);
+    destroy_access_log(log);
+
+    ck_assert_int_eq(read_log(path, buf, sizeof(buf)), 2);
+    ck_assert_int_eq(strncmp(buf, "- - - [", 7), 0);
+    ck_assert_ptr_ne(strstr(buf, "] \"GET /index.html HTTP/1.1\" 200 1234 "
+                                 "\"http://localhost/\\\"home\\\"\" \"check\"\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\" 304 - \""), NULL);
+
+    close_request(req);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_log_access_json) {
+    char path[] = "/tmp/check_accesslog_XXXXXX", buf[4096];
+    request *req = parse_request(log_req_buf, -1);
+    request *utf8_req =
+        parse_request("GET / HTTP/1.1\r\nUser-Agent: caf\xc3\xa9 \xff\r\n\r\n", -1);
+    access_log *log = NULL;
+    close(mkstemp(path));
+
+    // call log_access() and check if destroy_access_log() writes the line as JSON
+    log = create_access_log(path, LOG_FORMAT_JSON);
+    ck_assert_int_eq(log_access(log, req, 206, 10, 3), 1);
+    ck_assert_int_eq(log_access(log, utf8_req, 200, 0, 0), 1);
+    destroy_access_log(log);
+
+    ck_assert_int_eq(read_log(path, buf, sizeof(buf)), 2);
+    ck_assert_int_eq(strncmp(buf, "{\"time\":\"", 9), 0);
+    ck_assert_ptr_ne(strstr(buf, "Z\",\"client\":\"-\",\"method\":\"GET\",\"url\":\"/index.html\","
+                                 "\"protocol\":\"HTTP/1.1\",\"status\":206,\"bytes\":10,"
+                                 "\"latency_us\":3,\"referer\":\"http://localhost/\\\"home\\\"\","
+                                 "\"user_agent\":\"check\"}\n"),
+                     NULL);
+
+    // check if bytes outside ASCII are escaped, one by one
+    ck_assert_ptr_ne(strstr(buf, "\"user_agent\":\"caf\\u00c3\\u00a9 \\u00ff\"}\n"), NULL);
+
+    close_request(utf8_req);
+    close_request(req);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_log_access_record) {
+    char path[] = "/tmp/check_accesslog_XXXXXX", buf[4096];
+    request *req = parse_request(log_req_buf, -1);
+    access_log_record record;
+    access_log *log = NULL;
+    close(mkstemp(path));
+
+    // capture a request, free it, call log_access_record() and check if the request is logged
+    capture_access_log_record(&record, req);
+    close_request(req);
+    log = create_access_log(path, LOG_FORMAT_COMBINED);
+    ck_assert_int_eq(log_access_record(log, &record, 200, 512, 9), 1);
+    ck_assert_int_eq(log_access_record(log, NULL, 200, 0, 0), 0);
+    ck_assert_int_eq(log_access_record(NULL, &record, 200, 0, 0), 0);
+    destroy_access_log(log);
+
+    ck_assert_int_eq(read_log(path, buf, sizeof(buf)), 1);
+    ck_assert_ptr_ne(strstr(buf, "] \"GET /index.html HTTP/1.1\" 200 512 "
+                                 "\"http://localhost/\\\"home\\\"\" \"check\"\n"),
+                     NULL);
+
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_log_access_threads) {
+    char path[] = "/tmp/check_accesslog_XXXXXX";
+    char *buf = malloc(NO_THREADS * NO_RECORDS_PER_THREAD * 256);
+    pthread_t threads[NO_THREADS];
+    close(mkstemp(path));
+
+    // log from several threads at once, twice, and check if every record is written once
+    mt_log = create_access_log(path, LOG_FORMAT_COMBINED);
+    ck_assert_ptr_ne(mt_log, NULL);
+    for (int round = 0; round < 2; round++) {
+        for (int t_no = 0; t_no < NO_THREADS; t_no++)
+            ck_assert_int_eq(pthread_create(&threads[t_no], NULL, log_requests, NULL), 0);
+        for (int t_no = 0; t_no < NO_THREADS; t_no++)
+            pthread_join(threads[t_no], NULL);
+    }
+    destroy_access_log(mt_log);
+    mt_log = NULL;
+
+    ck_assert_int_eq(read_log(path, buf, NO_THREADS * NO_RECORDS_PER_THREAD * 256),
+                     2 * NO_THREADS * NO_RECORDS_PER_THREAD);
+
+    free(buf);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_reopen_access_log) {
+    char path[] = "/tmp/check_accesslog_XXXXXX", rotated_path[64], buf[4096];
+    request *req = parse_request(log_req_buf, -1);
+    access_log *log = NULL;
+    close(mkstemp(path));
+    snprintf(rotated_path, sizeof(rotated_path), "%s.1", path);
+
+    // rotate the log, call reopen_access_log() and check if later records go to the new file
+    log = create_access_log(path, LOG_FORMAT_COMBINED);
+    ck_assert_int_eq(log_access(log, req, 200, 1, 1), 1);
+    ck_assert_int_eq(rename(path, rotated_path), 0);
+    reopen_access_log(log);
+    usleep(ACCESS_LOG_FLUSH_MSEC * 2000);
+    ck_assert_int_eq(log_access(log, req, 200, 2, 1), 1);
+    destroy_access_log(log);
+
+    ck_assert_int_eq(read_log(rotated_path, buf, sizeof(buf)), 1);
+    ck_assert_ptr_ne(strstr(buf, "\" 200 1 \""), NULL);
+    ck_assert_int_eq(read_log(path, buf, sizeof(buf)), 1);
+    ck_assert_ptr_ne(strstr(buf, "\" 200 2 \""), NULL);
+
+    close_request(req);
+    unlink(path);
+    unlink(rotated_path);
+}
+END_TEST
+
+Suite *accesslog_suite() {
+    const TTest *tests[] = {test_create_access_log, test_log_access_combined, test_log_access_json,
+                            test_log_access_record, test_log_access_threads,
+                            test_reopen_access_log};
+
+    Suite *suite = suite_create("AccessLog");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = accesslog_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
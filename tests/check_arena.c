@@ -0,0 +1,151 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+START_TEST(test_create_arena) {
+    // call create_arena() and check if the arena has an empty first block.
+    arena *mem = create_arena(1024);
+    ck_assert_ptr_ne(mem, NULL);
+    ck_assert_ptr_ne(mem->first, NULL);
+    ck_assert_ptr_eq(mem->current, mem->first);
+    ck_assert_int_eq(mem->first->size, 1024);
+    ck_assert_int_eq(mem->first->used, 0);
+
+    destroy_arena(mem);
+}
+END_TEST
+
+START_TEST(test_arena_alloc) {
+    arena *mem = create_arena(1024);
+    ck_assert_ptr_ne(mem, NULL);
+
+    // call arena_alloc() with odd sizes and check if the memory is aligned and doesn't overlap.
+    char *first = arena_alloc(mem, 3);
+    char *second = arena_alloc(mem, 5);
+    ck_assert_ptr_ne(first, NULL);
+    ck_assert_ptr_ne(second, NULL);
+    ck_assert_int_eq((uintptr_t)first % _Alignof(max_align_t), 0);
+    ck_assert_int_eq((uintptr_t)second % _Alignof(max_align_t), 0);
+    ck_assert_int_ge(second - first, 3);
+
+    // call arena_strdup() and check if the string is copied.
+    char *copy = arena_strdup(mem, "text/html");
+    ck_assert_str_eq(copy, "text/html");
+
+    destroy_arena(mem);
+}
+END_TEST
+
+START_TEST(test_arena_alloc_grow) {
+    arena *mem = create_arena(1024);
+    ck_assert_ptr_ne(mem, NULL);
+
+    // allocate more than a block and check if a new block is added.
+    ck_assert_ptr_ne(arena_alloc(mem, 1000), NULL);
+    ck_assert_ptr_ne(arena_alloc(mem, 1000), NULL);
+    ck_assert_ptr_ne(mem->current, mem->first);
+    ck_assert_ptr_eq(mem->first->next, mem->current);
+
+    // allocate more than the block size and check if the block is large enough.
+    char *large = arena_alloc(mem, 4096);
+    ck_assert_ptr_ne(large, NULL);
+    ck_assert_int_ge(mem->current->size, 4096);
+    memset(large, 'a', 4096);
+
+    destroy_arena(mem);
+}
+END_TEST
+
+START_TEST(test_rewind_arena) {
+    arena *mem = create_arena(1024);
+    ck_assert_ptr_ne(mem, NULL);
+
+    // take a mark, allocate past the block and check if rewinding hands out the same memory again.
+    ck_assert_ptr_ne(arena_alloc(mem, 100), NULL);
+    arena_mark mark = get_arena_mark(mem);
+    char *after_mark = arena_alloc(mem, 100);
+    ck_assert_ptr_ne(arena_alloc(mem, 2000), NULL);
+
+    rewind_arena(mem, mark);
+    ck_assert_ptr_eq(mem->current, mem->first);
+    ck_assert_ptr_eq(arena_alloc(mem, 100), after_mark);
+
+    destroy_arena(mem);
+}
+END_TEST
+
+START_TEST(test_reset_arena) {
+    arena *mem = create_arena(1024);
+    ck_assert_ptr_ne(mem, NULL);
+
+    // fill two blocks, reset and check if the blocks are reused without allocating new ones.
+    char *first = arena_alloc(mem, 1000);
+    ck_assert_ptr_ne(arena_alloc(mem, 1000), NULL);
+    arena_block *second_block = mem->current;
+
+    reset_arena(mem);
+    ck_assert_ptr_eq(arena_alloc(mem, 1000), first);
+    ck_assert_ptr_ne(arena_alloc(mem, 1000), NULL);
+    ck_assert_ptr_eq(mem->current, second_block);
+    ck_assert_ptr_eq(second_block->next, NULL);
+
+    destroy_arena(mem);
+}
+END_TEST
+
+START_TEST(test_acquire_release_arena) {
+    // call acquire_arena() and check if a new arena is created.
+    arena *mem = acquire_arena();
+    ck_assert_ptr_ne(mem, NULL);
+    ck_assert_int_eq(mem->block_size, ARENA_BLOCK_SIZE);
+    ck_assert_ptr_ne(arena_alloc(mem, 100), NULL);
+
+    // release the arena and check if the next acquire_arena() returns it empty.
+    release_arena(mem);
+    arena *reused = acquire_arena();
+    ck_assert_ptr_eq(reused, mem);
+    ck_assert_int_eq(reused->first->used, 0);
+
+    // call acquire_arena() again and check if a different arena is returned.
+    arena *other = acquire_arena();
+    ck_assert_ptr_ne(other, NULL);
+    ck_assert_ptr_ne(other, reused);
+
+    release_arena(reused);
+    release_arena(other);
+    release_arena(NULL);
+}
+END_TEST
+
+Suite *arena_suite() {
+    const TTest *tests[] = {test_create_arena,
+                            test_arena_alloc,
+                            test_arena_alloc_grow,
+                            test_rewind_arena,
+                            test_reset_arena,
+                            test_acquire_release_arena};
+
+    Suite *suite = suite_create("Arena");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = arena_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -97,6 +97,21 @@ START_TEST(test_get_config_int_invalid_key) {
 }
 END_TEST
 
+START_TEST(test_reload_config) {
+    // call reload_config() without loading config and check if it loads the config
+    ck_assert_int_eq(reload_config(), 1);
+    ck_assert_int_eq(get_config_int("server_port"), 8080);
+
+    // call reload_config() again and check if the config is still loaded
+    ck_assert_int_eq(reload_config(), 1);
+    char *val = get_config_str("server_host");
+    ck_assert_str_eq(val, "127.0.0.1");
+    free(val);
+
+    unload_config();
+}
+END_TEST
+
 Suite *config_suite() {
     const TTest *tests[] = {test_check_config,
                             test_get_config_without_load,
@@ -107,7 +122,8 @@ Suite *config_suite() {
                             test_get_config_str_valid_key,
                             test_get_config_str_invalid_key,
                             test_get_config_int_valid_key,
-                            test_get_config_int_invalid_key};
+                            test_get_config_int_invalid_key,
+                            test_reload_config};
 
     Suite *suite = suite_create("Config");
     TCase *tc_core = tcase_create("Core");
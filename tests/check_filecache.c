@@ -0,0 +1,485 @@
+#include <check.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filecache.h"
+
+/**
+ * Creates an unlinked temporary file of `size` bytes, filled with `a`, and stats it.
+ */
+int create_test_file(const size_t size, struct stat *file_stat) {
+    char path[] = "/tmp/check_filecache_XXXXXX", *data = malloc(size);
+    int file_fd = mkstemp(path);
+    ck_assert_int_ne(file_fd, -1);
+    ck_assert_ptr_ne(data, NULL);
+    unlink(path);
+
+    memset(data, 'a', size);
+    ck_assert_int_eq(write(file_fd, data, size), size);
+    ck_assert_int_eq(fstat(file_fd, file_stat), 0);
+    free(data);
+
+    return file_fd;
+}
+
+/**
+ * Checks if the header lines of the entry are `headers` followed by the validators of the entry.
+ */
+void check_entry_headers(const file_entry *entry, const char *headers) {
+    size_t headers_len = strlen(headers);
+
+    ck_assert_int_eq(strncmp(entry->headers, headers, headers_len), 0);
+    ck_assert_ptr_eq(entry->validators, entry->headers + headers_len);
+    ck_assert_int_eq(strncmp(entry->validators, "ETag: ", 6), 0);
+    ck_assert_int_eq(entry->headers_len, headers_len + entry->validators_len);
+    ck_assert_int_eq(entry->headers_len, strlen(entry->headers));
+}
+
+/**
+ * Writes the `no_paths` first paths of the form `/site/N.txt` that hash to the shard of `0.txt`.
+ */
+void get_same_shard_paths(char paths[][32], const int no_paths) {
+    uint32_t shard = _hash_file_path("/site/0.txt") & (FILE_CACHE_SHARDS - 1);
+
+    for (int n = 0, p_no = 0; p_no < no_paths; n++) {
+        snprintf(paths[p_no], 32, "/site/%d.txt", n);
+        if ((_hash_file_path(paths[p_no]) & (FILE_CACHE_SHARDS - 1)) == shard)
+            p_no++;
+    }
+}
+
+START_TEST(test_create_file_cache) {
+    // call create_file_cache() and check if the budget is split between the shards.
+    file_cache *cache = create_file_cache(FILE_CACHE_SHARDS * 1024, 512, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    ck_assert_int_eq(cache->shard_budget, 1024);
+    ck_assert_int_eq(cache->max_file_size, 512);
+    ck_assert_ptr_eq(cache->shards[0].hand, NULL);
+    destroy_file_cache(cache);
+
+    // call create_file_cache() without a budget and check if NULL is returned.
+    ck_assert_ptr_eq(create_file_cache(0, 512, 0), NULL);
+    destroy_file_cache(NULL);
+}
+END_TEST
+
+START_TEST(test_add_file_cache_entry) {
+    struct stat file_stat;
+    int file_fd = create_test_file(10, &file_stat);
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+
+    // call get_file_cache_entry() before the file is added and check if NULL is returned.
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "/site/index.html", NULL), NULL);
+
+    // call add_file_cache_entry() and check if the contents and the header lines are cached.
+    file_entry *entry =
+        add_file_cache_entry(cache, "/site/index.html", NULL, file_fd, &file_stat, "text/html");
+    ck_assert_ptr_ne(entry, NULL);
+    ck_assert_int_eq(entry->size, 10);
+    ck_assert_int_eq(memcmp(entry->data, "aaaaaaaaaa", 10), 0);
+    ck_assert_str_eq(entry->mimetype, "text/html");
+    check_entry_headers(entry, "Content-Type: text/html\r\nContent-Length: 10\r\n"
+                               "Accept-Ranges: bytes\r\n");
+
+    // call get_file_cache_entry() and check if the same entry is returned with a reference held.
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "/site/index.html", NULL), entry);
+    ck_assert_int_eq(atomic_load(&entry->refs), 3);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "/site/other.html", NULL), NULL);
+
+    // call add_file_cache_entry() for a cached path and check if the cached entry is returned.
+    ck_assert_ptr_eq(
+        add_file_cache_entry(cache, "/site/index.html", NULL, file_fd, &file_stat, "a/b"), entry);
+    release_file_cache_entry(entry);
+    release_file_cache_entry(entry);
+    release_file_cache_entry(entry);
+
+    destroy_file_cache(cache);
+    close(file_fd);
+}
+END_TEST
+
+START_TEST(test_file_cache_coding) {
+    struct stat file_stat;
+    int file_fd = create_test_file(10, &file_stat);
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    file_entry *plain =
+        add_file_cache_entry(cache, "/site/a.css", NULL, file_fd, &file_stat, "a/b");
+    ck_assert_ptr_ne(plain, NULL);
+
+    // call get_file_cache_entry() with a coding and check if the file as is isn't returned.
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "/site/a.css", "gzip"), NULL);
+
+    // call add_file_cache_entry() with a coding and check if it gets its own entry and header line.
+    file_entry *gzip =
+        add_file_cache_entry(cache, "/site/a.css", "gzip", file_fd, &file_stat, "a/b");
+    ck_assert_ptr_ne(gzip, NULL);
+    ck_assert_ptr_ne(gzip, plain);
+    ck_assert_str_eq(gzip->coding, "gzip");
+    check_entry_headers(gzip,
+                        "Content-Type: a/b\r\nContent-Length: 10\r\nContent-Encoding: gzip\r\n"
+                        "Accept-Ranges: bytes\r\n");
+    ck_assert_str_eq(plain->coding, "");
+    ck_assert_uint_eq(atomic_load(&plain->variants), FILE_VARIANTS_UNKNOWN);
+
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "/site/a.css", "gzip"), gzip);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "/site/a.css", NULL), plain);
+    for (int r_no = 0; r_no < 2; r_no++) {
+        release_file_cache_entry(plain);
+        release_file_cache_entry(gzip);
+    }
+
+    destroy_file_cache(cache);
+    close(file_fd);
+}
+END_TEST
+
+START_TEST(test_add_file_cache_entry_too_large) {
+    struct stat file_stat;
+    int file_fd = create_test_file(2048, &file_stat);
+    file_cache *cache = create_file_cache(FILE_CACHE_SHARDS * 1024, 4096, 0);
+    ck_assert_ptr_ne(cache, NULL);
+
+    // call add_file_cache_entry() with a file larger than the budget of a shard and check if it
+    // isn't cached.
+    ck_assert_ptr_eq(add_file_cache_entry(cache, "/site/big.bin", NULL, file_fd, &file_stat, "a/b"),
+                     NULL);
+    destroy_file_cache(cache);
+
+    // call add_file_cache_entry() with a file larger than the max file size and check if it isn't
+    // cached.
+    cache = create_file_cache(1024 * 1024, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    ck_assert_ptr_eq(add_file_cache_entry(cache, "/site/big.bin", NULL, file_fd, &file_stat, "a/b"),
+                     NULL);
+    ck_assert_int_eq(cache->shards[0].used, 0);
+    destroy_file_cache(cache);
+
+    close(file_fd);
+}
+END_TEST
+
+START_TEST(test_file_cache_eviction) {
+    char paths[3][32];
+    struct stat file_stat;
+    int file_fd = create_test_file(1000, &file_stat);
+    file_cache *cache = create_file_cache(FILE_CACHE_SHARDS * 2500, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    get_same_shard_paths(paths, 3);
+
+    // fill a shard with two entries and look up the first one.
+    file_entry *first = add_file_cache_entry(cache, paths[0], NULL, file_fd, &file_stat, "a/b");
+    file_entry *second = add_file_cache_entry(cache, paths[1], NULL, file_fd, &file_stat, "a/b");
+    ck_assert_ptr_ne(first, NULL);
+    ck_assert_ptr_ne(second, NULL);
+    release_file_cache_entry(first);
+    release_file_cache_entry(first = get_file_cache_entry(cache, paths[0], NULL));
+
+    // add a third entry and check if the entry that wasn't looked up again is evicted, while it is
+    // still held.
+    file_entry *third = add_file_cache_entry(cache, paths[2], NULL, file_fd, &file_stat, "a/b");
+    ck_assert_ptr_ne(third, NULL);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, paths[1], NULL), NULL);
+    ck_assert_int_eq(atomic_load(&second->refs), 1);
+    ck_assert_int_eq(memcmp(second->data, "aaaa", 4), 0);
+    release_file_cache_entry(second);
+
+    // check if the entry that was looked up is still cached.
+    ck_assert_ptr_eq(get_file_cache_entry(cache, paths[0], NULL), first);
+    release_file_cache_entry(first);
+    release_file_cache_entry(third);
+
+    destroy_file_cache(cache);
+    close(file_fd);
+}
+END_TEST
+
+START_TEST(test_file_cache_revalidate) {
+    char path[] = "/tmp/check_filecache_XXXXXX";
+    struct stat file_stat;
+    int file_fd = mkstemp(path);
+    ck_assert_int_ne(file_fd, -1);
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    ck_assert_int_eq(fstat(file_fd, &file_stat), 0);
+
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 1);
+    ck_assert_ptr_ne(cache, NULL);
+    file_entry *entry = add_file_cache_entry(cache, path, NULL, file_fd, &file_stat, "text/plain");
+    ck_assert_ptr_ne(entry, NULL);
+    release_file_cache_entry(entry);
+
+    // make the entry due for revalidation and check if it is still served while the file is
+    // unchanged.
+    atomic_fetch_sub(&entry->checked_at, 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, NULL), entry);
+    release_file_cache_entry(entry);
+
+    // change the file, make the entry due again and check if it is dropped.
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    atomic_fetch_sub(&entry->checked_at, 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, NULL), NULL);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, NULL), NULL);
+
+    destroy_file_cache(cache);
+    close(file_fd);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_invalidate_file_cache) {
+    struct stat file_stat;
+    int file_fd = create_test_file(10, &file_stat);
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    const char *paths[] = {"site/a.css", "site/a.css", "site/d/b.css", "site/d/e/c.css",
+                           "site/dd.css"};
+    const char *codings[] = {NULL, "gzip", NULL, NULL, NULL};
+    for (int p_no = 0; p_no < 5; p_no++)
+        release_file_cache_entry(
+            add_file_cache_entry(cache, paths[p_no], codings[p_no], file_fd, &file_stat, "a/b"));
+
+    // call invalidate_file_cache_path() and check if the entries of all codings are removed.
+    ck_assert_int_eq(invalidate_file_cache_path(cache, "site/a.css"), 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "site/a.css", NULL), NULL);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "site/a.css", "gzip"), NULL);
+    ck_assert_int_eq(invalidate_file_cache_path(cache, "site/a.css"), 0);
+
+    // call invalidate_file_cache_dir() and check if only the entries below the directory are
+    // removed.
+    ck_assert_int_eq(invalidate_file_cache_dir(cache, "site/d/"), 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "site/d/e/c.css", NULL), NULL);
+    file_entry *entry = get_file_cache_entry(cache, "site/dd.css", NULL);
+    ck_assert_ptr_ne(entry, NULL);
+    release_file_cache_entry(entry);
+    ck_assert_int_eq(invalidate_file_cache_dir(cache, "site"), 1);
+
+    destroy_file_cache(cache);
+    close(file_fd);
+}
+END_TEST
+
+START_TEST(test_watched_file_cache) {
+    char path[] = "/tmp/check_filecache_XXXXXX";
+    struct stat file_stat;
+    int file_fd = mkstemp(path);
+    ck_assert_int_ne(file_fd, -1);
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    ck_assert_int_eq(fstat(file_fd, &file_stat), 0);
+
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 1);
+    ck_assert_ptr_ne(cache, NULL);
+    set_file_cache_watched(cache, true);
+
+    // call add_file_cache_entry() and check if the entry is cached and not revalidated.
+    file_entry *entry = add_file_cache_entry(cache, path, NULL, file_fd, &file_stat, "text/plain");
+    ck_assert_ptr_ne(entry, NULL);
+    release_file_cache_entry(entry);
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    atomic_fetch_sub(&entry->checked_at, 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, NULL), entry);
+    release_file_cache_entry(entry);
+
+    // change the file after it was stat-ed and check if its entry is returned but not cached.
+    ck_assert_int_eq(invalidate_file_cache_path(cache, path), 1);
+    entry = add_file_cache_entry(cache, path, NULL, file_fd, &file_stat, "text/plain");
+    ck_assert_ptr_ne(entry, NULL);
+    ck_assert_int_eq(atomic_load(&entry->refs), 1);
+    release_file_cache_entry(entry);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, NULL), NULL);
+
+    // unwatch the cache and check if the file is cached and revalidated again.
+    ck_assert_int_eq(fstat(file_fd, &file_stat), 0);
+    set_file_cache_watched(cache, false);
+    entry = add_file_cache_entry(cache, path, NULL, file_fd, &file_stat, "text/plain");
+    ck_assert_int_eq(atomic_load(&entry->refs), 2);
+    release_file_cache_entry(entry);
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    atomic_fetch_sub(&entry->checked_at, 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, NULL), NULL);
+
+    destroy_file_cache(cache);
+    close(file_fd);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_add_encoded_file_cache_entry) {
+    char path[] = "/tmp/check_filecache_XXXXXX";
+    struct stat file_stat;
+    int file_fd = mkstemp(path);
+    ck_assert_int_ne(file_fd, -1);
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    ck_assert_int_eq(fstat(file_fd, &file_stat), 0);
+
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 1);
+    ck_assert_ptr_ne(cache, NULL);
+
+    // call add_encoded_file_cache_entry() and check if the entry holds the given contents.
+    file_entry *entry =
+        add_encoded_file_cache_entry(cache, path, "gzip", &file_stat, "text/plain", "xyz", 3);
+    ck_assert_ptr_ne(entry, NULL);
+    ck_assert_int_eq(entry->size, 3);
+    ck_assert_int_eq(entry->file_size, 10);
+    ck_assert_int_eq(memcmp(entry->data, "xyz", 3), 0);
+    check_entry_headers(
+        entry, "Content-Type: text/plain\r\nContent-Length: 3\r\nContent-Encoding: gzip\r\n"
+               "Accept-Ranges: bytes\r\n");
+    release_file_cache_entry(entry);
+
+    // make the entry due for revalidation and check if it is checked against the file.
+    atomic_fetch_sub(&entry->checked_at, 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, "gzip"), entry);
+    release_file_cache_entry(entry);
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    atomic_fetch_sub(&entry->checked_at, 2);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, path, "gzip"), NULL);
+
+    // call add_encoded_file_cache_entry() with contents larger than the max file size.
+    char large[2048] = {0};
+    ck_assert_ptr_eq(add_encoded_file_cache_entry(cache, path, "gzip", &file_stat, "text/plain",
+                                                  large, sizeof(large)),
+                     NULL);
+
+    destroy_file_cache(cache);
+    close(file_fd);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_file_cache_validators) {
+    char etag[FILE_ETAG_SIZE], other_etag[FILE_ETAG_SIZE], validators[256];
+    struct stat file_stat;
+    int file_fd = create_test_file(10, &file_stat);
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+
+    // call format_file_etag() and check if the tag is quoted and differs by coding and mtime.
+    ck_assert_int_gt(format_file_etag(&file_stat, NULL, etag, sizeof(etag)), 2);
+    ck_assert_int_eq(etag[0], '"');
+    ck_assert_int_eq(etag[strlen(etag) - 1], '"');
+    ck_assert_int_gt(format_file_etag(&file_stat, "gzip", other_etag, sizeof(other_etag)), 0);
+    ck_assert_str_ne(etag, other_etag);
+    file_stat.st_mtim.tv_nsec ^= 1;
+    ck_assert_int_gt(format_file_etag(&file_stat, NULL, other_etag, sizeof(other_etag)), 0);
+    ck_assert_str_ne(etag, other_etag);
+    file_stat.st_mtim.tv_nsec ^= 1;
+    ck_assert_int_eq(format_file_etag(&file_stat, NULL, other_etag, 4), -1);
+
+    // call add_file_cache_entry() and check if the entry ends with its ETag and Last-Modified.
+    file_stat.st_mtim.tv_sec = 784111777;
+    ck_assert_int_gt(format_file_etag(&file_stat, NULL, etag, sizeof(etag)), 0);
+    file_entry *entry =
+        add_file_cache_entry(cache, "/site/index.html", NULL, file_fd, &file_stat, "text/html");
+    ck_assert_ptr_ne(entry, NULL);
+    ck_assert_str_eq(entry->etag, etag);
+    snprintf(validators, sizeof(validators),
+             "ETag: %s\r\nLast-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n", etag);
+    ck_assert_str_eq(entry->validators, validators);
+    ck_assert_int_eq(entry->validators_len, strlen(validators));
+    release_file_cache_entry(entry);
+
+    destroy_file_cache(cache);
+    close(file_fd);
+}
+END_TEST
+
+START_TEST(test_add_fd_cache_entry) {
+    struct stat file_stat;
+    int file_fd = create_test_file(2048, &file_stat), other_fd = dup(file_fd);
+    file_cache *cache = create_fd_cache(FILE_CACHE_SHARDS, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    ck_assert_int_eq(cache->shard_budget, 1);
+
+    // call add_file_cache_entry() with an fd cache and check if NULL is returned.
+    ck_assert_ptr_eq(add_file_cache_entry(cache, "/site/big.bin", NULL, file_fd, &file_stat, "a/b"),
+                     NULL);
+
+    // call add_fd_cache_entry() and check if the entry holds the descriptor instead of the bytes.
+    file_entry *entry =
+        add_fd_cache_entry(cache, "/site/big.bin", NULL, file_fd, &file_stat, "a/b");
+    ck_assert_ptr_ne(entry, NULL);
+    ck_assert_int_eq(entry->fd, file_fd);
+    ck_assert_ptr_eq(entry->data, NULL);
+    ck_assert_int_eq(entry->size, 2048);
+    check_entry_headers(entry, "Content-Type: a/b\r\nContent-Length: 2048\r\n"
+                               "Accept-Ranges: bytes\r\n");
+    ck_assert_ptr_eq(get_file_cache_entry(cache, "/site/big.bin", NULL), entry);
+    release_file_cache_entry(entry);
+
+    // call add_fd_cache_entry() for a cached path and check if the new descriptor is closed.
+    ck_assert_ptr_eq(add_fd_cache_entry(cache, "/site/big.bin", NULL, other_fd, &file_stat, "a/b"),
+                     entry);
+    ck_assert_int_eq(fcntl(other_fd, F_GETFD), -1);
+    release_file_cache_entry(entry);
+
+    // evict the entry while it is held and check if the descriptor is only closed once it is
+    // released.
+    destroy_file_cache(cache);
+    ck_assert_int_ne(fcntl(file_fd, F_GETFD), -1);
+    release_file_cache_entry(entry);
+    ck_assert_int_eq(fcntl(file_fd, F_GETFD), -1);
+}
+END_TEST
+
+START_TEST(test_fd_cache_eviction) {
+    char paths[2][32];
+    struct stat file_stat;
+    int first_fd = create_test_file(10, &file_stat), second_fd = dup(first_fd);
+    file_cache *cache = create_fd_cache(1, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    get_same_shard_paths(paths, 2);
+
+    // fill a shard with a descriptor, add another one and check if the first one is closed.
+    release_file_cache_entry(
+        add_fd_cache_entry(cache, paths[0], NULL, first_fd, &file_stat, "a/b"));
+    release_file_cache_entry(
+        add_fd_cache_entry(cache, paths[1], NULL, second_fd, &file_stat, "a/b"));
+    ck_assert_int_eq(fcntl(first_fd, F_GETFD), -1);
+    ck_assert_ptr_eq(get_file_cache_entry(cache, paths[0], NULL), NULL);
+    ck_assert_int_eq(cache->shards[_hash_file_path(paths[1]) & (FILE_CACHE_SHARDS - 1)].used, 1);
+
+    destroy_file_cache(cache);
+    ck_assert_int_eq(fcntl(second_fd, F_GETFD), -1);
+}
+END_TEST
+
+Suite *filecache_suite() {
+    const TTest *tests[] = {test_create_file_cache,
+                            test_add_file_cache_entry,
+                            test_file_cache_coding,
+                            test_add_file_cache_entry_too_large,
+                            test_file_cache_eviction,
+                            test_file_cache_revalidate,
+                            test_invalidate_file_cache,
+                            test_watched_file_cache,
+                            test_add_encoded_file_cache_entry,
+                            test_file_cache_validators,
+                            test_add_fd_cache_entry,
+                            test_fd_cache_eviction};
+
+    Suite *suite = suite_create("File Cache");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = filecache_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
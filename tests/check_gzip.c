@@ -0,0 +1,80 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "gzip.h"
+
+START_TEST(test_gzip_compress) {
+    char src[4096], out[4096];
+    size_t gzip_size = 0;
+    z_stream stream;
+
+    for (int c_no = 0; c_no < sizeof(src); c_no++)
+        src[c_no] = "<p>nanows</p>\n"[c_no % 14];
+
+    // call gzip_compress() and check if a smaller gzip stream is returned.
+    char *gzip_data = gzip_compress(src, sizeof(src), 6, &gzip_size);
+    ck_assert_ptr_ne(gzip_data, NULL);
+    ck_assert_int_lt(gzip_size, sizeof(src));
+    ck_assert_int_eq((unsigned char)gzip_data[0], 0x1f);
+    ck_assert_int_eq((unsigned char)gzip_data[1], 0x8b);
+
+    // inflate the stream and check if the original bytes come back.
+    memset(&stream, 0, sizeof(stream));
+    ck_assert_int_eq(inflateInit2(&stream, 15 + 16), Z_OK);
+    stream.next_in = (Bytef *)gzip_data;
+    stream.avail_in = gzip_size;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = sizeof(out);
+    ck_assert_int_eq(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    ck_assert_int_eq(stream.total_out, sizeof(src));
+    ck_assert_int_eq(memcmp(src, out, sizeof(src)), 0);
+    inflateEnd(&stream);
+    free(gzip_data);
+
+    // call gzip_compress() with invalid arguments and check if NULL is returned.
+    ck_assert_ptr_eq(gzip_compress(NULL, 10, 6, &gzip_size), NULL);
+    ck_assert_ptr_eq(gzip_compress(src, sizeof(src), 6, NULL), NULL);
+    ck_assert_ptr_eq(gzip_compress(src, sizeof(src), 42, &gzip_size), NULL);
+}
+END_TEST
+
+START_TEST(test_is_compressible_mimetype) {
+    // call is_compressible_mimetype() and check if only text types are compressed.
+    ck_assert(is_compressible_mimetype("text/html"));
+    ck_assert(is_compressible_mimetype("text/javascript"));
+    ck_assert(is_compressible_mimetype("application/json"));
+    ck_assert(is_compressible_mimetype("image/svg+xml"));
+    ck_assert(!is_compressible_mimetype("image/png"));
+    ck_assert(!is_compressible_mimetype("application/octet-stream"));
+    ck_assert(!is_compressible_mimetype(NULL));
+}
+END_TEST
+
+Suite *gzip_suite() {
+    const TTest *tests[] = {test_gzip_compress, test_is_compressible_mimetype};
+
+    Suite *suite = suite_create("Gzip");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = gzip_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+#include <check.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "headers.h"
+
+START_TEST(test_lookup_header) {
+    char name[64];
+
+    // look up every known header by its name, lowercased and uppercased, and check if its ID is
+    // returned, i.e. the hash table has no collisions.
+    for (int header = 0; header < NO_KNOWN_HEADERS; header++) {
+        const char *known_name = get_header_name(header);
+        size_t len = strlen(known_name);
+        ck_assert_int_eq(lookup_header(known_name, len), header);
+
+        for (size_t c_no = 0; c_no <= len; c_no++)
+            name[c_no] = tolower(known_name[c_no]);
+        ck_assert_int_eq(lookup_header(name, len), header);
+
+        for (size_t c_no = 0; c_no <= len; c_no++)
+            name[c_no] = toupper(known_name[c_no]);
+        ck_assert_int_eq(lookup_header(name, len), header);
+    }
+}
+END_TEST
+
+START_TEST(test_lookup_header_unknown) {
+    // call lookup_header() with unknown names and check if HDR_UNKNOWN is returned.
+    ck_assert_int_eq(lookup_header("X-Forwarded-For", 15), HDR_UNKNOWN);
+    ck_assert_int_eq(lookup_header("Sec-Fetch-Mode", 14), HDR_UNKNOWN);
+    ck_assert_int_eq(lookup_header("Hosts", 5), HDR_UNKNOWN);
+    ck_assert_int_eq(lookup_header("", 0), HDR_UNKNOWN);
+    ck_assert_int_eq(lookup_header(NULL, 4), HDR_UNKNOWN);
+
+    // call lookup_header() with a prefix of a known name and check if only the prefix is compared.
+    ck_assert_int_eq(lookup_header("Hostname", 4), HDR_HOST);
+    ck_assert_int_eq(lookup_header("Host", 3), HDR_UNKNOWN);
+}
+END_TEST
+
+START_TEST(test_get_header_name) {
+    // call get_header_name() and check if the canonical name is returned.
+    ck_assert_str_eq(get_header_name(HDR_CONTENT_TYPE), "Content-Type");
+    ck_assert_str_eq(get_header_name(HDR_ETAG), "ETag");
+
+    // call get_header_name() with invalid IDs and check if NULL is returned.
+    ck_assert_ptr_eq(get_header_name(HDR_UNKNOWN), NULL);
+    ck_assert_ptr_eq(get_header_name(NO_KNOWN_HEADERS), NULL);
+}
+END_TEST
+
+START_TEST(test_format_http_date) {
+    char date[HTTP_DATE_SIZE];
+
+    // call format_http_date() and check if the date is in the preferred format.
+    ck_assert_int_eq(format_http_date(784111777, date, sizeof(date)), 29);
+    ck_assert_str_eq(date, "Sun, 06 Nov 1994 08:49:37 GMT");
+
+    // call format_http_date() with a buffer too small and check if -1 is returned.
+    ck_assert_int_eq(format_http_date(784111777, date, 20), -1);
+}
+END_TEST
+
+START_TEST(test_parse_http_date) {
+    // call parse_http_date() and check if the date is parsed back.
+    ck_assert_int_eq(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT"), 784111777);
+    ck_assert_int_eq(parse_http_date("Thu, 01 Jan 1970 00:00:00 GMT"), 0);
+
+    // call parse_http_date() with invalid dates and check if -1 is returned.
+    ck_assert_int_eq(parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT"), -1);
+    ck_assert_int_eq(parse_http_date("Sun, 06 Nov 1994"), -1);
+    ck_assert_int_eq(parse_http_date("Sun, 06 Now 1994 08:49:37 GMT"), -1);
+    ck_assert_int_eq(parse_http_date("Sun, 06 nFe 1994 08:49:37 GMT"), -1);
+    ck_assert_int_eq(parse_http_date(NULL), -1);
+}
+END_TEST
+
+Suite *headers_suite() {
+    const TTest *tests[] = {test_lookup_header, test_lookup_header_unknown, test_get_header_name,
+                            test_format_http_date, test_parse_http_date};
+
+    Suite *suite = suite_create("Headers");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = headers_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
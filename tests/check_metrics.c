@@ -0,0 +1,186 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#define NO_THREADS 4
+#define NO_METRICS_PER_THREAD 1000
+
+void *collect_metrics(void *arg) {
+    for (int m_no = 0; m_no < NO_METRICS_PER_THREAD; m_no++) {
+        add_metric(METRIC_CONNECTIONS, 1);
+        add_response_metric(200, 10);
+        observe_metric(STAGE_PARSE, metrics_now());
+    }
+
+    return NULL;
+}
+
+START_TEST(test_get_metrics_bucket) {
+    // call _get_metrics_bucket() and check if small durations get a bucket each
+    for (uint64_t nsec = 0; nsec < 2 * METRICS_HIST_SUB_BUCKETS; nsec++)
+        ck_assert_int_eq(_get_metrics_bucket(nsec), nsec);
+
+    // call _get_metrics_bucket() and check if larger durations share buckets within a group
+    ck_assert_int_eq(_get_metrics_bucket(16), 16);
+    ck_assert_int_eq(_get_metrics_bucket(17), 16);
+    ck_assert_int_eq(_get_metrics_bucket(18), 17);
+    ck_assert_int_eq(_get_metrics_bucket(1000), _get_metrics_bucket(1023));
+    ck_assert_int_eq(_get_metrics_bucket(1024), _get_metrics_bucket(1023) + 1);
+
+    // call _get_metrics_bucket() and check if buckets never go down, and too long durations are
+    // counted in the last bucket
+    for (uint64_t nsec = 1; nsec < ((uint64_t)1 << METRICS_HIST_MAX_BITS); nsec = nsec * 3 / 2 + 1)
+        ck_assert_int_le(_get_metrics_bucket(nsec - 1), _get_metrics_bucket(nsec));
+    ck_assert_int_eq(_get_metrics_bucket(((uint64_t)1 << METRICS_HIST_MAX_BITS) - 1),
+                     METRICS_HIST_BUCKETS - 1);
+    ck_assert_int_eq(_get_metrics_bucket((uint64_t)1 << 40), METRICS_HIST_BUCKETS - 1);
+}
+END_TEST
+
+START_TEST(test_metrics_disabled) {
+    char buf[METRICS_BUF_SIZE];
+
+    // collect metrics before enable_metrics() and check if nothing is collected
+    ck_assert(!metrics_enabled());
+    ck_assert_int_eq(metrics_now(), 0);
+    add_metric(METRIC_CONNECTIONS, 1);
+    observe_metric(STAGE_PARSE, 1);
+
+    ck_assert_int_gt(format_metrics(buf, sizeof(buf)), 0);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_connections_total 0\n"), NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_count{stage=\"parse\"} 0\n"),
+                     NULL);
+}
+END_TEST
+
+START_TEST(test_format_metrics) {
+    char buf[METRICS_BUF_SIZE];
+    uint64_t start = 0;
+
+    enable_metrics();
+    ck_assert(metrics_enabled());
+    ck_assert_int_gt((start = metrics_now()), 0);
+
+    // collect a few metrics, call format_metrics() and check if they are formatted
+    add_metric(METRIC_CONNECTIONS, 2);
+    add_metric(METRIC_ERRORS_SEND, 1);
+    add_response_metric(200, 100);
+    add_response_metric(206, 20);
+    add_response_metric(304, 0);
+    add_response_metric(444, 0);
+    observe_metric(STAGE_FILE_OPEN, start);
+    observe_metric(STAGE_BODY_SEND, 0);
+
+    ck_assert_int_gt(format_metrics(buf, sizeof(buf)), 0);
+    ck_assert_ptr_ne(strstr(buf, "# TYPE nanows_connections_total counter\n"
+                                 "nanows_connections_total 2\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_responses_total{class=\"2xx\"} 2\n"
+                                 "nanows_responses_total{class=\"3xx\"} 1\n"
+                                 "nanows_responses_total{class=\"4xx\"} 0\n"
+                                 "nanows_responses_total{class=\"5xx\"} 0\n"
+                                 "nanows_responses_total{class=\"none\"} 1\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_response_body_bytes_total 120\n"), NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_connection_errors_total{reason=\"send\"} 1\n"), NULL);
+    ck_assert_ptr_ne(strstr(buf, "# TYPE nanows_stage_duration_seconds histogram\n"), NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_bucket{stage=\"file_open\","
+                                 "le=\"+Inf\"} 1\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_count{stage=\"file_open\"} 1\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_count{stage=\"body_send\"} 0\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_bucket{stage=\"parse\","
+                                 "le=\"1.28e-07\"} 0\n"),
+                     NULL);
+
+    // call format_metrics() with a buffer too small and check if it returns 0
+    ck_assert_int_eq(format_metrics(buf, 64), 0);
+    ck_assert_int_eq(format_metrics(NULL, 0), 0);
+}
+END_TEST
+
+START_TEST(test_record_metric) {
+    char buf[METRICS_BUF_SIZE];
+
+    enable_metrics();
+
+    // record durations at and just above a bound, and check if the bound includes itself only
+    _record_metric(STAGE_PARSE, 128);
+    _record_metric(STAGE_PARSE, 129);
+    _record_metric(STAGE_PARSE, 256);
+    _record_metric(STAGE_PARSE, 257);
+
+    ck_assert_int_gt(format_metrics(buf, sizeof(buf)), 0);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_bucket{stage=\"parse\","
+                                 "le=\"1.28e-07\"} 1\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_bucket{stage=\"parse\","
+                                 "le=\"2.56e-07\"} 3\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_bucket{stage=\"parse\","
+                                 "le=\"5.12e-07\"} 4\n"),
+                     NULL);
+    ck_assert_ptr_ne(strstr(buf, "\nnanows_stage_duration_seconds_sum{stage=\"parse\"} "
+                                 "0.000000770\n"),
+                     NULL);
+}
+END_TEST
+
+START_TEST(test_metrics_threads) {
+    char buf[METRICS_BUF_SIZE], line[128];
+    pthread_t threads[NO_THREADS];
+
+    // collect metrics from several threads at once, twice, and check if every metric is counted
+    enable_metrics();
+    for (int round = 0; round < 2; round++) {
+        for (int t_no = 0; t_no < NO_THREADS; t_no++)
+            ck_assert_int_eq(pthread_create(&threads[t_no], NULL, collect_metrics, NULL), 0);
+        for (int t_no = 0; t_no < NO_THREADS; t_no++)
+            pthread_join(threads[t_no], NULL);
+    }
+
+    ck_assert_int_gt(format_metrics(buf, sizeof(buf)), 0);
+    snprintf(line, sizeof(line), "\nnanows_connections_total %d\n",
+             2 * NO_THREADS * NO_METRICS_PER_THREAD);
+    ck_assert_ptr_ne(strstr(buf, line), NULL);
+    snprintf(line, sizeof(line), "\nnanows_response_body_bytes_total %d\n",
+             2 * NO_THREADS * NO_METRICS_PER_THREAD * 10);
+    ck_assert_ptr_ne(strstr(buf, line), NULL);
+    snprintf(line, sizeof(line),
+             "\nnanows_stage_duration_seconds_bucket{stage=\"parse\",le=\"+Inf\"} %d\n",
+             2 * NO_THREADS * NO_METRICS_PER_THREAD);
+    ck_assert_ptr_ne(strstr(buf, line), NULL);
+}
+END_TEST
+
+Suite *metrics_suite() {
+    const TTest *tests[] = {test_get_metrics_bucket, test_metrics_disabled, test_format_metrics,
+                            test_record_metric, test_metrics_threads};
+
+    Suite *suite = suite_create("Metrics");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = metrics_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
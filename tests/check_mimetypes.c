@@ -1,4 +1,6 @@
 #include <check.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include "mimetypes.h"
 
@@ -16,9 +18,59 @@ START_TEST(test_create_mime_table) {
 END_TEST
 
 START_TEST(test_get_mimetype_for_ext_without_table) {
-    // call get_mimetype_for_ext() without calling create_mime_table() and check if it returns NULL
+    // call get_mimetype_for_ext() without calling create_mime_table() and check if it returns the
+    // built-in mimetype
     const char *mimetype = get_mimetype_for_ext(".html", NULL);
-    ck_assert_ptr_eq(mimetype, NULL);
+    ck_assert_str_eq(mimetype, "text/html");
+
+    // call get_mimetype_for_ext() with an unknown or without extension and check if it returns the
+    // built-in default mimetype
+    ck_assert_str_eq(get_mimetype_for_ext(".xyz", NULL), "application/octet-stream");
+    ck_assert_str_eq(get_mimetype_for_ext(NULL, NULL), "application/octet-stream");
+    ck_assert_str_eq(get_mimetype_for_ext(".averyveryverylongextension", NULL),
+                     "application/octet-stream");
+}
+END_TEST
+
+START_TEST(test_get_mimetype_for_ext_ignores_case) {
+    char mimetype[MIME_BUF_SIZE];
+
+    // call get_mimetype_for_ext() with uppercase extensions and check if it returns the right
+    // mimetype
+    ck_assert_str_eq(get_mimetype_for_ext(".HTML", NULL), "text/html");
+    ck_assert_str_eq(get_mimetype_for_ext(".Css", mimetype), "text/css");
+    ck_assert_str_eq(mimetype, "text/css");
+}
+END_TEST
+
+START_TEST(test_load_mime_table_overrides) {
+    char path[] = "/tmp/check_mimetypes_XXXXXX";
+    int fd = mkstemp(path);
+    FILE *mime_file = fdopen(fd, "w");
+
+    ck_assert_ptr_ne(mime_file, NULL);
+    fputs("# overrides\n*=text/plain\n.CSS=text/x-css\n.foo=application/x-foo\n", mime_file);
+    fputs(".foo=application/x-bar\n", mime_file);
+    fclose(mime_file);
+
+    // call load_mime_table() and check if loaded extensions override the built-in ones
+    ck_assert_int_eq(load_mime_table(path), 1);
+    ck_assert_int_eq(load_mime_table(path), 2);
+    ck_assert_str_eq(get_mimetype_for_ext(".css", NULL), "text/x-css");
+    ck_assert_str_eq(get_mimetype_for_ext(".FOO", NULL), "application/x-bar");
+    ck_assert_str_eq(get_mimetype_for_ext(".xyz", NULL), "text/plain");
+
+    // check if other extensions are still found in the built-in table
+    ck_assert_str_eq(get_mimetype_for_ext(".html", NULL), "text/html");
+
+    // call destroy_mime_table() and check if the built-in table is used alone again
+    destroy_mime_table();
+    ck_assert_str_eq(get_mimetype_for_ext(".css", NULL), "text/css");
+    ck_assert_str_eq(get_mimetype_for_ext(".xyz", NULL), "application/octet-stream");
+    unlink(path);
+
+    // call load_mime_table() with a missing file and check if it fails
+    ck_assert_int_eq(load_mime_table(path), 0);
 }
 END_TEST
 
@@ -46,12 +98,18 @@ START_TEST(test_get_mimetype_for_url) {
     create_mime_table();
     const char *mimetype_html = get_mimetype_for_url("http://www.example.com/index.html", NULL);
     ck_assert_str_eq(mimetype_html, "text/html");
+
+    // call get_mimetype_for_url() with a dot in a directory only and check if it returns the
+    // default mimetype
+    ck_assert_str_eq(get_mimetype_for_url("/v1.2/README", NULL), "application/octet-stream");
 }
 END_TEST
 
 Suite *mimetypes_suite() {
-    const TTest *tests[] = {test_create_mime_table, test_get_mimetype_for_ext_without_table,
-                            test_get_mimetype_for_ext, test_get_mimetype_for_ext_default};
+    const TTest *tests[] = {test_create_mime_table,         test_get_mimetype_for_ext_without_table,
+                            test_get_mimetype_for_ext,      test_get_mimetype_for_ext_default,
+                            test_get_mimetype_for_url,      test_get_mimetype_for_ext_ignores_case,
+                            test_load_mime_table_overrides};
 
     Suite *suite = suite_create("Mimetypes");
     TCase *tc_core = tcase_create("Core");
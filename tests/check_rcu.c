@@ -0,0 +1,143 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "rcu.h"
+
+#define NO_THREADS 4
+#define NO_READS_PER_THREAD 100000
+
+rcu_ptr *mt_ptr = NULL;
+atomic_bool mt_published, mt_stop;
+atomic_long mt_bad_reads;
+
+void *publish_value(void *value) {
+    void *old_value = publish_rcu_ptr(mt_ptr, value);
+    atomic_store(&mt_published, true);
+    return old_value;
+}
+
+void *read_values(void *arg) {
+    int token = 0, *value = NULL;
+
+    // every value is set to 1 while it is published, and to 0 only after it is replaced.
+    for (int r_no = 0; r_no < NO_READS_PER_THREAD && !atomic_load(&mt_stop); r_no++) {
+        value = acquire_rcu_ptr(mt_ptr, &token);
+        if (atomic_load((atomic_int *)value) != 1)
+            atomic_fetch_add(&mt_bad_reads, 1);
+        release_rcu_ptr(mt_ptr, token);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_acquire_rcu_ptr) {
+    int first = 1, second = 2, token = 0, nested_token = 0;
+    rcu_ptr *ptr = create_rcu_ptr(&first);
+    ck_assert_ptr_ne(ptr, NULL);
+
+    // call acquire_rcu_ptr() and check if it returns the published value, also when nested.
+    ck_assert_ptr_eq(acquire_rcu_ptr(ptr, &token), &first);
+    ck_assert_ptr_eq(acquire_rcu_ptr(ptr, &nested_token), &first);
+    release_rcu_ptr(ptr, nested_token);
+    release_rcu_ptr(ptr, token);
+
+    // call publish_rcu_ptr() without readers and check if it returns the old value right away.
+    ck_assert_ptr_eq(publish_rcu_ptr(ptr, &second), &first);
+    ck_assert_ptr_eq(acquire_rcu_ptr(ptr, &token), &second);
+    release_rcu_ptr(ptr, token);
+
+    // call destroy_rcu_ptr() and check if it returns the published value.
+    ck_assert_ptr_eq(destroy_rcu_ptr(ptr), &second);
+    ck_assert_ptr_eq(destroy_rcu_ptr(NULL), NULL);
+}
+END_TEST
+
+START_TEST(test_publish_rcu_ptr_waits_for_readers) {
+    int first = 1, second = 2, token = 0, new_token = 0;
+    pthread_t writer;
+    void *old_value = NULL;
+
+    mt_ptr = create_rcu_ptr(&first);
+    ck_assert_ptr_ne(mt_ptr, NULL);
+    atomic_store(&mt_published, false);
+
+    // publish a value while a reader holds the old one and check if the writer waits for it.
+    ck_assert_ptr_eq(acquire_rcu_ptr(mt_ptr, &token), &first);
+    ck_assert_int_eq(pthread_create(&writer, NULL, publish_value, &second), 0);
+    usleep(50000);
+    ck_assert(!atomic_load(&mt_published));
+
+    // check if readers entering meanwhile get the new value without waiting.
+    ck_assert_ptr_eq(acquire_rcu_ptr(mt_ptr, &new_token), &second);
+    release_rcu_ptr(mt_ptr, new_token);
+
+    // release the old value and check if the writer returns it.
+    release_rcu_ptr(mt_ptr, token);
+    pthread_join(writer, &old_value);
+    ck_assert(atomic_load(&mt_published));
+    ck_assert_ptr_eq(old_value, &first);
+
+    destroy_rcu_ptr(mt_ptr);
+    mt_ptr = NULL;
+}
+END_TEST
+
+START_TEST(test_rcu_ptr_concurrent) {
+    atomic_int values[64];
+    pthread_t readers[NO_THREADS];
+    void *old_value = NULL;
+
+    for (int v_no = 0; v_no < 64; v_no++)
+        atomic_init(&values[v_no], 0);
+    atomic_store(&values[0], 1);
+    atomic_store(&mt_bad_reads, 0);
+    atomic_store(&mt_stop, false);
+    mt_ptr = create_rcu_ptr(&values[0]);
+    ck_assert_ptr_ne(mt_ptr, NULL);
+
+    // keep replacing the value while readers read it and check if no reader sees a replaced value.
+    for (int t_no = 0; t_no < NO_THREADS; t_no++)
+        ck_assert_int_eq(pthread_create(&readers[t_no], NULL, read_values, NULL), 0);
+    for (int v_no = 1; v_no < 64; v_no++) {
+        atomic_store(&values[v_no], 1);
+        old_value = publish_rcu_ptr(mt_ptr, &values[v_no]);
+        atomic_store((atomic_int *)old_value, 0);
+    }
+    atomic_store(&mt_stop, true);
+    for (int t_no = 0; t_no < NO_THREADS; t_no++)
+        pthread_join(readers[t_no], NULL);
+
+    ck_assert_int_eq(atomic_load(&mt_bad_reads), 0);
+    destroy_rcu_ptr(mt_ptr);
+    mt_ptr = NULL;
+}
+END_TEST
+
+Suite *rcu_suite() {
+    const TTest *tests[] = {test_acquire_rcu_ptr, test_publish_rcu_ptr_waits_for_readers,
+                            test_rcu_ptr_concurrent};
+
+    Suite *suite = suite_create("RCU");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = rcu_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,4 +1,7 @@
 #include <check.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "request.h"
 
@@ -30,7 +33,7 @@ START_TEST(test__initialize_request) {
     ck_assert_ptr_eq(req->http_method, NULL);
     ck_assert_ptr_eq(req->url, NULL);
     ck_assert_ptr_eq(req->http_ver, NULL);
-    ck_assert_int_eq(g_hash_table_size(req->header_htab), 0);
+    ck_assert_int_eq(req->no_headers, 0);
 
     _free_request(req);
 }
@@ -46,7 +49,7 @@ START_TEST(test__parse_request) {
     ck_assert_str_eq(req->http_method, "GET");
     ck_assert_str_eq(req->url, "/");
     ck_assert_str_eq(req->http_ver, "HTTP/1.1");
-    ck_assert_int_eq(g_hash_table_size(req->header_htab), 12);
+    ck_assert_int_eq(req->no_headers, 12);
 
     _free_request(req);
 }
@@ -86,7 +89,7 @@ START_TEST(test_get_request_header) {
     ck_assert_int_eq(ret_val, 1);
 
     // Check if all the request header fields are parsed correctly.
-    ck_assert_int_eq(g_hash_table_size(req->header_htab), 12);
+    ck_assert_int_eq(req->no_headers, 12);
 
     // Check if the request header field Host is parsed correctly.
     const char *val = get_request_header(req, "Host", NULL);
@@ -146,6 +149,275 @@ START_TEST(test_get_request_header_null_req) {
 }
 END_TEST
 
+START_TEST(test_get_request_header_case_insensitive) {
+    // Create a sample request to test get_request_header() function.
+    request *req = _initialize_request();
+    int ret_val = _parse_request(req_buf, req);
+    ck_assert_int_eq(ret_val, 1);
+
+    // Check if header field names are matched regardless of their case.
+    ck_assert_str_eq(get_request_header(req, "host", NULL), "localhost:8080");
+    ck_assert_str_eq(get_request_header(req, "ACCEPT-LANGUAGE", NULL), "en-US,en;q=0.9");
+    _free_request(req);
+}
+END_TEST
+
+START_TEST(test_get_known_request_header) {
+    char buf[] = "GET / HTTP/1.1\r\nhost: a\r\nX-Custom: 1\r\nHost: b\r\nx-custom: 2\r\n\r\n";
+    request *req = create_request(-1);
+    ck_assert_int_eq(parse_request_buf(req, buf, strlen(buf)), PARSE_COMPLETE);
+
+    // check if known headers are in their slots and other headers in unknown_headers.
+    ck_assert_int_eq(req->no_headers, 4);
+    ck_assert_int_eq(req->header_slots[HDR_HOST], 1);
+    ck_assert_int_eq(req->no_unknown_headers, 2);
+
+    // call get_known_request_header() and check if the first of repeated headers is returned.
+    ck_assert_str_eq(get_known_request_header(req, HDR_HOST), "a");
+    ck_assert_ptr_eq(get_known_request_header(req, HDR_CONNECTION), NULL);
+    ck_assert_ptr_eq(get_known_request_header(req, HDR_UNKNOWN), NULL);
+    ck_assert_str_eq(get_request_header(req, "X-CUSTOM", NULL), "1");
+    _free_request(req);
+}
+END_TEST
+
+START_TEST(test_get_encoding_quality) {
+    char buf[] = "GET / HTTP/1.1\r\nAccept-Encoding: GZip;q=0.5, br ; level=1;q=0.25,"
+                 "deflate;q=0, *;q=0.1\r\n\r\n";
+    request *req = create_request(-1);
+    ck_assert_int_eq(parse_request_buf(req, buf, strlen(buf)), PARSE_COMPLETE);
+
+    // call get_encoding_quality() and check if listed codings get their own quality.
+    ck_assert_int_eq(get_encoding_quality(req, "gzip"), 500);
+    ck_assert_int_eq(get_encoding_quality(req, "br"), 250);
+    ck_assert_int_eq(get_encoding_quality(req, "deflate"), 0);
+
+    // check if codings that aren't listed get the quality of `*`.
+    ck_assert_int_eq(get_encoding_quality(req, "zstd"), 100);
+    ck_assert_int_eq(get_encoding_quality(req, NULL), 0);
+    _free_request(req);
+
+    // call get_encoding_quality() without the header and check if nothing is acceptable.
+    char no_accept_buf[] = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+    req = create_request(-1);
+    ck_assert_int_eq(parse_request_buf(req, no_accept_buf, strlen(no_accept_buf)),
+                     PARSE_COMPLETE);
+    ck_assert_int_eq(get_encoding_quality(req, "gzip"), 0);
+    _free_request(req);
+
+    // call _parse_quality() and check if values are parsed into thousandths.
+    ck_assert_int_eq(_parse_quality("1"), 1000);
+    ck_assert_int_eq(_parse_quality("0.8, br"), 800);
+    ck_assert_int_eq(_parse_quality("0.125"), 125);
+    ck_assert_int_eq(_parse_quality("1.5"), 1000);
+    ck_assert_int_eq(_parse_quality("x"), 0);
+}
+END_TEST
+
+START_TEST(test_match_request_etag) {
+    char buf[] = "GET / HTTP/1.1\r\nIf-None-Match: \"a-1\" , W/\"b-2\",\"c-3\"\r\n"
+                 "If-Match: *\r\n\r\n";
+    request *req = create_request(-1);
+    ck_assert_int_eq(parse_request_buf(req, buf, strlen(buf)), PARSE_COMPLETE);
+
+    // call match_request_etag() and check if listed tags match, weak or not.
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_NONE_MATCH, "\"a-1\""), 1);
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_NONE_MATCH, "\"b-2\""), 1);
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_NONE_MATCH, "W/\"c-3\""), 1);
+
+    // check if tags that aren't listed, or only partly, don't match.
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_NONE_MATCH, "\"a-12\""), 0);
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_NONE_MATCH, "\"a\""), 0);
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_NONE_MATCH, NULL), 0);
+
+    // check if `*` matches any tag, and a missing header none.
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_MATCH, "\"d-4\""), 1);
+    ck_assert_int_eq(match_request_etag(req, HDR_IF_RANGE, "\"a-1\""), 0);
+    _free_request(req);
+}
+END_TEST
+
+/**
+ * Parses a request with the `Range` header `range` and returns `get_request_ranges()` for a body
+ * of `size` bytes, with space for 2 ranges.
+ */
+int get_ranges(const char *range, const off_t size, byte_range *ranges) {
+    char buf[256];
+    request *req = create_request(-1);
+    int no_ranges = 0;
+
+    snprintf(buf, sizeof(buf), "GET / HTTP/1.1\r\nRange: %s\r\n\r\n", range);
+    ck_assert_int_eq(parse_request_buf(req, buf, strlen(buf)), PARSE_COMPLETE);
+    no_ranges = get_request_ranges(req, size, ranges, 2);
+    _free_request(req);
+    return no_ranges;
+}
+
+START_TEST(test_get_request_ranges) {
+    byte_range ranges[2];
+    request *req = create_request(-1);
+    char buf[] = "GET / HTTP/1.1\r\n\r\n";
+
+    // call get_request_ranges() and check if a, a- and -n ranges are parsed and clamped.
+    ck_assert_int_eq(get_ranges("bytes=0-99", 1000, ranges), 1);
+    ck_assert_int_eq(ranges[0].start, 0);
+    ck_assert_int_eq(ranges[0].end, 100);
+    ck_assert_int_eq(get_ranges("BYTES=900-", 1000, ranges), 1);
+    ck_assert_int_eq(ranges[0].start, 900);
+    ck_assert_int_eq(ranges[0].end, 1000);
+    ck_assert_int_eq(get_ranges("bytes=-100", 1000, ranges), 1);
+    ck_assert_int_eq(ranges[0].start, 900);
+    ck_assert_int_eq(get_ranges("bytes=-2000", 1000, ranges), 1);
+    ck_assert_int_eq(ranges[0].start, 0);
+    ck_assert_int_eq(get_ranges("bytes=990-2000", 1000, ranges), 1);
+    ck_assert_int_eq(ranges[0].end, 1000);
+
+    // check if multiple ranges are returned in order, leaving out those past the end.
+    ck_assert_int_eq(get_ranges("bytes=20-29, 0-9", 1000, ranges), 2);
+    ck_assert_int_eq(ranges[0].start, 20);
+    ck_assert_int_eq(ranges[1].end, 10);
+    ck_assert_int_eq(get_ranges("bytes=0-9,5000-,20-29", 1000, ranges), 2);
+    ck_assert_int_eq(ranges[1].start, 20);
+
+    // check if ranges that can't be satisfied return -1, and invalid headers or too many ranges 0.
+    ck_assert_int_eq(get_ranges("bytes=1000-", 1000, ranges), -1);
+    ck_assert_int_eq(get_ranges("bytes=-0", 1000, ranges), -1);
+    ck_assert_int_eq(get_ranges("bytes=9-0", 1000, ranges), 0);
+    ck_assert_int_eq(get_ranges("bytes=a-9", 1000, ranges), 0);
+    ck_assert_int_eq(get_ranges("bytes=0-9x", 1000, ranges), 0);
+    ck_assert_int_eq(get_ranges("bytes=", 1000, ranges), 0);
+    ck_assert_int_eq(get_ranges("items=0-9", 1000, ranges), 0);
+    ck_assert_int_eq(get_ranges("bytes=0-1,2-3,4-5", 1000, ranges), 0);
+    ck_assert_int_eq(get_ranges("bytes=99999999999999999999-", 1000, ranges), 0);
+
+    // check if a request without the header has no ranges.
+    ck_assert_int_eq(parse_request_buf(req, buf, strlen(buf)), PARSE_COMPLETE);
+    ck_assert_int_eq(get_request_ranges(req, 1000, ranges, 2), 0);
+    _free_request(req);
+}
+END_TEST
+
+START_TEST(test_parse_request_buf) {
+    // call parse_request_buf() on pipelined requests and check if only the first one is parsed.
+    char buf[] = "GET /a HTTP/1.1\r\nHost: a\r\n\r\nGET /b HTTP/1.1\r\nX-Next: b\r\n\r\n";
+    request *req = create_request(-1);
+
+    ck_assert_int_eq(parse_request_buf(req, buf, strlen(buf)), PARSE_COMPLETE);
+    ck_assert_int_eq(req->head_size, 28);
+    ck_assert_str_eq(req->url, "/a");
+    ck_assert_str_eq(get_request_header(req, "Host", NULL), "a");
+    ck_assert_ptr_eq(get_request_header(req, "X-Next", NULL), NULL);
+
+    // check if the request points into the buffer and the next request is untouched.
+    ck_assert_ptr_eq(req->url, buf + 4);
+    ck_assert_str_eq(buf + req->head_size, "GET /b HTTP/1.1\r\nX-Next: b\r\n\r\n");
+    _free_request(req);
+}
+END_TEST
+
+START_TEST(test_parse_request_buf_partial) {
+    // call parse_request_buf() with the request arriving one byte at a time and check if it
+    // resumes where it stopped.
+    char buf[REQ_BUF_SIZE];
+    size_t req_len = strlen(req_buf);
+    request *req = create_request(-1);
+
+    for (size_t len = 0; len < req_len; len++) {
+        buf[len] = req_buf[len];
+        ck_assert_int_eq(parse_request_buf(req, buf, len + 1),
+                         (len + 1 < req_len) ? PARSE_INCOMPLETE : PARSE_COMPLETE);
+    }
+
+    ck_assert_int_eq(req->head_size, req_len);
+    ck_assert_str_eq(req->http_method, "GET");
+    ck_assert_int_eq(req->no_headers, 12);
+    ck_assert_str_eq(get_request_header(req, "Sec-Fetch-User", NULL), "?1");
+    _free_request(req);
+}
+END_TEST
+
+START_TEST(test_parse_request_buf_malformed) {
+    const char *malformed[] = {"GET\r\n\r\n", " / HTTP/1.1\r\n\r\n", "GET / HTTP/1.1\n\r\n",
+                               "GET / HTTP/1.1\r\nNo-Colon\r\n\r\n",
+                               "GET / HTTP/1.1\r\nBad Key: x\r\n\r\n"};
+
+    // call parse_request_buf() on malformed requests and check if it returns PARSE_ERROR.
+    for (int m_no = 0; m_no < sizeof(malformed) / sizeof(malformed[0]); m_no++) {
+        char buf[64];
+        request *req = create_request(-1);
+
+        strcpy(buf, malformed[m_no]);
+        ck_assert_int_eq(parse_request_buf(req, buf, strlen(buf)), PARSE_ERROR);
+        _free_request(req);
+    }
+}
+END_TEST
+
+START_TEST(test_scan_request_kernels) {
+    request_scanner scanners[3] = {_scan_request_scalar};
+    int no_scanners = 1;
+    char buf[96];
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        scanners[no_scanners++] = _scan_request_sse42;
+    if (__builtin_cpu_supports("avx2"))
+        scanners[no_scanners++] = _scan_request_avx2;
+#endif
+
+    // fill a buffer with header bytes, including UTF-8 bytes, and put a delimiter at every offset.
+    for (int b_no = 0; b_no < sizeof(buf); b_no++)
+        buf[b_no] = (b_no % 7 == 0) ? '\xc3' : 'a' + b_no % 26;
+
+    // call each scanner and check if it stops at the delimiter, or at the end if there is none.
+    for (int s_no = 0; s_no < no_scanners; s_no++) {
+        for (size_t d_pos = 0; d_pos < sizeof(buf); d_pos++) {
+            char saved = buf[d_pos];
+
+            buf[d_pos] = ':';
+            ck_assert_int_eq(scanners[s_no](buf, 0, sizeof(buf), ' ', ':'), d_pos);
+            ck_assert_int_eq(scanners[s_no](buf, 0, sizeof(buf), ' ' - 1, 0x7f), sizeof(buf));
+            buf[d_pos] = '\r';
+            ck_assert_int_eq(scanners[s_no](buf, 0, sizeof(buf), ' ' - 1, 0x7f), d_pos);
+            buf[d_pos] = 0x7f;
+            ck_assert_int_eq(scanners[s_no](buf, 0, sizeof(buf), ' ', ':'), d_pos);
+            ck_assert_int_eq(scanners[s_no](buf, 0, d_pos, ' ', ':'), d_pos);
+            buf[d_pos] = saved;
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_get_requests_pipelined) {
+    int conn_fds[2];
+    request_buf req_buf = {.len = 0, .start = 0};
+    request *reqs[MAX_PIPELINED_REQS];
+    const char *pipelined = "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\nGET /c HT";
+
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, conn_fds), 0);
+
+    // send pipelined requests at once and check if all complete requests are parsed in order.
+    send(conn_fds[1], pipelined, strlen(pipelined), 0);
+    ck_assert_int_eq(get_requests(conn_fds[0], &req_buf, NULL, reqs, MAX_PIPELINED_REQS), 2);
+    ck_assert_str_eq(reqs[0]->url, "/a");
+    ck_assert_str_eq(reqs[1]->url, "/b");
+    _free_request(reqs[0]);
+    _free_request(reqs[1]);
+
+    // send the rest of the last request and check if it is parsed from the kept bytes.
+    send(conn_fds[1], "TP/1.1\r\n\r\n", 10, 0);
+    ck_assert_int_eq(get_requests(conn_fds[0], &req_buf, NULL, reqs, MAX_PIPELINED_REQS), 1);
+    ck_assert_str_eq(reqs[0]->url, "/c");
+    ck_assert_int_eq(req_buf.start, req_buf.len);
+    _free_request(reqs[0]);
+
+    // close the client side and check if it returns 0.
+    close(conn_fds[1]);
+    ck_assert_int_eq(get_requests(conn_fds[0], &req_buf, NULL, reqs, MAX_PIPELINED_REQS), 0);
+    close(conn_fds[0]);
+}
+END_TEST
+
 Suite *request_suite() {
     const TTest *tests[] = {test__initialize_request,
                             test__parse_request,
@@ -155,7 +427,17 @@ Suite *request_suite() {
                             test_get_request_header,
                             test_get_request_header_undefined_field,
                             test_get_request_header_null_field,
-                            test_get_request_header_null_req};
+                            test_get_request_header_null_req,
+                            test_get_request_header_case_insensitive,
+                            test_get_known_request_header,
+                            test_get_encoding_quality,
+                            test_match_request_etag,
+                            test_get_request_ranges,
+                            test_parse_request_buf,
+                            test_parse_request_buf_partial,
+                            test_parse_request_buf_malformed,
+                            test_scan_request_kernels,
+                            test_get_requests_pipelined};
 
     Suite *suite = suite_create("Request");
     TCase *tc_core = tcase_create("Core");
@@ -1,5 +1,9 @@
 #include <check.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "request.h"
 #include "response.h"
@@ -12,7 +16,7 @@ START_TEST(test__initialize_response) {
     ck_assert_int_eq(res->conn_fd, -1);
     ck_assert_ptr_eq(res->http_ver, NULL);
     ck_assert_ptr_eq(res->status_code, NULL);
-    ck_assert_int_eq(g_hash_table_size(res->header_htab), 0);
+    ck_assert_int_eq(res->no_headers, 0);
 
     _free_response(res);
 }
@@ -45,7 +49,7 @@ START_TEST(test_create_response_from_request) {
     ck_assert_int_ne(res->conn_fd, req->conn_fd);
     ck_assert_str_eq(res->http_ver, req->http_ver);
     ck_assert_ptr_eq(res->status_code, NULL);
-    ck_assert_int_eq(g_hash_table_size(res->header_htab), 0);
+    ck_assert_int_eq(res->no_headers, 0);
 
     _free_request(req);
     close_response(res);
@@ -63,7 +67,7 @@ START_TEST(test_create_response_from_default_request) {
     ck_assert_int_eq(res->conn_fd, -1);
     ck_assert_ptr_eq(res->http_ver, NULL);
     ck_assert_ptr_eq(res->status_code, NULL);
-    ck_assert_int_eq(g_hash_table_size(res->header_htab), 0);
+    ck_assert_int_eq(res->no_headers, 0);
 
     _free_request(req);
     _free_response(res);
@@ -86,7 +90,7 @@ START_TEST(test_set_response_header) {
     set_response_header(res, "Content-Type", "text/html");
     set_response_header(res, "Content-Length", "100");
     set_response_header(res, "Connection", "close");
-    ck_assert_int_eq(g_hash_table_size(res->header_htab), 3);
+    ck_assert_int_eq(res->no_headers, 3);
 
     _free_response(res);
 }
@@ -115,6 +119,166 @@ START_TEST(test_get_response_header) {
 }
 END_TEST
 
+START_TEST(test_set_known_response_header) {
+    char buf[RES_HEAD_MAX_SIZE];
+    response *res = _initialize_response();
+    ck_assert_ptr_ne(res, NULL);
+    ck_assert_int_eq(set_response_status(res, "HTTP/1.1", "200 OK"), 1);
+
+    // set known and unknown headers and check if known keys use their canonical name.
+    ck_assert_ptr_ne(set_known_response_header(res, HDR_CONTENT_LENGTH, "5"), NULL);
+    ck_assert_ptr_ne(set_response_header(res, "x-custom", "1"), NULL);
+    ck_assert_ptr_ne(set_response_header(res, "content-type", "text/html"), NULL);
+    ck_assert_int_eq(res->no_unknown_headers, 1);
+    format_response_head(res, buf, sizeof(buf));
+    ck_assert_str_eq(buf, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nx-custom: 1\r\n"
+                          "Content-Type: text/html\r\n\r\n");
+
+    // set headers that are already set and check if they are not overwritten.
+    ck_assert_ptr_eq(set_known_response_header(res, HDR_CONTENT_TYPE, "text/plain"), NULL);
+    ck_assert_ptr_eq(set_response_header(res, "X-Custom", "2"), NULL);
+    ck_assert_ptr_eq(set_known_response_header(res, HDR_UNKNOWN, "1"), NULL);
+    ck_assert_str_eq(get_response_header(res, "X-CUSTOM", NULL), "1");
+    ck_assert_int_eq(res->no_headers, 3);
+
+    _free_response(res);
+}
+END_TEST
+
+START_TEST(test_send_response_head_with_body) {
+    char buf[RES_HEAD_MAX_SIZE];
+    int conn_fds[2];
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, conn_fds), 0);
+
+    response *res = create_response(conn_fds[0]);
+    ck_assert_ptr_ne(res, NULL);
+    set_response_status(res, "HTTP/1.1", "200 OK");
+    set_known_response_header(res, HDR_CONTENT_LENGTH, "5");
+
+    // call send_response_head_with_body() and check if head and body arrive with a single read.
+    ck_assert_int_eq(send_response_head_with_body(res, "hello", 5), 43);
+    ck_assert_int_eq(recv(conn_fds[1], buf, sizeof(buf) - 1, 0), 43);
+    buf[43] = '\0';
+    ck_assert_str_eq(buf, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello");
+
+    // call send_response_head() and check if only the head is sent.
+    ck_assert_int_eq(send_response_head(res), 38);
+
+    close_response(res);
+    close(conn_fds[0]);
+    close(conn_fds[1]);
+}
+END_TEST
+
+START_TEST(test_send_response_fd) {
+    char buf[64], path[] = "/tmp/check_response_XXXXXX";
+    int conn_fds[2], file_fd = mkstemp(path);
+    off_t file_off = 2;
+    ck_assert_int_ne(file_fd, -1);
+    unlink(path);
+    ck_assert_int_eq(write(file_fd, "0123456789", 10), 10);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, conn_fds), 0);
+
+    response *res = create_response(conn_fds[0]);
+    ck_assert_ptr_ne(res, NULL);
+
+    // call send_response_fd() with a range and check if only the range is sent.
+    ck_assert_int_eq(send_response_fd(res, file_fd, 3, 4), 4);
+    ck_assert_int_eq(recv(conn_fds[1], buf, sizeof(buf), 0), 4);
+    ck_assert_int_eq(memcmp(buf, "3456", 4), 0);
+
+    // call send_response_fd() past the end of the file and check if the sent bytes are returned.
+    ck_assert_int_eq(send_response_fd(res, file_fd, 8, 10), 2);
+    ck_assert_int_eq(recv(conn_fds[1], buf, sizeof(buf), 0), 2);
+
+    // call _splice_file_range() and check if the offset is advanced past the sent bytes.
+    ck_assert_int_eq(_splice_file_range(conn_fds[0], file_fd, &file_off, 5), 5);
+    ck_assert_int_eq(file_off, 7);
+    ck_assert_int_eq(recv(conn_fds[1], buf, sizeof(buf), 0), 5);
+    ck_assert_int_eq(memcmp(buf, "23456", 5), 0);
+
+    close_response(res);
+    close(file_fd);
+    close(conn_fds[0]);
+    close(conn_fds[1]);
+}
+END_TEST
+
+START_TEST(test_create_response_in_arena) {
+    arena *mem = create_arena(ARENA_BLOCK_SIZE);
+    ck_assert_ptr_ne(mem, NULL);
+
+    // call create_response_in_arena() and check if the response and its strings are in the arena.
+    response *res = create_response_in_arena(mem, -1);
+    ck_assert_ptr_ne(res, NULL);
+    ck_assert_ptr_eq(res->mem, mem);
+    ck_assert_int_eq(set_response_status(res, "HTTP/1.1", "200 OK"), 1);
+    ck_assert_ptr_ne(set_response_header(res, "Content-Type", "text/html"), NULL);
+
+    char *start = mem->first->data, *end = mem->first->data + mem->first->used;
+    ck_assert((char *)res >= start && (char *)res < end);
+    ck_assert(res->status_code >= start && res->status_code < end);
+    ck_assert(res->headers[0].value >= start && res->headers[0].value < end);
+
+    // call set_response_header() with a set header and check if it is not overwritten.
+    ck_assert_ptr_eq(set_response_header(res, "content-type", "text/plain"), NULL);
+    ck_assert_str_eq(get_response_header(res, "Content-Type", NULL), "text/html");
+
+    // call close_response() and check if the arena is left to be reset by its owner.
+    close_response(res);
+    ck_assert_int_ne(mem->first->used, 0);
+
+    destroy_arena(mem);
+}
+END_TEST
+
+START_TEST(test_format_response_head) {
+    char buf[RES_HEAD_MAX_SIZE];
+
+    // call _initialize_response() to initialize a response with default values.
+    response *res = _initialize_response();
+    ck_assert_ptr_ne(res, NULL);
+
+    // call format_response_head() without status code and check if -1 is returned.
+    res->http_ver = strdup("HTTP/1.1");
+    ck_assert_int_eq(format_response_head(res, buf, sizeof(buf)), -1);
+
+    // call format_response_head() with a header and check if the head is serialized.
+    res->status_code = strdup("200 OK");
+    set_response_header(res, "Content-Type", "text/html");
+    ssize_t head_size = format_response_head(res, buf, sizeof(buf));
+    ck_assert_str_eq(buf, "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\n");
+    ck_assert_int_eq(head_size, strlen(buf));
+
+    // call format_response_head() with a small buffer and check if -1 is returned.
+    ck_assert_int_eq(format_response_head(res, buf, 16), -1);
+
+    _free_response(res);
+}
+END_TEST
+
+START_TEST(test_set_response_raw_headers) {
+    char buf[RES_HEAD_MAX_SIZE];
+    const char raw_headers[] = "Content-Length: 10\r\n";
+    response *res = _initialize_response();
+    ck_assert_ptr_ne(res, NULL);
+    ck_assert_int_eq(set_response_status(res, "HTTP/1.1", "200 OK"), 1);
+    set_known_response_header(res, HDR_SERVER, "nanows");
+
+    // call set_response_raw_headers() and check if the lines are appended after the headers.
+    ck_assert_int_eq(set_response_raw_headers(res, raw_headers, sizeof(raw_headers) - 1), 1);
+    ssize_t head_size = format_response_head(res, buf, sizeof(buf));
+    ck_assert_str_eq(buf, "HTTP/1.1 200 OK\r\nServer: nanows\r\nContent-Length: 10\r\n\r\n");
+    ck_assert_int_eq(head_size, strlen(buf));
+
+    // call set_response_raw_headers() with invalid arguments and check if 0 is returned.
+    ck_assert_int_eq(set_response_raw_headers(NULL, raw_headers, 4), 0);
+    ck_assert_int_eq(set_response_raw_headers(res, NULL, 4), 0);
+
+    _free_response(res);
+}
+END_TEST
+
 Suite *response_suite() {
     const TTest *tests[] = {test__initialize_response,
                             test__free_response,
@@ -122,7 +286,13 @@ Suite *response_suite() {
                             test_create_response_from_default_request,
                             test_create_response_from_null_request,
                             test_set_response_header,
-                            test_get_response_header};
+                            test_get_response_header,
+                            test_set_known_response_header,
+                            test_send_response_head_with_body,
+                            test_send_response_fd,
+                            test_create_response_in_arena,
+                            test_format_response_head,
+                            test_set_response_raw_headers};
 
     Suite *suite = suite_create("Response");
     TCase *tc_core = tcase_create("Core");
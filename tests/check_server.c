@@ -0,0 +1,167 @@
+#include <check.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "server.h"
+
+// The snapshot of the config, set directly as the tests don't start the server.
+extern rcu_ptr *current_config;
+
+START_TEST(test_keep_alive_request_http_1_1) {
+    // call keep_alive_request() on an HTTP/1.1 request and check if the connection is kept open.
+    request *req = parse_request("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", -1);
+    ck_assert_ptr_ne(req, NULL);
+    ck_assert(keep_alive_request(req, 1));
+    close_request(req);
+
+    // call keep_alive_request() with "Connection: close" and check if the connection is closed.
+    req = parse_request("GET / HTTP/1.1\r\nConnection: close\r\n\r\n", -1);
+    ck_assert_ptr_ne(req, NULL);
+    ck_assert(!keep_alive_request(req, 1));
+    close_request(req);
+}
+END_TEST
+
+START_TEST(test_keep_alive_request_http_1_0) {
+    // call keep_alive_request() on an HTTP/1.0 request and check if the connection is closed.
+    request *req = parse_request("GET / HTTP/1.0\r\nHost: localhost\r\n\r\n", -1);
+    ck_assert_ptr_ne(req, NULL);
+    ck_assert(!keep_alive_request(req, 1));
+    close_request(req);
+
+    // call keep_alive_request() with "Connection: Keep-Alive" and check if the connection is kept
+    // open.
+    req = parse_request("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", -1);
+    ck_assert_ptr_ne(req, NULL);
+    ck_assert(keep_alive_request(req, 1));
+    close_request(req);
+}
+END_TEST
+
+START_TEST(test_keep_alive_request_max_requests) {
+    // call keep_alive_request() at the max number of requests and check if the connection is
+    // closed.
+    request *req = parse_request("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", -1);
+    ck_assert_ptr_ne(req, NULL);
+    ck_assert(keep_alive_request(req, DEFAULT_KEEPALIVE_REQUESTS - 1));
+    ck_assert(!keep_alive_request(req, DEFAULT_KEEPALIVE_REQUESTS));
+    close_request(req);
+}
+END_TEST
+
+START_TEST(test_keep_alive_request_null_req) {
+    // call keep_alive_request() with NULL request and check if it returns false.
+    ck_assert(!keep_alive_request(NULL, 1));
+}
+END_TEST
+
+START_TEST(test_serve_connection_pool_pipelined) {
+    int conn_fds[2], no_responses = 0, no_kept_alive = 0;
+    char res_buf[32768];
+    const char *res = NULL, *pipelined = "GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n"
+                                         "GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n"
+                                         "GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+    size_t res_len = 0;
+    ssize_t read_size = 0;
+    server_config *config = NULL;
+
+    load_config();
+    ck_assert_ptr_ne(config = create_server_config(), NULL);
+    config->mode = MODE_POOL;
+    ck_assert_ptr_ne(current_config = create_rcu_ptr(config), NULL);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, conn_fds), 0);
+
+    // send 6 pipelined requests at once and call serve_connection() in pool mode, and check if all
+    // of them get a response and only the last one closes the connection.
+    send(conn_fds[1], pipelined, strlen(pipelined), 0);
+    ck_assert_int_eq(serve_connection(conn_fds[0]), 0);
+    while ((read_size = read(conn_fds[1], res_buf + res_len, sizeof(res_buf) - 1 - res_len)) > 0)
+        res_len += read_size;
+    res_buf[res_len] = '\0';
+
+    for (res = strstr(res_buf, "HTTP/1.1 200"); res != NULL; res = strstr(res + 1, "HTTP/1.1 200"))
+        no_responses++;
+    for (res = strstr(res_buf, "Connection: keep-alive"); res != NULL;
+         res = strstr(res + 1, "Connection: keep-alive"))
+        no_kept_alive++;
+    ck_assert_int_eq(no_responses, 6);
+    ck_assert_int_eq(no_kept_alive, 5);
+    ck_assert_ptr_ne(res = strstr(res_buf, "Connection: close"), NULL);
+    ck_assert_ptr_eq(strstr(res, "HTTP/1.1 200"), NULL);
+
+    close(conn_fds[1]);
+    destroy_server_config(destroy_rcu_ptr(current_config));
+    current_config = NULL;
+    unload_config();
+}
+END_TEST
+
+START_TEST(test_create_server_config) {
+    // call create_server_config() and check if the values of the config file are parsed.
+    load_config();
+    server_config *config = create_server_config();
+    ck_assert_ptr_ne(config, NULL);
+    ck_assert_str_eq(config->host, "127.0.0.1");
+    ck_assert_int_eq(config->port, 8080);
+    ck_assert_str_eq(config->site_dir, "site");
+    ck_assert_str_eq(config->default_page, "/index.html");
+    ck_assert_int_eq(config->mode, MODE_THREAD);
+    ck_assert_int_eq(config->no_acceptors, 1);
+    ck_assert_int_gt(config->no_workers, 0);
+    ck_assert_int_eq(config->keep_alive_timeout, 5);
+    ck_assert_int_eq(config->gzip_level, 6);
+    ck_assert(config->file_cache_watch);
+
+    destroy_server_config(config);
+    destroy_server_config(NULL);
+    unload_config();
+}
+END_TEST
+
+START_TEST(test_acquire_server_config_defaults) {
+    int token = 0;
+
+    // call acquire_server_config() before the server is started and check if the defaults are used.
+    const server_config *config = acquire_server_config(&token);
+    ck_assert_ptr_ne(config, NULL);
+    ck_assert_ptr_eq(config->site_dir, NULL);
+    ck_assert_int_eq(config->keep_alive_timeout, DEFAULT_KEEPALIVE_TIMEOUT);
+    ck_assert_int_eq(config->keep_alive_requests, DEFAULT_KEEPALIVE_REQUESTS);
+    release_server_config(token);
+    ck_assert_int_eq(get_keep_alive_timeout(), DEFAULT_KEEPALIVE_TIMEOUT);
+
+    // call reload_server_config() before the server is started and check if it fails.
+    ck_assert_int_eq(reload_server_config(), 0);
+}
+END_TEST
+
+Suite *server_suite() {
+    const TTest *tests[] = {test_keep_alive_request_http_1_1, test_keep_alive_request_http_1_0,
+                            test_keep_alive_request_max_requests,
+                            test_keep_alive_request_null_req, test_serve_connection_pool_pipelined,
+                            test_create_server_config,
+                            test_acquire_server_config_defaults};
+
+    Suite *suite = suite_create("Server");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = server_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
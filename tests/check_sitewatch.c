@@ -0,0 +1,154 @@
+#include <check.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sitewatch.h"
+
+/**
+ * Writes `data` to the file at `path`, creating or truncating it.
+ */
+void write_test_file(const char *path, const char *data) {
+    int file_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ck_assert_int_ne(file_fd, -1);
+    ck_assert_int_eq(write(file_fd, data, strlen(data)), strlen(data));
+    close(file_fd);
+}
+
+/**
+ * Opens the file at `path` and adds it to the cache, as the server does on a miss.
+ */
+void cache_test_file(file_cache *cache, const char *path, const char *coding) {
+    struct stat file_stat;
+    int file_fd = open(path, O_RDONLY);
+    ck_assert_int_ne(file_fd, -1);
+    ck_assert_int_eq(fstat(file_fd, &file_stat), 0);
+
+    file_entry *entry = add_file_cache_entry(cache, path, coding, file_fd, &file_stat, "a/b");
+    ck_assert_ptr_ne(entry, NULL);
+    release_file_cache_entry(entry);
+    close(file_fd);
+}
+
+/**
+ * Waits up to a second for the file at `path` to be removed from the cache.
+ */
+bool wait_for_invalidation(file_cache *cache, const char *path, const char *coding) {
+    file_entry *entry = NULL;
+
+    for (int w_no = 0; w_no < 100; w_no++) {
+        if ((entry = get_file_cache_entry(cache, path, coding)) == NULL)
+            return true;
+        release_file_cache_entry(entry);
+        usleep(10000);
+    }
+
+    return false;
+}
+
+START_TEST(test_site_watch) {
+    char root[] = "/tmp/check_sitewatch_XXXXXX", path[256], moved[256];
+    ck_assert_ptr_ne(mkdtemp(root), NULL);
+    snprintf(path, sizeof(path), "%s/a.txt", root);
+    write_test_file(path, "a");
+
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    file_cache *caches[] = {cache, NULL};
+
+    // call create_site_watch() and check if the cache is watched.
+    site_watch *watch = create_site_watch(root, caches, 2);
+    ck_assert_ptr_ne(watch, NULL);
+    ck_assert(watch->complete);
+    ck_assert(atomic_load(&cache->watched));
+
+    // modify a cached file and check if its entries are removed.
+    cache_test_file(cache, path, NULL);
+    cache_test_file(cache, path, "gzip");
+    write_test_file(path, "b");
+    ck_assert(wait_for_invalidation(cache, path, NULL));
+    ck_assert(wait_for_invalidation(cache, path, "gzip"));
+
+    // create a sidecar of a cached file and check if the file is removed, as its variants changed.
+    cache_test_file(cache, path, NULL);
+    snprintf(moved, sizeof(moved), "%s.gz", path);
+    write_test_file(moved, "c");
+    ck_assert(wait_for_invalidation(cache, path, NULL));
+
+    // create a directory, cache a file in it and move the directory, and check if the file is
+    // removed.
+    snprintf(path, sizeof(path), "%s/d", root);
+    ck_assert_int_eq(mkdir(path, 0755), 0);
+    usleep(50000);
+    snprintf(path, sizeof(path), "%s/d/b.txt", root);
+    write_test_file(path, "d");
+    cache_test_file(cache, path, NULL);
+    snprintf(moved, sizeof(moved), "%s/e", root);
+    snprintf(path, sizeof(path), "%s/d", root);
+    ck_assert_int_eq(rename(path, moved), 0);
+    snprintf(path, sizeof(path), "%s/d/b.txt", root);
+    ck_assert(wait_for_invalidation(cache, path, NULL));
+
+    // cache a file in the moved directory, delete it and check if it is removed.
+    snprintf(path, sizeof(path), "%s/e/b.txt", root);
+    cache_test_file(cache, path, NULL);
+    ck_assert_int_eq(unlink(path), 0);
+    ck_assert(wait_for_invalidation(cache, path, NULL));
+
+    // call destroy_site_watch() and check if the cache is no longer watched.
+    destroy_site_watch(watch);
+    ck_assert(!atomic_load(&cache->watched));
+    destroy_site_watch(NULL);
+    destroy_file_cache(cache);
+
+    snprintf(path, sizeof(path), "rm -rf %s", root);
+    ck_assert_int_eq(system(path), 0);
+}
+END_TEST
+
+START_TEST(test_site_watch_missing_root) {
+    file_cache *cache = create_file_cache(1024 * 1024, 1024, 0);
+    ck_assert_ptr_ne(cache, NULL);
+    file_cache *caches[] = {cache};
+
+    // call create_site_watch() on a missing root and check if the cache is left unwatched.
+    site_watch *watch = create_site_watch("/tmp/check_sitewatch_missing", caches, 1);
+    ck_assert_ptr_ne(watch, NULL);
+    ck_assert(!watch->complete);
+    ck_assert(!atomic_load(&cache->watched));
+    destroy_site_watch(watch);
+
+    // call create_site_watch() with too many caches and check if NULL is returned.
+    ck_assert_ptr_eq(create_site_watch("/tmp", caches, SITE_WATCH_MAX_CACHES + 1), NULL);
+    destroy_file_cache(cache);
+}
+END_TEST
+
+Suite *sitewatch_suite() {
+    const TTest *tests[] = {test_site_watch, test_site_watch_missing_root};
+
+    Suite *suite = suite_create("Site Watch");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = sitewatch_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,146 @@
+#include <check.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "workqueue.h"
+
+#define NO_THREADS 4
+#define NO_ITEMS_PER_THREAD 10000
+
+work_queue *mt_queue = NULL;
+atomic_long mt_popped_sum, mt_popped_count;
+
+START_TEST(test_create_work_queue) {
+    // call create_work_queue() and check if the capacity is rounded up to a power of 2.
+    work_queue *queue = create_work_queue(100);
+    ck_assert_ptr_ne(queue, NULL);
+    ck_assert_int_eq(work_queue_capacity(queue), 128);
+    destroy_work_queue(queue);
+
+    // call create_work_queue() with 0 capacity and check if it returns NULL.
+    queue = create_work_queue(0);
+    ck_assert_ptr_eq(queue, NULL);
+}
+END_TEST
+
+START_TEST(test_work_queue_push_pop) {
+    int conn_fd = -1;
+    work_queue *queue = create_work_queue(4);
+    ck_assert_ptr_ne(queue, NULL);
+
+    // call work_queue_pop() on an empty queue and check if it returns 0.
+    ck_assert_int_eq(work_queue_pop(queue, &conn_fd), 0);
+    ck_assert_int_eq(conn_fd, -1);
+
+    // push and pop a few connections and check if they are popped in FIFO order.
+    ck_assert_int_eq(work_queue_push(queue, 10), 1);
+    ck_assert_int_eq(work_queue_push(queue, 11), 1);
+    ck_assert_int_eq(work_queue_pop(queue, &conn_fd), 1);
+    ck_assert_int_eq(conn_fd, 10);
+    ck_assert_int_eq(work_queue_pop(queue, &conn_fd), 1);
+    ck_assert_int_eq(conn_fd, 11);
+    ck_assert_int_eq(work_queue_pop(queue, &conn_fd), 0);
+
+    destroy_work_queue(queue);
+}
+END_TEST
+
+START_TEST(test_work_queue_full) {
+    int conn_fd = -1;
+    work_queue *queue = create_work_queue(4);
+    ck_assert_ptr_ne(queue, NULL);
+
+    // fill the queue and check if the next push fails.
+    for (int fd = 0; fd < 4; fd++)
+        ck_assert_int_eq(work_queue_push(queue, fd), 1);
+    ck_assert_int_eq(work_queue_push(queue, 4), 0);
+
+    // pop one connection and check if the cell can be reused on the next lap.
+    ck_assert_int_eq(work_queue_pop(queue, &conn_fd), 1);
+    ck_assert_int_eq(conn_fd, 0);
+    ck_assert_int_eq(work_queue_push(queue, 4), 1);
+    for (int fd = 1; fd <= 4; fd++) {
+        ck_assert_int_eq(work_queue_pop(queue, &conn_fd), 1);
+        ck_assert_int_eq(conn_fd, fd);
+    }
+
+    destroy_work_queue(queue);
+}
+END_TEST
+
+void *_producer(void *arg) {
+    int base = *((int *)arg);
+    for (int i = 1; i <= NO_ITEMS_PER_THREAD; i++)
+        while (!work_queue_push(mt_queue, base + i))
+            sched_yield();
+    return NULL;
+}
+
+void *_consumer(void *arg) {
+    int conn_fd = -1;
+    while (atomic_load(&mt_popped_count) < NO_THREADS * NO_ITEMS_PER_THREAD) {
+        if (!work_queue_pop(mt_queue, &conn_fd)) {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add(&mt_popped_sum, conn_fd);
+        atomic_fetch_add(&mt_popped_count, 1);
+    }
+    return NULL;
+}
+
+START_TEST(test_work_queue_multi_threaded) {
+    pthread_t producers[NO_THREADS], consumers[NO_THREADS];
+    int bases[NO_THREADS];
+    long expected_sum = 0;
+
+    // push from and pop on multiple threads and check if every connection is popped exactly once.
+    mt_queue = create_work_queue(64);
+    atomic_init(&mt_popped_sum, 0);
+    atomic_init(&mt_popped_count, 0);
+
+    for (int t_no = 0; t_no < NO_THREADS; t_no++) {
+        bases[t_no] = t_no * NO_ITEMS_PER_THREAD;
+        for (int i = 1; i <= NO_ITEMS_PER_THREAD; i++)
+            expected_sum += bases[t_no] + i;
+        pthread_create(&consumers[t_no], NULL, _consumer, NULL);
+        pthread_create(&producers[t_no], NULL, _producer, &bases[t_no]);
+    }
+
+    for (int t_no = 0; t_no < NO_THREADS; t_no++) {
+        pthread_join(producers[t_no], NULL);
+        pthread_join(consumers[t_no], NULL);
+    }
+
+    ck_assert_int_eq(atomic_load(&mt_popped_count), NO_THREADS * NO_ITEMS_PER_THREAD);
+    ck_assert_int_eq(atomic_load(&mt_popped_sum), expected_sum);
+    destroy_work_queue(mt_queue);
+}
+END_TEST
+
+Suite *workqueue_suite() {
+    const TTest *tests[] = {test_create_work_queue, test_work_queue_push_pop, test_work_queue_full,
+                            test_work_queue_multi_threaded};
+
+    Suite *suite = suite_create("WorkQueue");
+    TCase *tc_core = tcase_create("Core");
+
+    for (int t_no = 0; t_no < sizeof(tests) / sizeof(tests[0]); t_no++)
+        tcase_add_test(tc_core, tests[t_no]);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+int main() {
+    int no_failed;
+
+    Suite *suite = workqueue_suite();
+    SRunner *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    no_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (no_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
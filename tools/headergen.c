@@ -0,0 +1,103 @@
+/**
+ * @file tools/headergen.c
+ * @brief Generates the perfect hash table of known HTTP headers.
+ *
+ * Run by `make` to generate `bin/gen/headertable.h` from the `KNOWN_HEADERS` of
+ * `include/headers.h`, which is included by slib/headers.c. Writes the header to stdout.
+ *
+ * A header name is hashed with `HEADER_HASH_SLOT()`, from its length and its first, middle and last
+ * bytes, each weighted by a constant. The weights are searched in order, from `1` to
+ * `HEADER_GEN_MAX_WEIGHT`, until no two known headers share a slot of the `HEADER_TABLE_SIZE`
+ * slots. So a lookup compares a header name with a single known header.
+ *
+ * Usage: headergen > headertable.h
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers.h"
+
+/**
+ * @brief Defines the max weight of a byte of a header name.
+ */
+#define HEADER_GEN_MAX_WEIGHT 31
+
+/**
+ * @brief Expands a `KNOWN_HEADERS` entry into its name, indexed by its ID.
+ */
+#define HEADER_GEN_NAME(id, name) [id] = name,
+
+const char *names[NO_KNOWN_HEADERS] = {KNOWN_HEADERS(HEADER_GEN_NAME)};
+
+unsigned hash_name(const char *name, const unsigned *weights) {
+    size_t len = strlen(name);
+
+    return HEADER_HASH_SLOT(len, HEADER_HASH_BYTE(name[0]), HEADER_HASH_BYTE(name[len / 2]),
+                            HEADER_HASH_BYTE(name[len - 1]), weights[0], weights[1], weights[2]);
+}
+
+int is_perfect(const unsigned *weights, int8_t *table) {
+    unsigned slot = 0;
+
+    memset(table, -1, HEADER_TABLE_SIZE);
+    for (int h_no = 0; h_no < NO_KNOWN_HEADERS; h_no++) {
+        slot = hash_name(names[h_no], weights);
+        if (table[slot] >= 0)
+            return 0;
+        table[slot] = h_no;
+    }
+    return 1;
+}
+
+int find_weights(unsigned *weights, int8_t *table) {
+    for (weights[0] = 1; weights[0] <= HEADER_GEN_MAX_WEIGHT; weights[0]++) {
+        for (weights[1] = 1; weights[1] <= HEADER_GEN_MAX_WEIGHT; weights[1]++) {
+            for (weights[2] = 1; weights[2] <= HEADER_GEN_MAX_WEIGHT; weights[2]++) {
+                if (is_perfect(weights, table))
+                    return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int8_t table[HEADER_TABLE_SIZE];
+    unsigned weights[3];
+
+    if (argc != 1) {
+        fprintf(stderr, "Usage: %s > headertable.h\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!find_weights(weights, table)) {
+        fprintf(stderr, "%s: no perfect hash found, HEADER_TABLE_SIZE must be increased\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("/**\n");
+    printf(" * @file headertable.h\n");
+    printf(" * @brief The perfect hash table of known headers, generated from headers.h.\n");
+    printf(" *\n");
+    printf(" * Generated at build time by tools/headergen.c, do not edit.\n");
+    printf(" */\n\n");
+    printf("#ifndef _HEADERTABLE_H\n#define _HEADERTABLE_H 1\n\n");
+    printf("#define HEADER_HASH_FIRST %uu\n", weights[0]);
+    printf("#define HEADER_HASH_MIDDLE %uu\n", weights[1]);
+    printf("#define HEADER_HASH_LAST %uu\n\n", weights[2]);
+
+    printf("static const int8_t header_table[HEADER_TABLE_SIZE] = {");
+    for (int s_no = 0; s_no < HEADER_TABLE_SIZE; s_no++)
+        printf("%s%2d,", (s_no % 16 == 0) ? "\n    " : " ", table[s_no]);
+    printf("\n};\n#endif\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file tools/mimegen.c
+ * @brief Generates the perfect hash table of MIME types from a MIME types file.
+ *
+ * Run by `make` to generate `bin/gen/mimetable.h` from etc/mimetypes.conf, which is included by
+ * slib/mimetypes.c. Reads the MIME types file given as the only argument (in the format described
+ * in `include/mimetypes.h`) and writes the header to stdout.
+ *
+ * The table has the smallest power of 2 number of slots, at least `MIME_GEN_LOAD_FACTOR` times the
+ * number of extensions, for which a seed is found with which no two extensions share a slot. So a
+ * lookup compares an extension with a single record. Extensions are lowercased and, like at
+ * runtime, the last record of an extension wins.
+ *
+ * Usage: mimegen <mime types file> > mimetable.h
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mimetypes.h"
+
+/**
+ * @brief Defines the max number of extensions in the MIME types file.
+ */
+#define MIME_GEN_MAX_RECORDS 4096
+
+/**
+ * @brief Defines the min number of slots of the table per extension.
+ */
+#define MIME_GEN_LOAD_FACTOR 4
+
+/**
+ * @brief Defines the number of seeds tried for a size, before the size is doubled.
+ */
+#define MIME_GEN_MAX_SEEDS (1u << 20)
+
+/**
+ * @brief Defines the MIME type of unknown extensions if the MIME types file has no default.
+ */
+#define MIME_GEN_DEFAULT "application/octet-stream"
+
+char *exts[MIME_GEN_MAX_RECORDS], *mimetypes[MIME_GEN_MAX_RECORDS];
+size_t no_records = 0;
+
+char *trim_record(char *s) {
+    char *end = s + strlen(s);
+
+    while (isspace((unsigned char)*s))
+        s++;
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+int add_record(const char *ext, const char *mimetype) {
+    for (size_t r_no = 0; r_no < no_records; r_no++) {
+        if (strcmp(exts[r_no], ext) == 0) {
+            free(mimetypes[r_no]);
+            mimetypes[r_no] = strdup(mimetype);
+            return mimetypes[r_no] != NULL;
+        }
+    }
+
+    if (no_records == MIME_GEN_MAX_RECORDS)
+        return 0;
+    exts[no_records] = strdup(ext);
+    mimetypes[no_records] = strdup(mimetype);
+    return exts[no_records] != NULL && mimetypes[no_records++] != NULL;
+}
+
+uint32_t hash_ext(const char *ext, const uint32_t seed) {
+    uint32_t hash = MIME_HASH_BASIS ^ seed;
+
+    for (; *ext != '\0'; ext++)
+        hash = MIME_HASH_STEP(hash, *ext);
+    return hash;
+}
+
+int is_perfect(const size_t size, const uint32_t seed, unsigned char *used) {
+    size_t slot = 0;
+
+    memset(used, 0, size);
+    for (size_t r_no = 0; r_no < no_records; r_no++) {
+        slot = MIME_HASH_SLOT(hash_ext(exts[r_no], seed), size);
+        if (used[slot])
+            return 0;
+        used[slot] = 1;
+    }
+    return 1;
+}
+
+void print_string(const char *s) {
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+int main(int argc, char **argv) {
+    FILE *mime_file = NULL;
+    char buf[MIME_BUF_SIZE], *line = NULL, *key = NULL, *value = NULL, *mime_default = NULL;
+    unsigned char *used = NULL;
+    size_t size = 1, *slots = NULL;
+    uint32_t seed = 0;
+    int found = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <mime types file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((mime_file = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    while (fgets(buf, MIME_BUF_SIZE, mime_file) != NULL) {
+        line = trim_record(buf);
+        if (line[0] == '#' || (value = strchr(line, '=')) == NULL)
+            continue;
+
+        *value++ = '\0';
+        key = trim_record(line);
+        value = trim_record(value);
+        if (value[0] == '\0')
+            continue;
+
+        if (strcmp(key, DEFAULT_MIMETYPE_KEY) == 0) {
+            free(mime_default);
+            mime_default = strdup(value);
+            continue;
+        }
+
+        if (key[0] != '.' || strlen(key) > MIME_EXT_MAX_LEN) {
+            fprintf(stderr, "%s: skipping invalid extension '%s'\n", argv[1], key);
+            continue;
+        }
+
+        for (char *c = key; *c != '\0'; c++)
+            *c = tolower((unsigned char)*c);
+        if (!add_record(key, value)) {
+            fprintf(stderr, "%s: too many records\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+    fclose(mime_file);
+
+    while (size < no_records * MIME_GEN_LOAD_FACTOR)
+        size *= 2;
+
+    for (; !found && size <= MIME_GEN_MAX_RECORDS * MIME_GEN_LOAD_FACTOR * 4; size *= 2) {
+        if ((used = realloc(used, size)) == NULL)
+            return EXIT_FAILURE;
+
+        for (seed = 0; seed < MIME_GEN_MAX_SEEDS; seed++) {
+            if ((found = is_perfect(size, seed, used)))
+                break;
+        }
+    }
+    free(used);
+
+    if (!found) {
+        fprintf(stderr, "%s: no perfect hash found\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    size /= 2;
+
+    if ((slots = malloc(size * sizeof(size_t))) == NULL)
+        return EXIT_FAILURE;
+    for (size_t s_no = 0; s_no < size; s_no++)
+        slots[s_no] = no_records;
+    for (size_t r_no = 0; r_no < no_records; r_no++)
+        slots[MIME_HASH_SLOT(hash_ext(exts[r_no], seed), size)] = r_no;
+
+    printf("/**\n");
+    printf(" * @file mimetable.h\n");
+    printf(" * @brief The perfect hash table of MIME types, generated from %s.\n", argv[1]);
+    printf(" *\n");
+    printf(" * Generated at build time by tools/mimegen.c, do not edit.\n");
+    printf(" */\n\n");
+    printf("#ifndef _MIMETABLE_H\n#define _MIMETABLE_H 1\n\n");
+    printf("#define MIME_TABLE_SIZE %zu\n", size);
+    printf("#define MIME_TABLE_SEED %uu\n", seed);
+    printf("#define MIME_TABLE_DEFAULT ");
+    print_string((mime_default != NULL) ? mime_default : MIME_GEN_DEFAULT);
+    printf("\n\n");
+
+    printf("static const mime_record mime_table[MIME_TABLE_SIZE] = {\n");
+    for (size_t s_no = 0; s_no < size; s_no++) {
+        if (slots[s_no] == no_records)
+            continue;
+
+        printf("    [%zu] = {", s_no);
+        print_string(exts[slots[s_no]]);
+        printf(", %zu, ", strlen(exts[slots[s_no]]));
+        print_string(mimetypes[slots[s_no]]);
+        printf("},\n");
+    }
+    printf("};\n#endif\n");
+
+    for (size_t r_no = 0; r_no < no_records; r_no++) {
+        free(exts[r_no]);
+        free(mimetypes[r_no]);
+    }
+    free(mime_default);
+    free(slots);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,962 @@
+/**
+ * @file tools/nanobench.c
+ * @brief HTTP load generator for benchmarking nanows end to end over loopback.
+ *
+ * Built by `make bench`, which also runs the standard scenarios against bin/nanows. Opens a number
+ * of connections to the server, spread over a few threads each running an edge-triggered `epoll`
+ * loop, and keeps every connection busy for the duration of a scenario. A connection sends up to
+ * the pipelining depth of requests at once, and sends the next request as soon as a response is
+ * complete. Without keep-alive, every request is sent on a new connection with
+ * `connection: close`, and its latency includes the TCP handshake.
+ *
+ * The requests go round-robin over a mix of URLs: the files of the site root (`site/` by default)
+ * whose size is in the range of the scenario, or the URLs given with `-u`. Latencies are recorded
+ * in log-linear histograms with 32 buckets per power of 2 (so a percentile is known within about
+ * 3%), and reported with the throughput. If the server is started by nanobench (`-x`) or its pid
+ * is given (`-P`), its CPU usage and RSS over the scenario are read from `/proc` and reported too.
+ * A server started with `-x` is restarted for every scenario, so scenarios don't affect each other.
+ * Server modes are compared by changing `server_mode` in etc/nanows.conf between runs.
+ *
+ * Scenarios (`-s`):
+ *     - small: small-file storm, 64 keep-alive connections requesting files up to 64 KiB.
+ *     - large: large-file download, 16 keep-alive connections requesting files over 64 KiB.
+ *     - churn: connection churn, 64 connections requesting small files, one request each.
+ *     - all: every scenario above, in order.
+ *
+ * Usage: nanobench [-s scenario] [-c connections] [-t threads] [-d seconds] [-q depth] [-K]
+ *                  [-u url]... [-r site root] [-H host] [-p port] [-x server | -P pid]
+ * Options after `-s` override the options of the scenario.
+ *
+ * @author Sai Hemanth Bheemreddy (@SaiHemanthBR)
+ * @copyright MIT License; Copyright (c) 2021 Sai Hemanth Bheemreddy
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief Defines the max number of URLs in the request mix.
+ */
+#define BENCH_MAX_URLS 1024
+
+/**
+ * @brief Defines the max length of a URL.
+ */
+#define BENCH_URL_SIZE 512
+
+/**
+ * @brief Defines the max number of requests in flight on a connection.
+ */
+#define BENCH_MAX_PIPELINE 64
+
+/**
+ * @brief Defines the size of the receive buffer of a connection, and so the max size of a response
+ * head.
+ */
+#define BENCH_BUF_SIZE 65536
+
+/**
+ * @brief Defines the size of the send buffer of a connection.
+ */
+#define BENCH_OUT_SIZE (BENCH_MAX_PIPELINE * (BENCH_URL_SIZE + 128))
+
+/**
+ * @brief Defines the log2 of the number of buckets every power of 2 of a histogram is split into.
+ */
+#define BENCH_HIST_SUB_BITS 5
+
+/**
+ * @brief Defines the log2 of the first latency (in nanoseconds) too long for the histograms.
+ */
+#define BENCH_HIST_MAX_BITS 40
+
+/**
+ * @brief Defines the number of buckets of a histogram.
+ */
+#define BENCH_HIST_BUCKETS ((BENCH_HIST_MAX_BITS - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS)
+
+/**
+ * @brief Defines the largest file of the scenarios with small files.
+ */
+#define BENCH_SMALL_FILE_SIZE (64 * 1024)
+
+/**
+ * @brief Defines the max number of milliseconds to wait for a server started with `-x`.
+ */
+#define BENCH_SERVER_WAIT_MSEC 5000
+
+/**
+ * @brief Defines the options of a run. In overrides, `-1` (or `NULL`) means the option is not set.
+ *
+ * @property char* bench_opts::name
+ * @brief The name of the scenario.
+ *
+ * @property int bench_opts::conns
+ * @brief The number of connections.
+ *
+ * @property int bench_opts::threads
+ * @brief The number of threads the connections are spread over.
+ *
+ * @property int bench_opts::duration
+ * @brief The duration in seconds.
+ *
+ * @property int bench_opts::pipeline
+ * @brief The max number of requests in flight on a connection.
+ *
+ * @property int bench_opts::keep_alive
+ * @brief Whether connections are kept open, `0` or `1`.
+ *
+ * @property long long bench_opts::min_size
+ * @brief The smallest file of the site root in the mix.
+ *
+ * @property long long bench_opts::max_size
+ * @brief The largest file of the site root in the mix.
+ */
+typedef struct bench_opts {
+    const char *name;
+    int conns;
+    int threads;
+    int duration;
+    int pipeline;
+    int keep_alive;
+    long long min_size;
+    long long max_size;
+} bench_opts;
+
+/**
+ * @brief Defines a connection and its requests in flight.
+ *
+ * @property int bench_conn::fd
+ * @brief The socket, or `-1`.
+ *
+ * @property bool bench_conn::connected
+ * @brief Whether the connection is established.
+ *
+ * @property bool bench_conn::closing
+ * @brief Whether the server closes the connection after the current response.
+ *
+ * @property int bench_conn::no_requests
+ * @brief The number of requests sent on the connection.
+ *
+ * @property int bench_conn::next_url
+ * @brief The index of the URL of the next request in the mix.
+ *
+ * @property int bench_conn::no_inflight
+ * @brief The number of requests sent without a complete response.
+ *
+ * @property int bench_conn::oldest
+ * @brief The index in `sent_at` of the oldest request in flight.
+ *
+ * @property uint64_t bench_conn::sent_at
+ * @brief The times the requests in flight were sent, a ring of `BENCH_MAX_PIPELINE` times.
+ *
+ * @property int bench_conn::status
+ * @brief The status code of the response being received.
+ *
+ * @property long long bench_conn::body_left
+ * @brief The bytes of the body of the response still to be received, `-1` while receiving a head.
+ *
+ * @property char* bench_conn::buf
+ * @brief The receive buffer.
+ *
+ * @property size_t bench_conn::buf_len
+ * @brief The number of bytes in `buf`.
+ *
+ * @property char* bench_conn::out
+ * @brief The send buffer.
+ *
+ * @property size_t bench_conn::out_len
+ * @brief The number of bytes in `out`.
+ *
+ * @property size_t bench_conn::out_pos
+ * @brief The number of bytes of `out` that were already sent.
+ */
+typedef struct bench_conn {
+    int fd;
+    bool connected;
+    bool closing;
+    int no_requests;
+    int next_url;
+    int no_inflight;
+    int oldest;
+    uint64_t sent_at[BENCH_MAX_PIPELINE];
+    int status;
+    long long body_left;
+    char *buf;
+    size_t buf_len;
+    char *out;
+    size_t out_len;
+    size_t out_pos;
+} bench_conn;
+
+/**
+ * @brief Defines a thread driving connections, and what it measured.
+ *
+ * @property pthread_t bench_thread::tid
+ * @brief The thread.
+ *
+ * @property bench_conn* bench_thread::conns
+ * @brief The connections of the thread.
+ *
+ * @property int bench_thread::no_conns
+ * @brief The number of connections.
+ *
+ * @property int bench_thread::epoll_fd
+ * @brief The epoll instance of the thread.
+ *
+ * @property uint64_t bench_thread::end_at
+ * @brief The time no more requests are sent at.
+ *
+ * @property uint64_t bench_thread::requests
+ * @brief The number of complete responses.
+ *
+ * @property uint64_t bench_thread::not_ok
+ * @brief The number of responses with a status of 400 or more.
+ *
+ * @property uint64_t bench_thread::errors
+ * @brief The number of connections that failed before a response, or in the middle of one.
+ *
+ * @property uint64_t bench_thread::dropped
+ * @brief The number of requests in flight on keep-alive connections the server closed after some
+ * responses, e.g. pipelined past its `keepalive_requests`. Its reset may discard responses too.
+ *
+ * @property uint64_t bench_thread::connects
+ * @brief The number of connections opened.
+ *
+ * @property uint64_t bench_thread::bytes
+ * @brief The number of bytes of response bodies received.
+ *
+ * @property uint64_t bench_thread::max_latency
+ * @brief The longest latency in nanoseconds.
+ *
+ * @property uint64_t bench_thread::hist
+ * @brief The histogram of latencies in nanoseconds.
+ */
+typedef struct bench_thread {
+    pthread_t tid;
+    bench_conn *conns;
+    int no_conns;
+    int epoll_fd;
+    uint64_t end_at;
+    uint64_t requests;
+    uint64_t not_ok;
+    uint64_t errors;
+    uint64_t dropped;
+    uint64_t connects;
+    uint64_t bytes;
+    uint64_t max_latency;
+    uint64_t hist[BENCH_HIST_BUCKETS];
+} bench_thread;
+
+const bench_opts scenarios[] = {
+    {"small", 64, -1, -1, 1, 1, 0, BENCH_SMALL_FILE_SIZE},
+    {"large", 16, -1, -1, 1, 1, BENCH_SMALL_FILE_SIZE + 1, -1},
+    {"churn", 64, -1, -1, 1, 0, 0, BENCH_SMALL_FILE_SIZE},
+};
+const int no_scenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+
+bench_opts overrides = {NULL, -1, -1, -1, -1, -1, -1, -1};
+bench_opts opts = {"custom", 64, 2, 10, 1, 1, -1, -1};
+
+char *site_urls[BENCH_MAX_URLS], *mix_urls[BENCH_MAX_URLS], *requests[BENCH_MAX_URLS];
+long long site_sizes[BENCH_MAX_URLS];
+size_t request_lens[BENCH_MAX_URLS];
+int no_site_urls = 0, no_mix_urls = 0;
+const char *site_root = "site", *host = "127.0.0.1", *server_path = NULL;
+bool site_given = false;
+struct sockaddr_in server_addr;
+pid_t server_pid = -1;
+
+uint64_t now_nsec() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+int get_hist_bucket(const uint64_t nsec) {
+    int msb = 0;
+
+    if (nsec < (1u << BENCH_HIST_SUB_BITS))
+        return (int)nsec;
+    if ((nsec >> BENCH_HIST_MAX_BITS) != 0)
+        return BENCH_HIST_BUCKETS - 1;
+
+    msb = 63 - __builtin_clzll(nsec);
+    return ((msb - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS) +
+           (int)(nsec >> (msb - BENCH_HIST_SUB_BITS)) - (1 << BENCH_HIST_SUB_BITS);
+}
+
+uint64_t get_hist_value(const int bucket) {
+    int group = bucket >> BENCH_HIST_SUB_BITS, shift = 0;
+
+    if (group == 0)
+        return bucket;
+
+    // The middle of the bucket, which is within half a bucket of every latency in it.
+    shift = group - 1;
+    return ((uint64_t)((1 << BENCH_HIST_SUB_BITS) + (bucket & ((1 << BENCH_HIST_SUB_BITS) - 1)))
+            << shift) +
+           (((uint64_t)1 << shift) >> 1);
+}
+
+uint64_t get_percentile(const uint64_t *hist, const uint64_t count, const double percentile) {
+    uint64_t target = (uint64_t)(percentile / 100 * count + 0.5), seen = 0;
+
+    if (target == 0)
+        target = 1;
+    for (int b_no = 0; b_no < BENCH_HIST_BUCKETS; b_no++)
+        if ((seen += hist[b_no]) >= target)
+            return get_hist_value(b_no);
+    return 0;
+}
+
+int add_site_url(const char *path, const struct stat *path_stat, int type, struct FTW *ftw_buf) {
+    size_t root_len = strlen(site_root), len = strlen(path);
+
+    (void)ftw_buf;
+    if (type != FTW_F || !S_ISREG(path_stat->st_mode) || no_site_urls == BENCH_MAX_URLS)
+        return 0;
+    // Precompressed sidecars are served in place of their files, not requested themselves.
+    if ((len > 3 && strcmp(path + len - 3, ".gz") == 0) ||
+        (len > 3 && strcmp(path + len - 3, ".br") == 0) || strpbrk(path, " %?#") != NULL ||
+        len - root_len >= BENCH_URL_SIZE)
+        return 0;
+
+    while (root_len > 0 && site_root[root_len - 1] == '/')
+        root_len--;
+    if ((site_urls[no_site_urls] = strdup(path + root_len)) == NULL)
+        return -1;
+    site_sizes[no_site_urls++] = (long long)path_stat->st_size;
+    return 0;
+}
+
+int build_request_mix(const bench_opts *run) {
+    int no_urls = 0;
+
+    for (int u_no = 0; u_no < no_mix_urls; u_no++)
+        free(requests[u_no]);
+    no_mix_urls = 0;
+
+    no_urls = no_site_urls;
+    for (int u_no = 0; u_no < no_urls; u_no++) {
+        // URLs given with -u are in the mix whatever their size.
+        if (site_sizes[u_no] >= 0 && ((run->min_size >= 0 && site_sizes[u_no] < run->min_size) ||
+                                      (run->max_size >= 0 && site_sizes[u_no] > run->max_size)))
+            continue;
+
+        mix_urls[no_mix_urls] = site_urls[u_no];
+        if (asprintf(&requests[no_mix_urls],
+                     "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: nanobench\r\n%s\r\n",
+                     site_urls[u_no], host, run->keep_alive ? "" : "Connection: close\r\n") < 0)
+            return 0;
+        request_lens[no_mix_urls] = strlen(requests[no_mix_urls]);
+        no_mix_urls++;
+    }
+
+    return no_mix_urls;
+}
+
+int open_conn(bench_thread *thread, bench_conn *conn, const bench_opts *run) {
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = conn};
+    struct linger no_linger = {.l_onoff = 1, .l_linger = 0};
+    int one = 1;
+
+    conn->connected = false;
+    conn->closing = false;
+    conn->no_requests = 0;
+    conn->no_inflight = 0;
+    conn->oldest = 0;
+    conn->body_left = -1;
+    conn->buf_len = 0;
+    conn->out_len = 0;
+    conn->out_pos = 0;
+
+    if ((conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        return 0;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // Churning connections are reset instead of closed, so they don't use up the local ports.
+    if (!run->keep_alive)
+        setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &no_linger, sizeof(no_linger));
+
+    if ((connect(conn->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 &&
+         errno != EINPROGRESS) ||
+        epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) < 0) {
+        close(conn->fd);
+        conn->fd = -1;
+        return 0;
+    }
+
+    thread->connects++;
+    return 1;
+}
+
+void close_conn(bench_conn *conn) {
+    if (conn->fd != -1)
+        close(conn->fd);
+    conn->fd = -1;
+}
+
+void queue_requests(bench_thread *thread, bench_conn *conn, const bench_opts *run) {
+    uint64_t now = now_nsec();
+    int url_no = 0;
+
+    if (now >= thread->end_at || conn->closing)
+        return;
+
+    if (conn->out_pos > 0) {
+        memmove(conn->out, conn->out + conn->out_pos, conn->out_len - conn->out_pos);
+        conn->out_len -= conn->out_pos;
+        conn->out_pos = 0;
+    }
+
+    // Without keep-alive, every connection carries a single request.
+    while (conn->no_inflight < (run->keep_alive ? run->pipeline : 1) &&
+           (run->keep_alive || conn->no_requests == 0)) {
+        url_no = conn->next_url++ % no_mix_urls;
+        if (conn->out_len + request_lens[url_no] > BENCH_OUT_SIZE)
+            break;
+
+        memcpy(conn->out + conn->out_len, requests[url_no], request_lens[url_no]);
+        conn->out_len += request_lens[url_no];
+        conn->sent_at[(conn->oldest + conn->no_inflight) % BENCH_MAX_PIPELINE] = now;
+        conn->no_inflight++;
+        conn->no_requests++;
+    }
+}
+
+int flush_conn(bench_conn *conn) {
+    ssize_t send_size = 0;
+
+    while (conn->out_pos < conn->out_len) {
+        send_size =
+            send(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos, MSG_NOSIGNAL);
+        if (send_size < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        conn->out_pos += send_size;
+    }
+
+    return 0;
+}
+
+int parse_response_head(bench_conn *conn, const char *head, const char *head_end) {
+    const char *line = head, *line_end = NULL, *value = NULL;
+
+    if (head_end - head < 12 || strncmp(head, "HTTP/1.", 7) != 0)
+        return 0;
+    conn->status = (int)strtol(head + 9, NULL, 10);
+    conn->body_left = 0;
+
+    for (; line < head_end; line = line_end + 2) {
+        if ((line_end = memmem(line, head_end + 2 - line, "\r\n", 2)) == NULL)
+            break;
+        if (line_end - line > 15 && strncasecmp(line, "content-length:", 15) == 0)
+            conn->body_left = strtoll(line + 15, NULL, 10);
+        else if (line_end - line > 11 && strncasecmp(line, "connection:", 11) == 0) {
+            for (value = line + 11; *value == ' '; value++)
+                ;
+            if (line_end - value >= 5 && strncasecmp(value, "close", 5) == 0)
+                conn->closing = true;
+        }
+    }
+
+    return conn->body_left >= 0;
+}
+
+int complete_response(bench_thread *thread, bench_conn *conn) {
+    uint64_t latency = now_nsec() - conn->sent_at[conn->oldest];
+
+    thread->hist[get_hist_bucket(latency)]++;
+    if (latency > thread->max_latency)
+        thread->max_latency = latency;
+    thread->requests++;
+    if (conn->status >= 400)
+        thread->not_ok++;
+
+    conn->oldest = (conn->oldest + 1) % BENCH_MAX_PIPELINE;
+    conn->no_inflight--;
+    conn->body_left = -1;
+    return 1;
+}
+
+int read_conn(bench_thread *thread, bench_conn *conn, const bench_opts *run) {
+    ssize_t recv_size = 0;
+    size_t pos = 0, take = 0;
+    char *head_end = NULL;
+
+    while (true) {
+        if (conn->buf_len == BENCH_BUF_SIZE)
+            return -1;
+
+        recv_size = recv(conn->fd, conn->buf + conn->buf_len, BENCH_BUF_SIZE - conn->buf_len, 0);
+        if (recv_size == 0)
+            return -1;
+        if (recv_size < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        conn->buf_len += recv_size;
+
+        for (pos = 0; pos < conn->buf_len;) {
+            if (conn->body_left < 0) {
+                if ((head_end = memmem(conn->buf + pos, conn->buf_len - pos, "\r\n\r\n", 4)) ==
+                    NULL)
+                    break;
+                if (conn->no_inflight == 0 ||
+                    parse_response_head(conn, conn->buf + pos, head_end) == 0)
+                    return -1;
+                pos = head_end + 4 - conn->buf;
+            }
+
+            take = conn->buf_len - pos;
+            if ((long long)take > conn->body_left)
+                take = conn->body_left;
+            pos += take;
+            conn->body_left -= take;
+            thread->bytes += take;
+            if (conn->body_left > 0)
+                break;
+
+            complete_response(thread, conn);
+            // The connection is done, later responses (if any) are not waited for.
+            if (conn->closing || !run->keep_alive)
+                return 1;
+        }
+
+        memmove(conn->buf, conn->buf + pos, conn->buf_len - pos);
+        conn->buf_len -= pos;
+
+        queue_requests(thread, conn, run);
+        if (flush_conn(conn) < 0)
+            return -1;
+    }
+}
+
+void *run_bench_thread(void *arg) {
+    bench_thread *thread = arg;
+    const bench_opts *run = &opts;
+    struct epoll_event events[256];
+    bench_conn *conn = NULL;
+    int no_events = 0, r_val = 0, sock_err = 0;
+    socklen_t err_len = sizeof(sock_err);
+
+    for (int c_no = 0; c_no < thread->no_conns; c_no++) {
+        conn = &thread->conns[c_no];
+        if (open_conn(thread, conn, run))
+            queue_requests(thread, conn, run);
+        else
+            thread->errors++;
+    }
+
+    while (now_nsec() < thread->end_at) {
+        if ((no_events = epoll_wait(thread->epoll_fd, events, 256, 100)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int e_no = 0; e_no < no_events; e_no++) {
+            conn = events[e_no].data.ptr;
+            if (conn->fd == -1)
+                continue;
+
+            r_val = 0;
+            if (!conn->connected) {
+                if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &sock_err, &err_len) < 0 ||
+                    sock_err != 0)
+                    r_val = -1;
+                else if ((events[e_no].events & EPOLLOUT) != 0)
+                    conn->connected = true;
+            }
+            if (r_val == 0 && conn->connected && flush_conn(conn) < 0)
+                r_val = -1;
+            if (r_val == 0 && conn->connected)
+                r_val = read_conn(thread, conn, run);
+            if (r_val == 0)
+                continue;
+
+            // A connection that failed with requests in flight is an error, unless the server
+            // closed it after some responses.
+            if (r_val < 0 && conn->connected && conn->no_inflight > 0 && run->keep_alive &&
+                conn->no_requests > conn->no_inflight)
+                thread->dropped += conn->no_inflight;
+            else if (r_val < 0 && (conn->no_inflight > 0 || !conn->connected))
+                thread->errors++;
+            close_conn(conn);
+            if (now_nsec() < thread->end_at) {
+                if (open_conn(thread, conn, run))
+                    queue_requests(thread, conn, run);
+                else
+                    thread->errors++;
+            }
+        }
+    }
+
+    for (int c_no = 0; c_no < thread->no_conns; c_no++)
+        close_conn(&thread->conns[c_no]);
+    return NULL;
+}
+
+int connect_server() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0), r_val = 0;
+
+    if (fd < 0)
+        return 0;
+    r_val = connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0;
+    close(fd);
+    return r_val;
+}
+
+int start_server() {
+    int null_fd = -1, status = 0;
+
+    if (server_path == NULL)
+        return 1;
+    if (connect_server()) {
+        fprintf(stderr, "Port %d is already in use, stop the server listening on it first\n",
+                ntohs(server_addr.sin_port));
+        return 0;
+    }
+
+    if ((server_pid = fork()) < 0) {
+        perror("Unable to start server");
+        return 0;
+    }
+
+    // The server logs every request to stdout, which would slow it down.
+    if (server_pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGINT);
+        if ((null_fd = open("/dev/null", O_WRONLY)) >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execl(server_path, server_path, (char *)NULL);
+        _exit(127);
+    }
+
+    for (int w_no = 0; w_no < BENCH_SERVER_WAIT_MSEC / 50; w_no++) {
+        if (waitpid(server_pid, &status, WNOHANG) == server_pid) {
+            fprintf(stderr, "Server %s exited with status %d\n", server_path,
+                    WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            server_pid = -1;
+            return 0;
+        }
+        if (connect_server())
+            return 1;
+        usleep(50000);
+    }
+
+    fprintf(stderr, "Server %s is not listening on port %d\n", server_path,
+            ntohs(server_addr.sin_port));
+    return 0;
+}
+
+void stop_server() {
+    if (server_path == NULL || server_pid <= 0)
+        return;
+
+    // SIGINT stops nanows cleanly, it is killed if it doesn't.
+    kill(server_pid, SIGINT);
+    for (int w_no = 0; w_no < 40 && waitpid(server_pid, NULL, WNOHANG) != server_pid; w_no++)
+        usleep(50000);
+    if (kill(server_pid, SIGKILL) == 0)
+        waitpid(server_pid, NULL, 0);
+    server_pid = -1;
+}
+
+int read_server_cpu(unsigned long *ticks) {
+    char path[64], buf[1024], *fields = NULL;
+    unsigned long utime = 0, stime = 0;
+    FILE *stat_file = NULL;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)server_pid);
+    if (server_pid <= 0 || (stat_file = fopen(path, "r")) == NULL)
+        return 0;
+    fields = fgets(buf, sizeof(buf), stat_file);
+    fclose(stat_file);
+
+    // The name of the command may hold spaces, the fields start after its closing parenthesis.
+    if (fields == NULL || (fields = strrchr(buf, ')')) == NULL ||
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime,
+               &stime) != 2)
+        return 0;
+    *ticks = utime + stime;
+    return 1;
+}
+
+int read_server_rss(long *rss_kb, long *peak_kb) {
+    char path[64], line[256];
+    FILE *status_file = NULL;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)server_pid);
+    if (server_pid <= 0 || (status_file = fopen(path, "r")) == NULL)
+        return 0;
+
+    *rss_kb = *peak_kb = -1;
+    while (fgets(line, sizeof(line), status_file) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+            *rss_kb = strtol(line + 6, NULL, 10);
+        else if (strncmp(line, "VmHWM:", 6) == 0)
+            *peak_kb = strtol(line + 6, NULL, 10);
+    }
+    fclose(status_file);
+    return *rss_kb >= 0;
+}
+
+void apply_overrides(bench_opts *run) {
+    if (overrides.conns > 0)
+        run->conns = overrides.conns;
+    if (overrides.threads > 0)
+        run->threads = overrides.threads;
+    if (overrides.duration > 0)
+        run->duration = overrides.duration;
+    if (overrides.pipeline > 0)
+        run->pipeline = overrides.pipeline;
+    if (overrides.keep_alive >= 0)
+        run->keep_alive = overrides.keep_alive;
+    if (overrides.min_size >= 0)
+        run->min_size = overrides.min_size;
+    if (overrides.max_size >= 0)
+        run->max_size = overrides.max_size;
+}
+
+int run_scenario(const bench_opts *scenario) {
+    bench_thread *threads = NULL;
+    bench_conn *conns = NULL;
+    uint64_t hist[BENCH_HIST_BUCKETS] = {0}, requests = 0, not_ok = 0, errors = 0, dropped = 0,
+             connects = 0, bytes = 0, max_latency = 0, start = 0, elapsed = 0;
+    unsigned long cpu_start = 0, cpu_end = 0;
+    long rss_kb = -1, peak_kb = -1;
+    bool has_cpu = false;
+    int c_no = 0, r_val = 1;
+    double secs = 0;
+
+    // Unset options of the scenario keep the defaults, options given after -s override both.
+    opts = (bench_opts){scenario->name, 64, 2, 10, 1, 1, -1, -1};
+    if (scenario->conns > 0)
+        opts.conns = scenario->conns;
+    if (scenario->pipeline > 0)
+        opts.pipeline = scenario->pipeline;
+    opts.keep_alive = scenario->keep_alive;
+    opts.min_size = scenario->min_size;
+    opts.max_size = scenario->max_size;
+    apply_overrides(&opts);
+    if (opts.threads > opts.conns)
+        opts.threads = opts.conns;
+    if (opts.pipeline > BENCH_MAX_PIPELINE)
+        opts.pipeline = BENCH_MAX_PIPELINE;
+
+    printf("scenario %s: %d connections, %d threads, %s, pipeline %d, %d s\n", opts.name,
+           opts.conns, opts.threads, opts.keep_alive ? "keep-alive" : "no keep-alive",
+           opts.pipeline, opts.duration);
+    if (build_request_mix(&opts) == 0) {
+        printf("  skipped: no URLs in the mix\n\n");
+        return 1;
+    }
+    printf("  mix: %d URLs (%s", no_mix_urls, mix_urls[0]);
+    for (int u_no = 1; u_no < no_mix_urls && u_no < 4; u_no++)
+        printf(", %s", mix_urls[u_no]);
+    printf("%s)\n", (no_mix_urls > 4) ? ", ..." : "");
+    fflush(stdout);
+
+    if (!start_server())
+        return 0;
+
+    if ((threads = calloc(opts.threads, sizeof(bench_thread))) == NULL ||
+        (conns = calloc(opts.conns, sizeof(bench_conn))) == NULL) {
+        free(threads);
+        stop_server();
+        return 0;
+    }
+
+    has_cpu = read_server_cpu(&cpu_start);
+    start = now_nsec();
+    for (int t_no = 0; t_no < opts.threads; t_no++) {
+        threads[t_no].conns = &conns[c_no];
+        threads[t_no].no_conns = opts.conns / opts.threads + (t_no < opts.conns % opts.threads);
+        threads[t_no].end_at = start + (uint64_t)opts.duration * 1000000000u;
+        for (int n_no = 0; n_no < threads[t_no].no_conns; n_no++, c_no++) {
+            conns[c_no].fd = -1;
+            conns[c_no].next_url = c_no;
+            conns[c_no].buf = malloc(BENCH_BUF_SIZE);
+            conns[c_no].out = malloc(BENCH_OUT_SIZE);
+            if (conns[c_no].buf == NULL || conns[c_no].out == NULL)
+                r_val = 0;
+        }
+        if (r_val == 0 || (threads[t_no].epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+            pthread_create(&threads[t_no].tid, NULL, run_bench_thread, &threads[t_no]) != 0) {
+            perror("Unable to start benchmark thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int t_no = 0; t_no < opts.threads; t_no++) {
+        pthread_join(threads[t_no].tid, NULL);
+        close(threads[t_no].epoll_fd);
+
+        requests += threads[t_no].requests;
+        not_ok += threads[t_no].not_ok;
+        errors += threads[t_no].errors;
+        dropped += threads[t_no].dropped;
+        connects += threads[t_no].connects;
+        bytes += threads[t_no].bytes;
+        if (threads[t_no].max_latency > max_latency)
+            max_latency = threads[t_no].max_latency;
+        for (int b_no = 0; b_no < BENCH_HIST_BUCKETS; b_no++)
+            hist[b_no] += threads[t_no].hist[b_no];
+    }
+    elapsed = now_nsec() - start;
+    secs = (double)elapsed / 1e9;
+    has_cpu = has_cpu && read_server_cpu(&cpu_end);
+    read_server_rss(&rss_kb, &peak_kb);
+    stop_server();
+
+    printf("  requests: %llu (%.1f req/s, %.1f MiB/s), status >= 400: %llu\n",
+           (unsigned long long)requests, requests / secs, bytes / secs / (1024 * 1024),
+           (unsigned long long)not_ok);
+    printf("  connects: %llu, errors: %llu, dropped: %llu\n", (unsigned long long)connects,
+           (unsigned long long)errors, (unsigned long long)dropped);
+    if (requests > 0)
+        printf("  latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+               get_percentile(hist, requests, 50) / 1e3, get_percentile(hist, requests, 99) / 1e3,
+               get_percentile(hist, requests, 99.9) / 1e3, max_latency / 1e3);
+    if (has_cpu)
+        printf("  server: cpu %.1f%%, rss %ld KiB (peak %ld KiB)\n",
+               (double)(cpu_end - cpu_start) / sysconf(_SC_CLK_TCK) / secs * 100, rss_kb, peak_kb);
+    printf("\n");
+
+    for (c_no = 0; c_no < opts.conns; c_no++) {
+        free(conns[c_no].buf);
+        free(conns[c_no].out);
+    }
+    free(conns);
+    free(threads);
+    return requests > 0;
+}
+
+void print_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-s small|large|churn|all] [-c connections] [-t threads] [-d seconds]\n"
+            "       [-q pipeline depth] [-K] [-u url]... [-r site root] [-H host] [-p port]\n"
+            "       [-x server binary | -P server pid]\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    const bench_opts *run_scenarios[sizeof(scenarios) / sizeof(scenarios[0]) + 1];
+    bench_opts custom = {"custom", -1, -1, -1, -1, 1, -1, -1};
+    int opt = 0, no_runs = 0, port = 8080, r_val = EXIT_SUCCESS;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    while ((opt = getopt(argc, argv, "s:c:t:d:q:Ku:r:H:p:x:P:h")) != -1) {
+        switch (opt) {
+        case 's':
+            no_runs = 0;
+            for (int s_no = 0; s_no < no_scenarios; s_no++)
+                if (strcmp(optarg, "all") == 0 || strcmp(optarg, scenarios[s_no].name) == 0)
+                    run_scenarios[no_runs++] = &scenarios[s_no];
+            if (no_runs == 0) {
+                fprintf(stderr, "Unknown scenario %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            // Options given before -s are overridden by the scenario.
+            overrides = (bench_opts){NULL, -1, -1, -1, -1, -1, -1, -1};
+            break;
+        case 'c':
+            overrides.conns = atoi(optarg);
+            break;
+        case 't':
+            overrides.threads = atoi(optarg);
+            break;
+        case 'd':
+            overrides.duration = atoi(optarg);
+            break;
+        case 'q':
+            overrides.pipeline = atoi(optarg);
+            break;
+        case 'K':
+            overrides.keep_alive = 0;
+            break;
+        case 'u':
+            if (no_site_urls == BENCH_MAX_URLS || strlen(optarg) >= BENCH_URL_SIZE ||
+                optarg[0] != '/') {
+                fprintf(stderr, "Invalid URL %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            site_urls[no_site_urls] = optarg;
+            site_sizes[no_site_urls++] = -1;
+            break;
+        case 'r':
+            site_root = optarg;
+            site_given = true;
+            break;
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'x':
+            server_path = optarg;
+            break;
+        case 'P':
+            server_pid = atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid host %s, an IPv4 address is expected\n", host);
+        return EXIT_FAILURE;
+    }
+
+    // The files of the site root are the mix, unless URLs are given.
+    if ((no_site_urls == 0 || site_given) &&
+        nftw(site_root, add_site_url, 16, FTW_PHYS) != 0) {
+        perror(site_root);
+        return EXIT_FAILURE;
+    }
+
+    if (no_runs == 0)
+        run_scenarios[no_runs++] = &custom;
+
+    for (int r_no = 0; r_no < no_runs; r_no++)
+        if (!run_scenario(run_scenarios[r_no]))
+            r_val = EXIT_FAILURE;
+
+    return r_val;
+}